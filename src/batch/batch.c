@@ -0,0 +1,223 @@
+/*
+ *  batch.c
+ *
+ *  Created on: Feb 25, 2022
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <string.h>
+#include <sys/param.h>
+#include "batch.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+/* Before the first reading: '[' of the array, or the marker */
+#define BATCH_OPEN_SIZE                               1
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static uint32_t batch_position(const batch_t *batch);
+
+/******************************************************************************/
+
+/*!
+ * @brief  Position of the next reading in the payload, after its separator or length prefix
+ */
+static uint32_t batch_position(const batch_t *batch)
+{
+    if(batch->format == BATCH_FORMAT_JSON)
+    {
+        /* '[' or ',' */
+        return batch->length + 1;
+    }
+    return batch->length + ((batch->count == 0) ? BATCH_OPEN_SIZE : 0) + BATCH_BINARY_PREFIX_SIZE;
+}
+
+/******************************************************************************/
+
+/*!
+ * @brief  Initialize an empty batch
+ */
+void batch_init(batch_t *batch, batch_format_t format, uint8_t *payload, uint32_t payload_size,
+                uint8_t *record, uint32_t record_size, uint32_t latency_ms)
+{
+    memset(batch, 0, sizeof(batch_t));
+    batch->format = format;
+    batch->payload = payload;
+    batch->payload_size = payload_size;
+    batch->record = record;
+    batch->record_size = record_size;
+    batch->latency_ms = latency_ms;
+}
+
+/*!
+ * @brief  Get where the next reading can be encoded in place. Only when the largest reading so far fits:
+ *         a reading that does not fit would be encoded a second time after the flush
+ */
+uint8_t* batch_reserve(batch_t *batch, uint32_t *room)
+{
+    uint32_t position = batch_position(batch);
+    uint32_t closing = (batch->format == BATCH_FORMAT_JSON) ? 1 : 0;      /* ']' */
+
+    *room = 0;
+    if(position + closing + MAX(batch->max_length, 1) <= batch->payload_size)
+    {
+        *room = batch->payload_size - position - closing;
+    }
+    return &batch->payload[MIN(position, batch->payload_size)];
+}
+
+/*!
+ * @brief  Get where the compact form of the next reading can be written in place
+ */
+uint8_t* batch_record_slot(batch_t *batch, uint32_t *room)
+{
+    uint32_t position = batch->record_length + sizeof(uint16_t);
+
+    *room = (position < batch->record_size) ? batch->record_size - position : 0;
+    return &batch->record[MIN(position, batch->record_size)];
+}
+
+/*!
+ * @brief  Add a reading: separator or length prefix, then the reading unless it was encoded in place
+ */
+bool batch_add(batch_t *batch, const uint8_t *reading, uint32_t length, const uint8_t *record, uint16_t record_length,
+               uint32_t now_ms)
+{
+    uint32_t position = batch_position(batch);
+    uint32_t closing = (batch->format == BATCH_FORMAT_JSON) ? 1 : 0;      /* ']' */
+    uint8_t *slot = &batch->record[batch->record_length];
+    uint8_t *prefix;
+
+    if((batch->record_length + sizeof(uint16_t) + record_length > batch->record_size) ||
+       (position + length + closing > batch->payload_size))
+    {
+        return false;
+    }
+
+    if(batch->format == BATCH_FORMAT_JSON)
+    {
+        batch->payload[batch->length] = (batch->count == 0) ? '[' : ',';
+    }
+    else
+    {
+        if(batch->count == 0)
+        {
+            batch->payload[batch->length++] = BATCH_BINARY_MARKER;
+        }
+        prefix = &batch->payload[batch->length];
+        prefix[0] = (uint8_t) length;
+        prefix[1] = (uint8_t) (length >> 8);
+    }
+    if(reading != &batch->payload[position])
+    {
+        memcpy(&batch->payload[position], reading, length);
+    }
+    batch->length = position + length;
+    batch->max_length = MAX(batch->max_length, length);
+
+    /* Written in place, or a reading from the journal or from before a flush */
+    slot[0] = (uint8_t) record_length;
+    slot[1] = (uint8_t) (record_length >> 8);
+    if(record != &slot[sizeof(uint16_t)])
+    {
+        memmove(&slot[sizeof(uint16_t)], record, record_length);
+    }
+    batch->record_length += sizeof(uint16_t) + record_length;
+
+    if(batch->count == 0)
+    {
+        batch->first_ms = now_ms;
+    }
+    batch->count++;
+    return true;
+}
+
+/*!
+ * @brief  Check if the oldest reading waited for the latency budget
+ */
+bool batch_due(const batch_t *batch, uint32_t now_ms)
+{
+    return (batch->count > 0) && ((now_ms - batch->first_ms) >= batch->latency_ms);
+}
+
+/*!
+ * @brief  Close the payload, json array is closed and zero terminated
+ */
+uint32_t batch_finish(batch_t *batch, batch_flush_t reason)
+{
+    uint32_t length = batch->length;
+
+    if(batch->count == 0)
+    {
+        return 0;
+    }
+    if(batch->format == BATCH_FORMAT_JSON)
+    {
+        batch->payload[length++] = ']';
+        if(length < batch->payload_size)
+        {
+            batch->payload[length] = '\0';
+        }
+    }
+
+    batch->stats.flushes[reason]++;
+    batch->stats.readings += batch->count;
+    batch->stats.bytes += length;
+    if(batch->count > batch->stats.max_readings)
+    {
+        batch->stats.max_readings = batch->count;
+    }
+    return length;
+}
+
+/*!
+ * @brief  Get the compact readings of the batch in order
+ */
+const uint8_t* batch_record_next(const batch_t *batch, uint32_t *position, uint16_t *length)
+{
+    const uint8_t *record = &batch->record[*position];
+
+    if(*position + sizeof(uint16_t) > batch->record_length)
+    {
+        return NULL;
+    }
+    *length = record[0] | (record[1] << 8);
+    *position += sizeof(uint16_t) + *length;
+    return &record[sizeof(uint16_t)];
+}
+
+/*!
+ * @brief  Empty the batch
+ */
+void batch_reset(batch_t *batch, bool published)
+{
+    if(!published && (batch->count > 0))
+    {
+        batch->stats.failed++;
+    }
+    batch->length = 0;
+    batch->record_length = 0;
+    batch->count = 0;
+}
@@ -0,0 +1,161 @@
+/*
+ *  batch.h
+ *
+ *  Created on: Feb 25, 2022
+ */
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+/* First byte of a binary batch: then u16 length (little endian) and reading, for each reading.
+ * A single binary reading starts with TELEMETRY_BINARY_VERSION instead */
+#define BATCH_BINARY_MARKER                           0x80
+#define BATCH_BINARY_PREFIX_SIZE                      2
+
+/* Payload of a batch: json array of readings, or binary readings with length prefix */
+typedef uint8_t batch_format_t;
+enum {
+    BATCH_FORMAT_JSON = 0,
+    BATCH_FORMAT_BINARY,
+};
+
+/* Why a batch was published */
+typedef uint8_t batch_flush_t;
+enum {
+    BATCH_FLUSH_SIZE = 0,                             /* Next reading did not fit */
+    BATCH_FLUSH_LATENCY,                              /* Oldest reading waited long enough */
+    BATCH_FLUSH_OFFLINE,                              /* Uplink lost, readings go to the journal */
+    BATCH_FLUSH_COUNT
+};
+
+/*!
+ * @brief  Batch statistics
+ */
+typedef struct {
+    uint32_t flushes[BATCH_FLUSH_COUNT];
+    uint32_t readings;                                /* Readings in flushed batches */
+    uint32_t bytes;                                   /* Payload bytes of flushed batches */
+    uint32_t max_readings;                            /* Largest batch */
+    uint32_t failed;                                  /* Batches not published */
+} batch_stats_t;
+
+/*!
+ * @brief  Readings collected into one payload. The compact form of each reading is kept beside,
+ *         to store the readings of a batch that cannot be published
+ */
+typedef struct {
+    batch_format_t format;
+    uint8_t *payload;
+    uint32_t payload_size;
+    uint32_t length;                                  /* Payload written, without closing */
+    uint8_t *record;                                  /* u16 length and compact reading, for each reading */
+    uint32_t record_size;
+    uint32_t record_length;
+    uint32_t count;                                   /* Readings in the batch */
+    uint32_t max_length;                              /* Largest reading added, to encode in place */
+    uint32_t first_ms;                                /* Time the oldest reading was added */
+    uint32_t latency_ms;                              /* Latency budget */
+    batch_stats_t stats;
+} batch_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+/*!
+ * @brief  Initialize an empty batch
+ * @param  Batch, format
+ *         Payload buffer and its size, the byte budget
+ *         Record buffer and its size
+ *         Latency budget in ms
+ * @retval None
+ */
+void batch_init(batch_t *batch, batch_format_t format, uint8_t *payload, uint32_t payload_size,
+                uint8_t *record, uint32_t record_size, uint32_t latency_ms);
+
+/*!
+ * @brief  Get where the next reading can be encoded in place
+ * @param  Batch
+ *         [out] Room for the reading, 0 if the largest reading so far would not fit: the reading is then
+ *         encoded elsewhere, batch_add() copies it or tells that the batch is full
+ * @retval Buffer of the reading
+ */
+uint8_t* batch_reserve(batch_t *batch, uint32_t *room);
+
+/*!
+ * @brief  Get where the compact form of the next reading can be written in place
+ * @param  Batch
+ *         [out] Room for the compact reading
+ * @retval Buffer of the compact reading
+ */
+uint8_t* batch_record_slot(batch_t *batch, uint32_t *room);
+
+/*!
+ * @brief  Add a reading after the readings of the batch
+ * @param  Batch
+ *         Reading as published and its length, not copied when encoded at batch_reserve()
+ *         Compact reading and its length, not copied when written at batch_record_slot()
+ *         Current time in ms
+ * @retval False if the batch is full: publish it and add the reading again
+ */
+bool batch_add(batch_t *batch, const uint8_t *reading, uint32_t length, const uint8_t *record, uint16_t record_length,
+               uint32_t now_ms);
+
+/*!
+ * @brief  Check if the oldest reading waited for the latency budget
+ * @param  Batch, current time in ms
+ * @retval True if the batch must be published
+ */
+bool batch_due(const batch_t *batch, uint32_t now_ms);
+
+/*!
+ * @brief  Close the payload to publish it
+ * @param  Batch, flush reason
+ * @retval Payload length, 0 if the batch is empty
+ */
+uint32_t batch_finish(batch_t *batch, batch_flush_t reason);
+
+/*!
+ * @brief  Get the compact readings of the batch in order, e.g. when it cannot be published
+ * @param  Batch
+ *         [in/out] Position, 0 for the first reading
+ *         [out] Length of the reading
+ * @retval Compact reading, NULL after the last
+ */
+const uint8_t* batch_record_next(const batch_t *batch, uint32_t *position, uint16_t *length);
+
+/*!
+ * @brief  Empty the batch after it is published or stored
+ * @param  Batch, true if it was published
+ * @retval None
+ */
+void batch_reset(batch_t *batch, bool published);
+
+/******************************************************************************/
+
+#endif /* _BATCH_H_ */
@@ -45,65 +45,149 @@
 #define WIFI_PASSWORD                                 "1133557799"
 #define WIFI_SSID_MAX_LENGTH                          32
 #define WIFI_PASSWORD_MAX_LENGTH                      64
-#define WIFI_TIME_RETRY_CONNECT_MS                    3000
+#define WIFI_TIME_RETRY_CONNECT_MS                    3000  /* Wait after a failed full scan */
+#define WIFI_NVS_NAMESPACE                            "wifi"
+
+/* Fast connect: BSSID and channel of the last good link are stored, the station connects to them
+ * without a scan, then falls back to a full scan */
+#define WIFI_FAST_CONNECT                             1
+#define WIFI_FAST_ATTEMPTS                            2     /* Direct connects before a full scan */
+
+/* IP: DHCP, lease of the last good link reused on the same AP, or static */
+#define WIFI_IP_DHCP                                  0
+#define WIFI_IP_CACHED                                1
+#define WIFI_IP_STATIC                                2
+#define WIFI_IP_MODE                                  WIFI_IP_DHCP
+#define WIFI_STATIC_IP                                "192.168.1.50"
+#define WIFI_STATIC_NETMASK                           "255.255.255.0"
+#define WIFI_STATIC_GW                                "192.168.1.1"
+
+/* Clock, set by SNTP once the network is up. Until then time() counts from boot: a reading done before
+ * gets time MODBUS_TIME_UNSYNCED, not an uptime the backend would take for a date */
+#define SNTP_SERVER                                   "pool.ntp.org"
+#define TIME_VALID_MIN                                1640995200    /* 2022-01-01, earlier is uptime */
 
 /* Modbus */
 #define MAX_SLAVE_ID                                  32
 #define MODBUS_RX_BUFFER_SIZE                         1024
-#define MODBUS_COMMAND_MAX_SIZE                       128
-#define MODBUS_QUEUE_SIZE                             128
+#define MODBUS_UART_EVENT_QUEUE_SIZE                  16
+#define MODBUS_COMMAND_MAX_SIZE                       256   /* Frame buffer, longest function 04 reply is 255 bytes */
+#define MODBUS_RING_SIZE                              32    /* Readings per bus, power of 2 */
+#define MODBUS_RING_BACKPRESSURE                      24    /* Unread readings of a bus at which polling waits for the publisher */
+#define MODBUS_BACKPRESSURE_WAIT_MS                   20    /* Recheck of the ring while polling waits */
 #define MODBUS_QUEUE_TIMEOUT_MS                       50
-
-#define MODBUS_TIME_BETWEEN_POLLING_MS                5000
+#define MODBUS_BUS_QUEUE_SIZE                         8
+#define MODBUS_WRITE_QUEUE_SIZE                       8     /* Pending writes per bus */
+#define MODBUS_WRITE_MAX_SIZE                         32    /* Data bytes of one write request */
+#define MODBUS_WRITE_MAX_REGS                         123   /* Function 16 limit */
+#define MODBUS_WRITE_BURST                            4     /* Writes sent in a row before a waiting poll */
+#define MODBUS_TRANSACTION_DEPTH                      2     /* Transactions in flight per poller */
+#define MODBUS_READ_MAX_REGS                          125   /* Function 04 limit */
+#define MODBUS_READ_GAP_MAX                           8     /* Unused registers read to merge two reads */
+#define MODBUS_READ_PLAN_SIZE                         8
+
+#define MODBUS_RETRY_MAX                              2     /* Immediate retries on CRC or frame error */
+#define MODBUS_QUARANTINE_TIMEOUTS                    3     /* Consecutive timeouts before quarantine */
+#define MODBUS_QUARANTINE_BACKOFF_MIN_MS              5000
+#define MODBUS_QUARANTINE_BACKOFF_MAX_MS              600000
+#define MODBUS_REPORT_BY_EXCEPTION                    1     /* Publish registers past their deadband or silence only */
+#define MODBUS_SCHEDULE_REPORT_MS                     60000 /* Log lateness and jitter of poll groups */
 #define MODBUS_RX_TIMEOUT_MS                          1000
-
+#define MODBUS_FRAME_DELAY_MS                         20    /* Minimum gap between two frames */
+#define MODBUS_TURNAROUND_MS                          20    /* Slave processing time before it replies */
+
+/* Password of writes to 0x68 meters, LSB first before adding 0x33. The factory default is 33 44 44 44
+ * on the wire, a meter with its own password is set with modbus_api_set_password() */
+#define MODBUS_ELEC_PASSWORD                          {0x00, 0x11, 0x11, 0x11}
+
+#define MODBUS_DISCOVERY_AT_BOOT                      1     /* Scan buses at boot when no slave list is stored */
+#define MODBUS_DISCOVERY_ID_FIRST                     1     /* Modbus id range scanned for water meters */
+#define MODBUS_DISCOVERY_ID_LAST                      247
+#define MODBUS_DISCOVERY_PROBE_REGISTER               0x0000
+#define MODBUS_NVS_NAMESPACE                          "modbus"
+
+/* One entry per RS-485 bus: UART, bus task and poller task of its own, pinned to "core".
+ * To add a bus, append to MODBUS_BUS_DEFAULT, e.g. {UART_NUM_1, 19, 18, 1200, UART_PARITY_EVEN, 0},
+ * then add its slave count and slave list at the same index */
 #ifdef ELECTRIC_METER_USED
-#define MODBUS_PORT_NUM                               UART_NUM_2
-#define MODBUS_BAUDRATE                               1200
-#define MODBUS_PARITY                                 UART_PARITY_EVEN
-#define MODBUS_UART_TXD                               23
-#define MODBUS_UART_RXD                               22
-#define MODBUS_SLAVE_COUNT                            2
-#define MODBUS_SLAVE_ID_DEFAULT                       {{1, 2, 3, 4, 5, 6}, {11, 12, 13, 14, 15, 16}, }
+#define MODBUS_BUS_COUNT                              1
+/*                                                     port        txd  rxd  baudrate  parity           core */
+#define MODBUS_BUS_DEFAULT                            {{UART_NUM_2, 23, 22,  1200,     UART_PARITY_EVEN, 1}, }
+#define MODBUS_SLAVE_COUNT                            {2, }
+#define MODBUS_SLAVE_ID_DEFAULT                       {{{1, 2, 3, 4, 5, 6}, {11, 12, 13, 14, 15, 16}, }, }
 #else
-#define MODBUS_PORT_NUM                               UART_NUM_2
-#define MODBUS_BAUDRATE                               9600
-#define MODBUS_PARITY                                 UART_PARITY_DISABLE
-#define MODBUS_UART_TXD                               23
-#define MODBUS_UART_RXD                               22
-#define MODBUS_SLAVE_COUNT                            2
-#define MODBUS_SLAVE_ID_DEFAULT                       {1, 2, }
+#define MODBUS_BUS_COUNT                              1
+/*                                                     port        txd  rxd  baudrate  parity              core */
+#define MODBUS_BUS_DEFAULT                            {{UART_NUM_2, 23, 22,  9600,     UART_PARITY_DISABLE, 1}, }
+#define MODBUS_SLAVE_COUNT                            {2, }
+#define MODBUS_SLAVE_ID_DEFAULT                       {{1, 2, }, }
 #endif
 
 /* MQTT */
 #define MQTT_DATA_MAX_LENGTH                          1024
 #define MQTT_TOPIC_MAX_LENGTH                         128
-#define MQTT_MAX_SUBCRIBE_TOPIC                       8
+#define MQTT_MAX_SUBCRIBE_TOPIC                       256   /* Handlers on topic filters, e.g. one per slave */
+#define MQTT_TOPIC_TRIE_NODES                         640   /* Topic levels of all filters, 32 bytes each */
+#define MQTT_TOPIC_TRIE_HASH_SIZE                     1024  /* Power of 2, larger than the number of levels */
+#define MQTT_TOPIC_MATCH_MAX                          8     /* Handlers called for one message */
 #define MQTT_CLIENT_ID_LENGTH                         32
-#define MQTT_MESSAGE_QUEUE_SIZE                       4
-#define MQTT_QUEUE_MAX_DELAY_MS                       200
+#define MQTT_MESSAGE_QUEUE_SIZE                       4     /* Received messages buffered, pooled */
+#define MQTT_MESSAGE_MAX_LENGTH                       4096  /* Received message, reassembled from the chunks of the client */
+#define MQTT_DATA_TOPIC                               "Data"
+#define MQTT_HEARTBEAT_TOPIC                          "Heartbeat"
+#define MQTT_HEARTBEAT_PERIOD_MS                      1000
+
+/* Readings are published QoS 0, or QoS 1 with a window of publishes in flight, acked by msg_id */
+#define MQTT_DATA_QOS                                 1
+#define MQTT_QOS1_WINDOW                              8     /* Publishes in flight, each keeps a copy of its payload */
+#define MQTT_QOS1_RETRANSMIT_MS                       10000 /* Publish not acked in time is sent again */
+#define MQTT_QOS1_WINDOW_WAIT_MS                      5000  /* Publish waits for a free slot, then fails */
+#define MQTT_QOS1_CHECK_MS                            500   /* Period of the retransmit check */
+#define MQTT_DATA_BINARY_TOPIC                        "DataBin"
+#define MQTT_SCHEMA_TOPIC                             "Schema"
 
 #define MQTT_BROKER_URI                              "mqtts://broker.emqx.io:8883"
 #define MQTT_USERNAME                                "admin"
 #define MQTT_PASSWORD                                "123456"
 
-/* JSON */
-#define JSON_METER_TYPE_KEY                           "meter"
-#define JSON_SLAVE_ID_KEY                             "slave"
-#define JSON_REG_KEY                                  "regs"
-#define JSON_ADDRESS_KEY                              "address"
-#define JSON_NAME_KEY                                 "key"
-#define JSON_VALUE_KEY                                "value"
+/* Journal of readings not published while MQTT is down, replayed oldest first */
+#define JOURNAL_PARTITION_LABEL                       "journal"
+#define JOURNAL_PARTITION_SUBTYPE                     0x99  /* Custom data subtype, see partitions.csv */
+#define JOURNAL_SECTOR_SIZE                           4096
+#define JOURNAL_RECORD_MAX_SIZE                       256
+#define JOURNAL_REPLAY_BATCH                          32    /* Records replayed per publisher wakeup */
+
+/* Telemetry: readings as json, or as binary decoded with the schema retained on MQTT_SCHEMA_TOPIC */
+#define TELEMETRY_FORMAT_JSON                         0
+#define TELEMETRY_FORMAT_BINARY                       1
+#define TELEMETRY_FORMAT                              TELEMETRY_FORMAT_JSON
+#define JSON_READING_MAX_LENGTH                       4096  /* Compact json of a reading with all registers */
+
+/* Readings of many slaves in one publish, until the byte or the latency budget is reached */
+#define BATCH_MAX_LENGTH                              MQTT_DATA_MAX_LENGTH
+#define BATCH_MAX_LATENCY_MS                          5000
+#define BATCH_RECORD_BUFFER_SIZE                      4096  /* Compact readings of a batch, journaled if it is not published */
+
+/* Publisher: wakes up on each reading, drains all of them */
+#define PUBLISHER_IDLE_MS                             1000  /* Longest sleep, for journal replay and link changes */
 
 /* TASK */
 #define MODBUS_TASK_NAME                              "modbus"
 #define MODBUS_TASK_SIZE                              4096
 #define MODBUS_TASK_PRIORITY                          3
 
+#define MODBUS_BUS_TASK_NAME                          "modbus_bus"
+#define MODBUS_BUS_TASK_SIZE                          4096
+#define MODBUS_BUS_TASK_PRIORITY                      5
+
 #define MQTT_TASK_NAME                                "MQTT"
 #define MQTT_TASK_SIZE                                4096
 #define MQTT_TASK_PRIORITY                            4
 
+#define PUBLISHER_TASK_NAME                           "publisher"
+#define PUBLISHER_TASK_SIZE                           4096
+#define PUBLISHER_TASK_PRIORITY                       2     /* Below pollers, the ring absorbs bursts */
+
 /******************************************************************************/
 /*                              PRIVATE DATA                                  */
 /******************************************************************************/
@@ -0,0 +1,390 @@
+/*
+ *  journal.c
+ *
+ *  Created on: Feb 08, 2022
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <string.h>
+#include "utility/utility.h"
+#include "journal.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define JOURNAL_MAGIC                                 0x4C4E524A    /* "JRNL" */
+#define JOURNAL_ALIGN(size)                           (((size) + 3) & ~3UL)
+
+/* Record state, bits are only cleared so a state is written without erase */
+#define JOURNAL_STATE_FREE                            0xFF
+#define JOURNAL_STATE_VALID                           0xFE
+#define JOURNAL_STATE_SENT                            0xFC
+
+/*!
+ * @brief  Header at start of each sector
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;
+} journal_sector_t;
+
+/*!
+ * @brief  Header of each record, followed by data
+ */
+typedef struct {
+    uint8_t state;
+    uint8_t reserved;
+    uint16_t length;
+    uint16_t crc;                                     /* crc16 of data */
+    uint16_t reserved2;
+} journal_record_t;
+
+typedef uint8_t journal_result_t;
+enum {
+    JOURNAL_RECORD_OK = 0,
+    JOURNAL_RECORD_FREE,                              /* Free space, end of sector data */
+    JOURNAL_RECORD_INVALID,                           /* Torn header, the rest of sector is not used */
+};
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static bool journal_read_sector(journal_t *journal, uint32_t sector, journal_sector_t *header);
+static journal_result_t journal_read_record(journal_t *journal, uint32_t sector, uint32_t offset, journal_record_t *record);
+static uint32_t journal_count_unsent(journal_t *journal, uint32_t sector, uint32_t offset);
+static bool journal_start_sector(journal_t *journal, uint32_t sector);
+
+/******************************************************************************/
+
+/*!
+ * @brief  Read sector header
+ * @retval True if the sector is in use
+ */
+static bool journal_read_sector(journal_t *journal, uint32_t sector, journal_sector_t *header)
+{
+    if(!journal->flash.read(journal->flash.ctx, sector * journal->flash.sector_size, header, sizeof(journal_sector_t)))
+    {
+        return false;
+    }
+    return (header->magic == JOURNAL_MAGIC);
+}
+
+/*!
+ * @brief  Read record header at offset of sector
+ */
+static journal_result_t journal_read_record(journal_t *journal, uint32_t sector, uint32_t offset, journal_record_t *record)
+{
+    if((offset + sizeof(journal_record_t)) > journal->flash.sector_size)
+    {
+        return JOURNAL_RECORD_FREE;
+    }
+    if(!journal->flash.read(journal->flash.ctx, sector * journal->flash.sector_size + offset, record, sizeof(journal_record_t)))
+    {
+        return JOURNAL_RECORD_INVALID;
+    }
+    if((record->state == JOURNAL_STATE_FREE) && (record->length == 0xFFFF))
+    {
+        return JOURNAL_RECORD_FREE;
+    }
+    if((record->length == 0) || ((offset + sizeof(journal_record_t) + record->length) > journal->flash.sector_size))
+    {
+        return JOURNAL_RECORD_INVALID;
+    }
+    return JOURNAL_RECORD_OK;
+}
+
+/*!
+ * @brief  Count unsent records of a sector from offset
+ */
+static uint32_t journal_count_unsent(journal_t *journal, uint32_t sector, uint32_t offset)
+{
+    journal_record_t record;
+    uint32_t count = 0;
+
+    while(journal_read_record(journal, sector, offset, &record) == JOURNAL_RECORD_OK)
+    {
+        if(record.state == JOURNAL_STATE_VALID)
+        {
+            count++;
+        }
+        offset += JOURNAL_ALIGN(sizeof(journal_record_t) + record.length);
+    }
+    return count;
+}
+
+/*!
+ * @brief  Erase a sector and make it the write sector. Unsent records in it are dropped
+ */
+static bool journal_start_sector(journal_t *journal, uint32_t sector)
+{
+    journal_sector_t header;
+    uint32_t dropped;
+
+    if((journal->pending > 0) && (sector == journal->read_sector))
+    {
+        dropped = journal_count_unsent(journal, sector, journal->read_offset);
+        dropped = (dropped > journal->pending) ? journal->pending : dropped;
+        journal->pending -= dropped;
+        journal->stats.dropped += dropped;
+        journal->read_sector = (sector + 1) % journal->num_sector;
+        journal->read_offset = sizeof(journal_sector_t);
+        journal->peek_offset = 0;
+    }
+
+    if(!journal->flash.erase(journal->flash.ctx, sector * journal->flash.sector_size, journal->flash.sector_size))
+    {
+        return false;
+    }
+    journal->stats.erased++;
+
+    header.magic = JOURNAL_MAGIC;
+    header.sequence = ++journal->sequence;
+    if(!journal->flash.write(journal->flash.ctx, sector * journal->flash.sector_size, &header, sizeof(header)))
+    {
+        return false;
+    }
+    journal->write_sector = sector;
+    journal->write_offset = sizeof(journal_sector_t);
+    return true;
+}
+
+/******************************************************************************/
+
+/*!
+ * @brief  Open the journal
+ */
+bool journal_init(journal_t *journal, const journal_flash_t *flash)
+{
+    journal_sector_t header;
+    journal_record_t record;
+    journal_result_t result;
+    uint32_t oldest = 0, oldest_sequence = 0;
+    uint32_t sector, offset;
+    bool found = false;
+    bool read_found = false;
+
+    memset(journal, 0, sizeof(journal_t));
+    memcpy(&journal->flash, flash, sizeof(journal_flash_t));
+    journal->num_sector = flash->size / flash->sector_size;
+    if(journal->num_sector < 2)
+    {
+        return false;
+    }
+
+    /* Newest sector is the write sector, oldest is where unsent records may start */
+    for(sector = 0; sector < journal->num_sector; sector++)
+    {
+        if(!journal_read_sector(journal, sector, &header))
+        {
+            continue;
+        }
+        if(!found || (header.sequence > journal->sequence))
+        {
+            journal->sequence = header.sequence;
+            journal->write_sector = sector;
+        }
+        if(!found || (header.sequence < oldest_sequence))
+        {
+            oldest_sequence = header.sequence;
+            oldest = sector;
+        }
+        found = true;
+    }
+    if(!found)
+    {
+        if(!journal_start_sector(journal, 0))
+        {
+            return false;
+        }
+        journal->read_sector = journal->write_sector;
+        journal->read_offset = journal->write_offset;
+        return true;
+    }
+
+    /* Walk sectors from the oldest: first unsent record, number of unsent records, end of data */
+    sector = oldest;
+    while(1)
+    {
+        offset = sizeof(journal_sector_t);
+        while((result = journal_read_record(journal, sector, offset, &record)) == JOURNAL_RECORD_OK)
+        {
+            if(record.state == JOURNAL_STATE_VALID)
+            {
+                if(!read_found)
+                {
+                    journal->read_sector = sector;
+                    journal->read_offset = offset;
+                    read_found = true;
+                }
+                journal->pending++;
+            }
+            offset += JOURNAL_ALIGN(sizeof(journal_record_t) + record.length);
+        }
+
+        if(sector == journal->write_sector)
+        {
+            /* Do not write over a torn header, go on in the next sector */
+            journal->write_offset = (result == JOURNAL_RECORD_FREE) ? offset : journal->flash.sector_size;
+            break;
+        }
+        sector = (sector + 1) % journal->num_sector;
+    }
+
+    if(!read_found)
+    {
+        journal->read_sector = journal->write_sector;
+        journal->read_offset = journal->write_offset;
+    }
+    return true;
+}
+
+/*!
+ * @brief  Append a record
+ */
+bool journal_append(journal_t *journal, const void *data, uint16_t length)
+{
+    journal_record_t record;
+    uint32_t size = JOURNAL_ALIGN(sizeof(journal_record_t) + length);
+    uint32_t address;
+
+    if((length == 0) || (size > (journal->flash.sector_size - sizeof(journal_sector_t))))
+    {
+        return false;
+    }
+
+    /* Records do not span sectors, next sector when no room */
+    if((journal->write_offset + size) > journal->flash.sector_size)
+    {
+        if(!journal_start_sector(journal, (journal->write_sector + 1) % journal->num_sector))
+        {
+            return false;
+        }
+    }
+    if(journal->pending == 0)
+    {
+        journal->read_sector = journal->write_sector;
+        journal->read_offset = journal->write_offset;
+    }
+
+    /* Header first: a torn record has a valid length and fails its check */
+    memset(&record, 0xFF, sizeof(record));
+    record.state = JOURNAL_STATE_VALID;
+    record.length = length;
+    record.crc = crc16_modbus(data, length);
+    address = journal->write_sector * journal->flash.sector_size + journal->write_offset;
+    journal->write_offset += size;
+    if(!journal->flash.write(journal->flash.ctx, address, &record, sizeof(record)) ||
+       !journal->flash.write(journal->flash.ctx, address + sizeof(record), data, length))
+    {
+        return false;
+    }
+
+    journal->pending++;
+    journal->stats.appended++;
+    return true;
+}
+
+/*!
+ * @brief  Get the oldest unsent record
+ */
+uint16_t journal_peek(journal_t *journal, void *data, uint16_t size)
+{
+    journal_record_t record;
+    journal_result_t result;
+    uint32_t address;
+
+    journal->peek_offset = 0;
+    while(journal->pending > 0)
+    {
+        result = journal_read_record(journal, journal->read_sector, journal->read_offset, &record);
+        if(result != JOURNAL_RECORD_OK)
+        {
+            if(journal->read_sector == journal->write_sector)
+            {
+                break;
+            }
+            journal->read_sector = (journal->read_sector + 1) % journal->num_sector;
+            journal->read_offset = sizeof(journal_sector_t);
+            continue;
+        }
+
+        address = journal->read_sector * journal->flash.sector_size + journal->read_offset;
+        journal->peek_size = JOURNAL_ALIGN(sizeof(journal_record_t) + record.length);
+        if(record.state == JOURNAL_STATE_VALID)
+        {
+            if((record.length <= size) &&
+               journal->flash.read(journal->flash.ctx, address + sizeof(record), data, record.length) &&
+               (crc16_modbus(data, record.length) == record.crc))
+            {
+                journal->peek_offset = journal->read_offset;
+                return record.length;
+            }
+
+            /* Skip it, never sent */
+            journal->flash.write(journal->flash.ctx, address, &(uint8_t){JOURNAL_STATE_SENT}, 1);
+            journal->stats.corrupted++;
+            journal->pending--;
+        }
+        journal->read_offset += journal->peek_size;
+    }
+    return 0;
+}
+
+/*!
+ * @brief  Mark the record returned by journal_peek() as sent
+ */
+bool journal_mark_sent(journal_t *journal)
+{
+    uint8_t state = JOURNAL_STATE_SENT;
+    uint32_t address;
+
+    if(journal->peek_offset == 0)
+    {
+        return false;
+    }
+    address = journal->read_sector * journal->flash.sector_size + journal->peek_offset;
+    if(!journal->flash.write(journal->flash.ctx, address, &state, sizeof(state)))
+    {
+        return false;
+    }
+    journal->read_offset = journal->peek_offset + journal->peek_size;
+    journal->peek_offset = 0;
+    journal->pending--;
+    journal->stats.replayed++;
+    return true;
+}
+
+/*!
+ * @brief  Number of unsent records
+ */
+uint32_t journal_pending(const journal_t *journal)
+{
+    return journal->pending;
+}
+
+/*!
+ * @brief  Get journal statistics
+ */
+void journal_get_stats(const journal_t *journal, journal_stats_t *stats)
+{
+    memcpy(stats, &journal->stats, sizeof(journal_stats_t));
+}
@@ -0,0 +1,136 @@
+/*
+ *  journal.h
+ *
+ *  Created on: Feb 08, 2022
+ */
+
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+/*!
+ * @brief  Flash operations, offset from start of the journal area. Write only clears bits (NOR flash)
+ */
+typedef struct {
+    bool (*read)(void *ctx, uint32_t offset, void *data, uint32_t size);
+    bool (*write)(void *ctx, uint32_t offset, const void *data, uint32_t size);
+    bool (*erase)(void *ctx, uint32_t offset, uint32_t size);
+    uint32_t size;                                    /* Size of journal area */
+    uint32_t sector_size;                             /* Erase unit */
+    void *ctx;
+} journal_flash_t;
+
+/*!
+ * @brief  Journal statistics
+ */
+typedef struct {
+    uint32_t appended;                                /* Records written */
+    uint32_t replayed;                                /* Records marked sent */
+    uint32_t dropped;                                 /* Unsent records erased when the journal wrapped */
+    uint32_t corrupted;                               /* Records skipped on check fail */
+    uint32_t erased;                                  /* Sector erases */
+} journal_stats_t;
+
+/*!
+ * @brief  Journal instance. Sectors are written in turn, a record never spans two sectors
+ */
+typedef struct {
+    journal_flash_t flash;
+    uint32_t num_sector;
+    uint32_t sequence;                                /* Sequence of write sector, the oldest sector has the lowest */
+    uint32_t write_sector;
+    uint32_t write_offset;                            /* Offset of next record in write sector */
+    uint32_t read_sector;                             /* Oldest record which may be unsent */
+    uint32_t read_offset;
+    uint32_t peek_offset;                             /* Record returned by journal_peek(), 0 if none */
+    uint32_t peek_size;
+    uint32_t pending;                                 /* Unsent records */
+    journal_stats_t stats;
+} journal_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+/*!
+ * @brief  Open the journal, find write and read positions from the sectors on flash
+ * @param  Journal
+ *         Flash operations, copied
+ * @retval True if success
+ */
+bool journal_init(journal_t *journal, const journal_flash_t *flash);
+
+/*!
+ * @brief  Append a record. When the journal is full, the oldest sector is erased
+ * @param  Journal
+ *         Record and its length
+ * @retval True if success
+ */
+bool journal_append(journal_t *journal, const void *data, uint16_t length);
+
+/*!
+ * @brief  Get the oldest unsent record
+ * @param  Journal
+ *         [out] Record
+ *         Size of record buffer
+ * @retval Length of record, 0 if none
+ */
+uint16_t journal_peek(journal_t *journal, void *data, uint16_t size);
+
+/*!
+ * @brief  Mark the record returned by journal_peek() as sent
+ * @param  Journal
+ * @retval True if success
+ */
+bool journal_mark_sent(journal_t *journal);
+
+/*!
+ * @brief  Number of unsent records
+ * @param  Journal
+ * @retval Number of records
+ */
+uint32_t journal_pending(const journal_t *journal);
+
+/*!
+ * @brief  Get journal statistics
+ * @param  Journal
+ *         [out] Statistics
+ * @retval None
+ */
+void journal_get_stats(const journal_t *journal, journal_stats_t *stats);
+
+/*!
+ * @brief  Flash operations on a data partition (ESP-IDF only)
+ * @param  [out] Flash operations
+ *         Partition label
+ * @retval True if the partition is found
+ */
+bool journal_partition_open(journal_flash_t *flash, const char *label);
+
+/******************************************************************************/
+
+#endif /* _JOURNAL_H_ */
@@ -0,0 +1,83 @@
+/*
+ *  journal_partition.c
+ *
+ *  Created on: Feb 08, 2022
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <esp_partition.h>
+#include "config.h"
+#include "journal.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static const char* TAG = "JOURNAL";
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static bool journal_partition_read(void *ctx, uint32_t offset, void *data, uint32_t size);
+static bool journal_partition_write(void *ctx, uint32_t offset, const void *data, uint32_t size);
+static bool journal_partition_erase(void *ctx, uint32_t offset, uint32_t size);
+
+/******************************************************************************/
+
+static bool journal_partition_read(void *ctx, uint32_t offset, void *data, uint32_t size)
+{
+    return (esp_partition_read((const esp_partition_t*) ctx, offset, data, size) == ESP_OK);
+}
+
+static bool journal_partition_write(void *ctx, uint32_t offset, const void *data, uint32_t size)
+{
+    return (esp_partition_write((const esp_partition_t*) ctx, offset, data, size) == ESP_OK);
+}
+
+static bool journal_partition_erase(void *ctx, uint32_t offset, uint32_t size)
+{
+    return (esp_partition_erase_range((const esp_partition_t*) ctx, offset, size) == ESP_OK);
+}
+
+/******************************************************************************/
+
+/*!
+ * @brief  Flash operations on a data partition
+ */
+bool journal_partition_open(journal_flash_t *flash, const char *label)
+{
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, JOURNAL_PARTITION_SUBTYPE, label);
+
+    if(partition == NULL)
+    {
+        ESP_LOGE(TAG, "Partition %s not found", label);
+        return false;
+    }
+
+    flash->read = journal_partition_read;
+    flash->write = journal_partition_write;
+    flash->erase = journal_partition_erase;
+    flash->size = partition->size;
+    flash->sector_size = JOURNAL_SECTOR_SIZE;
+    flash->ctx = (void*) partition;
+    ESP_LOGI(TAG, "Partition %s at 0x%x, %u bytes", label, partition->address, partition->size);
+    return true;
+}
@@ -15,6 +15,7 @@
 #include "modbus_api/modbus_api.h"
 #include "wifi_lib/wifi_lib.h"
 #include "mqtt_api/mqtt_api.h"
+#include "publisher/publisher.h"
 
 /******************************************************************************/
 /*                     EXPORTED TYPES and DEFINITIONS                         */
@@ -43,11 +44,19 @@ static const char* TAG = "MAIN";
 /******************************************************************************/
 
 /*!
- * @brief  Hanle message received from mqtt
+ * @brief  Hanle message received from mqtt: a poll plan command, see modbus_plan_parse()
  */
-void main_mqtt_message_handle(char* message, uint32_t length)
+void main_mqtt_message_handle(const char* topic, char* message, uint32_t length, void* context)
 {
-    ESP_LOGI(TAG, "Received message");
+    modbus_plan_change_t change;
+
+    ESP_LOGI(TAG, "Received message %s", message);
+    if(!modbus_plan_parse(message, &change))
+    {
+        ESP_LOGE(TAG, "Invalid plan command");
+        return;
+    }
+    modbus_api_set_plan(&change);
 }
 
 /**
@@ -68,30 +77,44 @@ void app_main()
     wifi_lib_init_sta();
 
     /* MQTT initialization */
-    mqtt_register_callback("Config", main_mqtt_message_handle);
     mqtt_api_init();
 
+    /* Publisher first, it waits for the readings of the pollers */
+    publisher_init();
+
     /* Modbus master init */
     modbus_api_init();
 
-    modbus_data_t modbus_data;
+    /* Poll plan commands, once the pollers run. Send them retained to apply them again after reboot */
+    mqtt_api_subscribe("Config", main_mqtt_message_handle, NULL);
+
+    /* Heartbeat, whatever the data flow */
+    publisher_stats_t stats;
+    mqtt_inbound_stats_t inbound;
+    wifi_fast_stats_t wifi;
+#if (MQTT_DATA_QOS == 1)
+    mqtt_window_stats_t window;
+#endif
+    TickType_t wake = xTaskGetTickCount();
     while(1)
     {
-        /* Check modbus queue */
-        if(modbus_api_queue_get(&modbus_data) == ESP_OK)
-        {
-            char *message = modbus_api_data_to_json(&modbus_data);
-            if(message != NULL)
-            {
-                ESP_LOGI(TAG, "-------------- %s", message);
-                free(message);
-            }
-        }
-
-        /* Send heartbeat */
-        mqtt_api_publish("Heartbeat", "Hello world!", MQTT_AUTO_LENGTH);
-
-        ESP_LOGI(TAG, "Free heap %u", esp_get_minimum_free_heap_size());
-        vTaskDelay(1000 / portTICK_RATE_MS);
+        mqtt_api_publish_unacked(MQTT_HEARTBEAT_TOPIC, "Hello world!", MQTT_AUTO_LENGTH);
+
+        publisher_get_stats(&stats);
+        ESP_LOGI(TAG, "Free heap %u, publisher: %u readings in %u wakeups, max %u", esp_get_minimum_free_heap_size(),
+                 stats.readings, stats.wakeups, stats.max_drain);
+        mqtt_api_get_inbound_stats(&inbound);
+        ESP_LOGI(TAG, "MQTT inbound: %u received, %u fragmented, %u overflow, %u too large, %u broken, max queued %u",
+                 inbound.received, inbound.fragmented, inbound.overflow, inbound.too_large, inbound.broken, inbound.max_queued);
+#if (MQTT_DATA_QOS == 1)
+        mqtt_api_get_window_stats(&window);
+        ESP_LOGI(TAG, "Publish window: %u/%u in flight, max %u, acked %u, retransmits %u, full %u, ack %ums avg %ums max",
+                 window.in_flight, MQTT_QOS1_WINDOW, window.max_in_flight, window.acked, window.retransmits, window.full,
+                 window.ack_latency_avg, window.ack_latency_max);
+#endif
+        wifi_lib_get_stats(&wifi);
+        ESP_LOGI(TAG, "Wifi: time to IP %ums, max %ums, %u direct, %u scan, %u fallbacks", wifi.time_to_ip,
+                 wifi.time_to_ip_max, wifi.direct, wifi.scan, wifi.fallbacks);
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(MQTT_HEARTBEAT_PERIOD_MS));
     }
-}
\ No newline at end of file
+}
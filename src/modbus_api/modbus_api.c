@@ -10,11 +10,22 @@
 /*                              INCLUDE FILES                                 */
 /******************************************************************************/
 
-#include <cJSON.h>
+#include <sys/param.h>
+#include <time.h>
+#include <nvs.h>
+#include <freertos/semphr.h>
 #include "config.h"
 #include "modbus_table.h"
 #include "modbus_command.h"
+#include "modbus_frame.h"
+#include "modbus_bus.h"
 #include "modbus_api.h"
+#include "modbus_discovery.h"
+#include "modbus_ring.h"
+#include "modbus_decode.h"
+#include "modbus_telemetry.h"
+#include "modbus_report.h"
+#include "modbus_plan.h"
 
 /******************************************************************************/
 /*                     EXPORTED TYPES and DEFINITIONS                         */
@@ -28,36 +39,126 @@ typedef struct {
     const char *name;
 } modbus_reg_info_t;
 
+/*!
+ * @brief  Poll group, registers "first" to "last" read every "period" ms
+ */
+typedef struct {
+    modbus_reg_id first;
+    modbus_reg_id last;
+    uint32_t period;
+    const char *name;
+} modbus_group_info_t;
+
+/*!
+ * @brief  Schedule entry, one per (slave, group)
+ */
+typedef struct {
+    TickType_t deadline;                              /* Next time to read */
+    uint8_t slave;                                    /* Index in slave list */
+    modbus_group_id group;
+    bool busy;                                        /* Being read */
+} modbus_api_entry_t;
+
+/*!
+ * @brief  Transactions of one schedule entry with response buffer and the reading being built
+ */
+typedef struct {
+    modbus_transaction_t transaction;
+    modbus_api_entry_t *entry;
+    uint8_t step;                                     /* Transaction index in the group */
+    uint8_t retry;                                    /* Retries of current step */
+    uint16_t index;                                   /* Write index in data */
+    bool result;                                      /* All transactions of the reading succeeded */
+    modbus_data_t data;
+    uint8_t buffer[MODBUS_COMMAND_MAX_SIZE];
+} modbus_api_job_t;
+
+/*!
+ * @brief  Slave health, a slave that keeps timing out is quarantined and only probed with backoff
+ */
+typedef struct {
+    uint8_t timeouts;                                 /* Consecutive timeouts */
+    bool quarantined;
+    bool probing;                                     /* A probe read is on the bus */
+    uint32_t backoff;                                 /* Time between probes in ms */
+    TickType_t probe_time;                            /* Next probe */
+} modbus_api_health_t;
+
+/*!
+ * @brief  Poller of one bus. Slave state is kept by index in the slave list, whatever the plan
+ */
+typedef struct {
+    uint8_t bus;
+    volatile bool discover;                           /* Scan the bus when no job is in flight */
+    modbus_plan_store_t store;                        /* Plans, swapped when no job is in flight */
+    const modbus_plan_t *plan;                        /* Active plan, read by the poller only */
+    volatile uint32_t plan_version;
+    QueueHandle_t done_queue;                         /* Finished transactions, back from bus task, NULL to wake up */
+    modbus_api_job_t job[MODBUS_TRANSACTION_DEPTH];
+    modbus_api_entry_t entry[MAX_SLAVE_ID * MODBUS_GROUP_COUNT];
+    TickType_t slave_served[MAX_SLAVE_ID];            /* Last dispatch time, to share the bus between slaves */
+    modbus_api_health_t health[MAX_SLAVE_ID];
+    modbus_group_stats_t stats[MODBUS_GROUP_COUNT];
+    modbus_ring_t ring;                               /* Readings, poller is producer, reader task is consumer */
+    modbus_data_t reading[MODBUS_RING_SIZE];
+    uint32_t throttled;                               /* Times polling waited for the reader, ring above MODBUS_RING_BACKPRESSURE */
+#if (MODBUS_REPORT_BY_EXCEPTION)
+    modbus_report_t report;
+    modbus_report_last_t last[MAX_SLAVE_ID];          /* Last report of each slave */
+#endif
+} modbus_api_poller_t;
+
+_Static_assert((MODBUS_RING_SIZE & (MODBUS_RING_SIZE - 1)) == 0, "MODBUS_RING_SIZE must be a power of 2");
+/* Jobs in flight when polling is held back still find a free slot */
+_Static_assert(MODBUS_RING_BACKPRESSURE + MODBUS_TRANSACTION_DEPTH < MODBUS_RING_SIZE, "MODBUS_RING_BACKPRESSURE is too high");
+
 /******************************************************************************/
 /*                              PRIVATE DATA                                  */
 /******************************************************************************/
 
 static const char* TAG = "MODBUS";
-const char *meter_type[METER_COUNT] = {"electric", "water"};
 
-static QueueHandle_t modbus_command_queue;
-static uint32_t slave_count = MODBUS_SLAVE_COUNT;
+static modbus_api_poller_t modbus_poller[MODBUS_BUS_COUNT];
+static TaskHandle_t volatile modbus_reader = NULL;     /* Task waiting in modbus_api_reading_wait() */
+static SemaphoreHandle_t plan_lock;                    /* Builders of plans and of the slave lists */
+
+/* Slave list of each bus, append only so readings and plans keep pointing at the same slave.
+ * A plan picks the slaves it polls from it */
+static uint32_t slave_count[MODBUS_BUS_COUNT] = MODBUS_SLAVE_COUNT;
 
 #ifdef ELECTRIC_METER_USED
 /* Electric meter*/
-static uint8_t slave_address[MAX_SLAVE_ID][6] = MODBUS_SLAVE_ID_DEFAULT;
+static uint8_t slave_address[MODBUS_BUS_COUNT][MAX_SLAVE_ID][6] = MODBUS_SLAVE_ID_DEFAULT;
+static const uint8_t default_password[MODBUS_PASSWORD_SIZE] = MODBUS_ELEC_PASSWORD;
+static uint8_t slave_password[MODBUS_BUS_COUNT][MAX_SLAVE_ID][MODBUS_PASSWORD_SIZE];   /* Of meters not on the default */
+static bool slave_password_set[MODBUS_BUS_COUNT][MAX_SLAVE_ID];
 const modbus_reg_info_t modbus_reg_info[] = {
-#define XTABLE_ITEM(id, name, type, address, size, flag) { id, address, size, flag, #name },
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence) { id, address, size, flag, #name },
     MODBUS_ELECTRIC_CMD
 #undef XTABLE_ITEM
 };
+static const uint16_t *modbus_reg_offset = modbus_elec_offset;
 
-typedef void (*modbus_data_convert_t)(uint8_t*, char*);
-const char *day_in_week[] = {"sun", "mon", "tue", "wed", "thu", "fri", "sat", "null"};
-modbus_data_convert_t modbus_data_convert[MB_ELEC_NUMBER_OF_CMD];
+const modbus_group_info_t modbus_group_info[] = {
+#define XGROUP_ITEM(id, first, last, period) { first, last, period, #id },
+    MODBUS_ELECTRIC_POLL_GROUPS
+#undef XGROUP_ITEM
+};
 #else
 /* Water meter */
-static uint8_t slave_address[MAX_SLAVE_ID] = MODBUS_SLAVE_ID_DEFAULT;
+static uint8_t slave_address[MODBUS_BUS_COUNT][MAX_SLAVE_ID] = MODBUS_SLAVE_ID_DEFAULT;
 const modbus_reg_info_t modbus_reg_info[] = {
-#define XTABLE_ITEM(id, name, type, address, size, flag) { id, address, size, flag, #name },
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence) { id, address, size, flag, #name },
     MODBUS_WATER_INPUT_REGS
 #undef XTABLE_ITEM
 };
+static const uint16_t *modbus_reg_offset = modbus_water_offset;
+
+const modbus_group_info_t modbus_group_info[] = {
+#define XGROUP_ITEM(id, first, last, period) { first, last, period, #id },
+    MODBUS_WATER_POLL_GROUPS
+#undef XGROUP_ITEM
+};
 #endif
 
 /******************************************************************************/
@@ -71,8 +172,27 @@ const modbus_reg_info_t modbus_reg_info[] = {
 /******************************************************************************/
 
 uint16_t modbus_api_get_num_reg(modbus_reg_id start, modbus_reg_id stop);
+uint8_t modbus_api_build_read_plan(modbus_reg_id start, modbus_reg_id stop, uint16_t gap_max, modbus_read_plan_t *plan);
+static void modbus_api_reading_put(modbus_api_poller_t *poller, uint8_t slave, modbus_data_t *data);
+static void modbus_api_job_complete(modbus_transaction_t *transaction);
+static void modbus_api_job_submit(modbus_api_poller_t *poller, modbus_api_job_t *job);
+static bool modbus_api_job_retry(modbus_api_poller_t *poller, modbus_api_job_t *job);
+static void modbus_api_health_update(modbus_api_poller_t *poller, modbus_api_job_t *job, TickType_t now);
+static bool modbus_api_job_done(modbus_api_poller_t *poller, modbus_api_job_t *job);
+static modbus_api_entry_t* modbus_api_schedule_next(modbus_api_poller_t *poller, TickType_t now, TickType_t *wait);
+static void modbus_api_schedule_dispatch(modbus_api_poller_t *poller, modbus_api_job_t *job, modbus_api_entry_t *entry, TickType_t now);
+static void modbus_api_schedule_done(modbus_api_poller_t *poller, modbus_api_entry_t *entry, TickType_t now);
+static void modbus_api_schedule_report(modbus_api_poller_t *poller);
+static bool modbus_api_plan_reads(modbus_plan_t *plan);
+static void modbus_api_plan_default(uint8_t bus, modbus_plan_t *plan);
+static void modbus_api_plan_swap(modbus_api_poller_t *poller, TickType_t now);
+static bool modbus_api_slave_load(uint8_t bus);
+static void modbus_api_slave_save(uint8_t bus);
+static int32_t modbus_api_slave_find(uint8_t bus, const uint8_t *address);
+static int32_t modbus_api_slave_add(uint8_t bus, const uint8_t *address);
+static void modbus_api_discover_run(modbus_api_poller_t *poller);
 static void modbus_api_task(void *arg);
-static void modbus_api_add_reg_data_to_json(cJSON* root, const modbus_reg_info_t *table, modbus_data_t *modbus_data);
+static const uint8_t* modbus_api_slave_address(const modbus_data_t *modbus_data);
 
 /******************************************************************************/
 
@@ -81,282 +201,1128 @@ static void modbus_api_add_reg_data_to_json(cJSON* root, const modbus_reg_info_t
  */
 uint16_t modbus_api_get_num_reg(modbus_reg_id start, modbus_reg_id stop)
 {
-    uint16_t ret_val = 0;
+    return modbus_reg_offset[stop + 1] - modbus_reg_offset[start];
+}
+
+/*!
+ * @brief  Merge REPORT registers from "start" to "stop" into the fewest function 04 reads.
+ *         Two registers go in the same read when at most "gap_max" unused registers are between them
+ */
+uint8_t modbus_api_build_read_plan(modbus_reg_id start, modbus_reg_id stop, uint16_t gap_max, modbus_read_plan_t *plan)
+{
+    modbus_read_t *read = NULL;
+    uint16_t end;
+
+    plan->count = 0;
     for(modbus_reg_id i = start; i <= stop; i++)
     {
-        ret_val += modbus_reg_info[i].size;
+        if(!(modbus_reg_info[i].flag & REPORT))
+        {
+            continue;
+        }
+
+        end = modbus_reg_info[i].address + modbus_reg_info[i].size;
+        if((read != NULL) &&
+           (modbus_reg_info[i].address <= read->address + read->num_reg + gap_max) &&
+           (end - read->address <= MODBUS_READ_MAX_REGS))
+        {
+            /* Extend current read */
+            read->num_reg = end - read->address;
+            read->last = i;
+        }
+        else
+        {
+            if(plan->count >= MODBUS_READ_PLAN_SIZE)
+            {
+                ESP_LOGE(TAG, "Read plan is full at register %s", modbus_reg_info[i].name);
+                plan->count = 0;
+                break;
+            }
+            read = &plan->read[plan->count++];
+            read->address = modbus_reg_info[i].address;
+            read->num_reg = modbus_reg_info[i].size;
+            read->first = i;
+            read->last = i;
+        }
     }
-    return ret_val;
+    return plan->count;
 }
 
 /*!
- * @brief  Task for get data from slave
+ * @brief  Put a finished reading into the ring of the bus, with the registers to report.
+ *         A reading with nothing to report is dropped
  */
+static void modbus_api_reading_put(modbus_api_poller_t *poller, uint8_t slave, modbus_data_t *data)
+{
+    modbus_data_t *slot;
+    time_t now = time(NULL);
+
+    /* Uptime until SNTP sets the clock, a journaled reading must not carry it as a date */
+    data->time = (now >= TIME_VALID_MIN) ? (uint32_t) now : MODBUS_TIME_UNSYNCED;
+#if (MODBUS_REPORT_BY_EXCEPTION)
 #ifdef ELECTRIC_METER_USED
-static void modbus_api_task(void *arg)
+    const uint8_t *address = slave_address[poller->bus][slave];
+#else
+    const uint8_t *address = &slave_address[poller->bus][slave];
+#endif
+    data->report = modbus_report_check(&poller->report, &poller->last[slave], address, data);
+    if(data->report == 0)
+    {
+        return;
+    }
+#else
+    data->report = MODBUS_REPORT_ALL;
+#endif
+
+    slot = (modbus_data_t*) modbus_ring_produce(&poller->ring);
+    if(slot == NULL)
+    {
+        ESP_LOGW(TAG, "Bus %d reading dropped, ring is full", poller->bus);
+        return;
+    }
+    memcpy(slot, data, sizeof(modbus_data_t));
+    modbus_ring_commit(&poller->ring);
+    if(modbus_reader != NULL)
+    {
+        xTaskNotifyGive(modbus_reader);
+    }
+
+#if (MODBUS_REPORT_BY_EXCEPTION)
+    /* Only once it is on its way, a dropped reading is checked again next time */
+    modbus_report_commit(&poller->last[slave], address, data);
+#endif
+}
+
+/*!
+ * @brief  Called from bus task when a transaction is done, hand it back to poller
+ */
+static void modbus_api_job_complete(modbus_transaction_t *transaction)
 {
-    uint32_t i, j, index;
-    bool result;
-    modbus_data_t modbus_data;
-    uint8_t buffer[MODBUS_COMMAND_MAX_SIZE];
+    modbus_api_job_t *job = (modbus_api_job_t*) transaction->arg;
+    xQueueSend(modbus_poller[transaction->bus].done_queue, &job, portMAX_DELAY);
+}
 
-    while(1)
+#ifdef ELECTRIC_METER_USED
+/*!
+ * @brief  Build and submit transaction "step" of the job (one command of the group)
+ */
+static void modbus_api_job_submit(modbus_api_poller_t *poller, modbus_api_job_t *job)
+{
+    modbus_transaction_t *transaction = &job->transaction;
+    modbus_reg_id reg = job->data.start + job->step;
+
+    transaction->bus = poller->bus;
+    transaction->protocol = poller->plan->protocol;
+    memcpy(transaction->slave, slave_address[poller->bus][job->entry->slave], sizeof(transaction->slave));
+    transaction->address = modbus_reg_info[reg].address;
+    transaction->size = modbus_reg_info[reg].size;
+    transaction->rx_data = job->buffer;
+    transaction->complete = modbus_api_job_complete;
+    transaction->arg = job;
+    if(modbus_bus_submit(transaction) != ESP_OK)
+    {
+        transaction->status = MODBUS_STATUS_TIMEOUT;
+        modbus_api_job_complete(transaction);
+    }
+}
+
+/*!
+ * @brief  Handle reply, put to queue when all commands of the group are received
+ * @retval True when the job is finished
+ */
+static bool modbus_api_job_done(modbus_api_poller_t *poller, modbus_api_job_t *job)
+{
+    modbus_reg_id reg = job->data.start + job->step;
+    uint16_t length;
+
+    if(job->transaction.status != MODBUS_STATUS_OK)
+    {
+        return !modbus_api_job_retry(poller, job);
+    }
+
+    /* Data index = 12 (see the document), a short reply leaves the rest of the register zero */
+    length = MIN(job->transaction.rx_size - (MODBUS_FRAME_OVERHEAD + 2), modbus_reg_info[reg].size);
+    memcpy(&job->data.data[job->index], &job->buffer[MODBUS_FRAME_DATA_INDEX + 2], length);
+    memset(&job->data.data[job->index + length], 0, modbus_reg_info[reg].size - length);
+    job->index += modbus_reg_info[reg].size;
+
+    /* If read all register success, put to queue */
+    if(reg == job->data.stop)
+    {
+        ESP_LOGI(TAG, "Receive response from slave"ADDRSTR, ADDR2STR(slave_address[poller->bus][job->entry->slave]));
+        job->data.slave_id = job->entry->slave;
+        modbus_api_reading_put(poller, job->entry->slave, &job->data);
+        return true;
+    }
+
+    /* Next command */
+    job->step++;
+    job->retry = 0;
+    modbus_api_job_submit(poller, job);
+    return false;
+}
+#else
+/*!
+ * @brief  Build and submit transaction "step" of the job (one read of the group plan)
+ */
+static void modbus_api_job_submit(modbus_api_poller_t *poller, modbus_api_job_t *job)
+{
+    modbus_transaction_t *transaction = &job->transaction;
+    const modbus_read_t *read = &poller->plan->read[job->entry->group].read[job->step];
+
+    transaction->bus = poller->bus;
+    transaction->protocol = poller->plan->protocol;
+    transaction->slave[0] = slave_address[poller->bus][job->entry->slave];
+    transaction->address = read->address;
+    transaction->size = read->num_reg;
+    transaction->rx_data = job->buffer;
+    transaction->complete = modbus_api_job_complete;
+    transaction->arg = job;
+    if(modbus_bus_submit(transaction) != ESP_OK)
+    {
+        transaction->status = MODBUS_STATUS_TIMEOUT;
+        modbus_api_job_complete(transaction);
+    }
+}
+
+/*!
+ * @brief  Scatter reply into register slots, put to queue when all reads of the group are received
+ * @retval True when the job is finished
+ */
+static bool modbus_api_job_done(modbus_api_poller_t *poller, modbus_api_job_t *job)
+{
+    const modbus_read_plan_t *plan = &poller->plan->read[job->entry->group];
+    const modbus_read_t *read = &plan->read[job->step];
+    uint8_t *src;
+
+    if(job->transaction.status != MODBUS_STATUS_OK)
+    {
+        return !modbus_api_job_retry(poller, job);
+    }
+
+    /* Packet: slave_id - function id - byte count - data0 - data1... */
+    for(modbus_reg_id i = read->first; i <= read->last; i++)
+    {
+        src = &job->buffer[3 + RAW_LEN(modbus_reg_info[i].address - read->address)];
+        memcpy(&job->data.data[RAW_LEN(modbus_api_get_num_reg(job->data.start, i) - modbus_reg_info[i].size)],
+               src, RAW_LEN(modbus_reg_info[i].size));
+    }
+
+    /* If read all register success, put to queue */
+    if(job->step + 1 >= plan->count)
+    {
+        ESP_LOGI(TAG, "Receive response from slave %d", slave_address[poller->bus][job->entry->slave]);
+        job->data.slave_id = slave_address[poller->bus][job->entry->slave];
+        modbus_api_reading_put(poller, job->entry->slave, &job->data);
+        return true;
+    }
+
+    /* Next read */
+    job->step++;
+    job->retry = 0;
+    modbus_api_job_submit(poller, job);
+    return false;
+}
+#endif
+
+/*!
+ * @brief  Retry a failed transaction at once when the error is transient (CRC or malformed frame).
+ *         Timeout and exception are not retried, the slave is silent or has answered
+ * @retval True if the transaction is submitted again
+ */
+static bool modbus_api_job_retry(modbus_api_poller_t *poller, modbus_api_job_t *job)
+{
+    modbus_status_t status = job->transaction.status;
+
+    if(((status == MODBUS_STATUS_CRC_ERROR) || (status == MODBUS_STATUS_FRAME_ERROR)) && (job->retry < MODBUS_RETRY_MAX))
+    {
+        job->retry++;
+        ESP_LOGW(TAG, "Bus %d slave %d error %d, retry %d", poller->bus, job->entry->slave, status, job->retry);
+        modbus_api_job_submit(poller, job);
+        return true;
+    }
+    return false;
+}
+
+/*!
+ * @brief  Update slave health from a transaction result. Any answer reinstates the slave,
+ *         consecutive timeouts put it in quarantine with exponential backoff between probes
+ */
+static void modbus_api_health_update(modbus_api_poller_t *poller, modbus_api_job_t *job, TickType_t now)
+{
+    modbus_api_health_t *health = &poller->health[job->entry->slave];
+
+    health->probing = false;
+    if(job->transaction.status != MODBUS_STATUS_TIMEOUT)
     {
-        /* Read data from electric meter */
-        modbus_data.meter = ELECTRIC_METER;
-        modbus_data.start = MB_DATE_CMD;
-        modbus_data.stop = MB_DATE_CMD;
+        if(health->quarantined)
+        {
+            ESP_LOGI(TAG, "Bus %d slave %d is back", poller->bus, job->entry->slave);
+        }
+        health->timeouts = 0;
+        health->quarantined = false;
+        health->backoff = 0;
+        return;
+    }
 
-        memset(&modbus_data, 0, sizeof(modbus_data));
-        for(i = 0; i < slave_count; i++)
+    if(health->timeouts < UINT8_MAX)
+    {
+        health->timeouts++;
+    }
+    if(health->timeouts >= MODBUS_QUARANTINE_TIMEOUTS)
+    {
+        health->backoff = (health->backoff == 0) ? MODBUS_QUARANTINE_BACKOFF_MIN_MS : MIN(health->backoff * 2, MODBUS_QUARANTINE_BACKOFF_MAX_MS);
+        health->probe_time = now + pdMS_TO_TICKS(health->backoff);
+        if(!health->quarantined)
         {
-            index = 0;    /* Index of data */
-            result = false;
-            for(j = modbus_data.start; j <= modbus_data.stop; j++)
-            {
-                /* Read data from start to stop */
-                result = modbus_command_get_elec_registers(slave_address[i], modbus_reg_info[j].address, buffer, modbus_reg_info[j].size);
-                if(!result)
-                {
-                    break;
-                }
-                memcpy(&modbus_data.data[index], &buffer[12], modbus_reg_info[j].size);    /* Data index = 12 (see the document) */
-                index += modbus_reg_info[j].size;
-                vTaskDelay(MODBUS_RX_TIMEOUT_MS / portTICK_RATE_MS);    /* Delay before next*/
-            }
-            /* If read all register success, put to queue */
-            if(result)
-            {
-                ESP_LOGI(TAG, "Receive response from slave"ADDRSTR, ADDR2STR(slave_address[i]));
-                modbus_data.slave_id = i;
-                modbus_api_queue_put(&modbus_data);
-            }
+            ESP_LOGW(TAG, "Bus %d slave %d quarantined", poller->bus, job->entry->slave);
         }
-        vTaskDelay(MODBUS_TIME_BETWEEN_POLLING_MS / portTICK_RATE_MS);
+        health->quarantined = true;
     }
 }
-#else
-static void modbus_api_task(void *arg)
+
+/******************************************************************************/
+
+/*!
+ * @brief  Most overdue entry, earliest deadline first. On a tie the slave served longest ago goes first.
+ *         A quarantined slave is skipped until its probe time, then one entry is read as probe
+ * @param  [out] Time until the next deadline when nothing is due
+ * @retval Entry to read now or NULL
+ */
+static modbus_api_entry_t* modbus_api_schedule_next(modbus_api_poller_t *poller, TickType_t now, TickType_t *wait)
 {
-    uint32_t i;
-    bool result;
-    modbus_data_t modbus_data;
-    uint16_t num_reg;
-    
-    while(1)
+    const modbus_plan_t *plan = poller->plan;
+    modbus_api_entry_t *best = NULL;
+    modbus_api_entry_t *entry;
+    modbus_api_health_t *health;
+    int32_t overdue, best_overdue = 0;
+    uint32_t num_entry = plan->slave_count * MODBUS_GROUP_COUNT;
+
+    *wait = portMAX_DELAY;
+    for(uint32_t i = 0; i < num_entry; i++)
     {
-        /* Read data from water meter */
-        modbus_data.meter = WATER_METER;
-        modbus_data.start = MB_POWER_RECEIVE_WH;
-        modbus_data.stop = MB_POWER_RECEIVE_WH;
-        num_reg = modbus_api_get_num_reg(modbus_data.start, modbus_data.stop);    /* Read from reg_1 to reg_2 */
-        for(i = 0; i < slave_count; i++)
+        entry = &poller->entry[plan->slave[i / MODBUS_GROUP_COUNT] * MODBUS_GROUP_COUNT + (i % MODBUS_GROUP_COUNT)];
+        if(entry->busy || (plan->group[entry->group].period == 0))
+        {
+            continue;
+        }
+
+        health = &poller->health[entry->slave];
+        if(health->quarantined)
         {
-            /* Read from each slave */
-            result = modbus_command_get_water_registers(slave_address[i], modbus_reg_info[modbus_data.start].address, num_reg, modbus_data.data);
-            if(result)
+            if(health->probing)
             {
-                /* Put to queue */
-                ESP_LOGI(TAG, "Receive response from slave %d", slave_address[i]);
-                modbus_data.slave_id = slave_address[i];
-                modbus_api_queue_put(&modbus_data);
-                vTaskDelay(MODBUS_RX_TIMEOUT_MS / portTICK_RATE_MS);    /* Delay before next*/
+                continue;
             }
+            if((int32_t)(now - health->probe_time) < 0)
+            {
+                *wait = MIN(*wait, health->probe_time - now);
+                continue;
+            }
+        }
+
+        overdue = (int32_t)(now - entry->deadline);
+        if(overdue < 0)
+        {
+            *wait = MIN(*wait, (TickType_t)(-overdue));
+            continue;
+        }
+
+        if((best == NULL) || (overdue > best_overdue) ||
+           ((overdue == best_overdue) &&
+            ((int32_t)(poller->slave_served[entry->slave] - poller->slave_served[best->slave]) < 0)))
+        {
+            best = entry;
+            best_overdue = overdue;
         }
-        vTaskDelay(MODBUS_TIME_BETWEEN_POLLING_MS / portTICK_RATE_MS);
     }
+    return best;
 }
-#endif
 
+/*!
+ * @brief  Start reading an entry, account lateness and jitter of its group
+ */
+static void modbus_api_schedule_dispatch(modbus_api_poller_t *poller, modbus_api_job_t *job, modbus_api_entry_t *entry, TickType_t now)
+{
+    modbus_group_stats_t *stats = &poller->stats[entry->group];
+    uint32_t lateness = (now - entry->deadline) * portTICK_RATE_MS;
+    uint32_t delta = (lateness > stats->lateness_last) ? (lateness - stats->lateness_last) : (stats->lateness_last - lateness);
+
+    /* Lateness and jitter, moving average over 8 samples */
+    stats->count++;
+    stats->lateness_avg = stats->lateness_avg - (stats->lateness_avg >> 3) + (lateness >> 3);
+    stats->lateness_max = MAX(stats->lateness_max, lateness);
+    stats->jitter = stats->jitter - (stats->jitter >> 3) + (delta >> 3);
+    stats->lateness_last = lateness;
 
-/******************************************************************************/
+    entry->busy = true;
+    poller->slave_served[entry->slave] = now;
+    if(poller->health[entry->slave].quarantined)
+    {
+        poller->health[entry->slave].probing = true;
+    }
+
+    job->entry = entry;
+    job->step = 0;
+    job->retry = 0;
+    job->index = 0;
+    job->data.meter = MODBUS_METER_TYPE;
+    job->data.bus = poller->bus;
+    job->data.start = poller->plan->group[entry->group].first;
+    job->data.stop = poller->plan->group[entry->group].last;
+    modbus_api_job_submit(poller, job);
+}
 
 /*!
- * @brief  Add registers info to json array
+ * @brief  Entry is read, set next deadline. Keep the period phase unless more than one period late
  */
-#ifdef ELECTRIC_METER_USED
-/* year, month, day, day in week*/
-void modbus_data_to_date(uint8_t *data, char* date_str)
+static void modbus_api_schedule_done(modbus_api_poller_t *poller, modbus_api_entry_t *entry, TickType_t now)
 {
-    uint32_t year = data[3] + 2000;
-    uint8_t i = (data[0] < 7) ? data[0] : 7;
-    sprintf(date_str, "%s, %02d/%02d/%02d", day_in_week[i], data[2], data[1], year);
+    TickType_t period = pdMS_TO_TICKS(poller->plan->group[entry->group].period);
+
+    entry->busy = false;
+    entry->deadline += period;
+    if((int32_t)(now - entry->deadline) > (int32_t)period)
+    {
+        entry->deadline = now;
+    }
 }
 
-/* hh_mm_ss */
-void modbus_data_to_time(uint8_t *data, char* date_str)
+/*!
+ * @brief  Log lateness and jitter of each group
+ */
+static void modbus_api_schedule_report(modbus_api_poller_t *poller)
 {
-    sprintf(date_str, "%d:%d:%d", data[0], data[1], data[2]);
+    ESP_LOGI(TAG, "Bus %d plan v%u: %u slaves", poller->bus, poller->plan->version, poller->plan->slave_count);
+    for(modbus_group_id i = 0; i < MODBUS_GROUP_COUNT; i++)
+    {
+        modbus_group_stats_t *stats = &poller->stats[i];
+        ESP_LOGI(TAG, "Bus %d %s: %u reads, lateness avg %ums max %ums, jitter %ums", poller->bus, modbus_group_info[i].name,
+                 stats->count, stats->lateness_avg, stats->lateness_max, stats->jitter);
+    }
+
+    modbus_ring_stats_t ring;
+    modbus_ring_get_stats(&poller->ring, &ring);
+    ESP_LOGI(TAG, "Bus %d readings: %u written, %u overwritten, %u dropped, high water %u/%u, throttled %u", poller->bus,
+             ring.written, ring.overwritten, ring.dropped, ring.high_water, MODBUS_RING_SIZE - 1, poller->throttled);
+#if (MODBUS_REPORT_BY_EXCEPTION)
+    modbus_report_stats_t *report = &poller->report.stats;
+    ESP_LOGI(TAG, "Bus %d report: %u of %u readings suppressed, %u of %u registers reported, %u refreshed", poller->bus,
+             report->suppressed, report->readings, report->regs_reported, report->regs_checked, report->regs_refreshed);
+#endif
 }
 
-/* Total - Tariff 1 - Tariff 2 -Tariff 3 - Tariff 4 */
-void modbus_data_to_energy(uint8_t *data, char* date_str)
+/*!
+ * @brief  Load slave list of a bus from NVS
+ * @retval True when a list is stored
+ */
+static bool modbus_api_slave_load(uint8_t bus)
 {
-    uint32_t *u32_value = (uint32_t*) data;
-    sprintf(date_str, "total %u, tariff 1 %u, tariff 2 %u, tariff 3 %u, tariff 4 %u", u32_value[0], u32_value[1], u32_value[2], u32_value[3], u32_value[4]);
+    nvs_handle_t handle;
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    size_t size = sizeof(slave_address[bus]);
+    esp_err_t err;
+
+    if(nvs_open(MODBUS_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+    {
+        return false;
+    }
+    snprintf(key, sizeof(key), "slave%d", bus);
+    err = nvs_get_blob(handle, key, slave_address[bus], &size);
+    nvs_close(handle);
+    if(err != ESP_OK)
+    {
+        return false;
+    }
+    slave_count[bus] = size / MODBUS_SLAVE_ADDRESS_SIZE;
+    ESP_LOGI(TAG, "Bus %d: %u slaves loaded", bus, slave_count[bus]);
+    return true;
 }
 
-/* Unclear */
-void modbus_data_to_day_table(uint8_t *data, char* date_str)
+/*!
+ * @brief  Store slave list of a bus to NVS
+ */
+static void modbus_api_slave_save(uint8_t bus)
 {
-    sprintf(date_str, "loadding...");
+    nvs_handle_t handle;
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    esp_err_t err;
+
+    err = nvs_open(MODBUS_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if(err == ESP_OK)
+    {
+        snprintf(key, sizeof(key), "slave%d", bus);
+        err = nvs_set_blob(handle, key, slave_address[bus], slave_count[bus] * MODBUS_SLAVE_ADDRESS_SIZE);
+        if(err == ESP_OK)
+        {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if(err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Save slave list of bus %d fail %d", bus, err);
+    }
 }
 
-/* Cycle - Null - Show bits */
-void modbus_data_to_show_mode(uint8_t *data, char* date_str)
+/*!
+ * @brief  Index of a slave in the slave list of a bus
+ * @retval Index, -1 if not listed
+ */
+static int32_t modbus_api_slave_find(uint8_t bus, const uint8_t *address)
 {
-    sprintf(date_str, "cycle %d", data[0]);
+    const uint8_t *table = (const uint8_t*) slave_address[bus];
+
+    for(uint32_t i = 0; i < slave_count[bus]; i++)
+    {
+        if(memcmp(&table[i * MODBUS_SLAVE_ADDRESS_SIZE], address, MODBUS_SLAVE_ADDRESS_SIZE) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
 }
 
-/* Version - Type - Status */
-void modbus_data_to_version(uint8_t *data, char* date_str)
+/*!
+ * @brief  Index of a slave in the slave list of a bus, the slave is appended if not listed.
+ *         Called with plan_lock held
+ * @retval Index, -1 if the list is full
+ */
+static int32_t modbus_api_slave_add(uint8_t bus, const uint8_t *address)
 {
-    sprintf(date_str, "version %d, type %d, status %d", data[0], data[1], data[2]);
+    int32_t index = modbus_api_slave_find(bus, address);
+
+    if((index >= 0) || (slave_count[bus] >= MAX_SLAVE_ID))
+    {
+        return index;
+    }
+    index = slave_count[bus];
+    memcpy(&((uint8_t*) slave_address[bus])[index * MODBUS_SLAVE_ADDRESS_SIZE], address, MODBUS_SLAVE_ADDRESS_SIZE);
+    /* Address is in place before other tasks see the count */
+    atomic_thread_fence(memory_order_release);
+    slave_count[bus] = index + 1;
+    return index;
+}
+
+/*!
+ * @brief  Scan the bus and poll the new slaves: they are added to the slave list and to a new plan,
+ *         taken at once. Called by the poller task when no job is in flight
+ */
+static void modbus_api_discover_run(modbus_api_poller_t *poller)
+{
+    uint8_t found[MAX_SLAVE_ID * MODBUS_SLAVE_ADDRESS_SIZE];
+    uint32_t listed = slave_count[poller->bus];
+    uint32_t num_found, num_new = 0;
+    modbus_plan_t *plan;
+    TickType_t start;
+    int32_t index;
+    bool polled;
+
+    poller->discover = false;
+    ESP_LOGW(TAG, "Bus %d: polling paused for discovery", poller->bus);
+    start = xTaskGetTickCount();
+    num_found = modbus_discovery_scan(poller->bus, found, MAX_SLAVE_ID);
+    ESP_LOGW(TAG, "Bus %d: polling resumed, paused %u ms", poller->bus, (xTaskGetTickCount() - start) * portTICK_RATE_MS);
+
+    xSemaphoreTake(plan_lock, portMAX_DELAY);
+    plan = modbus_plan_edit(&poller->store);
+    for(uint32_t i = 0; i < num_found; i++)
+    {
+        index = modbus_api_slave_add(poller->bus, &found[i * MODBUS_SLAVE_ADDRESS_SIZE]);
+        if(index < 0)
+        {
+            break;
+        }
+        polled = false;
+        for(uint32_t j = 0; j < plan->slave_count; j++)
+        {
+            polled |= (plan->slave[j] == index);
+        }
+        if(!polled)
+        {
+            plan->slave[plan->slave_count++] = index;
+            num_new++;
+        }
+    }
+    if(num_new > 0)
+    {
+        modbus_plan_publish(&poller->store);
+    }
+    if(slave_count[poller->bus] != listed)
+    {
+        modbus_api_slave_save(poller->bus);
+    }
+    xSemaphoreGive(plan_lock);
+
+    if(num_new > 0)
+    {
+        ESP_LOGI(TAG, "Bus %d: %u new slaves", poller->bus, num_new);
+    }
 }
 
-/* Meter constant */
-void modbus_data_to_constant(uint8_t *data, char* date_str)
+/******************************************************************************/
+
+/*!
+ * @brief  Build the reads of each group polled
+ * @retval False if a group has no register to report or needs more than MODBUS_READ_PLAN_SIZE reads
+ */
+static bool modbus_api_plan_reads(modbus_plan_t *plan)
 {
-    sprintf(date_str, "constant %02X %02X %02X", data[0], data[1], data[2]);
+    bool result = true;
+
+#ifndef ELECTRIC_METER_USED
+    for(modbus_group_id i = 0; i < MODBUS_GROUP_COUNT; i++)
+    {
+        plan->read[i].count = 0;
+        if((plan->group[i].period > 0) &&
+           (modbus_api_build_read_plan(plan->group[i].first, plan->group[i].last, plan->gap, &plan->read[i]) == 0))
+        {
+            result = false;
+        }
+    }
+#endif
+    return result;
 }
 
-/* Each byte was added MODBUS_DATA_ADD_BYTE */
-void modbus_parse_raw_data(uint8_t *data, uint16_t length)
+/*!
+ * @brief  Plan at boot: every listed slave, groups of the register table
+ */
+static void modbus_api_plan_default(uint8_t bus, modbus_plan_t *plan)
 {
-    for(uint16_t i = 0; i < length; i++)
+    memset(plan, 0, sizeof(modbus_plan_t));
+    plan->version = 1;
+#ifdef ELECTRIC_METER_USED
+    plan->protocol = MODBUS_PROTOCOL_ELEC;
+#else
+    plan->protocol = MODBUS_PROTOCOL_RTU;
+#endif
+    plan->slave_count = slave_count[bus];
+    for(uint32_t i = 0; i < slave_count[bus]; i++)
+    {
+        plan->slave[i] = i;
+    }
+    plan->gap = MODBUS_READ_GAP_MAX;
+    for(modbus_group_id i = 0; i < MODBUS_GROUP_COUNT; i++)
     {
-        data[i] = data[i] - MODBUS_DATA_ADD_BYTE;
+        plan->group[i].first = modbus_group_info[i].first;
+        plan->group[i].last = modbus_group_info[i].last;
+        plan->group[i].period = modbus_group_info[i].period;
+    }
+    if(!modbus_api_plan_reads(plan))
+    {
+#ifndef ELECTRIC_METER_USED
+        for(modbus_group_id i = 0; i < MODBUS_GROUP_COUNT; i++)
+        {
+            if(plan->read[i].count == 0)
+            {
+                ESP_LOGE(TAG, "Group %s is not polled", modbus_group_info[i].name);
+                plan->group[i].period = 0;
+            }
+        }
+#endif
     }
 }
 
-static void modbus_api_add_reg_data_to_json(cJSON* root, const modbus_reg_info_t *table, modbus_data_t *modbus_data)
+/*!
+ * @brief  Take a published plan, when no job is in flight. Slaves new to the plan are due now with a clean health,
+ *         the others keep their schedule, brought forward when the new period is shorter than the time left
+ */
+static void modbus_api_plan_swap(modbus_api_poller_t *poller, TickType_t now)
 {
-    uint16_t i;
-    char data_str[128];
-    uint8_t *data = modbus_data->data;
-    
-    for(i = modbus_data->start; i <= modbus_data->stop; i++)
+    const modbus_plan_t *plan;
+    bool polled[MAX_SLAVE_ID] = {false};
+    uint32_t period[MODBUS_GROUP_COUNT];
+    modbus_api_entry_t *entry;
+    uint8_t slave;
+
+    if(!modbus_plan_is_pending(&poller->store))
+    {
+        return;
+    }
+    /* Old plan goes back to the builder with the take, what is needed of it is copied first */
+    for(uint32_t i = 0; i < poller->plan->slave_count; i++)
+    {
+        polled[poller->plan->slave[i]] = true;
+    }
+    for(modbus_group_id i = 0; i < MODBUS_GROUP_COUNT; i++)
+    {
+        period[i] = poller->plan->group[i].period;
+    }
+    plan = modbus_plan_take(&poller->store);
+
+    for(uint32_t i = 0; i < plan->slave_count; i++)
     {
-        if(table[i].flag & REPORT)
+        slave = plan->slave[i];
+        if(!polled[slave])
         {
-            cJSON* object = cJSON_CreateObject();
-            modbus_parse_raw_data(data, table[i].size);
-            modbus_data_convert[i](data, data_str);
-            cJSON_AddStringToObject(object, JSON_NAME_KEY, table[i].name);
-            cJSON_AddStringToObject(object, JSON_VALUE_KEY, data_str);
-            cJSON_AddItemToArray(root, object);
+            memset(&poller->health[slave], 0, sizeof(modbus_api_health_t));
+            poller->slave_served[slave] = now;
+        }
+        for(modbus_group_id group = 0; group < MODBUS_GROUP_COUNT; group++)
+        {
+            entry = &poller->entry[slave * MODBUS_GROUP_COUNT + group];
+            if(!polled[slave] || (period[group] == 0))
+            {
+                entry->deadline = now;
+            }
+            else if((int32_t)(entry->deadline - now) > (int32_t) pdMS_TO_TICKS(plan->group[group].period))
+            {
+                entry->deadline = now + pdMS_TO_TICKS(plan->group[group].period);
+            }
         }
-        /* Next data */
-        data += table[i].size;
     }
+    poller->plan = plan;
+    poller->plan_version = plan->version;
+    ESP_LOGI(TAG, "Bus %d: plan v%u, %u slaves", poller->bus, plan->version, plan->slave_count);
 }
-#else
-static void modbus_api_add_reg_data_to_json(cJSON* root, const modbus_reg_info_t *table, modbus_data_t *modbus_data)
+
+/*!
+ * @brief  Task for get data from slave, one task per bus. Read the most overdue (slave, group) first,
+ *         keep MODBUS_TRANSACTION_DEPTH groups on the bus so a reply is handled while the next request is on the wire
+ */
+static void modbus_api_task(void *arg)
 {
-    uint16_t i;
-    uint32_t *value = (uint32_t*) &modbus_data->data[3];    /* Packet: slave_id - function id - byte count - data0 - data1... */
-    char addr_str[8];
+    modbus_api_poller_t *poller = (modbus_api_poller_t*) arg;
+    modbus_api_job_t *job;
+    modbus_api_job_t *free_job[MODBUS_TRANSACTION_DEPTH];
+    modbus_api_entry_t *entry;
+    uint32_t num_free = 0;
+    bool throttle;
+    TickType_t now, wait;
+    TickType_t report = xTaskGetTickCount();
 
-    for(i = modbus_data->start; i <= modbus_data->stop; i++)
+    /* All entries are due at start */
+    now = xTaskGetTickCount();
+    for(uint32_t i = 0; i < MAX_SLAVE_ID * MODBUS_GROUP_COUNT; i++)
     {
-        if(table[i].flag & REPORT)
+        poller->entry[i].slave = i / MODBUS_GROUP_COUNT;
+        poller->entry[i].group = i % MODBUS_GROUP_COUNT;
+        poller->entry[i].deadline = now;
+    }
+    for(uint32_t i = 0; i < MODBUS_TRANSACTION_DEPTH; i++)
+    {
+        free_job[num_free++] = &poller->job[i];
+    }
+
+    while(1)
+    {
+        /* Dispatch due entries while a job is free */
+        now = xTaskGetTickCount();
+        wait = portMAX_DELAY;
+        if(num_free == MODBUS_TRANSACTION_DEPTH)
+        {
+            if(poller->discover)
+            {
+                modbus_api_discover_run(poller);
+                now = xTaskGetTickCount();
+            }
+            /* Cycle boundary, nothing of the active plan is in use */
+            modbus_api_plan_swap(poller, now);
+        }
+        /* Reader is behind: hold new reads back rather than overwrite readings not published yet */
+        throttle = (modbus_ring_count(&poller->ring) >= MODBUS_RING_BACKPRESSURE);
+        if(throttle)
+        {
+            poller->throttled++;
+            wait = pdMS_TO_TICKS(MODBUS_BACKPRESSURE_WAIT_MS);
+        }
+        while((num_free > 0) && !poller->discover && !modbus_plan_is_pending(&poller->store) && !throttle)
+        {
+            entry = modbus_api_schedule_next(poller, now, &wait);
+            if(entry == NULL)
+            {
+                break;
+            }
+            modbus_api_schedule_dispatch(poller, free_job[--num_free], entry, now);
+        }
+
+        /* Wait for a reply, or for the next deadline when a job is free */
+        if(num_free == 0)
         {
-            cJSON* object = cJSON_CreateObject();
-            cJSON_AddStringToObject(object, JSON_NAME_KEY, table[i].name);
-            sprintf(addr_str, "0x%04X", table[i].address);
-            cJSON_AddStringToObject(object, JSON_ADDRESS_KEY, addr_str);
-            cJSON_AddNumberToObject(object, JSON_VALUE_KEY, *value++);
-            cJSON_AddItemToArray(root, object);
+            wait = portMAX_DELAY;
+        }
+        if((now - report) >= pdMS_TO_TICKS(MODBUS_SCHEDULE_REPORT_MS))
+        {
+            modbus_api_schedule_report(poller);
+            report = now;
+        }
+        if((xQueueReceive(poller->done_queue, &job, MIN(wait, pdMS_TO_TICKS(MODBUS_SCHEDULE_REPORT_MS))) == pdTRUE) &&
+           (job != NULL))
+        {
+            now = xTaskGetTickCount();
+            modbus_api_health_update(poller, job, now);
+            if(modbus_api_job_done(poller, job))
+            {
+                modbus_api_schedule_done(poller, job->entry, now);
+                free_job[num_free++] = job;
+            }
         }
     }
 }
+
+/******************************************************************************/
+
+/*!
+ * @brief  Address of the slave of a reading: meter address, or Modbus id
+ */
+static const uint8_t* modbus_api_slave_address(const modbus_data_t *modbus_data)
+{
+#ifdef ELECTRIC_METER_USED
+    return slave_address[modbus_data->bus][modbus_data->slave_id];
+#else
+    return &modbus_data->slave_id;
 #endif
+}
+
+/*!
+ * @brief  Convert modbus data to compact json, written into the buffer
+ */
+uint32_t modbus_api_data_to_json(const modbus_data_t *modbus_data, char *buffer, uint32_t size)
+{
+    return modbus_telemetry_to_json(modbus_data, modbus_api_slave_address(modbus_data), buffer, size);
+}
+
+/*!
+ * @brief  Convert modbus data to binary, written into the buffer
+ */
+uint32_t modbus_api_data_to_binary(const modbus_data_t *modbus_data, uint8_t *buffer, uint32_t size)
+{
+    return modbus_telemetry_to_binary(modbus_data, modbus_api_slave_address(modbus_data), buffer, size);
+}
+
+/******************************************************************************/
 
 /*!
- * @brief  Convert modbus data to json string
+ * @brief  Take the oldest reading, buses in turn
  */
-char* modbus_api_data_to_json(modbus_data_t *modbus_data)
+modbus_data_t* modbus_api_reading_acquire(void)
 {
-    cJSON* root = cJSON_CreateObject();
-    if(root == NULL)
+    static uint8_t next_bus = 0;
+    modbus_data_t *data;
+
+    for(uint8_t i = 0; i < MODBUS_BUS_COUNT; i++)
     {
-        ESP_LOGE(TAG, "Cannot create json root");
-        return NULL;
+        uint8_t bus = next_bus;
+        next_bus = (next_bus + 1) % MODBUS_BUS_COUNT;
+        data = (modbus_data_t*) modbus_ring_acquire(&modbus_poller[bus].ring);
+        if(data != NULL)
+        {
+            return data;
+        }
     }
+    return NULL;
+}
+
+/*!
+ * @brief  Give back a reading
+ */
+void modbus_api_reading_release(modbus_data_t *data)
+{
+    modbus_ring_release(&modbus_poller[data->bus].ring);
+}
+
+/*!
+ * @brief  Wait for a reading. Pollers notify the waiting task on each reading put, notifications
+ *         given while the reader was busy are counted, so no reading is missed between drains
+ */
+bool modbus_api_reading_wait(TickType_t wait)
+{
+    modbus_reader = xTaskGetCurrentTaskHandle();
+    return ulTaskNotifyTake(pdTRUE, wait) > 0;
+}
 
-    /* Add item to root */
-    cJSON_AddStringToObject(root, JSON_METER_TYPE_KEY, meter_type[modbus_data->meter]);
+/*!
+ * @brief  Size in byte of data of registers "start" to "stop"
+ */
+static uint16_t modbus_api_reading_data_size(modbus_reg_id start, modbus_reg_id stop)
+{
 #ifdef ELECTRIC_METER_USED
-    char slave_addr[32];
-    sprintf(slave_addr, ADDRSTR, ADDR2STR(slave_address[modbus_data->slave_id]));
-    cJSON_AddStringToObject(root, JSON_SLAVE_ID_KEY, slave_addr);
+    return modbus_api_get_num_reg(start, stop);
 #else
-    cJSON_AddNumberToObject(root, JSON_SLAVE_ID_KEY, modbus_data->slave_id);
+    return RAW_LEN(modbus_api_get_num_reg(start, stop));
 #endif
+}
+
+/*!
+ * @brief  Encode a reading in compact form, little endian
+ */
+uint16_t modbus_api_reading_encode(const modbus_data_t *data, uint8_t *buffer, uint16_t size)
+{
+    uint16_t length = modbus_api_reading_data_size(data->start, data->stop);
+
+    if((MODBUS_READING_HEADER_SIZE + length) > size)
+    {
+        return 0;
+    }
+    buffer[0] = data->meter;
+    buffer[1] = data->bus;
+    buffer[2] = data->slave_id;
+    buffer[3] = (uint8_t) data->start;
+    buffer[4] = (uint8_t) (data->start >> 8);
+    buffer[5] = (uint8_t) data->stop;
+    buffer[6] = (uint8_t) (data->stop >> 8);
+    buffer[7] = (uint8_t) data->time;
+    buffer[8] = (uint8_t) (data->time >> 8);
+    buffer[9] = (uint8_t) (data->time >> 16);
+    buffer[10] = (uint8_t) (data->time >> 24);
+    for(uint8_t i = 0; i < sizeof(data->report); i++)
+    {
+        buffer[11 + i] = (uint8_t) (data->report >> (i * 8));
+    }
+    memcpy(&buffer[MODBUS_READING_HEADER_SIZE], data->data, length);
+    return MODBUS_READING_HEADER_SIZE + length;
+}
 
-    cJSON* regs = cJSON_AddArrayToObject(root, JSON_REG_KEY);
-    if(regs != NULL)
+/*!
+ * @brief  Decode a reading in compact form
+ */
+bool modbus_api_reading_decode(modbus_data_t *data, const uint8_t *buffer, uint16_t length)
+{
+    if(length < MODBUS_READING_HEADER_SIZE)
     {
-        modbus_api_add_reg_data_to_json(regs, modbus_reg_info, modbus_data);
+        return false;
+    }
+    memset(data, 0, sizeof(modbus_data_t));
+    data->meter = buffer[0];
+    data->bus = buffer[1];
+    data->slave_id = buffer[2];
+    data->start = buffer[3] | (buffer[4] << 8);
+    data->stop = buffer[5] | (buffer[6] << 8);
+    data->time = buffer[7] | (buffer[8] << 8) | (buffer[9] << 16) | ((uint32_t) buffer[10] << 24);
+    for(uint8_t i = 0; i < sizeof(data->report); i++)
+    {
+        data->report |= (modbus_report_mask_t) buffer[11 + i] << (i * 8);
     }
 
-    /* Print json to string */
-    char* ret_val = cJSON_Print(root);
-    cJSON_Delete(root);
-    return ret_val;
+    /* Stored by another firmware or damaged */
+#ifdef ELECTRIC_METER_USED
+    if(data->slave_id >= MAX_SLAVE_ID)
+    {
+        return false;
+    }
+#endif
+    if((data->meter != MODBUS_METER_TYPE) || (data->bus >= MODBUS_BUS_COUNT) ||
+       (data->start > data->stop) || (data->stop >= (sizeof(modbus_reg_info) / sizeof(modbus_reg_info[0]))) ||
+       ((MODBUS_READING_HEADER_SIZE + modbus_api_reading_data_size(data->start, data->stop)) != length))
+    {
+        return false;
+    }
+    memcpy(data->data, &buffer[MODBUS_READING_HEADER_SIZE], length - MODBUS_READING_HEADER_SIZE);
+    return true;
 }
 
-/******************************************************************************/
+/*!
+ * @brief  Get reading ring statistics of a bus
+ */
+esp_err_t modbus_api_get_ring_stats(uint8_t bus, modbus_ring_stats_t *stats)
+{
+    if(bus >= MODBUS_BUS_COUNT)
+    {
+        return ESP_FAIL;
+    }
+    modbus_ring_get_stats(&modbus_poller[bus].ring, stats);
+    return ESP_OK;
+}
+
+/*!
+ * @brief  Get report statistics of a bus
+ */
+esp_err_t modbus_api_get_report_stats(uint8_t bus, modbus_report_stats_t *stats)
+{
+    if(bus >= MODBUS_BUS_COUNT)
+    {
+        return ESP_FAIL;
+    }
+#if (MODBUS_REPORT_BY_EXCEPTION)
+    memcpy(stats, &modbus_poller[bus].report.stats, sizeof(modbus_report_stats_t));
+#else
+    memset(stats, 0, sizeof(modbus_report_stats_t));
+#endif
+    return ESP_OK;
+}
 
 /*!
- * @brief  Get modbus data from queue
+ * @brief  Get schedule statistics of a poll group
  */
-esp_err_t modbus_api_queue_get(modbus_data_t *modbus_data)
+esp_err_t modbus_api_get_group_stats(uint8_t bus, modbus_group_id group, modbus_group_stats_t *stats)
 {
-    BaseType_t result = xQueueReceive(modbus_command_queue, modbus_data, pdMS_TO_TICKS(MODBUS_QUEUE_TIMEOUT_MS));
-    return (result == pdPASS) ? ESP_OK : ESP_FAIL;
+    if((bus >= MODBUS_BUS_COUNT) || (group >= MODBUS_GROUP_COUNT))
+    {
+        return ESP_FAIL;
+    }
+    memcpy(stats, &modbus_poller[bus].stats[group], sizeof(modbus_group_stats_t));
+    return ESP_OK;
 }
 
 /*!
- * @brief  Put modbus data into queue
+ * @brief  Build a plan from the latest one and a change, then publish it to the poller
  */
-esp_err_t modbus_api_queue_put(modbus_data_t *modbus_data)
+esp_err_t modbus_api_set_plan(const modbus_plan_change_t *change)
 {
-    if(modbus_command_queue != NULL)
+    modbus_api_poller_t *poller;
+    modbus_plan_t *plan;
+    modbus_api_job_t *wakeup = NULL;
+    uint32_t listed, missing = 0;
+    bool valid, polled;
+    int32_t index;
+
+    if(change->bus >= MODBUS_BUS_COUNT)
+    {
+        return ESP_FAIL;
+    }
+    poller = &modbus_poller[change->bus];
+
+    xSemaphoreTake(plan_lock, portMAX_DELAY);
+    listed = slave_count[change->bus];
+    plan = modbus_plan_edit(&poller->store);
+    if(change->fields & MODBUS_PLAN_GAP)
+    {
+        plan->gap = change->gap;
+    }
+    for(modbus_group_id i = 0; i < MODBUS_GROUP_COUNT; i++)
     {
-        BaseType_t result = xQueueSend(modbus_command_queue, modbus_data, pdMS_TO_TICKS(MODBUS_QUEUE_TIMEOUT_MS));
-        if(result == pdPASS)
+        if(change->period_set & (1UL << i))
         {
-            return ESP_OK;
+            plan->group[i].period = change->group[i].period;
         }
-        /* Drop oldest package */
-        if(result == errQUEUE_FULL)
+        if(change->range_set & (1UL << i))
         {
-            modbus_data_t tmp;
-            ESP_LOGI(TAG, "Queue is full. Drop oldest package");
-            xQueueReceive(modbus_command_queue, &tmp, pdMS_TO_TICKS(MODBUS_QUEUE_TIMEOUT_MS));
-            /* Put again */
-            result = xQueueSend(modbus_command_queue, modbus_data, pdMS_TO_TICKS(MODBUS_QUEUE_TIMEOUT_MS));
-            if(result == pdPASS)
+            plan->group[i].first = change->group[i].first;
+            plan->group[i].last = change->group[i].last;
+        }
+    }
+    valid = modbus_api_plan_reads(plan);
+
+    if(valid && (change->fields & MODBUS_PLAN_SLAVES))
+    {
+        /* Slaves not listed yet must all fit in the list, none is added otherwise */
+        for(uint32_t i = 0; i < change->slave_count; i++)
+        {
+            missing += (modbus_api_slave_find(change->bus, change->slave[i]) < 0) ? 1 : 0;
+        }
+        valid = (listed + missing <= MAX_SLAVE_ID);
+    }
+    if(valid && (change->fields & MODBUS_PLAN_SLAVES))
+    {
+        plan->slave_count = 0;
+        for(uint32_t i = 0; i < change->slave_count; i++)
+        {
+            index = modbus_api_slave_add(change->bus, change->slave[i]);
+            polled = false;
+            for(uint32_t j = 0; j < plan->slave_count; j++)
+            {
+                polled |= (plan->slave[j] == index);
+            }
+            if(!polled)
             {
-                return ESP_OK;
+                plan->slave[plan->slave_count++] = index;
             }
         }
+        if(slave_count[change->bus] != listed)
+        {
+            modbus_api_slave_save(change->bus);
+        }
     }
-    return ESP_FAIL;
+    if(valid)
+    {
+        modbus_plan_publish(&poller->store);
+        ESP_LOGI(TAG, "Bus %d: plan v%u published", change->bus, plan->version);
+    }
+    xSemaphoreGive(plan_lock);
+
+    if(!valid)
+    {
+        ESP_LOGE(TAG, "Bus %d: plan refused, a group has no register to report or too many reads, or too many slaves",
+                 change->bus);
+        return ESP_FAIL;
+    }
+    /* Wake the poller up if idle, it takes the plan when its jobs are done */
+    xQueueSend(poller->done_queue, &wakeup, 0);
+    return ESP_OK;
+}
+
+/*!
+ * @brief  Get the version of the plan in use
+ */
+uint32_t modbus_api_get_plan_version(uint8_t bus)
+{
+    return (bus < MODBUS_BUS_COUNT) ? modbus_poller[bus].plan_version : 0;
 }
 
 /*!
- * @brief  Set slave info
+ * @brief  Write a register or command of a slave
  */
-void modbus_api_set_slave(uint8_t *slave_id, uint8_t num_slave)
+esp_err_t modbus_api_write(uint8_t bus, uint8_t slave, modbus_reg_id reg, const uint8_t *data, modbus_write_complete_t complete, void *arg)
 {
-    slave_count = num_slave;
+    modbus_write_t write;
+    uint16_t length;
+
+    if((bus >= MODBUS_BUS_COUNT) || (slave >= slave_count[bus]) || (reg >= sizeof(modbus_reg_info) / sizeof(modbus_reg_info[0])))
+    {
+        return ESP_FAIL;
+    }
+
+    memset(&write, 0, sizeof(write));
+    write.bus = bus;
+    write.address = modbus_reg_info[reg].address;
+    write.size = modbus_reg_info[reg].size;
+    write.complete = complete;
+    write.arg = arg;
 #ifdef ELECTRIC_METER_USED
-    memcpy(slave_address, slave_id, slave_count * 6);
+    write.protocol = MODBUS_PROTOCOL_ELEC;
+    memcpy(write.slave, slave_address[bus][slave], sizeof(write.slave));
+    xSemaphoreTake(plan_lock, portMAX_DELAY);
+    memcpy(write.password, slave_password_set[bus][slave] ? slave_password[bus][slave] : default_password, MODBUS_PASSWORD_SIZE);
+    xSemaphoreGive(plan_lock);
+    length = write.size;
 #else
-    memcpy(slave_address, slave_id, slave_count);
+    write.protocol = MODBUS_PROTOCOL_RTU;
+    write.slave[0] = slave_address[bus][slave];
+    length = RAW_LEN(write.size);
 #endif
+    if(length > MODBUS_WRITE_MAX_SIZE)
+    {
+        return ESP_FAIL;
+    }
+    memcpy(write.data, data, length);
+    return modbus_bus_write(&write);
+}
+
+/*!
+ * @brief  Set the write password of an electric meter
+ */
+esp_err_t modbus_api_set_password(uint8_t bus, uint8_t slave, const uint8_t *password)
+{
+#ifdef ELECTRIC_METER_USED
+    if((bus >= MODBUS_BUS_COUNT) || (slave >= slave_count[bus]))
+    {
+        return ESP_FAIL;
+    }
+
+    xSemaphoreTake(plan_lock, portMAX_DELAY);
+    slave_password_set[bus][slave] = (password != NULL);
+    if(password != NULL)
+    {
+        memcpy(slave_password[bus][slave], password, MODBUS_PASSWORD_SIZE);
+    }
+    xSemaphoreGive(plan_lock);
+    return ESP_OK;
+#else
+    return ESP_FAIL;
+#endif
+}
+
+/*!
+ * @brief  Scan a bus for new slaves
+ */
+esp_err_t modbus_api_discover(uint8_t bus)
+{
+    if(bus >= MODBUS_BUS_COUNT)
+    {
+        return ESP_FAIL;
+    }
+    modbus_poller[bus].discover = true;
+    return ESP_OK;
 }
 
 /*!
@@ -364,30 +1330,43 @@ void modbus_api_set_slave(uint8_t *slave_id, uint8_t num_slave)
  */
 void modbus_api_init(void)
 {
-    /* Modbus command initialization */
-    modbus_command_init();
-
-    /* Creat modbus command queue */
-    modbus_command_queue = xQueueCreate(MODBUS_QUEUE_SIZE, sizeof(modbus_data_t));
-    if(modbus_command_queue == NULL)
+    /* Modbus bus initialization */
+    modbus_bus_init();
+    plan_lock = xSemaphoreCreateMutex();
+    if(plan_lock == NULL)
     {
-        ESP_LOGE(TAG, "Create modbus queue fail");
+        ESP_LOGE(TAG, "Create plan lock fail");
         return;
     }
 
-    /* Create task for modbus get data */
-    BaseType_t result = xTaskCreate(modbus_api_task, MODBUS_TASK_NAME, MODBUS_TASK_SIZE, NULL, MODBUS_TASK_PRIORITY, NULL);
-    if (result != pdPASS) {
-        ESP_LOGE(TAG, "Create modbus_api task fail %d", result);
-    }
+    /* Create one poller task per bus, on the core of its bus task */
+    char name[configMAX_TASK_NAME_LEN];
+    modbus_plan_t plan;
+    for(uint8_t i = 0; i < MODBUS_BUS_COUNT; i++)
+    {
+        modbus_poller[i].bus = i;
+        modbus_ring_init(&modbus_poller[i].ring, modbus_poller[i].reading, sizeof(modbus_data_t), MODBUS_RING_SIZE);
+        if(!modbus_api_slave_load(i))
+        {
+            modbus_poller[i].discover = MODBUS_DISCOVERY_AT_BOOT;
+        }
+        modbus_api_plan_default(i, &plan);
+        modbus_plan_store_init(&modbus_poller[i].store, &plan);
+        modbus_poller[i].plan = modbus_plan_active(&modbus_poller[i].store);
+        modbus_poller[i].plan_version = plan.version;
+        /* One more for the wakeup on a new plan */
+        modbus_poller[i].done_queue = xQueueCreate(MODBUS_TRANSACTION_DEPTH + 1, sizeof(modbus_api_job_t*));
+        if(modbus_poller[i].done_queue == NULL)
+        {
+            ESP_LOGE(TAG, "Create job queue fail");
+            return;
+        }
 
-#ifdef ELECTRIC_METER_USED
-    modbus_data_convert[MB_DATE_CMD] = modbus_data_to_date;
-    modbus_data_convert[MB_TIME_CMD] = modbus_data_to_time;
-    modbus_data_convert[MB_ENERGY_CMD] = modbus_data_to_energy;
-    modbus_data_convert[MB_SHOW_MODE_CMD] = modbus_data_to_show_mode;
-    modbus_data_convert[MB_VERSION_CMD] = modbus_data_to_version;
-    modbus_data_convert[MB_CONSTANT_CMD] = modbus_data_to_constant;
-    modbus_data_convert[MB_DAY_TABLE_CMD] = modbus_data_to_day_table;
-#endif
+        snprintf(name, sizeof(name), "%s%d", MODBUS_TASK_NAME, i);
+        BaseType_t result = xTaskCreatePinnedToCore(modbus_api_task, name, MODBUS_TASK_SIZE, &modbus_poller[i],
+                                                    MODBUS_TASK_PRIORITY, NULL, modbus_bus_get_config(i)->core);
+        if (result != pdPASS) {
+            ESP_LOGE(TAG, "Create modbus_api task %d fail %d", i, result);
+        }
+    }
 }
\ No newline at end of file
@@ -14,8 +14,12 @@
 /******************************************************************************/
 
 #include <stdint.h>
-#include <cJSON.h>
 #include "modbus_table.h"
+#include "modbus_data.h"
+#include "modbus_bus.h"
+#include "modbus_ring.h"
+#include "modbus_report.h"
+#include "modbus_plan.h"
 
 /******************************************************************************/
 /*                     EXPORTED TYPES and DEFINITIONS                         */
@@ -26,21 +30,17 @@
 #define MAX_SLAVE_ID                                  32
 #endif
 
-typedef uint8_t meter_type_t;
-enum {
-    ELECTRIC_METER = 0,
-    WATER_METER,
-    METER_COUNT
-};
-
+/*!
+ * @brief  Schedule statistics of a poll group, time in ms
+ */
 typedef struct
 {
-    meter_type_t meter;
-    uint8_t slave_id;
-    modbus_reg_id start;
-    modbus_reg_id stop;
-    uint8_t data[MODBUS_COMMAND_MAX_SIZE];
-} modbus_data_t;
+    uint32_t count;                                   /* Number of reads */
+    uint32_t lateness_avg;                            /* Time from deadline to dispatch, moving average */
+    uint32_t lateness_max;
+    uint32_t lateness_last;
+    uint32_t jitter;                                  /* Change of lateness between two reads, moving average */
+} modbus_group_stats_t;
 
 
 /******************************************************************************/
@@ -60,27 +60,114 @@ typedef struct
 /******************************************************************************/
 
 /*!
- * @brief  Get modbus data from queue
- * @param  [out] Data to store output
+ * @brief  Take the oldest reading, read it in place. Only one task may take readings
+ * @param  None
+ * @retval Reading, NULL if none. Must be given back with modbus_api_reading_release()
+ */
+modbus_data_t* modbus_api_reading_acquire(void);
+
+/*!
+ * @brief  Give back the reading taken by modbus_api_reading_acquire()
+ * @param  Reading
+ * @retval None
+ */
+void modbus_api_reading_release(modbus_data_t *data);
+
+/*!
+ * @brief  Block until a reading is put on any bus. Called by the task that takes readings, before it drains them
+ * @param  Longest wait in ticks, portMAX_DELAY to wait forever
+ * @retval True if readings were put since the last call, false on timeout
+ */
+bool modbus_api_reading_wait(TickType_t wait);
+
+/*!
+ * @brief  Encode a reading in compact form, to store it
+ * @param  Reading
+ *         [out] Buffer and its size
+ * @retval Encoded length, 0 if buffer is too small
+ */
+uint16_t modbus_api_reading_encode(const modbus_data_t *data, uint8_t *buffer, uint16_t size);
+
+/*!
+ * @brief  Decode a reading encoded by modbus_api_reading_encode()
+ * @param  [out] Reading
+ *         Encoded reading and its length
+ * @retval True if success
+ */
+bool modbus_api_reading_decode(modbus_data_t *data, const uint8_t *buffer, uint16_t length);
+
+/*!
+ * @brief  Get reading ring statistics of a bus
+ * @param  Bus index
+ *         [out] Statistics
  * @retval ESP_OK if success
- *         ESP_FAIL if fail
+ *         ESP_FAIL if bus is invalid
  */
-esp_err_t modbus_api_queue_get(modbus_data_t *modbus_data);
+esp_err_t modbus_api_get_ring_stats(uint8_t bus, modbus_ring_stats_t *stats);
 
 /*!
- * @brief  Put modbus data into queue
- * @param  [in] Data to put into queue
+ * @brief  Get report-by-exception statistics of a bus
+ * @param  Bus index
+ *         [out] Statistics, all 0 when MODBUS_REPORT_BY_EXCEPTION is off
  * @retval ESP_OK if success
- *         ESP_FAIL if fail
+ *         ESP_FAIL if bus is invalid
  */
-esp_err_t modbus_api_queue_put(modbus_data_t *modbus_data);
+esp_err_t modbus_api_get_report_stats(uint8_t bus, modbus_report_stats_t *stats);
 
 /*!
- * @brief  Set slave info
- * @param  Slave address and number of slaves
- * @retval None
+ * @brief  Get schedule statistics of a poll group
+ * @param  Bus index, group id
+ *         [out] Statistics
+ * @retval ESP_OK if success
+ *         ESP_FAIL if bus or group is invalid
  */
-void modbus_api_set_slave(uint8_t *slave_id, uint8_t num_slave);
+esp_err_t modbus_api_get_group_stats(uint8_t bus, modbus_group_id group, modbus_group_stats_t *stats);
+
+/*!
+ * @brief  Change what a bus polls: slaves, periods and registers of the groups. A new plan is built from the latest
+ *         one and the poller takes it between two reads, the plan in use is never changed. New slaves are added to
+ *         the slave list of the bus and stored in NVS
+ * @param  Change, see modbus_plan_parse()
+ * @retval ESP_OK if published
+ *         ESP_FAIL if bus is invalid, a group polled has no register to report or needs more than
+ *         MODBUS_READ_PLAN_SIZE reads, or the slave list is full
+ */
+esp_err_t modbus_api_set_plan(const modbus_plan_change_t *change);
+
+/*!
+ * @brief  Get the version of the plan a bus polls with, 1 at boot
+ * @param  Bus index
+ * @retval Version, 0 if bus is invalid
+ */
+uint32_t modbus_api_get_plan_version(uint8_t bus);
+
+/*!
+ * @brief  Write a register (water meter) or command (electric meter) of a slave, e.g. power relay or clock
+ * @param  Bus index, index of slave in the slave list of the bus, register id
+ *         Data: register values high byte first, or command data in BCD before adding 0x33
+ *         Called from bus task with the result, may be NULL, and its context
+ * @retval ESP_OK if queued
+ *         ESP_FAIL if parameter is invalid or bus queue is full
+ */
+esp_err_t modbus_api_write(uint8_t bus, uint8_t slave, modbus_reg_id reg, const uint8_t *data, modbus_write_complete_t complete, void *arg);
+
+/*!
+ * @brief  Set the password of the writes to an electric meter, in place of MODBUS_ELEC_PASSWORD. Not stored
+ * @param  Bus index, index of slave in the slave list of the bus
+ *         Password, MODBUS_PASSWORD_SIZE bytes LSB first before adding 0x33, NULL for MODBUS_ELEC_PASSWORD
+ * @retval ESP_OK if success
+ *         ESP_FAIL if parameter is invalid or the meters are water meters
+ */
+esp_err_t modbus_api_set_password(uint8_t bus, uint8_t slave, const uint8_t *password);
+
+/*!
+ * @brief  Scan a bus for new slaves. Slaves found are added to the slave list and stored in NVS.
+ *         The scan starts when the jobs in flight of the bus are done, polling is paused during the scan
+ * @param  Bus index
+ * @retval ESP_OK if success
+ *         ESP_FAIL if bus is invalid
+ */
+esp_err_t modbus_api_discover(uint8_t bus);
 
 /*!
  * @brief  Modbus in master mode initialization
@@ -90,11 +177,20 @@ void modbus_api_set_slave(uint8_t *slave_id, uint8_t num_slave);
 void modbus_api_init(void);
 
 /*!
- * @brief  Convert modbus data to json string
- * @param  None
- * @retval String response. NOTE: Must to free after use
+ * @brief  Convert modbus data to compact json, no heap is used
+ * @param  Reading
+ *         [out] Buffer and its size
+ * @retval Length of the zero terminated string, 0 if the buffer is too small
+ */
+uint32_t modbus_api_data_to_json(const modbus_data_t *modbus_data, char *buffer, uint32_t size);
+
+/*!
+ * @brief  Convert modbus data to binary, see modbus_telemetry.h for the format
+ * @param  Reading
+ *         [out] Buffer and its size
+ * @retval Length, 0 if the buffer is too small
  */
-char* modbus_api_data_to_json(modbus_data_t *modbus_data);
+uint32_t modbus_api_data_to_binary(const modbus_data_t *modbus_data, uint8_t *buffer, uint32_t size);
 
 /******************************************************************************/
 
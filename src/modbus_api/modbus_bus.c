@@ -0,0 +1,366 @@
+/*
+ *  modbus_bus.c
+ *
+ *  Created on: Jan 10, 2022
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <sys/param.h>
+#include "config.h"
+#include "modbus_command.h"
+#include "modbus_bus.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+typedef uint8_t modbus_bus_item_type_t;
+enum {
+    MODBUS_BUS_ITEM_TRANSACTION = 0,
+    MODBUS_BUS_ITEM_WRITE,
+};
+
+/*!
+ * @brief  Item of bus queue
+ */
+typedef struct {
+    modbus_bus_item_type_t type;
+    union {
+        modbus_transaction_t *transaction;
+        modbus_write_t write;
+    };
+} modbus_bus_item_t;
+
+/*!
+ * @brief  Bus instance
+ */
+typedef struct {
+    modbus_port_t port;
+    QueueHandle_t queue;                              /* Submitted transactions and writes */
+    modbus_write_t pending[MODBUS_WRITE_QUEUE_SIZE];  /* Writes not sent yet, oldest first */
+    uint32_t num_pending;
+    modbus_transaction_t *held;                       /* Transaction waiting for pending writes */
+    TickType_t last_frame;
+} modbus_bus_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static const char* TAG = "BUS";
+static const modbus_bus_config_t modbus_bus_config[MODBUS_BUS_COUNT] = MODBUS_BUS_DEFAULT;
+static modbus_bus_t modbus_bus[MODBUS_BUS_COUNT];
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static void modbus_bus_execute(modbus_bus_t *bus, modbus_transaction_t *transaction);
+static bool modbus_bus_write_join(const modbus_write_t *first, const modbus_write_t *write, uint16_t *start, uint16_t *end);
+static void modbus_bus_write_next(modbus_bus_t *bus);
+static void modbus_bus_task(void *arg);
+static void modbus_bus_transfer_done(modbus_transaction_t *transaction);
+
+/******************************************************************************/
+
+/*!
+ * @brief  Run a transaction, keep a minimum gap between frames for slow meters
+ */
+static void modbus_bus_execute(modbus_bus_t *bus, modbus_transaction_t *transaction)
+{
+    TickType_t elapsed = xTaskGetTickCount() - bus->last_frame;
+
+    if(elapsed < pdMS_TO_TICKS(MODBUS_FRAME_DELAY_MS))
+    {
+        vTaskDelay(pdMS_TO_TICKS(MODBUS_FRAME_DELAY_MS) - elapsed);
+    }
+    modbus_command_execute(&bus->port, transaction);
+    bus->last_frame = xTaskGetTickCount();
+}
+
+/*!
+ * @brief  Check if a pending write can be sent with the block [start, end) of the first write, extend the block
+ */
+static bool modbus_bus_write_join(const modbus_write_t *first, const modbus_write_t *write, uint16_t *start, uint16_t *end)
+{
+    uint16_t low, high;
+
+    if((write->protocol != first->protocol) || (memcmp(write->slave, first->slave, sizeof(first->slave)) != 0))
+    {
+        return false;
+    }
+    if(first->protocol == MODBUS_PROTOCOL_ELEC)
+    {
+        return (write->address == first->address);
+    }
+
+    /* Overlapped or adjacent registers only, the block has no hole */
+    low = MIN(*start, write->address);
+    high = MAX(*end, write->address + write->size);
+    if((write->address > *end) || (write->address + write->size < *start) || (high - low > MODBUS_WRITE_MAX_REGS))
+    {
+        return false;
+    }
+    *start = low;
+    *end = high;
+    return true;
+}
+
+/*!
+ * @brief  Send the oldest pending write with all pending writes joining it, report to each requester
+ */
+static void modbus_bus_write_next(modbus_bus_t *bus)
+{
+    modbus_write_t *first = &bus->pending[0];
+    modbus_write_t *write;
+    bool joined[MODBUS_WRITE_QUEUE_SIZE] = { true };
+    bool changed = true;
+    uint16_t start = first->address;
+    uint16_t end = first->address + first->size;
+    uint16_t size = first->size;
+    uint8_t data[MODBUS_COMMAND_MAX_SIZE];
+    uint8_t rx_data[MODBUS_COMMAND_MAX_SIZE];
+    const uint8_t *password = NULL;
+    uint32_t count = 0;
+
+    /* A write may join only after another one extended the block */
+    while(changed)
+    {
+        changed = false;
+        for(uint32_t i = 1; i < bus->num_pending; i++)
+        {
+            if(!joined[i] && modbus_bus_write_join(first, &bus->pending[i], &start, &end))
+            {
+                joined[i] = true;
+                changed = true;
+            }
+        }
+    }
+
+    /* Data in submit order, a newer write supersedes an older one */
+    for(uint32_t i = 0; i < bus->num_pending; i++)
+    {
+        write = &bus->pending[i];
+        if(!joined[i])
+        {
+            continue;
+        }
+        if(write->protocol == MODBUS_PROTOCOL_RTU)
+        {
+            memcpy(&data[RAW_LEN(write->address - start)], write->data, RAW_LEN(write->size));
+            size = end - start;
+        }
+        else
+        {
+            memcpy(data, write->data, write->size);
+            size = write->size;
+            password = write->password;
+        }
+        count++;
+    }
+
+    modbus_transaction_t transaction = {
+        .bus = first->bus,
+        .protocol = first->protocol,
+        .address = start,
+        .size = size,
+        .tx_data = data,
+        .password = password,
+        .rx_data = rx_data,
+    };
+    memcpy(transaction.slave, first->slave, sizeof(transaction.slave));
+    modbus_bus_execute(bus, &transaction);
+    if(count > 1)
+    {
+        ESP_LOGI(TAG, "Bus %d: %u writes sent in one transaction, status %d", first->bus, count, transaction.status);
+    }
+
+    /* Report and remove, keep order of the others */
+    count = 0;
+    for(uint32_t i = 0; i < bus->num_pending; i++)
+    {
+        write = &bus->pending[i];
+        if(!joined[i])
+        {
+            if(count != i)
+            {
+                memcpy(&bus->pending[count], write, sizeof(modbus_write_t));
+            }
+            count++;
+        }
+        else if(write->complete != NULL)
+        {
+            write->complete(write, transaction.status);
+        }
+    }
+    bus->num_pending = count;
+}
+
+/*!
+ * @brief  Bus task, the only owner of the UART. Writes go first, at most MODBUS_WRITE_BURST in a row
+ *         when a transaction waits. Transactions run in submit order
+ */
+static void modbus_bus_task(void *arg)
+{
+    modbus_bus_t *bus = (modbus_bus_t*) arg;
+    modbus_bus_item_t item;
+    modbus_transaction_t *transaction;
+    TickType_t wait;
+    uint32_t burst = 0;
+
+    while(1)
+    {
+        /* Take writes from the queue until a transaction comes, wait only when idle */
+        wait = ((bus->num_pending > 0) || (bus->held != NULL)) ? 0 : portMAX_DELAY;
+        while((bus->held == NULL) && (bus->num_pending < MODBUS_WRITE_QUEUE_SIZE) &&
+              (xQueueReceive(bus->queue, &item, wait) == pdTRUE))
+        {
+            if(item.type == MODBUS_BUS_ITEM_WRITE)
+            {
+                memcpy(&bus->pending[bus->num_pending++], &item.write, sizeof(modbus_write_t));
+            }
+            else
+            {
+                bus->held = item.transaction;
+            }
+            wait = 0;
+        }
+
+        if((bus->num_pending > 0) && ((bus->held == NULL) || (burst < MODBUS_WRITE_BURST)))
+        {
+            modbus_bus_write_next(bus);
+            burst++;
+        }
+        else if(bus->held != NULL)
+        {
+            transaction = bus->held;
+            bus->held = NULL;
+            burst = 0;
+            modbus_bus_execute(bus, transaction);
+            if(transaction->complete != NULL)
+            {
+                transaction->complete(transaction);
+            }
+        }
+    }
+}
+
+/*!
+ * @brief  Completion of blocking transfer, wake up the caller
+ */
+static void modbus_bus_transfer_done(modbus_transaction_t *transaction)
+{
+    xTaskNotifyGive((TaskHandle_t) transaction->arg);
+}
+
+/******************************************************************************/
+
+/*!
+ * @brief  Submit a transaction to the bus task
+ */
+esp_err_t modbus_bus_submit(modbus_transaction_t *transaction)
+{
+    modbus_bus_item_t item = {
+        .type = MODBUS_BUS_ITEM_TRANSACTION,
+        .transaction = transaction,
+    };
+
+    if((transaction->bus < MODBUS_BUS_COUNT) && (modbus_bus[transaction->bus].queue != NULL))
+    {
+        if(xQueueSend(modbus_bus[transaction->bus].queue, &item, pdMS_TO_TICKS(MODBUS_QUEUE_TIMEOUT_MS)) == pdPASS)
+        {
+            return ESP_OK;
+        }
+    }
+    ESP_LOGW(TAG, "Bus %d queue is full", transaction->bus);
+    return ESP_FAIL;
+}
+
+/*!
+ * @brief  Submit a transaction and wait until done
+ */
+bool modbus_bus_transfer(modbus_transaction_t *transaction)
+{
+    transaction->complete = modbus_bus_transfer_done;
+    transaction->arg = xTaskGetCurrentTaskHandle();
+    if(modbus_bus_submit(transaction) != ESP_OK)
+    {
+        return false;
+    }
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    return (transaction->status == MODBUS_STATUS_OK);
+}
+
+/*!
+ * @brief  Queue a write
+ */
+esp_err_t modbus_bus_write(const modbus_write_t *write)
+{
+    modbus_bus_item_t item = {
+        .type = MODBUS_BUS_ITEM_WRITE,
+    };
+    uint16_t length = (write->protocol == MODBUS_PROTOCOL_RTU) ? RAW_LEN(write->size) : write->size;
+
+    if((write->bus >= MODBUS_BUS_COUNT) || (modbus_bus[write->bus].queue == NULL) ||
+       (write->size == 0) || (length > MODBUS_WRITE_MAX_SIZE))
+    {
+        ESP_LOGE(TAG, "Invalid write to bus %d, size %d", write->bus, write->size);
+        return ESP_FAIL;
+    }
+
+    memcpy(&item.write, write, sizeof(modbus_write_t));
+    if(xQueueSend(modbus_bus[write->bus].queue, &item, pdMS_TO_TICKS(MODBUS_QUEUE_TIMEOUT_MS)) != pdPASS)
+    {
+        ESP_LOGW(TAG, "Bus %d queue is full", write->bus);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/*!
+ * @brief  Get bus configuration
+ */
+const modbus_bus_config_t* modbus_bus_get_config(uint8_t bus)
+{
+    return &modbus_bus_config[bus];
+}
+
+/*!
+ * @brief  Bus initialization
+ */
+void modbus_bus_init(void)
+{
+    char name[configMAX_TASK_NAME_LEN];
+
+    for(uint8_t i = 0; i < MODBUS_BUS_COUNT; i++)
+    {
+        /* UART for modbus */
+        modbus_command_init(&modbus_bus[i].port, &modbus_bus_config[i]);
+
+        /* Transaction queue, item is pointer to descriptor or copy of write request */
+        modbus_bus[i].queue = xQueueCreate(MODBUS_BUS_QUEUE_SIZE, sizeof(modbus_bus_item_t));
+        if(modbus_bus[i].queue == NULL)
+        {
+            ESP_LOGE(TAG, "Create bus %d queue fail", i);
+            return;
+        }
+
+        snprintf(name, sizeof(name), "%s%d", MODBUS_BUS_TASK_NAME, i);
+        BaseType_t result = xTaskCreatePinnedToCore(modbus_bus_task, name, MODBUS_BUS_TASK_SIZE, &modbus_bus[i],
+                                                    MODBUS_BUS_TASK_PRIORITY, NULL, modbus_bus_config[i].core);
+        if (result != pdPASS) {
+            ESP_LOGE(TAG, "Create modbus_bus task %d fail %d", i, result);
+        }
+    }
+}
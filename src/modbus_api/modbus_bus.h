@@ -0,0 +1,101 @@
+/*
+ *  modbus_bus.h
+ *
+ *  Created on: Jan 10, 2022
+ */
+
+#ifndef _MODBUS_BUS_H_
+#define _MODBUS_BUS_H_
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <esp_err.h>
+#include "config.h"
+#include "modbus_command.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+typedef struct modbus_write modbus_write_t;
+typedef void (*modbus_write_complete_t)(const modbus_write_t *write, modbus_status_t status);
+
+/*!
+ * @brief  Write request, copied into the bus task. Pending writes to the same slave are merged
+ */
+struct modbus_write {
+    uint8_t bus;                                      /* Index of bus */
+    modbus_protocol_t protocol;
+    uint8_t slave[6];                                 /* Slave id in slave[0] for RTU, meter address for 0x68 frame */
+    uint16_t address;                                 /* First register or command */
+    uint16_t size;                                    /* Number of registers for RTU, data size in byte for 0x68 frame */
+    uint8_t data[MODBUS_WRITE_MAX_SIZE];              /* Register values high byte first, or data before adding 0x33 */
+    uint8_t password[MODBUS_PASSWORD_SIZE];           /* Meter password of a 0x68 frame write, before adding 0x33 */
+    modbus_write_complete_t complete;                 /* Called from bus task when done, may be NULL */
+    void *arg;                                        /* User context */
+};
+
+
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+/*!
+ * @brief  Submit a transaction to the task of transaction->bus, return immediately
+ * @param  Transaction, must stay valid until complete() is called
+ * @retval ESP_OK if queued
+ *         ESP_FAIL if bus queue is full
+ */
+esp_err_t modbus_bus_submit(modbus_transaction_t *transaction);
+
+/*!
+ * @brief  Submit a transaction and wait until done. Do not call from bus task
+ * @param  Transaction, complete and arg are overwritten
+ * @retval True if status is MODBUS_STATUS_OK
+ */
+bool modbus_bus_transfer(modbus_transaction_t *transaction);
+
+/*!
+ * @brief  Queue a write. Writes go before polls; a write to registers next to or over the registers
+ *         of a pending write to the same slave is sent with it in one function 16 transaction,
+ *         the newest data wins. Several writes to one 0x68 command are sent once with the newest data
+ * @param  Write request, copied
+ * @retval ESP_OK if queued, complete() is called with the result
+ *         ESP_FAIL if request is invalid or bus queue is full
+ */
+esp_err_t modbus_bus_write(const modbus_write_t *write);
+
+/*!
+ * @brief  Get bus configuration
+ * @param  Bus index, less than MODBUS_BUS_COUNT
+ * @retval Configuration
+ */
+const modbus_bus_config_t* modbus_bus_get_config(uint8_t bus);
+
+/*!
+ * @brief  Bus initialization, install UART and start one bus task per bus
+ * @param  None
+ * @retval None
+ */
+void modbus_bus_init(void);
+
+/******************************************************************************/
+
+#endif /* _MODBUS_BUS_H_ */
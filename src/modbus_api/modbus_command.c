@@ -10,21 +10,48 @@
 /*                              INCLUDE FILES                                 */
 /******************************************************************************/
 
+#include <sys/param.h>
 #include <driver/uart.h>
 #include "config.h"
 #include "utility/utility.h"
 #include "modbus_command.h"
+#include "modbus_frame.h"
+#include "modbus_bus.h"
 
 /******************************************************************************/
 /*                     EXPORTED TYPES and DEFINITIONS                         */
 /******************************************************************************/
 
-#define FAIL_CHECK(a, str, ...)                                                      \
+#define STATUS_CHECK(a, status, str, ...)                                            \
     if (!(a)) {                                                                      \
         ESP_LOGE(TAG, "%s(%u): " str, __FUNCTION__, __LINE__, ##__VA_ARGS__);        \
-        return false;                                                                \
+        return (status);                                                             \
     }
 
+/* 1 start bit + 8 data bits + parity bit + 1 stop bit */
+#define MODBUS_CHAR_BITS(parity)                      (10 + (((parity) == UART_PARITY_DISABLE) ? 0 : 1))
+
+/* Time of one character on the line, in microsecond */
+#define MODBUS_CHAR_TIME_US(baud, parity)             ((MODBUS_CHAR_BITS(parity) * 1000000UL) / (baud))
+
+/* Inter-frame silence t3.5, fixed to 1750us above 19200 baud (see Modbus over serial line spec) */
+#define MODBUS_T35_US(baud, parity)                   (((baud) > 19200) ? 1750UL : ((35UL * MODBUS_CHAR_BITS(parity) * 100000UL) / (baud)))
+
+/* t3.5 in UART symbol time, used for the RX timeout interrupt */
+#define MODBUS_T35_SYMBOLS(baud, parity)              ((MODBUS_T35_US(baud, parity) + MODBUS_CHAR_TIME_US(baud, parity) - 1) / MODBUS_CHAR_TIME_US(baud, parity))
+
+/* Bytes moved from the RX FIFO to the driver buffer at once, rxfifo_full_thresh of uart_driver_install */
+#define MODBUS_RX_FIFO_FULL                           120
+
+/* Microsecond to tick, rounded up to whole ticks plus one as a wait of n ticks ends at the n-th tick boundary */
+#define MODBUS_US_TO_TICKS(us)                        (((us) + portTICK_PERIOD_MS * 1000UL - 1) / (portTICK_PERIOD_MS * 1000UL) + 1)
+
+/* Bytes read from the driver at once when a frame parser is used */
+#define MODBUS_RX_CHUNK_SIZE                          32
+
+/* Electric read reply: frame overhead + 2 bytes data identifier */
+#define MODBUS_ELEC_REPLY_OVERHEAD                    (MODBUS_FRAME_OVERHEAD + 2)
+
 /******************************************************************************/
 /*                              PRIVATE DATA                                  */
 /******************************************************************************/
@@ -41,80 +68,243 @@ static const char* TAG = "COMMAND";
 /*                                FUNCTIONS                                   */
 /******************************************************************************/
 
-static bool modbus_command_transceiver(uart_port_t uart_port, uint8_t *tx_data, uint16_t tx_size, uint8_t *rx_data, uint16_t max_size, uint16_t *rx_size);
+static TickType_t modbus_command_rx_wait(const modbus_port_t *port, uint16_t remaining);
+static modbus_status_t modbus_command_parse_frame(modbus_port_t *port, modbus_frame_parser_t *parser, size_t size, bool *done);
+static modbus_status_t modbus_command_receive_frame(modbus_port_t *port, modbus_frame_parser_t *parser, TickType_t timeout, uint8_t *rx_data, uint16_t max_size, uint16_t *rx_size);
+static modbus_status_t modbus_command_transceiver(modbus_port_t *port, modbus_transaction_t *transaction, modbus_frame_parser_t *parser, uint8_t *tx_data, uint16_t tx_size, uint16_t max_size);
+static bool modbus_command_address_match(const uint8_t *request, const uint8_t *response);
+static modbus_status_t modbus_command_water_transaction(modbus_port_t *port, modbus_transaction_t *transaction);
+static modbus_status_t modbus_command_elec_transaction(modbus_port_t *port, modbus_transaction_t *transaction);
+static modbus_status_t modbus_command_water_write(modbus_port_t *port, modbus_transaction_t *transaction);
+static modbus_status_t modbus_command_elec_write(modbus_port_t *port, modbus_transaction_t *transaction);
 
 /******************************************************************************/
 
 /*!
- * @brief  UART transceiver
+ * @brief  Longest wait for the next data event of a frame. The driver posts one when MODBUS_RX_FIFO_FULL
+ *         bytes are in, or after t3.5 of silence, so the wait covers the bytes still expected, up to a
+ *         FIFO, plus t3.5
+ */
+static TickType_t modbus_command_rx_wait(const modbus_port_t *port, uint16_t remaining)
+{
+    return MODBUS_US_TO_TICKS(MIN(remaining, MODBUS_RX_FIFO_FULL) * port->char_us + port->t35_us);
+}
+
+/*!
+ * @brief  Read pending bytes through the frame parser
+ * @param  done is set when the frame ended, at the end byte, before the line is silent
+ */
+static modbus_status_t modbus_command_parse_frame(modbus_port_t *port, modbus_frame_parser_t *parser, size_t size, bool *done)
+{
+    uint8_t chunk[MODBUS_RX_CHUNK_SIZE];
+    modbus_frame_result_t result;
+    uint16_t used;
+    int rc;
+
+    while(size > 0)
+    {
+        rc = uart_read_bytes(port->port, chunk, MIN(size, sizeof(chunk)), 0);
+        if(rc <= 0)
+        {
+            break;
+        }
+        size -= rc;
+
+        result = modbus_frame_feed_buffer(parser, chunk, rc, &used);
+        if(result != MODBUS_FRAME_INCOMPLETE)
+        {
+            /* Bytes after the end byte are dropped by the next transaction flush */
+            *done = true;
+            STATUS_CHECK((result != MODBUS_FRAME_CHECKSUM_ERROR), MODBUS_STATUS_CRC_ERROR, "Check sum error on port %d", port->port);
+            return MODBUS_STATUS_OK;
+        }
+    }
+    return MODBUS_STATUS_OK;
+}
+
+/*!
+ * @brief  Receive one frame. The frame ends on the RX timeout event, the line silent for t3.5 after
+ *         the last byte, when "max_size" bytes are in, or at the end byte when a frame parser is given.
+ *         "timeout" is only the time to wait for the first data event, a frame longer than the FIFO
+ *         comes in several events
  */
-static bool modbus_command_transceiver(uart_port_t uart_port, uint8_t *tx_data, uint16_t tx_size, uint8_t *rx_data, uint16_t max_size, uint16_t *rx_size)
+static modbus_status_t modbus_command_receive_frame(modbus_port_t *port, modbus_frame_parser_t *parser, TickType_t timeout, uint8_t *rx_data, uint16_t max_size, uint16_t *rx_size)
 {
+    uart_event_t event;
+    bool line_error = false;
+    bool done = false;
+    modbus_status_t status;
+    int rc;
+    TickType_t wait = timeout;
+
     *rx_size = 0;
+    port->rx_crc = CRC16_MODBUS_INIT;
+    if(parser != NULL)
+    {
+        modbus_frame_init(parser, rx_data, max_size);
+    }
+
+    while(xQueueReceive(port->uart_queue, &event, wait) == pdTRUE)
+    {
+        switch(event.type)
+        {
+        case UART_DATA:
+            if(parser != NULL)
+            {
+                /* Preamble and noise are skipped, the frame may span several RX timeouts */
+                status = modbus_command_parse_frame(port, parser, event.size, &done);
+                *rx_size = parser->size;
+                if(done)
+                {
+                    STATUS_CHECK(!line_error, MODBUS_STATUS_FRAME_ERROR, "Frame or parity error on port %d", port->port);
+                    return status;
+                }
+                break;
+            }
+
+            if(*rx_size < max_size)
+            {
+                rc = uart_read_bytes(port->port, &rx_data[*rx_size], MIN(event.size, (size_t)(max_size - *rx_size)), 0);
+                if(rc > 0)
+                {
+                    /* CRC as bytes come, the frame is checked when the last byte is in */
+                    port->rx_crc = crc16_modbus_update(port->rx_crc, &rx_data[*rx_size], rc);
+                    *rx_size += rc;
+                }
+            }
+            /* RX timeout flag is set when the line is idle for t3.5 */
+            if(event.timeout_flag || (*rx_size >= max_size))
+            {
+                STATUS_CHECK(!line_error, MODBUS_STATUS_FRAME_ERROR, "Frame or parity error on port %d", port->port);
+                return MODBUS_STATUS_OK;
+            }
+            break;
+
+        case UART_FIFO_OVF:
+        case UART_BUFFER_FULL:
+            uart_flush_input(port->port);
+            xQueueReset(port->uart_queue);
+            STATUS_CHECK(0, MODBUS_STATUS_FRAME_ERROR, "Rx overflow on port %d", port->port);
+            break;
+
+        case UART_FRAME_ERR:
+        case UART_PARITY_ERR:
+            line_error = true;
+            break;
+
+        default:
+            break;
+        }
+        wait = modbus_command_rx_wait(port, max_size - *rx_size);
+    }
+
+    /* No event in time: no response, or a frame cut short the length check rejects */
+    if(parser != NULL)
+    {
+        STATUS_CHECK(((*rx_size > 0) || (parser->skipped > 0)), MODBUS_STATUS_TIMEOUT, "No response");
+        STATUS_CHECK(0, MODBUS_STATUS_FRAME_ERROR, "Incomplete frame on port %d, %d bytes, %u skipped", port->port, *rx_size, parser->skipped);
+    }
+    STATUS_CHECK((*rx_size > 0), MODBUS_STATUS_TIMEOUT, "No response");
+    STATUS_CHECK(!line_error, MODBUS_STATUS_FRAME_ERROR, "Frame or parity error on port %d", port->port);
+    return MODBUS_STATUS_OK;
+}
+
+/*!
+ * @brief  UART transceiver
+ */
+static modbus_status_t modbus_command_transceiver(modbus_port_t *port, modbus_transaction_t *transaction, modbus_frame_parser_t *parser, uint8_t *tx_data, uint16_t tx_size, uint16_t max_size)
+{
+    /* Rounded up, pdMS_TO_TICKS() would cut a 32 ms probe timeout to 20..30 ms */
+    TickType_t timeout = MODBUS_US_TO_TICKS(((transaction->timeout_ms > 0) ? transaction->timeout_ms : MODBUS_RX_TIMEOUT_MS) * 1000UL);
+
+    transaction->rx_size = 0;
     
-    /* Flush uart buffer before */
-    uart_flush(uart_port);
+    /* Flush uart buffer and pending events before */
+    uart_flush_input(port->port);
+    xQueueReset(port->uart_queue);
 
     /* Write data to the UART */
-    int rc = uart_write_bytes(uart_port, (const char*)tx_data, tx_size);
-    uart_wait_tx_done(uart_port, -1);
-    FAIL_CHECK((rc > 0), "Cannot write uart port %d", uart_port);
+    int rc = uart_write_bytes(port->port, (const char*)tx_data, tx_size);
+    uart_wait_tx_done(port->port, -1);
+    STATUS_CHECK((rc > 0), MODBUS_STATUS_FRAME_ERROR, "Cannot write uart port %d", port->port);
+
+    /* Read data from UART until end of frame */
+    return modbus_command_receive_frame(port, parser, timeout, transaction->rx_data, max_size, &transaction->rx_size);
+}
 
-    /* Read data from UART */
-    rc = uart_read_bytes(uart_port, rx_data, max_size, pdMS_TO_TICKS(MODBUS_RX_TIMEOUT_MS));
-    FAIL_CHECK((rc > 0), "No response");
+/*!
+ * @brief  Response address must be the request address, wildcard bytes match any value
+ */
+static bool modbus_command_address_match(const uint8_t *request, const uint8_t *response)
+{
+    static const uint8_t broadcast[6] = {MODBUS_BROADCAST_BYTE, MODBUS_BROADCAST_BYTE, MODBUS_BROADCAST_BYTE,
+                                         MODBUS_BROADCAST_BYTE, MODBUS_BROADCAST_BYTE, MODBUS_BROADCAST_BYTE};
 
-    *rx_size = rc;
+    if(memcmp(request, broadcast, sizeof(broadcast)) == 0)
+    {
+        return true;
+    }
+    for(uint8_t i = 0; i < 6; i++)
+    {
+        if((request[i] != MODBUS_WILDCARD_BYTE) && (request[i] != response[i]))
+        {
+            return false;
+        }
+    }
     return true;
 }
 
 /******************************************************************************/
 
 /*!
- * @brief  Get water meter registers
+ * @brief  Read water meter input registers (function 04)
  */
-bool modbus_command_get_water_registers(uint8_t slave_id, uint16_t address, uint16_t num_reg, uint8_t *rx_data)
+static modbus_status_t modbus_command_water_transaction(modbus_port_t *port, modbus_transaction_t *transaction)
 {
     uint8_t command[8];
-    uint16_t crc16, crc16_receive;
-    uint16_t rx_size = 0;
+    uint16_t crc16;
+    uint8_t slave_id = transaction->slave[0];
+    uint8_t *rx_data = transaction->rx_data;
+    modbus_status_t status;
 
     /* Build command */
     command[0] = slave_id;
     command[1] = MODBUS_READ_INPUT_FUNCTION;
-    command[2] = HI_UINT16(address);
-    command[3] = LO_UINT16(address);
-    command[4] = HI_UINT16(num_reg);
-    command[5] = LO_UINT16(num_reg);
+    command[2] = HI_UINT16(transaction->address);
+    command[3] = LO_UINT16(transaction->address);
+    command[4] = HI_UINT16(transaction->size);
+    command[5] = LO_UINT16(transaction->size);
     crc16 = crc16_modbus(command, 6);
     command[6] = HI_UINT16(crc16);
     command[7] = LO_UINT16(crc16);
     
     /* Send and receive data */
-    uint8_t max_size = RAW_LEN(num_reg) + 5;    /* 1 Address + 1 Function + 1 Byte count + 2 CRC */
-    if(modbus_command_transceiver(MODBUS_PORT_NUM, command, 8, rx_data, max_size, &rx_size))
-    {
-        /* Check valid */
-        if(rx_size == max_size)
-        {
-            crc16 = crc16_modbus(rx_data, rx_size - 2);
-            crc16_receive = MERGE_UINT16(rx_data[rx_size - 2], rx_data[rx_size - 1]);
-            FAIL_CHECK((crc16 == crc16_receive), "Slave %d CRC error, %d != %d", slave_id, crc16, crc16_receive);
-            return true;
-        }
-    }
-    FAIL_CHECK(0, "Slave %d no response", slave_id);
-    return false;
+    uint16_t max_size = RAW_LEN(transaction->size) + 5;    /* 1 Address + 1 Function + 1 Byte count + 2 CRC */
+    STATUS_CHECK((max_size <= MODBUS_COMMAND_MAX_SIZE), MODBUS_STATUS_FRAME_ERROR, "Slave %d too many registers %d", slave_id, transaction->size);
+    status = modbus_command_transceiver(port, transaction, NULL, command, 8, max_size);
+    STATUS_CHECK((status == MODBUS_STATUS_OK), status, "Slave %d no response", slave_id);
+
+    /* Check valid */
+    uint16_t rx_size = transaction->rx_size;
+    STATUS_CHECK(((rx_size == max_size) || (rx_size == MODBUS_EXCEPTION_SIZE)), MODBUS_STATUS_FRAME_ERROR,
+                 "Slave %d invalid length %d", slave_id, rx_size);
+    STATUS_CHECK((port->rx_crc == CRC16_MODBUS_RESIDUE), MODBUS_STATUS_CRC_ERROR, "Slave %d CRC error, residue %04X", slave_id, port->rx_crc);
+    STATUS_CHECK((rx_data[1] == MODBUS_READ_INPUT_FUNCTION), MODBUS_STATUS_EXCEPTION, "Slave %d exception %02X", slave_id, rx_data[2]);
+    STATUS_CHECK((rx_data[0] == slave_id), MODBUS_STATUS_FRAME_ERROR, "Slave %d response from %d", slave_id, rx_data[0]);
+    return MODBUS_STATUS_OK;
 }
 
 /*!
- * @brief  Get electric meter registers
+ * @brief  Read electric meter command (0x68 frame)
  */
-bool modbus_command_get_elec_registers(uint8_t *slave_id, uint16_t address, uint8_t *rx_data, uint8_t rx_data_size)
+static modbus_status_t modbus_command_elec_transaction(modbus_port_t *port, modbus_transaction_t *transaction)
 {
     uint8_t command[14];
-    uint8_t sum;
-    uint16_t rx_size, max_size;
+    uint16_t max_size;
+    uint8_t *slave_id = transaction->slave;
+    uint8_t *rx_data = transaction->rx_data;
+    modbus_frame_parser_t parser;
+    modbus_status_t status;
 
     /* Build command */
     command[0] = MODBUS_START_BYTE;
@@ -122,50 +312,213 @@ bool modbus_command_get_elec_registers(uint8_t *slave_id, uint16_t address, uint
     command[7] = MODBUS_START_BYTE;
     command[8] = MODBUS_READ_REQUEST_BYTE;
     command[9] = 2;    /* Length */
-    command[10] = HI_UINT16(address);
-    command[11] = LO_UINT16(address);
+    command[10] = HI_UINT16(transaction->address);
+    command[11] = LO_UINT16(transaction->address);
     command[12] = check_sum(command, 12);
     command[13] = MODBUS_END_BYTE;
 
-    /* Send and receive data */
-    max_size = 14 + rx_data_size;
-    if(modbus_command_transceiver(MODBUS_PORT_NUM, command, 14, rx_data, max_size, &rx_size))
+    /* Send and receive data, the parser checks frame format and check sum */
+    max_size = MODBUS_ELEC_REPLY_OVERHEAD + transaction->size;
+    STATUS_CHECK((max_size <= MODBUS_COMMAND_MAX_SIZE), MODBUS_STATUS_FRAME_ERROR, "Response too long %d", max_size);
+    status = modbus_command_transceiver(port, transaction, &parser, command, 14, max_size);
+    STATUS_CHECK((status == MODBUS_STATUS_OK), status, "No response from slave "ADDRSTR, ADDR2STR(slave_id));
+
+    /* Check valid, the meter may answer less data than asked */
+    uint16_t rx_size = transaction->rx_size;
+    STATUS_CHECK(modbus_command_address_match(slave_id, &rx_data[1]), MODBUS_STATUS_FRAME_ERROR,
+                 "Response from "ADDRSTR" to slave "ADDRSTR, ADDR2STR(&rx_data[1]), ADDR2STR(slave_id));
+    STATUS_CHECK(!(rx_data[MODBUS_FRAME_CONTROL_INDEX] & MODBUS_ERROR_FLAG), MODBUS_STATUS_EXCEPTION,
+                 "Error response %02X from slave "ADDRSTR, rx_data[MODBUS_FRAME_DATA_INDEX], ADDR2STR(slave_id));
+    STATUS_CHECK((rx_size >= MODBUS_ELEC_REPLY_OVERHEAD), MODBUS_STATUS_FRAME_ERROR, "Invalid length %d from slave "ADDRSTR, rx_size, ADDR2STR(slave_id));
+    return MODBUS_STATUS_OK;
+}
+
+/*!
+ * @brief  Write water meter registers, function 06 for one register, function 16 for more
+ */
+static modbus_status_t modbus_command_water_write(modbus_port_t *port, modbus_transaction_t *transaction)
+{
+    uint8_t command[MODBUS_COMMAND_MAX_SIZE];
+    uint16_t size = 0;
+    uint16_t crc16;
+    uint8_t slave_id = transaction->slave[0];
+    uint8_t *rx_data = transaction->rx_data;
+    uint8_t function = (transaction->size == 1) ? MODBUS_WRITE_REGISTER_FUNCTION : MODBUS_WRITE_MULTIPLE_FUNCTION;
+    modbus_status_t status;
+
+    /* Build command: 1 Address + 1 Function + 2 Register + (2 Quantity + 1 Byte count) + Data + 2 CRC */
+    STATUS_CHECK((RAW_LEN(transaction->size) + 9 <= MODBUS_COMMAND_MAX_SIZE), MODBUS_STATUS_FRAME_ERROR,
+                 "Slave %d too many registers %d", slave_id, transaction->size);
+    command[size++] = slave_id;
+    command[size++] = function;
+    command[size++] = HI_UINT16(transaction->address);
+    command[size++] = LO_UINT16(transaction->address);
+    if(function == MODBUS_WRITE_MULTIPLE_FUNCTION)
     {
-        /* Check valid */
-        if((rx_size == max_size) && (rx_data[0] == MODBUS_START_BYTE) && (rx_data[rx_size - 1] == MODBUS_END_BYTE))
-        {
-            sum = check_sum(rx_data, rx_size - 2);
-            FAIL_CHECK((sum == rx_data[rx_size - 2]), "Check sum error from slave"ADDRSTR, ADDR2STR(slave_id));
-            return true;
-        }
-        else
-        {
-            FAIL_CHECK(0, "Invalid data from slave "ADDRSTR, ADDR2STR(slave_id));
-        }
+        command[size++] = HI_UINT16(transaction->size);
+        command[size++] = LO_UINT16(transaction->size);
+        command[size++] = RAW_LEN(transaction->size);
+    }
+    memcpy(&command[size], transaction->tx_data, RAW_LEN(transaction->size));
+    size += RAW_LEN(transaction->size);
+    crc16 = crc16_modbus(command, size);
+    command[size++] = HI_UINT16(crc16);
+    command[size++] = LO_UINT16(crc16);
+
+    /* Response is 8 bytes: echo of function 06 command, or address and quantity of function 16 */
+    status = modbus_command_transceiver(port, transaction, NULL, command, size, 8);
+    STATUS_CHECK((status == MODBUS_STATUS_OK), status, "Slave %d no response", slave_id);
+
+    /* Check valid */
+    uint16_t rx_size = transaction->rx_size;
+    STATUS_CHECK(((rx_size == 8) || (rx_size == MODBUS_EXCEPTION_SIZE)), MODBUS_STATUS_FRAME_ERROR,
+                 "Slave %d invalid length %d", slave_id, rx_size);
+    STATUS_CHECK((port->rx_crc == CRC16_MODBUS_RESIDUE), MODBUS_STATUS_CRC_ERROR, "Slave %d CRC error, residue %04X", slave_id, port->rx_crc);
+    STATUS_CHECK((rx_data[1] == function), MODBUS_STATUS_EXCEPTION, "Slave %d exception %02X", slave_id, rx_data[2]);
+    STATUS_CHECK((rx_data[0] == slave_id), MODBUS_STATUS_FRAME_ERROR, "Slave %d response from %d", slave_id, rx_data[0]);
+    STATUS_CHECK((memcmp(&rx_data[2], &command[2], 4) == 0), MODBUS_STATUS_FRAME_ERROR, "Slave %d invalid write response", slave_id);
+    return MODBUS_STATUS_OK;
+}
+
+/*!
+ * @brief  Write electric meter command (0x68 frame, control 0x04): command, password and data, bytes after
+ *         the command are added MODBUS_DATA_ADD_BYTE
+ */
+static modbus_status_t modbus_command_elec_write(modbus_port_t *port, modbus_transaction_t *transaction)
+{
+    static const uint8_t default_password[MODBUS_PASSWORD_SIZE] = MODBUS_ELEC_PASSWORD;
+    uint8_t command[MODBUS_COMMAND_MAX_SIZE];
+    uint16_t size = 0;
+    uint8_t *slave_id = transaction->slave;
+    uint8_t *rx_data = transaction->rx_data;
+    const uint8_t *password = (transaction->password != NULL) ? transaction->password : default_password;
+    modbus_frame_parser_t parser;
+    modbus_status_t status;
+
+    /* Build command */
+    STATUS_CHECK((transaction->size + MODBUS_PASSWORD_SIZE + MODBUS_ELEC_REPLY_OVERHEAD <= MODBUS_COMMAND_MAX_SIZE),
+                 MODBUS_STATUS_FRAME_ERROR, "Command too long %d", transaction->size);
+    command[size++] = MODBUS_START_BYTE;
+    memcpy(&command[size], slave_id, 6);
+    size += 6;
+    command[size++] = MODBUS_START_BYTE;
+    command[size++] = MODBUS_WRITE_REQUEST_BYTE;
+    command[size++] = 2 + MODBUS_PASSWORD_SIZE + transaction->size;    /* Length */
+    command[size++] = HI_UINT16(transaction->address);
+    command[size++] = LO_UINT16(transaction->address);
+    for(uint16_t i = 0; i < MODBUS_PASSWORD_SIZE; i++)
+    {
+        command[size++] = password[i] + MODBUS_DATA_ADD_BYTE;
+    }
+    for(uint16_t i = 0; i < transaction->size; i++)
+    {
+        command[size++] = transaction->tx_data[i] + MODBUS_DATA_ADD_BYTE;
+    }
+    command[size] = check_sum(command, size);
+    size++;
+    command[size++] = MODBUS_END_BYTE;
+
+    /* Response has the command, no data or one error byte, e.g. on a wrong password */
+    status = modbus_command_transceiver(port, transaction, &parser, command, size, MODBUS_FRAME_OVERHEAD + 2);
+    STATUS_CHECK((status == MODBUS_STATUS_OK), status, "No response from slave "ADDRSTR, ADDR2STR(slave_id));
+
+    /* Check valid */
+    STATUS_CHECK(modbus_command_address_match(slave_id, &rx_data[1]), MODBUS_STATUS_FRAME_ERROR,
+                 "Response from "ADDRSTR" to slave "ADDRSTR, ADDR2STR(&rx_data[1]), ADDR2STR(slave_id));
+    STATUS_CHECK(!(rx_data[MODBUS_FRAME_CONTROL_INDEX] & MODBUS_ERROR_FLAG), MODBUS_STATUS_EXCEPTION,
+                 "Write error %02X from slave "ADDRSTR, rx_data[MODBUS_FRAME_DATA_INDEX], ADDR2STR(slave_id));
+    STATUS_CHECK((rx_data[MODBUS_FRAME_CONTROL_INDEX] == MODBUS_WRITE_RESPONSE_BYTE), MODBUS_STATUS_FRAME_ERROR,
+                 "Invalid control %02X from slave "ADDRSTR, rx_data[MODBUS_FRAME_CONTROL_INDEX], ADDR2STR(slave_id));
+    return MODBUS_STATUS_OK;
+}
+
+/*!
+ * @brief  Run one transaction on the bus
+ */
+void modbus_command_execute(modbus_port_t *port, modbus_transaction_t *transaction)
+{
+    if(transaction->protocol == MODBUS_PROTOCOL_RTU)
+    {
+        transaction->status = (transaction->tx_data != NULL) ? modbus_command_water_write(port, transaction) :
+                                                               modbus_command_water_transaction(port, transaction);
+    }
+    else
+    {
+        transaction->status = (transaction->tx_data != NULL) ? modbus_command_elec_write(port, transaction) :
+                                                               modbus_command_elec_transaction(port, transaction);
     }
-    FAIL_CHECK(0, "No response from slave "ADDRSTR, ADDR2STR(slave_id));
-    return false;
 }
 
 /******************************************************************************/
 
+/*!
+ * @brief  Get water meter registers
+ */
+bool modbus_command_get_water_registers(uint8_t bus, uint8_t slave_id, uint16_t address, uint16_t num_reg, uint8_t *rx_data)
+{
+    modbus_transaction_t transaction = {
+        .bus = bus,
+        .protocol = MODBUS_PROTOCOL_RTU,
+        .slave = {slave_id},
+        .address = address,
+        .size = num_reg,
+        .rx_data = rx_data,
+    };
+    return modbus_bus_transfer(&transaction);
+}
+
+/*!
+ * @brief  Get electric meter registers
+ */
+bool modbus_command_get_elec_registers(uint8_t bus, uint8_t *slave_id, uint16_t address, uint8_t *rx_data, uint8_t rx_data_size)
+{
+    modbus_transaction_t transaction = {
+        .bus = bus,
+        .protocol = MODBUS_PROTOCOL_ELEC,
+        .address = address,
+        .size = rx_data_size,
+        .rx_data = rx_data,
+    };
+    memcpy(transaction.slave, slave_id, sizeof(transaction.slave));
+    return modbus_bus_transfer(&transaction);
+}
+
+/******************************************************************************/
+
+/*!
+ * @brief  Time from end of request to end of a response of "size" bytes, the data event comes after t3.5 of silence
+ */
+uint16_t modbus_command_response_time_ms(const modbus_bus_config_t *config, uint16_t size)
+{
+    uint32_t time_us = size * MODBUS_CHAR_TIME_US(config->baudrate, config->parity) + MODBUS_T35_US(config->baudrate, config->parity);
+    return MODBUS_TURNAROUND_MS + (time_us + 999) / 1000;
+}
+
 /*!
  * @brief  UART for modbus initialization
  */
-void modbus_command_init(void)
+void modbus_command_init(modbus_port_t *port, const modbus_bus_config_t *config)
 {
     /* Configure parameters of an UART driver, communication pins and install the driver */
     uart_config_t uart_config = {
-            .baud_rate = MODBUS_BAUDRATE,
+            .baud_rate = config->baudrate,
             .data_bits = UART_DATA_8_BITS,
-            .parity    = MODBUS_PARITY,
+            .parity    = config->parity,
             .stop_bits = UART_STOP_BITS_1,
             .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
             .source_clk = UART_SCLK_APB,
     };
     
     /* Init UART for modbus master */
-    ESP_ERROR_CHECK(uart_driver_install(MODBUS_PORT_NUM, MODBUS_RX_BUFFER_SIZE, 0, 0, NULL, 0));
-    ESP_ERROR_CHECK(uart_param_config(MODBUS_PORT_NUM, &uart_config));
-    ESP_ERROR_CHECK(uart_set_pin(MODBUS_PORT_NUM, MODBUS_UART_TXD, MODBUS_UART_RXD, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
-}
\ No newline at end of file
+    port->port = config->port;
+    ESP_ERROR_CHECK(uart_driver_install(config->port, MODBUS_RX_BUFFER_SIZE, 0, MODBUS_UART_EVENT_QUEUE_SIZE, &port->uart_queue, 0));
+    ESP_ERROR_CHECK(uart_param_config(config->port, &uart_config));
+    ESP_ERROR_CHECK(uart_set_pin(config->port, config->txd, config->rxd, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+
+    /* Frame end detection: RX timeout interrupt after t3.5 of silence */
+    port->char_us = MODBUS_CHAR_TIME_US(config->baudrate, config->parity);
+    port->t35_us = MODBUS_T35_US(config->baudrate, config->parity);
+    ESP_ERROR_CHECK(uart_set_rx_timeout(config->port, MODBUS_T35_SYMBOLS(config->baudrate, config->parity)));
+    ESP_LOGI(TAG, "Port %d, %u baud, frame silence %luus (%lu symbols)", config->port, config->baudrate,
+             MODBUS_T35_US(config->baudrate, config->parity), MODBUS_T35_SYMBOLS(config->baudrate, config->parity));
+}
@@ -13,7 +13,9 @@
 /*                              INCLUDE FILES                                 */
 /******************************************************************************/
 
-
+#include <stdint.h>
+#include <stdbool.h>
+#include <driver/uart.h>
 
 /******************************************************************************/
 /*                     EXPORTED TYPES and DEFINITIONS                         */
@@ -22,6 +24,9 @@
 /*  */
 #define MODBUS_READ_INPUT_FUNCTION                    0x04
 #define MODBUS_WRITE_REGISTER_FUNCTION                0x06
+#define MODBUS_WRITE_MULTIPLE_FUNCTION                0x10
+#define MODBUS_EXCEPTION_FLAG                         0x80
+#define MODBUS_EXCEPTION_SIZE                         5     /* 1 Address + 1 Function + 1 Exception code + 2 CRC */
 
 #define REG_LEN(raw_len)                              ((raw_len) >> 1)
 #define RAW_LEN(reg_len)                              ((reg_len) << 1)
@@ -35,6 +40,10 @@
 #define MODBUS_READ_RESPONSE_BYTE                     0x81
 #define MODBUS_WRITE_REQUEST_BYTE                     0x04
 #define MODBUS_WRITE_RESPONSE_BYTE                    0x84
+#define MODBUS_PASSWORD_SIZE                          4     /* After the command of a write, LSB first, added 0x33 */
+#define MODBUS_ERROR_FLAG                             0x40  /* Set in control byte of error response */
+#define MODBUS_WILDCARD_BYTE                          0xAA  /* Address byte matching any meter */
+#define MODBUS_BROADCAST_BYTE                         0x99  /* 99 99 99 99 99 99 is broadcast address */
 
 #define ADDRSTR                                       "%02X %02X %02X %02X %02X %02X"
 #define get_byte(data, idx)                           (((const uint8_t*)(data))[idx])
@@ -45,6 +54,67 @@
                                                       get_byte(addr,4), \
                                                       get_byte(addr,5) \
 
+/* Result of a bus transaction */
+typedef uint8_t modbus_status_t;
+enum {
+    MODBUS_STATUS_OK = 0,
+    MODBUS_STATUS_TIMEOUT,                            /* No response */
+    MODBUS_STATUS_CRC_ERROR,                          /* CRC or check sum mismatch */
+    MODBUS_STATUS_FRAME_ERROR,                        /* Malformed, truncated or line error */
+    MODBUS_STATUS_EXCEPTION,                          /* Slave replied with exception or error code */
+};
+
+typedef uint8_t modbus_protocol_t;
+enum {
+    MODBUS_PROTOCOL_RTU = 0,                          /* Modbus RTU, water meter */
+    MODBUS_PROTOCOL_ELEC,                             /* 0x68 frame, electric meter */
+};
+
+/*!
+ * @brief  Bus configuration
+ */
+typedef struct {
+    uart_port_t port;
+    int txd;
+    int rxd;
+    uint32_t baudrate;
+    uart_parity_t parity;
+    int core;                                         /* CPU core of bus and poller tasks */
+} modbus_bus_config_t;
+
+/*!
+ * @brief  UART of a bus, used only by its bus task
+ */
+typedef struct {
+    uart_port_t port;
+    QueueHandle_t uart_queue;                         /* UART driver events */
+    uint32_t char_us;                                 /* Time of one character on the line */
+    uint32_t t35_us;                                  /* Inter-frame silence t3.5 */
+    uint16_t rx_crc;                                  /* Running CRC of the last frame received without parser */
+} modbus_port_t;
+
+typedef struct modbus_transaction modbus_transaction_t;
+typedef void (*modbus_complete_t)(modbus_transaction_t *transaction);
+
+/*!
+ * @brief  Request descriptor. Owned by the caller until complete() is called
+ */
+struct modbus_transaction {
+    uint8_t bus;                                      /* Index of bus */
+    modbus_protocol_t protocol;
+    uint8_t slave[6];                                 /* Slave id in slave[0] for RTU, meter address for 0x68 frame */
+    uint16_t address;                                 /* Register address or command */
+    uint16_t size;                                    /* Number of registers for RTU, data size in byte for 0x68 frame */
+    uint16_t timeout_ms;                              /* Response timeout, 0 for MODBUS_RX_TIMEOUT_MS */
+    const uint8_t *tx_data;                           /* Data to write, NULL to read */
+    const uint8_t *password;                          /* Of a 0x68 frame write, NULL for MODBUS_ELEC_PASSWORD */
+    uint8_t *rx_data;                                 /* Response buffer, MODBUS_COMMAND_MAX_SIZE bytes */
+    uint16_t rx_size;                                 /* [out] Response size */
+    modbus_status_t status;                           /* [out] Result */
+    modbus_complete_t complete;                       /* Called from bus task when done, may be NULL */
+    void *arg;                                        /* User context */
+};
+
 /******************************************************************************/
 /*                              PRIVATE DATA                                  */
 /******************************************************************************/
@@ -62,31 +132,50 @@
 /******************************************************************************/
 
 /*!
- * @brief  Get water meter registers
- * @param  Slave id
+ * @brief  Run one transaction on the bus, only called from bus task
+ * @param  UART of the bus
+ *         Transaction, status and response are filled in
+ * @retval None
+ */
+void modbus_command_execute(modbus_port_t *port, modbus_transaction_t *transaction);
+
+/*!
+ * @brief  Get water meter registers, block until done. Do not call from bus task
+ * @param  Bus index
+ *         Slave id
  *         Register address
  *         Number of registers
  *         Rx data
  * @retval True if success
  */
-bool modbus_command_get_water_registers(uint8_t slave_id, uint16_t address, uint16_t num_reg, uint8_t *rx_data);
+bool modbus_command_get_water_registers(uint8_t bus, uint8_t slave_id, uint16_t address, uint16_t num_reg, uint8_t *rx_data);
 
 /*!
- * @brief  Get electric meter registers
- * @param  Slave address
+ * @brief  Get electric meter registers, block until done. Do not call from bus task
+ * @param  Bus index
+ *         Slave address
  *         Register address
  *         Rx data
  *         Rx Data size
  * @retval True if success
  */
-bool modbus_command_get_elec_registers(uint8_t *slave_id, uint16_t address, uint8_t *rx_data, uint8_t rx_data_size);
+bool modbus_command_get_elec_registers(uint8_t bus, uint8_t *slave_id, uint16_t address, uint8_t *rx_data, uint8_t rx_data_size);
+
+/*!
+ * @brief  Time from end of request to end of a response of "size" bytes, baud rate aware
+ * @param  Bus configuration
+ *         Response size in byte
+ * @retval Timeout in ms
+ */
+uint16_t modbus_command_response_time_ms(const modbus_bus_config_t *config, uint16_t size);
 
 /*!
  * @brief  UART for modbus initialization
- * @param  None
+ * @param  [out] UART of the bus
+ *         Bus configuration
  * @retval None
  */
-void modbus_command_init(void);
+void modbus_command_init(modbus_port_t *port, const modbus_bus_config_t *config);
 
 /******************************************************************************/
 
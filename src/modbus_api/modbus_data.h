@@ -0,0 +1,91 @@
+/*
+ *  modbus_data.h
+ *
+ *  Created on: Feb 23, 2022
+ */
+
+#ifndef _MODBUS_DATA_H_
+#define _MODBUS_DATA_H_
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdint.h>
+#include "modbus_table.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+/* Payload of a reading, each register in its own slot, in table order */
+#ifdef ELECTRIC_METER_USED
+#define MODBUS_DATA_SIZE                              MB_ELEC_DATA_SIZE
+#define MODBUS_REG_COUNT                              MB_ELEC_NUMBER_OF_CMD
+#define MODBUS_GROUP_COUNT                            MB_ELEC_NUMBER_OF_GROUP
+#define MODBUS_METER_TYPE                             ELECTRIC_METER
+#define MODBUS_SLAVE_ADDRESS_SIZE                     6     /* Meter address */
+#define MODBUS_DECODE                                 modbus_decode_elec
+#else
+#define MODBUS_DATA_SIZE                              MB_WATER_DATA_SIZE
+#define MODBUS_REG_COUNT                              MB_WATER_NUMBER_OF_REG
+#define MODBUS_GROUP_COUNT                            MB_WATER_NUMBER_OF_GROUP
+#define MODBUS_METER_TYPE                             WATER_METER
+#define MODBUS_SLAVE_ADDRESS_SIZE                     1     /* Modbus id */
+#define MODBUS_DECODE                                 modbus_decode_water
+#endif
+
+typedef uint8_t meter_type_t;
+enum {
+    ELECTRIC_METER = 0,
+    WATER_METER,
+    METER_COUNT
+};
+
+/* Registers of a reading to publish, bit per register id */
+typedef uint64_t modbus_report_mask_t;
+#define MODBUS_REPORT_BIT(reg)                        ((modbus_report_mask_t) 1 << (reg))
+#define MODBUS_REPORT_ALL                             (~(modbus_report_mask_t) 0)
+
+_Static_assert(MODBUS_REG_COUNT <= 64, "modbus_report_mask_t has a bit per register");
+
+typedef struct
+{
+    meter_type_t meter;
+    uint8_t bus;
+    uint8_t slave_id;
+    modbus_reg_id start;
+    modbus_reg_id stop;
+    uint32_t time;                                    /* Unix time when the reading is done, or MODBUS_TIME_UNSYNCED */
+    modbus_report_mask_t report;                      /* Registers to publish, the others did not change enough */
+    uint8_t data[MODBUS_DATA_SIZE];
+} modbus_data_t;
+
+#define MODBUS_TIME_UNSYNCED                          0     /* Reading done before the clock was set by SNTP */
+
+/* Compact form of a reading: meter, bus, slave, start, stop, time, report, then data of registers start to stop */
+#define MODBUS_READING_HEADER_SIZE                    19
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+
+#endif /* _MODBUS_DATA_H_ */
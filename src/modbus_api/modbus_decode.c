@@ -0,0 +1,168 @@
+/*
+ *  modbus_decode.c
+ *
+ *  Created on: Feb 18, 2022
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include "modbus_table.h"
+#include "modbus_decode.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+/* Added to each data byte of the 0x68 frame, see MODBUS_DATA_ADD_BYTE */
+#define MODBUS_DECODE_ELEC_BIAS                       0x33
+
+#define BCD(x)                                        ((((x) >> 4) * 10) + ((x) & 0x0F))
+
+/*!
+ * @brief  Decode entry of a register or command
+ */
+typedef struct {
+    modbus_wire_type_t type;
+    uint8_t size;                                     /* Size in byte */
+    uint8_t flag;
+} modbus_decode_item_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static const uint8_t modbus_decode_type_size[MB_TYPE_COUNT] = {
+    [MB_TYPE_INT32] = MB_TYPE_SIZE_INT32,
+    [MB_TYPE_INT32_WS] = MB_TYPE_SIZE_INT32_WS,
+    [MB_TYPE_FLOAT32] = MB_TYPE_SIZE_FLOAT32,
+    [MB_TYPE_UINT16] = MB_TYPE_SIZE_UINT16,
+    [MB_TYPE_BCD3] = MB_TYPE_SIZE_BCD3,
+    [MB_TYPE_BCD4] = MB_TYPE_SIZE_BCD4,
+    [MB_TYPE_DATE] = MB_TYPE_SIZE_DATE,
+    [MB_TYPE_TIME] = MB_TYPE_SIZE_TIME,
+    [MB_TYPE_RAW] = MB_TYPE_SIZE_RAW,
+};
+
+static const modbus_decode_item_t modbus_decode_water_table[MB_WATER_NUMBER_OF_REG] = {
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence) { MB_TYPE_##type, (size) * 2, flag },
+    MODBUS_WATER_INPUT_REGS
+#undef XTABLE_ITEM
+};
+
+static const modbus_decode_item_t modbus_decode_elec_table[MB_ELEC_NUMBER_OF_CMD] = {
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence) { MB_TYPE_##type, size, flag },
+    MODBUS_ELECTRIC_CMD
+#undef XTABLE_ITEM
+};
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static uint32_t modbus_decode_element(modbus_wire_type_t type, const uint8_t *data, uint8_t bias);
+static uint16_t modbus_decode_range(const modbus_decode_item_t *table, uint16_t start, uint16_t stop, const uint8_t *data,
+                                    uint8_t bias, uint8_t flag, modbus_value_t *value, uint16_t max_value);
+
+/******************************************************************************/
+
+/*!
+ * @brief  Decode one element, bias is removed from each byte first
+ * @retval Value bits, float is returned as its bits
+ */
+static uint32_t modbus_decode_element(modbus_wire_type_t type, const uint8_t *data, uint8_t bias)
+{
+    uint8_t b[4];
+
+    for(uint8_t i = 0; i < modbus_decode_type_size[type]; i++)
+    {
+        b[i] = data[i] - bias;
+    }
+
+    switch(type)
+    {
+    case MB_TYPE_INT32:
+    case MB_TYPE_FLOAT32:
+        return ((uint32_t) b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+    case MB_TYPE_INT32_WS:
+        return ((uint32_t) b[2] << 24) | (b[3] << 16) | (b[0] << 8) | b[1];
+    case MB_TYPE_UINT16:
+        return (b[0] << 8) | b[1];
+    case MB_TYPE_BCD3:
+    case MB_TYPE_TIME:
+        return BCD(b[2]) * 10000UL + BCD(b[1]) * 100 + BCD(b[0]);
+    case MB_TYPE_BCD4:
+        return BCD(b[3]) * 1000000UL + BCD(b[2]) * 10000UL + BCD(b[1]) * 100 + BCD(b[0]);
+    case MB_TYPE_DATE:
+        return (2000 + BCD(b[3])) * 10000UL + BCD(b[2]) * 100 + BCD(b[1]);
+    default:
+        return b[0];
+    }
+}
+
+/*!
+ * @brief  Decode entries "start" to "stop" of a decode table, data has one slot per entry
+ */
+static uint16_t modbus_decode_range(const modbus_decode_item_t *table, uint16_t start, uint16_t stop, const uint8_t *data,
+                                    uint8_t bias, uint8_t flag, modbus_value_t *value, uint16_t max_value)
+{
+    const modbus_decode_item_t *item;
+    uint16_t count = 0;
+    uint8_t size;
+
+    for(uint16_t reg = start; reg <= stop; reg++)
+    {
+        item = &table[reg];
+        if((item->flag & flag) == flag)
+        {
+            size = modbus_decode_type_size[item->type];
+            for(uint16_t offset = 0, index = 0; (offset < item->size) && (count < max_value); offset += size, index++)
+            {
+                value[count].reg = reg;
+                value[count].index = index;
+                value[count].type = item->type;
+                value[count].u32 = modbus_decode_element(item->type, &data[offset], bias);
+                count++;
+            }
+        }
+        data += item->size;
+    }
+    return count;
+}
+
+/******************************************************************************/
+
+/*!
+ * @brief  Decode water meter registers
+ */
+uint16_t modbus_decode_water(modbus_reg_id start, modbus_reg_id stop, const uint8_t *data, uint8_t flag,
+                             modbus_value_t *value, uint16_t max_value)
+{
+    if((start > stop) || (stop >= MB_WATER_NUMBER_OF_REG))
+    {
+        return 0;
+    }
+    return modbus_decode_range(modbus_decode_water_table, start, stop, data, 0, flag, value, max_value);
+}
+
+/*!
+ * @brief  Decode electric meter commands
+ */
+uint16_t modbus_decode_elec(modbus_elec_cmd_id start, modbus_elec_cmd_id stop, const uint8_t *data, uint8_t flag,
+                            modbus_value_t *value, uint16_t max_value)
+{
+    if((start > stop) || (stop >= MB_ELEC_NUMBER_OF_CMD))
+    {
+        return 0;
+    }
+    return modbus_decode_range(modbus_decode_elec_table, start, stop, data, MODBUS_DECODE_ELEC_BIAS, flag, value, max_value);
+}
@@ -0,0 +1,75 @@
+/*
+ *  modbus_decode.h
+ *
+ *  Created on: Feb 18, 2022
+ */
+
+#ifndef _MODBUS_DECODE_H_
+#define _MODBUS_DECODE_H_
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdint.h>
+#include "modbus_table.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+/*!
+ * @brief  One decoded element of a register or command
+ */
+typedef struct {
+    modbus_reg_id reg;                                /* Register or command id */
+    uint8_t index;                                    /* Element in the register, from 0 */
+    modbus_wire_type_t type;
+    union {
+        int32_t i32;                                  /* MB_TYPE_INT32, MB_TYPE_INT32_WS */
+        float f32;                                    /* MB_TYPE_FLOAT32 */
+        uint32_t u32;                                 /* Other types */
+    };
+} modbus_value_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+/*!
+ * @brief  Decode water meter registers "start" to "stop"
+ * @param  Register range, data as received (one slot per register in table order)
+ *         Flag the registers must have, FLAG_NONE for all
+ *         [out] Values and their maximum number
+ * @retval Number of values
+ */
+uint16_t modbus_decode_water(modbus_reg_id start, modbus_reg_id stop, const uint8_t *data, uint8_t flag,
+                             modbus_value_t *value, uint16_t max_value);
+
+/*!
+ * @brief  Decode electric meter commands "start" to "stop", data bytes still added 0x33
+ * @param  Command range, data as received (one slot per command in table order)
+ *         Flag the commands must have, FLAG_NONE for all
+ *         [out] Values and their maximum number
+ * @retval Number of values
+ */
+uint16_t modbus_decode_elec(modbus_elec_cmd_id start, modbus_elec_cmd_id stop, const uint8_t *data, uint8_t flag,
+                            modbus_value_t *value, uint16_t max_value);
+
+/******************************************************************************/
+
+#endif /* _MODBUS_DECODE_H_ */
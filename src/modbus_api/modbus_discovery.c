@@ -0,0 +1,197 @@
+/*
+ *  modbus_discovery.c
+ *
+ *  Created on: Jan 20, 2022
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include "config.h"
+#include "modbus_table.h"
+#include "modbus_command.h"
+#include "modbus_frame.h"
+#include "modbus_bus.h"
+#include "modbus_discovery.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+/*!
+ * @brief  Scan state
+ */
+typedef struct {
+    modbus_transaction_t transaction;
+    uint8_t *found;
+    uint32_t count;
+    uint32_t max_found;
+    uint32_t probes;
+    uint8_t buffer[MODBUS_COMMAND_MAX_SIZE];
+} modbus_discovery_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static const char* TAG = "DISCOVERY";
+
+#ifdef ELECTRIC_METER_USED
+/* Read address command, taken from the command table */
+static const uint16_t modbus_discovery_address_cmd =
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence) (id == MB_ADDRESS_CMD) ? (address) :
+    MODBUS_ELECTRIC_CMD 0;
+#undef XTABLE_ITEM
+static const uint8_t modbus_discovery_address_size =
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence) (id == MB_ADDRESS_CMD) ? (size) :
+    MODBUS_ELECTRIC_CMD 0;
+#undef XTABLE_ITEM
+#endif
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static modbus_status_t modbus_discovery_probe(modbus_discovery_t *discovery);
+static void modbus_discovery_add(modbus_discovery_t *discovery, const uint8_t *address);
+#ifdef ELECTRIC_METER_USED
+static void modbus_discovery_search(modbus_discovery_t *discovery, uint8_t *address, uint8_t level);
+#endif
+
+/******************************************************************************/
+
+/*!
+ * @brief  Send the probe transaction and wait for its result
+ */
+static modbus_status_t modbus_discovery_probe(modbus_discovery_t *discovery)
+{
+    discovery->probes++;
+    discovery->transaction.status = MODBUS_STATUS_TIMEOUT;    /* Kept when the bus queue is full */
+    modbus_bus_transfer(&discovery->transaction);
+    return discovery->transaction.status;
+}
+
+/*!
+ * @brief  Add a slave address, once
+ */
+static void modbus_discovery_add(modbus_discovery_t *discovery, const uint8_t *address)
+{
+    for(uint32_t i = 0; i < discovery->count; i++)
+    {
+        if(memcmp(&discovery->found[i * MODBUS_SLAVE_ADDRESS_SIZE], address, MODBUS_SLAVE_ADDRESS_SIZE) == 0)
+        {
+            return;
+        }
+    }
+    if(discovery->count < discovery->max_found)
+    {
+        memcpy(&discovery->found[discovery->count * MODBUS_SLAVE_ADDRESS_SIZE], address, MODBUS_SLAVE_ADDRESS_SIZE);
+        discovery->count++;
+    }
+}
+
+#ifdef ELECTRIC_METER_USED
+/*!
+ * @brief  Address bytes from "level" are wildcard. No response: no meter in this branch.
+ *         One valid response: the meter address is in the response. Corrupted response: more
+ *         than one meter answered, fix the next byte to each BCD value (00..99) and search again
+ */
+static void modbus_discovery_search(modbus_discovery_t *discovery, uint8_t *address, uint8_t level)
+{
+    modbus_status_t status;
+
+    memcpy(discovery->transaction.slave, address, sizeof(discovery->transaction.slave));
+    status = modbus_discovery_probe(discovery);
+    if((status == MODBUS_STATUS_OK) || (status == MODBUS_STATUS_EXCEPTION))
+    {
+        ESP_LOGI(TAG, "Found meter "ADDRSTR, ADDR2STR(&discovery->buffer[1]));
+        modbus_discovery_add(discovery, &discovery->buffer[1]);
+        return;
+    }
+    if(status == MODBUS_STATUS_TIMEOUT)
+    {
+        return;
+    }
+    if(level >= 6)
+    {
+        ESP_LOGW(TAG, "Collision on full address "ADDRSTR, ADDR2STR(address));
+        return;
+    }
+
+    /* Address is BCD, byte 0 first */
+    for(uint8_t value = 0; (value < 100) && (discovery->count < discovery->max_found); value++)
+    {
+        address[level] = ((value / 10) << 4) | (value % 10);
+        modbus_discovery_search(discovery, address, level + 1);
+    }
+    address[level] = MODBUS_WILDCARD_BYTE;
+}
+#endif
+
+/******************************************************************************/
+
+/*!
+ * @brief  Find slaves on a bus
+ */
+uint32_t modbus_discovery_scan(uint8_t bus, uint8_t *found, uint32_t max_found)
+{
+    modbus_discovery_t discovery;
+    const modbus_bus_config_t *config = modbus_bus_get_config(bus);
+    TickType_t start = xTaskGetTickCount();
+
+    memset(&discovery, 0, sizeof(discovery));
+    discovery.found = found;
+    discovery.max_found = max_found;
+    discovery.transaction.bus = bus;
+    discovery.transaction.rx_data = discovery.buffer;
+
+#ifdef ELECTRIC_METER_USED
+    uint8_t address[6];
+
+    /* Wildcard reply is the longest when meters send a preamble */
+    discovery.transaction.protocol = MODBUS_PROTOCOL_ELEC;
+    discovery.transaction.address = modbus_discovery_address_cmd;
+    discovery.transaction.size = modbus_discovery_address_size;
+    discovery.transaction.timeout_ms = modbus_command_response_time_ms(config, MODBUS_FRAME_OVERHEAD + 2 + modbus_discovery_address_size + 4);
+    memset(address, MODBUS_WILDCARD_BYTE, sizeof(address));
+    modbus_discovery_search(&discovery, address, 0);
+#else
+    uint8_t id;
+    modbus_status_t status;
+
+    /* Any valid response, exception included, means a slave with this id */
+    discovery.transaction.protocol = MODBUS_PROTOCOL_RTU;
+    discovery.transaction.address = MODBUS_DISCOVERY_PROBE_REGISTER;
+    discovery.transaction.size = 1;
+    discovery.transaction.timeout_ms = modbus_command_response_time_ms(config, RAW_LEN(1) + 5);
+    for(uint16_t i = MODBUS_DISCOVERY_ID_FIRST; (i <= MODBUS_DISCOVERY_ID_LAST) && (discovery.count < max_found); i++)
+    {
+        id = i;
+        discovery.transaction.slave[0] = id;
+        status = modbus_discovery_probe(&discovery);
+        if((status == MODBUS_STATUS_CRC_ERROR) || (status == MODBUS_STATUS_FRAME_ERROR))
+        {
+            /* Something answered, check again before adding it */
+            status = modbus_discovery_probe(&discovery);
+        }
+        if((status == MODBUS_STATUS_OK) || (status == MODBUS_STATUS_EXCEPTION))
+        {
+            ESP_LOGI(TAG, "Found slave %d", id);
+            modbus_discovery_add(&discovery, &id);
+        }
+    }
+#endif
+
+    ESP_LOGI(TAG, "Bus %d: %u slaves found, %u probes in %ums, probe timeout %ums", bus, discovery.count, discovery.probes,
+             (xTaskGetTickCount() - start) * portTICK_RATE_MS, discovery.transaction.timeout_ms);
+    return discovery.count;
+}
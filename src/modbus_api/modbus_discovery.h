@@ -0,0 +1,55 @@
+/*
+ *  modbus_discovery.h
+ *
+ *  Created on: Jan 20, 2022
+ */
+
+#ifndef _MODBUS_DISCOVERY_H_
+#define _MODBUS_DISCOVERY_H_
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdint.h>
+#include "modbus_api.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+/*!
+ * @brief  Find slaves on a bus. Water meter: probe each Modbus id with a short timeout.
+ *         Electric meter: wildcard (0xAA) address search, one address byte more on each collision.
+ *         Blocking, called from the poller task of the bus: no slave of that bus is polled until the scan
+ *         ends, e.g. 17 s for Modbus ids 1 to 247 at 9600 baud. Other buses go on
+ * @param  Bus index
+ *         [out] Addresses found, MODBUS_SLAVE_ADDRESS_SIZE bytes each
+ *         Max number of addresses
+ * @retval Number of slaves found
+ */
+uint32_t modbus_discovery_scan(uint8_t bus, uint8_t *found, uint32_t max_found);
+
+/******************************************************************************/
+
+#endif /* _MODBUS_DISCOVERY_H_ */
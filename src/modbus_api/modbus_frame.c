@@ -0,0 +1,236 @@
+/*
+ *  modbus_frame.c
+ *
+ *  Created on: Jan 18, 2022
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <string.h>
+#include "modbus_command.h"
+#include "modbus_frame.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+enum {
+    FRAME_STATE_START = 0,                            /* Wait first 0x68, skip 0xFE preamble */
+    FRAME_STATE_ADDRESS,
+    FRAME_STATE_START2,
+    FRAME_STATE_CONTROL,
+    FRAME_STATE_LENGTH,
+    FRAME_STATE_DATA,
+    FRAME_STATE_CHECKSUM,
+    FRAME_STATE_END,
+};
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static modbus_frame_result_t modbus_frame_step(modbus_frame_parser_t *parser, uint8_t byte);
+static modbus_frame_result_t modbus_frame_resync(modbus_frame_parser_t *parser);
+
+/******************************************************************************/
+
+/*!
+ * @brief  Parse one byte
+ * @retval MODBUS_FRAME_RESYNC when the byte does not fit the buffered frame, the byte is not stored
+ */
+static modbus_frame_result_t modbus_frame_step(modbus_frame_parser_t *parser, uint8_t byte)
+{
+    switch(parser->state)
+    {
+    case FRAME_STATE_START:
+        if(byte == MODBUS_START_BYTE)
+        {
+            parser->size = 0;
+            parser->sum = 0;
+            parser->state = FRAME_STATE_ADDRESS;
+            break;
+        }
+        if(byte != MODBUS_FRAME_PREAMBLE_BYTE)
+        {
+            parser->skipped++;
+        }
+        return MODBUS_FRAME_INCOMPLETE;
+
+    case FRAME_STATE_ADDRESS:
+        if(parser->size == 6)
+        {
+            parser->state = FRAME_STATE_START2;
+        }
+        break;
+
+    case FRAME_STATE_START2:
+        if(byte != MODBUS_START_BYTE)
+        {
+            return MODBUS_FRAME_RESYNC;
+        }
+        parser->state = FRAME_STATE_CONTROL;
+        break;
+
+    case FRAME_STATE_CONTROL:
+        parser->state = FRAME_STATE_LENGTH;
+        break;
+
+    case FRAME_STATE_LENGTH:
+        if(byte + MODBUS_FRAME_OVERHEAD > parser->max_size)
+        {
+            return MODBUS_FRAME_RESYNC;
+        }
+        parser->state = (byte == 0) ? FRAME_STATE_CHECKSUM : FRAME_STATE_DATA;
+        break;
+
+    case FRAME_STATE_DATA:
+        if(parser->size + 1 == MODBUS_FRAME_DATA_INDEX + parser->frame[MODBUS_FRAME_LENGTH_INDEX])
+        {
+            parser->state = FRAME_STATE_CHECKSUM;
+        }
+        break;
+
+    case FRAME_STATE_CHECKSUM:
+        /* Check sum is not part of the sum */
+        parser->frame[parser->size++] = byte;
+        parser->state = FRAME_STATE_END;
+        return MODBUS_FRAME_INCOMPLETE;
+
+    case FRAME_STATE_END:
+    default:
+        if(byte != MODBUS_END_BYTE)
+        {
+            return MODBUS_FRAME_RESYNC;
+        }
+        parser->frame[parser->size++] = byte;
+        parser->state = FRAME_STATE_START;
+        if(parser->sum != parser->frame[parser->size - 2])
+        {
+            return MODBUS_FRAME_CHECKSUM_ERROR;
+        }
+        if(parser->frame[MODBUS_FRAME_CONTROL_INDEX] & MODBUS_ERROR_FLAG)
+        {
+            return MODBUS_FRAME_ERROR_CODE;
+        }
+        return MODBUS_FRAME_COMPLETE;
+    }
+
+    parser->frame[parser->size++] = byte;
+    parser->sum += byte;
+    return MODBUS_FRAME_INCOMPLETE;
+}
+
+/*!
+ * @brief  The buffered frame is invalid: drop its first 0x68 and parse the remaining bytes again,
+ *         a frame may start inside. Bytes are moved down in place, never overwritten before read
+ * @retval Result of the frame found in the buffered bytes, MODBUS_FRAME_INCOMPLETE if none ended
+ */
+static modbus_frame_result_t modbus_frame_resync(modbus_frame_parser_t *parser)
+{
+    modbus_frame_result_t result;
+    uint8_t *frame = parser->frame;
+    uint16_t count = parser->size;
+    uint16_t i = 1;
+
+    parser->skipped++;
+    parser->size = 0;
+    parser->state = FRAME_STATE_START;
+    while(i < count)
+    {
+        result = modbus_frame_step(parser, frame[i]);
+        if(result == MODBUS_FRAME_INCOMPLETE)
+        {
+            i++;
+            continue;
+        }
+        if(result != MODBUS_FRAME_RESYNC)
+        {
+            /* A whole frame was buffered, bytes after its end byte are dropped as after any frame */
+            return result;
+        }
+
+        /* Again invalid: buffer = partial frame without its start + bytes not parsed yet */
+        memmove(frame, &frame[1], parser->size - 1);
+        memmove(&frame[parser->size - 1], &frame[i], count - i);
+        count = parser->size - 1 + count - i;
+        parser->skipped++;
+        parser->size = 0;
+        parser->state = FRAME_STATE_START;
+        i = 0;
+    }
+    return MODBUS_FRAME_INCOMPLETE;
+}
+
+/******************************************************************************/
+
+/*!
+ * @brief  Start parsing a new frame
+ */
+void modbus_frame_init(modbus_frame_parser_t *parser, uint8_t *frame, uint16_t max_size)
+{
+    parser->state = FRAME_STATE_START;
+    parser->sum = 0;
+    parser->size = 0;
+    parser->max_size = max_size;
+    parser->frame = frame;
+    parser->skipped = 0;
+}
+
+/*!
+ * @brief  Feed one byte
+ */
+modbus_frame_result_t modbus_frame_feed(modbus_frame_parser_t *parser, uint8_t byte)
+{
+    modbus_frame_result_t result;
+
+    while((result = modbus_frame_step(parser, byte)) == MODBUS_FRAME_RESYNC)
+    {
+        result = modbus_frame_resync(parser);
+        if(result != MODBUS_FRAME_INCOMPLETE)
+        {
+            /* The frame ended before "byte", which is dropped with the bytes after it */
+            return result;
+        }
+    }
+    return result;
+}
+
+/*!
+ * @brief  Feed bytes until a frame ends
+ */
+modbus_frame_result_t modbus_frame_feed_buffer(modbus_frame_parser_t *parser, const uint8_t *data, uint16_t length, uint16_t *used)
+{
+    modbus_frame_result_t result = MODBUS_FRAME_INCOMPLETE;
+    uint16_t i;
+
+    for(i = 0; (i < length) && (result == MODBUS_FRAME_INCOMPLETE); i++)
+    {
+        result = modbus_frame_feed(parser, data[i]);
+    }
+    *used = i;
+    return result;
+}
+
+/*!
+ * @brief  Data length field of the frame being parsed
+ */
+uint8_t modbus_frame_data_length(const modbus_frame_parser_t *parser)
+{
+    return (parser->size > MODBUS_FRAME_LENGTH_INDEX) ? parser->frame[MODBUS_FRAME_LENGTH_INDEX] : 0;
+}
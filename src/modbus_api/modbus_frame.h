@@ -0,0 +1,102 @@
+/*
+ *  modbus_frame.h
+ *
+ *  Created on: Jan 18, 2022
+ */
+
+#ifndef _MODBUS_FRAME_H_
+#define _MODBUS_FRAME_H_
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+/* Frame: [FE..FE] 68 A0 A1 A2 A3 A4 A5 68 C L D0..DL-1 CS 16 */
+#define MODBUS_FRAME_PREAMBLE_BYTE                    0xFE
+#define MODBUS_FRAME_CONTROL_INDEX                    8
+#define MODBUS_FRAME_LENGTH_INDEX                     9
+#define MODBUS_FRAME_DATA_INDEX                       10
+#define MODBUS_FRAME_OVERHEAD                         12    /* Header 10 bytes + check sum + end byte */
+
+typedef uint8_t modbus_frame_result_t;
+enum {
+    MODBUS_FRAME_INCOMPLETE = 0,                      /* Need more bytes */
+    MODBUS_FRAME_COMPLETE,                            /* Valid frame */
+    MODBUS_FRAME_ERROR_CODE,                          /* Valid frame with error flag in control byte */
+    MODBUS_FRAME_CHECKSUM_ERROR,                      /* Frame ended, check sum mismatch */
+    MODBUS_FRAME_RESYNC,                              /* Internal, partial frame is invalid */
+};
+
+/*!
+ * @brief  Incremental parser state, frame is stored without preamble
+ */
+typedef struct {
+    uint8_t state;
+    uint8_t sum;                                      /* Running check sum */
+    uint16_t size;                                    /* Bytes stored in frame */
+    uint16_t max_size;
+    uint8_t *frame;
+    uint32_t skipped;                                 /* Bytes dropped while looking for a frame */
+} modbus_frame_parser_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+/*!
+ * @brief  Start parsing a new frame
+ * @param  Parser
+ *         Buffer to store frame and its size
+ * @retval None
+ */
+void modbus_frame_init(modbus_frame_parser_t *parser, uint8_t *frame, uint16_t max_size);
+
+/*!
+ * @brief  Feed one byte. Skip preamble and noise, find 68 .. 68 header, check length and
+ *         check sum on the fly, report the frame as soon as the end byte arrives
+ * @param  Parser, received byte
+ * @retval MODBUS_FRAME_INCOMPLETE until a frame ends. A frame found in the bytes buffered before ends
+ *         ahead of "byte", which is then dropped
+ */
+modbus_frame_result_t modbus_frame_feed(modbus_frame_parser_t *parser, uint8_t byte);
+
+/*!
+ * @brief  Feed bytes until a frame ends
+ * @param  Parser
+ *         Data and length
+ *         [out] Number of bytes consumed
+ * @retval Result of the last byte consumed
+ */
+modbus_frame_result_t modbus_frame_feed_buffer(modbus_frame_parser_t *parser, const uint8_t *data, uint16_t length, uint16_t *used);
+
+/*!
+ * @brief  Data length field of the frame being parsed
+ * @param  Parser
+ * @retval L field
+ */
+uint8_t modbus_frame_data_length(const modbus_frame_parser_t *parser);
+
+/******************************************************************************/
+
+#endif /* _MODBUS_FRAME_H_ */
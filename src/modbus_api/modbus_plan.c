@@ -0,0 +1,284 @@
+/*
+ *  modbus_plan.c
+ *
+ *  Created on: Mar 11, 2022
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "modbus_plan.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define MODBUS_PLAN_SLOT_MASK                         0x7F
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static bool modbus_plan_number(const char **text, uint32_t max, uint32_t *value);
+static bool modbus_plan_address(const char **text, uint8_t *address);
+static bool modbus_plan_parse_slaves(const char **text, modbus_plan_change_t *change);
+static bool modbus_plan_parse_group(const char **text, modbus_group_id group, modbus_plan_change_t *change);
+
+/******************************************************************************/
+
+/*!
+ * @brief  Initialize a store, the poller owns slot 0
+ */
+void modbus_plan_store_init(modbus_plan_store_t *store, const modbus_plan_t *plan)
+{
+    memcpy(&store->plan[0], plan, sizeof(modbus_plan_t));
+    store->front = 0;
+    store->latest = 0;
+    store->back = 2;
+    atomic_init(&store->middle, 1);
+}
+
+/*!
+ * @brief  Copy the latest plan into the slot of the builder. The latest plan is in the middle or
+ *         the front slot, never written by the poller
+ */
+modbus_plan_t* modbus_plan_edit(modbus_plan_store_t *store)
+{
+    modbus_plan_t *plan = &store->plan[store->back];
+
+    memcpy(plan, &store->plan[store->latest], sizeof(modbus_plan_t));
+    plan->version++;
+    return plan;
+}
+
+/*!
+ * @brief  Trade the slot of the builder for the middle one
+ */
+void modbus_plan_publish(modbus_plan_store_t *store)
+{
+    store->latest = store->back;
+    store->back = atomic_exchange(&store->middle, store->back | MODBUS_PLAN_NEW) & MODBUS_PLAN_SLOT_MASK;
+}
+
+/*!
+ * @brief  Get the plan last published
+ */
+const modbus_plan_t* modbus_plan_latest(const modbus_plan_store_t *store)
+{
+    return &store->plan[store->latest];
+}
+
+/*!
+ * @brief  Check for a published plan
+ */
+bool modbus_plan_is_pending(modbus_plan_store_t *store)
+{
+    return (atomic_load(&store->middle) & MODBUS_PLAN_NEW) != 0;
+}
+
+/*!
+ * @brief  Trade the slot of the poller for the middle one, if published
+ */
+const modbus_plan_t* modbus_plan_take(modbus_plan_store_t *store)
+{
+    if(!modbus_plan_is_pending(store))
+    {
+        return NULL;
+    }
+    store->front = atomic_exchange(&store->middle, store->front) & MODBUS_PLAN_SLOT_MASK;
+    return &store->plan[store->front];
+}
+
+/*!
+ * @brief  Get the active plan
+ */
+const modbus_plan_t* modbus_plan_active(const modbus_plan_store_t *store)
+{
+    return &store->plan[store->front];
+}
+
+/******************************************************************************/
+
+/*!
+ * @brief  Decimal number up to "max", text is moved past it
+ */
+static bool modbus_plan_number(const char **text, uint32_t max, uint32_t *value)
+{
+    char *end;
+    unsigned long number;
+
+    if((**text < '0') || (**text > '9'))
+    {
+        return false;
+    }
+    number = strtoul(*text, &end, 10);
+    if(number > max)
+    {
+        return false;
+    }
+    *value = (uint32_t) number;
+    *text = end;
+    return true;
+}
+
+/*!
+ * @brief  Slave address: Modbus id, or meter address in hex as printed in the log
+ */
+static bool modbus_plan_address(const char **text, uint8_t *address)
+{
+#ifdef ELECTRIC_METER_USED
+    char digit[3] = {0};
+
+    if(strspn(*text, "0123456789abcdefABCDEF") != (MODBUS_SLAVE_ADDRESS_SIZE * 2))
+    {
+        return false;
+    }
+    for(uint8_t i = 0; i < MODBUS_SLAVE_ADDRESS_SIZE; i++)
+    {
+        memcpy(digit, &(*text)[i * 2], 2);
+        address[i] = (uint8_t) strtoul(digit, NULL, 16);
+    }
+    *text += MODBUS_SLAVE_ADDRESS_SIZE * 2;
+    return true;
+#else
+    uint32_t id;
+
+    if(!modbus_plan_number(text, 247, &id) || (id == 0))
+    {
+        return false;
+    }
+    address[0] = (uint8_t) id;
+    return true;
+#endif
+}
+
+/*!
+ * @brief  List of slaves, comma separated
+ */
+static bool modbus_plan_parse_slaves(const char **text, modbus_plan_change_t *change)
+{
+    change->slave_count = 0;
+    while(1)
+    {
+        if((change->slave_count >= MAX_SLAVE_ID) || !modbus_plan_address(text, change->slave[change->slave_count]))
+        {
+            return false;
+        }
+        change->slave_count++;
+        if(**text != ',')
+        {
+            break;
+        }
+        (*text)++;
+    }
+    change->fields |= MODBUS_PLAN_SLAVES;
+    return true;
+}
+
+/*!
+ * @brief  Period of a group, then its registers if given
+ */
+static bool modbus_plan_parse_group(const char **text, modbus_group_id group, modbus_plan_change_t *change)
+{
+    uint32_t first, last;
+
+    if(!modbus_plan_number(text, UINT32_MAX, &change->group[group].period))
+    {
+        return false;
+    }
+    change->period_set |= (1UL << group);
+    if(**text != ':')
+    {
+        return true;
+    }
+
+    (*text)++;
+    if(!modbus_plan_number(text, MODBUS_REG_COUNT - 1, &first) || (**text != '-'))
+    {
+        return false;
+    }
+    (*text)++;
+    if(!modbus_plan_number(text, MODBUS_REG_COUNT - 1, &last) || (first > last))
+    {
+        return false;
+    }
+    change->group[group].first = (modbus_reg_id) first;
+    change->group[group].last = (modbus_reg_id) last;
+    change->range_set |= (1UL << group);
+    return true;
+}
+
+/*!
+ * @brief  Parse a plan command
+ */
+bool modbus_plan_parse(const char *command, modbus_plan_change_t *change)
+{
+    const char *text = command;
+    bool bus = false;
+    uint32_t value = 0;
+    bool valid;
+
+    memset(change, 0, sizeof(modbus_plan_change_t));
+    while(1)
+    {
+        text += strspn(text, " \t\r\n");
+        if(*text == '\0')
+        {
+            break;
+        }
+
+        if(strncmp(text, "bus=", 4) == 0)
+        {
+            text += 4;
+            valid = modbus_plan_number(&text, UINT8_MAX, &value);
+            change->bus = (uint8_t) value;
+            bus = true;
+        }
+        else if(strncmp(text, "slaves=", 7) == 0)
+        {
+            text += 7;
+            valid = modbus_plan_parse_slaves(&text, change);
+        }
+        else if(strncmp(text, "gap=", 4) == 0)
+        {
+            text += 4;
+            valid = modbus_plan_number(&text, MODBUS_READ_MAX_REGS, &value);
+            change->gap = (uint16_t) value;
+            change->fields |= MODBUS_PLAN_GAP;
+        }
+        else if(text[0] == 'g')
+        {
+            text++;
+            valid = modbus_plan_number(&text, MODBUS_GROUP_COUNT - 1, &value) && (*text++ == '=') &&
+                    modbus_plan_parse_group(&text, (modbus_group_id) value, change);
+        }
+        else
+        {
+            valid = false;
+        }
+
+        /* Each word ends at a space */
+        if(!valid || ((*text != '\0') && (strchr(" \t\r\n", *text) == NULL)))
+        {
+            return false;
+        }
+    }
+    return bus;
+}
@@ -0,0 +1,184 @@
+/*
+ *  modbus_plan.h
+ *
+ *  Created on: Mar 11, 2022
+ */
+
+#ifndef _MODBUS_PLAN_H_
+#define _MODBUS_PLAN_H_
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "config.h"
+#include "modbus_data.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define MODBUS_PLAN_SLOTS                             3     /* Taken by the poller, published, being built */
+#define MODBUS_PLAN_NEW                               0x80  /* Flag of the published slot, not taken yet */
+
+/* Fields of a plan command */
+#define MODBUS_PLAN_SLAVES                            0x01
+#define MODBUS_PLAN_GAP                               0x02
+
+/*!
+ * @brief  One function 04 read, cover registers "first" to "last"
+ */
+typedef struct {
+    uint16_t address;
+    uint16_t num_reg;
+    modbus_reg_id first;
+    modbus_reg_id last;
+} modbus_read_t;
+
+/*!
+ * @brief  Reads needed to get REPORT registers of a range
+ */
+typedef struct {
+    uint8_t count;
+    modbus_read_t read[MODBUS_READ_PLAN_SIZE];
+} modbus_read_plan_t;
+
+/*!
+ * @brief  Poll group of a plan, registers "first" to "last" read every "period" ms, 0 is not polled
+ */
+typedef struct {
+    modbus_reg_id first;
+    modbus_reg_id last;
+    uint32_t period;
+} modbus_plan_group_t;
+
+/*!
+ * @brief  What a poller reads. Never changed once published, a new version replaces it
+ */
+typedef struct {
+    uint32_t version;
+    uint8_t protocol;                                 /* modbus_protocol_t, set by the meter type of the firmware */
+    uint8_t slave_count;
+    uint8_t slave[MAX_SLAVE_ID];                      /* Slaves polled, index in the slave list of the bus */
+    uint16_t gap;                                     /* Unused registers read to merge two reads */
+    modbus_plan_group_t group[MODBUS_GROUP_COUNT];
+#ifndef ELECTRIC_METER_USED
+    modbus_read_plan_t read[MODBUS_GROUP_COUNT];      /* Reads of each group, built with the plan */
+#endif
+} modbus_plan_t;
+
+/*!
+ * @brief  Plans of a bus, triple buffered. The builder and the poller each own a slot and trade it for the
+ *         middle one with an atomic exchange, so the poller never waits and never sees a plan being built
+ */
+typedef struct {
+    modbus_plan_t plan[MODBUS_PLAN_SLOTS];
+    _Atomic uint8_t middle;                           /* Slot index, MODBUS_PLAN_NEW when published */
+    uint8_t back;                                     /* Slot of the builder */
+    uint8_t latest;                                   /* Slot last published by the builder */
+    uint8_t front;                                    /* Slot of the poller, its active plan */
+} modbus_plan_store_t;
+
+/*!
+ * @brief  Change to the plan of a bus, from a command. Fields not set are kept
+ */
+typedef struct {
+    uint8_t bus;
+    uint8_t fields;                                   /* MODBUS_PLAN_SLAVES, ... */
+    uint8_t slave_count;
+    uint8_t slave[MAX_SLAVE_ID][MODBUS_SLAVE_ADDRESS_SIZE];
+    uint16_t gap;
+    uint32_t period_set;                              /* Bit per group with a new period */
+    uint32_t range_set;                               /* Bit per group with new registers */
+    modbus_plan_group_t group[MODBUS_GROUP_COUNT];
+} modbus_plan_change_t;
+
+_Static_assert(MODBUS_GROUP_COUNT <= 32, "modbus_plan_change_t has a bit per group");
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+/*!
+ * @brief  Initialize a store with its first plan, active at once
+ * @param  Store, plan version 1
+ * @retval None
+ */
+void modbus_plan_store_init(modbus_plan_store_t *store, const modbus_plan_t *plan);
+
+/*!
+ * @brief  Get a free plan to build, a copy of the latest one with the next version.
+ *         Builders must not run at the same time, the caller locks
+ * @param  Store
+ * @retval Plan to fill then give to modbus_plan_publish()
+ */
+modbus_plan_t* modbus_plan_edit(modbus_plan_store_t *store);
+
+/*!
+ * @brief  Publish the plan built from modbus_plan_edit(). A plan published before and not taken yet is replaced
+ * @param  Store
+ * @retval None
+ */
+void modbus_plan_publish(modbus_plan_store_t *store);
+
+/*!
+ * @brief  Get the plan last published, builder side
+ * @param  Store
+ * @retval Plan
+ */
+const modbus_plan_t* modbus_plan_latest(const modbus_plan_store_t *store);
+
+/*!
+ * @brief  Check for a published plan, poller side
+ * @param  Store
+ * @retval True if a plan waits to be taken
+ */
+bool modbus_plan_is_pending(modbus_plan_store_t *store);
+
+/*!
+ * @brief  Take the published plan, poller side, when nothing of the active plan is in use any more
+ * @param  Store
+ * @retval New active plan, NULL if none was published
+ */
+const modbus_plan_t* modbus_plan_take(modbus_plan_store_t *store);
+
+/*!
+ * @brief  Get the active plan, poller side
+ * @param  Store
+ * @retval Plan
+ */
+const modbus_plan_t* modbus_plan_active(const modbus_plan_store_t *store);
+
+/*!
+ * @brief  Parse a plan command, words separated by spaces:
+ *           bus=<n>                  bus index, required
+ *           slaves=<a>,<b>,...       slaves polled: Modbus ids, or meter addresses in 12 hex digits
+ *           g<n>=<ms>[:<first>-<last>]  period of group n, 0 to stop it, and its register ids
+ *           gap=<n>                  unused registers read to merge two reads
+ *         e.g. "bus=0 slaves=1,2,7 g1=1000 g3=0 g5=60000:20-24"
+ * @param  Command, zero terminated
+ *         [out] Change
+ * @retval True if the command is valid
+ */
+bool modbus_plan_parse(const char *command, modbus_plan_change_t *change);
+
+/******************************************************************************/
+
+#endif /* _MODBUS_PLAN_H_ */
@@ -0,0 +1,205 @@
+/*
+ *  modbus_report.c
+ *
+ *  Created on: Feb 24, 2022
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <math.h>
+#include <stdbool.h>
+#include "config.h"
+#include "modbus_table.h"
+#include "modbus_decode.h"
+#include "modbus_report.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+/*!
+ * @brief  Report policy of a register
+ */
+typedef struct {
+    uint16_t offset;                                  /* Slot in table layout, in byte */
+    uint16_t size;                                    /* In byte */
+    uint8_t flag;
+    modbus_report_policy_t policy;
+    float threshold;
+    uint32_t silence;                                 /* In second, 0 for never */
+} modbus_report_item_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+#ifdef ELECTRIC_METER_USED
+static const modbus_report_item_t modbus_report_table[MODBUS_REG_COUNT] = {
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence)                                          \
+    { MB_ELEC_OFFSET(name), size, flag, MB_REPORT_##report, threshold, silence },
+    MODBUS_ELECTRIC_CMD
+#undef XTABLE_ITEM
+};
+#else
+static const modbus_report_item_t modbus_report_table[MODBUS_REG_COUNT] = {
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence)                                          \
+    { MB_WATER_OFFSET(name) * 2, (size) * 2, flag, MB_REPORT_##report, threshold, silence },
+    MODBUS_WATER_INPUT_REGS
+#undef XTABLE_ITEM
+};
+#endif
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static bool modbus_report_moved(const modbus_report_item_t *item, const modbus_value_t *value, const modbus_value_t *last);
+
+/******************************************************************************/
+
+/*!
+ * @brief  Check if an element moved past the deadband of its register
+ */
+static bool modbus_report_moved(const modbus_report_item_t *item, const modbus_value_t *value, const modbus_value_t *last)
+{
+    float diff, base;
+
+    switch(item->policy)
+    {
+    case MB_REPORT_ALWAYS:
+        return true;
+    case MB_REPORT_REFRESH:
+        return false;
+    case MB_REPORT_CHANGE:
+        return (value->u32 != last->u32);
+    default:
+        break;
+    }
+
+    /* Difference of integers first, float loses digits of large counters */
+    switch(value->type)
+    {
+    case MB_TYPE_INT32:
+    case MB_TYPE_INT32_WS:
+        diff = (float) ((int64_t) value->i32 - last->i32);
+        base = (float) last->i32;
+        break;
+    case MB_TYPE_FLOAT32:
+        diff = value->f32 - last->f32;
+        base = last->f32;
+        break;
+    default:
+        diff = (float) ((int64_t) value->u32 - last->u32);
+        base = (float) last->u32;
+        break;
+    }
+
+    if(item->policy == MB_REPORT_PCT)
+    {
+        return (base == 0.0f) ? (diff != 0.0f) : (fabsf(diff) > item->threshold * fabsf(base) / 100.0f);
+    }
+    return (fabsf(diff) > item->threshold);
+}
+
+/******************************************************************************/
+
+/*!
+ * @brief  Find the registers of a reading to report
+ */
+modbus_report_mask_t modbus_report_check(modbus_report_t *report, const modbus_report_last_t *last, const uint8_t *slave,
+                                         const modbus_data_t *data)
+{
+    const modbus_report_item_t *item;
+    modbus_report_mask_t moved = 0, mask = 0, bit;
+    bool known = (memcmp(last->slave, slave, MODBUS_SLAVE_ADDRESS_SIZE) == 0);
+    uint16_t count;
+
+    if((data->start > data->stop) || (data->stop >= MODBUS_REG_COUNT))
+    {
+        return MODBUS_REPORT_ALL;
+    }
+    report->stats.readings++;
+
+    /* Both are laid out from the start register, values of each register line up */
+    count = MODBUS_DECODE(data->start, data->stop, data->data, REPORT, report->value, MODBUS_DATA_SIZE);
+    MODBUS_DECODE(data->start, data->stop, &last->data[modbus_report_table[data->start].offset], REPORT,
+                  report->last_value, MODBUS_DATA_SIZE);
+    for(uint16_t i = 0; i < count; i++)
+    {
+        if(modbus_report_moved(&modbus_report_table[report->value[i].reg], &report->value[i], &report->last_value[i]))
+        {
+            moved |= MODBUS_REPORT_BIT(report->value[i].reg);
+        }
+    }
+
+    for(modbus_reg_id reg = data->start; reg <= data->stop; reg++)
+    {
+        item = &modbus_report_table[reg];
+        bit = MODBUS_REPORT_BIT(reg);
+        if(!(item->flag & REPORT))
+        {
+            continue;
+        }
+        report->stats.regs_checked++;
+        if(!known || !(last->reported & bit) || (moved & bit))
+        {
+            mask |= bit;
+        }
+        else if((item->silence > 0) && ((int32_t) (data->time - last->time[reg]) >= (int32_t) item->silence))
+        {
+            mask |= bit;
+            report->stats.regs_refreshed++;
+        }
+        if(mask & bit)
+        {
+            report->stats.regs_reported++;
+        }
+    }
+
+    if(mask == 0)
+    {
+        report->stats.suppressed++;
+    }
+    return mask;
+}
+
+/*!
+ * @brief  Remember the reported registers of a reading
+ */
+void modbus_report_commit(modbus_report_last_t *last, const uint8_t *slave, const modbus_data_t *data)
+{
+    const modbus_report_item_t *item;
+    uint16_t base;
+
+    if((data->start > data->stop) || (data->stop >= MODBUS_REG_COUNT))
+    {
+        return;
+    }
+    if(memcmp(last->slave, slave, MODBUS_SLAVE_ADDRESS_SIZE) != 0)
+    {
+        memset(last, 0, sizeof(modbus_report_last_t));
+        memcpy(last->slave, slave, MODBUS_SLAVE_ADDRESS_SIZE);
+    }
+
+    base = modbus_report_table[data->start].offset;
+    for(modbus_reg_id reg = data->start; reg <= data->stop; reg++)
+    {
+        item = &modbus_report_table[reg];
+        if(data->report & MODBUS_REPORT_BIT(reg))
+        {
+            memcpy(&last->data[item->offset], &data->data[item->offset - base], item->size);
+            last->time[reg] = data->time;
+            last->reported |= MODBUS_REPORT_BIT(reg);
+        }
+    }
+}
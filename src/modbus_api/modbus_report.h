@@ -0,0 +1,88 @@
+/*
+ *  modbus_report.h
+ *
+ *  Created on: Feb 24, 2022
+ */
+
+#ifndef _MODBUS_REPORT_H_
+#define _MODBUS_REPORT_H_
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdint.h>
+#include "modbus_data.h"
+#include "modbus_decode.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+/*!
+ * @brief  Last report of a slave, registers are checked against it with the report policy of the table
+ */
+typedef struct {
+    uint8_t slave[MODBUS_SLAVE_ADDRESS_SIZE];         /* Slave the values belong to, another slave starts over */
+    modbus_report_mask_t reported;                    /* Registers reported at least once */
+    uint32_t time[MODBUS_REG_COUNT];                  /* Time of the last report of each register */
+    uint8_t data[MODBUS_DATA_SIZE];                   /* Reported data, one slot per register in table order */
+} modbus_report_last_t;
+
+/*!
+ * @brief  Report statistics, REPORT registers only
+ */
+typedef struct {
+    uint32_t readings;                                /* Readings checked */
+    uint32_t suppressed;                              /* Readings with nothing to report */
+    uint32_t regs_checked;
+    uint32_t regs_reported;
+    uint32_t regs_refreshed;                          /* Reported only because their silence was due */
+} modbus_report_stats_t;
+
+/*!
+ * @brief  Report filter of one poller, values are decoded in its scratch buffers
+ */
+typedef struct {
+    modbus_value_t value[MODBUS_DATA_SIZE];
+    modbus_value_t last_value[MODBUS_DATA_SIZE];
+    modbus_report_stats_t stats;
+} modbus_report_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+/*!
+ * @brief  Find the registers of a reading to report: first report, past their deadband, or silent for too long
+ * @param  Filter, last report of the slave, slave address (MODBUS_SLAVE_ADDRESS_SIZE bytes)
+ *         Reading, its time is compared with the last report
+ * @retval Registers to report, 0 if none
+ */
+modbus_report_mask_t modbus_report_check(modbus_report_t *report, const modbus_report_last_t *last, const uint8_t *slave,
+                                         const modbus_data_t *data);
+
+/*!
+ * @brief  Remember the registers "data->report" of a reading as reported
+ * @param  Last report of the slave, slave address, reading
+ * @retval None
+ */
+void modbus_report_commit(modbus_report_last_t *last, const uint8_t *slave, const modbus_data_t *data);
+
+/******************************************************************************/
+
+#endif /* _MODBUS_REPORT_H_ */
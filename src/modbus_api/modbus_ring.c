@@ -0,0 +1,138 @@
+/*
+ *  modbus_ring.c
+ *
+ *  Created on: Jan 25, 2022
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <string.h>
+#include "modbus_ring.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+/*!
+ * @brief  Ring initialization
+ */
+void modbus_ring_init(modbus_ring_t *ring, void *storage, uint32_t slot_size, uint32_t size)
+{
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->held, MODBUS_RING_NONE);
+    ring->mask = size - 1;
+    ring->slot_size = slot_size;
+    ring->slot = (uint8_t*) storage;
+    memset(&ring->stats, 0, sizeof(ring->stats));
+}
+
+/*!
+ * @brief  Producer: get the next slot to fill in place
+ */
+void* modbus_ring_produce(modbus_ring_t *ring)
+{
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load(&ring->tail);
+
+    /* Full: drop the oldest. If the consumer takes it first there is room anyway */
+    if((head - tail) >= ring->mask)
+    {
+        if(atomic_compare_exchange_strong(&ring->tail, &tail, tail + 1))
+        {
+            ring->stats.overwritten++;
+        }
+    }
+
+    /* The consumer only holds slots behind tail, this happens when the producer laps it */
+    if((head & ring->mask) == atomic_load(&ring->held))
+    {
+        ring->stats.dropped++;
+        return NULL;
+    }
+    return &ring->slot[(head & ring->mask) * ring->slot_size];
+}
+
+/*!
+ * @brief  Producer: publish the slot
+ */
+void modbus_ring_commit(modbus_ring_t *ring)
+{
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed) + 1;
+    uint32_t count;
+
+    atomic_store_explicit(&ring->head, head, memory_order_release);
+    ring->stats.written++;
+    count = head - atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if(count > ring->stats.high_water)
+    {
+        ring->stats.high_water = count;
+    }
+}
+
+/*!
+ * @brief  Consumer: take the oldest unread slot. The slot is marked held before tail moves,
+ *         so the producer never writes it once the consumer owns it
+ */
+void* modbus_ring_acquire(modbus_ring_t *ring)
+{
+    uint32_t tail = atomic_load(&ring->tail);
+
+    do
+    {
+        if(tail == atomic_load_explicit(&ring->head, memory_order_acquire))
+        {
+            atomic_store(&ring->held, MODBUS_RING_NONE);
+            return NULL;
+        }
+        atomic_store(&ring->held, tail & ring->mask);
+    } while(!atomic_compare_exchange_strong(&ring->tail, &tail, tail + 1));
+
+    return &ring->slot[(tail & ring->mask) * ring->slot_size];
+}
+
+/*!
+ * @brief  Consumer: give back the slot
+ */
+void modbus_ring_release(modbus_ring_t *ring)
+{
+    atomic_store_explicit(&ring->held, MODBUS_RING_NONE, memory_order_release);
+}
+
+/*!
+ * @brief  Number of unread slots, a snapshot when called by the producer or the consumer
+ */
+uint32_t modbus_ring_count(modbus_ring_t *ring)
+{
+    return atomic_load(&ring->head) - atomic_load(&ring->tail);
+}
+
+/*!
+ * @brief  Get ring statistics
+ */
+void modbus_ring_get_stats(modbus_ring_t *ring, modbus_ring_stats_t *stats)
+{
+    memcpy(stats, &ring->stats, sizeof(modbus_ring_stats_t));
+}
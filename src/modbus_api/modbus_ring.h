@@ -0,0 +1,119 @@
+/*
+ *  modbus_ring.h
+ *
+ *  Created on: Jan 25, 2022
+ */
+
+#ifndef _MODBUS_RING_H_
+#define _MODBUS_RING_H_
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define MODBUS_RING_NONE                              0xFFFFFFFF    /* No slot held */
+
+/*!
+ * @brief  Ring statistics
+ */
+typedef struct {
+    uint32_t written;                                 /* Slots committed */
+    uint32_t overwritten;                             /* Oldest unread slots dropped when full */
+    uint32_t dropped;                                 /* New slots dropped, slot was held by consumer */
+    uint32_t high_water;                              /* Max unread slots */
+} modbus_ring_stats_t;
+
+/*!
+ * @brief  Single producer, single consumer ring of fixed size slots. Head and tail are free running
+ *         counters, the producer moves tail too when it overwrites the oldest slot
+ */
+typedef struct {
+    _Atomic uint32_t head;                            /* Next slot to write, moved by producer */
+    _Atomic uint32_t tail;                            /* Oldest unread slot, moved by consumer or overwrite */
+    _Atomic uint32_t held;                            /* Slot index read by consumer, MODBUS_RING_NONE */
+    uint32_t mask;                                    /* Number of slots - 1 */
+    uint32_t slot_size;
+    uint8_t *slot;
+    modbus_ring_stats_t stats;                        /* Written by producer only */
+} modbus_ring_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+/*!
+ * @brief  Ring initialization
+ * @param  Ring
+ *         Slot storage, "size" slots of "slot_size" bytes
+ *         Number of slots, power of 2. At most size - 1 slots are unread
+ * @retval None
+ */
+void modbus_ring_init(modbus_ring_t *ring, void *storage, uint32_t slot_size, uint32_t size);
+
+/*!
+ * @brief  Producer: get the next slot to fill in place. When full the oldest unread slot is dropped
+ * @param  Ring
+ * @retval Slot, NULL if the slot is held by the consumer (the new data is dropped)
+ */
+void* modbus_ring_produce(modbus_ring_t *ring);
+
+/*!
+ * @brief  Producer: publish the slot got from modbus_ring_produce()
+ * @param  Ring
+ * @retval None
+ */
+void modbus_ring_commit(modbus_ring_t *ring);
+
+/*!
+ * @brief  Consumer: take the oldest unread slot, read in place until modbus_ring_release()
+ * @param  Ring
+ * @retval Slot, NULL if empty
+ */
+void* modbus_ring_acquire(modbus_ring_t *ring);
+
+/*!
+ * @brief  Consumer: give back the slot got from modbus_ring_acquire()
+ * @param  Ring
+ * @retval None
+ */
+void modbus_ring_release(modbus_ring_t *ring);
+
+/*!
+ * @brief  Get the number of unread slots
+ * @param  Ring
+ * @retval Unread slots
+ */
+uint32_t modbus_ring_count(modbus_ring_t *ring);
+
+/*!
+ * @brief  Get ring statistics
+ * @param  Ring
+ *         [out] Statistics
+ * @retval None
+ */
+void modbus_ring_get_stats(modbus_ring_t *ring, modbus_ring_stats_t *stats);
+
+/******************************************************************************/
+
+#endif /* _MODBUS_RING_H_ */
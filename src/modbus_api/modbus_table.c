@@ -0,0 +1,81 @@
+/*
+ *  modbus_table.c
+ *
+ *  Created on: Feb 16, 2022
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include "modbus_table.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+const uint16_t modbus_water_offset[MB_WATER_NUMBER_OF_REG + 1] = {
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence) MB_WATER_OFFSET(name),
+    MODBUS_WATER_INPUT_REGS
+#undef XTABLE_ITEM
+    sizeof(modbus_water_map_t) / sizeof(uint16_t)
+};
+
+const uint16_t modbus_elec_offset[MB_ELEC_NUMBER_OF_CMD + 1] = {
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence) MB_ELEC_OFFSET(name),
+    MODBUS_ELECTRIC_CMD
+#undef XTABLE_ITEM
+    sizeof(modbus_elec_map_t)
+};
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+
+/*!
+ * @brief  Find water meter register by address
+ */
+modbus_reg_id modbus_table_water_find(uint16_t reg_address)
+{
+    switch(reg_address)
+    {
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence) case (address): return id;
+    MODBUS_WATER_INPUT_REGS
+#undef XTABLE_ITEM
+    default:
+        return MB_WATER_INVALID_ID;
+    }
+}
+
+/*!
+ * @brief  Find electric meter command by its data identifier
+ */
+modbus_elec_cmd_id modbus_table_elec_find(uint16_t command)
+{
+    switch(command)
+    {
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence) case (address): return id;
+    MODBUS_ELECTRIC_CMD
+#undef XTABLE_ITEM
+    default:
+        return MB_ELEC_INVALID_CMD;
+    }
+}
@@ -14,6 +14,7 @@
 /******************************************************************************/
 
 #include <stdint.h>
+#include <stddef.h>
 
 /******************************************************************************/
 /*                     EXPORTED TYPES and DEFINITIONS                         */
@@ -22,79 +23,218 @@
 #define FLAG_NONE                                     0x00
 #define REPORT                                        0x01
 
+/* Wire type of a register or command, the value is made of "size" / MB_TYPE_SIZE elements of this type.
+ * Water meter registers are big endian, electric meter data is low byte first */
+typedef uint8_t modbus_wire_type_t;
+enum {
+    MB_TYPE_INT32 = 0,                                /* Signed, high word first */
+    MB_TYPE_INT32_WS,                                 /* Signed, low word first (word swapped) */
+    MB_TYPE_FLOAT32,                                  /* IEEE 754, high word first */
+    MB_TYPE_UINT16,
+    MB_TYPE_BCD3,                                     /* 6 digits */
+    MB_TYPE_BCD4,                                     /* 8 digits */
+    MB_TYPE_DATE,                                     /* BCD week day, day, month, year: value is YYYYMMDD */
+    MB_TYPE_TIME,                                     /* BCD second, minute, hour: value is hhmmss */
+    MB_TYPE_RAW,                                      /* Bytes, one value per byte */
+    MB_TYPE_COUNT
+};
+
+/* Size in byte of one element of each wire type */
+#define MB_TYPE_SIZE_INT32                            4
+#define MB_TYPE_SIZE_INT32_WS                         4
+#define MB_TYPE_SIZE_FLOAT32                          4
+#define MB_TYPE_SIZE_UINT16                           2
+#define MB_TYPE_SIZE_BCD3                             3
+#define MB_TYPE_SIZE_BCD4                             4
+#define MB_TYPE_SIZE_DATE                             4
+#define MB_TYPE_SIZE_TIME                             3
+#define MB_TYPE_SIZE_RAW                              1
+
+/* Report policy of a REPORT register, checked on each reading against the last reported value.
+ * A register is also reported when "silence" seconds passed since its last report, 0 for never */
+typedef uint8_t modbus_report_policy_t;
+enum {
+    MB_REPORT_ALWAYS = 0,                             /* Every reading */
+    MB_REPORT_CHANGE,                                 /* Any element changed */
+    MB_REPORT_ABS,                                    /* An element moved more than "threshold" */
+    MB_REPORT_PCT,                                    /* An element moved more than "threshold" percent of its last value */
+    MB_REPORT_REFRESH,                                /* Only when "silence" is due */
+};
+
+#define MB_WATER_REG_MAX_SIZE                         125   /* Registers of one function 04 read */
+#define MB_ELEC_CMD_MAX_SIZE                          200   /* Data of a 0x68 reply, L is at most 200 */
+
 /*****************************************************************************************************************************
-                       id                      | name                         | type            | address  | size | Flag
+                       id                      | name                         | wire type       | address  | size | Flag     | report  | threshold | silence (s)
 *****************************************************************************************************************************/
 #define MODBUS_WATER_INPUT_REGS                                                                                                 \
-XTABLE_ITEM(MB_POWER_RECEIVE_WH,                 power_receive_wh,              int32_t,          0x0000,    2,     REPORT )    \
-XTABLE_ITEM(MB_POWER_TRANSMISS_WH,               power_transmiss_wh,            int32_t,          0x0002,    2,     REPORT )    \
-XTABLE_ITEM(MB_WATT_RECEIVE,                     watt_receive,                  int32_t,          0x0004,    2,     REPORT )    \
-XTABLE_ITEM(MB_WATT_TRANSMISS,                   watt_transmiss,                int32_t,          0x0006,    2,     REPORT )    \
-XTABLE_ITEM(MB_POWER_GROUND_RECV_WARH1,          power_ground_recv_warh1,       int32_t,          0x0008,    2,     REPORT )    \
-XTABLE_ITEM(MB_POWER_GROUND_RECV_WARH2,          power_ground_recv_warh2,       int32_t,          0x000A,    2,     REPORT )    \
-XTABLE_ITEM(MB_POWER_GROUND_VAR,                 power_ground_var,              int32_t,          0x000C,    2,     REPORT )    \
-XTABLE_ITEM(MB_WATT_GROUND_VAR,                  watt_ground_var,               int32_t,          0x000E,    2,     REPORT )    \
-XTABLE_ITEM(MB_POWER_GROUND_TRAN_WARH1,          power_ground_tran_warh1,       int32_t,          0x0010,    2,     REPORT )    \
-XTABLE_ITEM(MB_POWER_GROUND_TRAN_WARH2,          power_ground_tran_warh2,       int32_t,          0x0012,    2,     REPORT )    \
-XTABLE_ITEM(MB_POWER_GROUND_TRAN_WARH3,          power_ground_tran_warh3,       int32_t,          0x0014,    2,     REPORT )    \
-XTABLE_ITEM(MB_POWER_GROUND_TRAN_WARH4,          power_ground_tran_warh4,       int32_t,          0x0016,    2,     REPORT )    \
-XTABLE_ITEM(MB_VOLTAGE_1,                        voltage_1,                     int32_t,          0x0018,    2,     REPORT )    \
-XTABLE_ITEM(MB_VOLTAGE_2,                        voltage_2,                     int32_t,          0x001A,    2,     REPORT )    \
-XTABLE_ITEM(MB_VOLTAGE_3,                        voltage_3,                     int32_t,          0x001C,    2,     REPORT )    \
-XTABLE_ITEM(MB_CURRENT_1,                        current_1,                     int32_t,          0x001E,    2,     REPORT )    \
-XTABLE_ITEM(MB_CURRENT_2,                        current_2,                     int32_t,          0x0020,    2,     REPORT )    \
-XTABLE_ITEM(MB_CURRENT_3,                        current_3,                     int32_t,          0x0022,    2,     REPORT )    \
-XTABLE_ITEM(MB_PHASE_1,                          phase_1,                       int32_t,          0x0024,    2,     REPORT )    \
-XTABLE_ITEM(MB_PHASE_2,                          phase_2,                       int32_t,          0x0026,    2,     REPORT )    \
-XTABLE_ITEM(MB_PHASE_3,                          phase_3,                       int32_t,          0x0028,    2,     REPORT )    \
-XTABLE_ITEM(MB_FREQUENCY,                        frequency,                     int32_t,          0x002A,    2,     REPORT )    \
-XTABLE_ITEM(MB_POWER_RELAY,                      power_relay,                   int32_t,          0x002C,    2,     REPORT )    \
-XTABLE_ITEM(MB_WATER_M3,                         water_m3,                      int32_t,          0x002E,    2,     REPORT )    \
-XTABLE_ITEM(MB_CHECK_FLOW,                       check_flow,                    int32_t,          0x0030,    2,     REPORT )    \
-XTABLE_ITEM(MB_WATER_HOT_M3,                     water_hot_m3,                  int32_t,          0x0032,    2,     REPORT )    \
-XTABLE_ITEM(MB_WATER_HOT_CHECK_FLOW,             water_hot_check_flow,          int32_t,          0x0034,    2,     REPORT )    \
-XTABLE_ITEM(MB_GAZ_M3,                           gaz_m3,                        int32_t,          0x0036,    2,     REPORT )    \
-XTABLE_ITEM(MB_GAZ_FLOW,                         gaz_flow,                      int32_t,          0x0038,    2,     REPORT )    \
-XTABLE_ITEM(MB_HEATER_KW,                        heater_kw,                     int32_t,          0x003A,    2,     REPORT )    \
-XTABLE_ITEM(MB_HEATER_FLOW,                      heater_flow,                   int32_t,          0x003C,    2,     REPORT )    \
-XTABLE_ITEM(MB_ID5_M3,                           id5_m3,                        int32_t,          0x003E,    2,     REPORT )    \
-XTABLE_ITEM(MB_HEATER_CHECK_FLOW,                heater_check_flow,             int32_t,          0x0040,    2,     REPORT )    \
-XTABLE_ITEM(MB_HEATER_TEMPERATURE,               heater_temperature,            int32_t,          0x0042,    2,     REPORT )
+XTABLE_ITEM(MB_POWER_RECEIVE_WH,                 power_receive_wh,              INT32,            0x0000,    2,     REPORT,    ABS,      10,        900    )    \
+XTABLE_ITEM(MB_POWER_TRANSMISS_WH,               power_transmiss_wh,            INT32,            0x0002,    2,     REPORT,    ABS,      10,        900    )    \
+XTABLE_ITEM(MB_WATT_RECEIVE,                     watt_receive,                  INT32,            0x0004,    2,     REPORT,    PCT,      2,         300    )    \
+XTABLE_ITEM(MB_WATT_TRANSMISS,                   watt_transmiss,                INT32,            0x0006,    2,     REPORT,    PCT,      2,         300    )    \
+XTABLE_ITEM(MB_POWER_GROUND_RECV_WARH1,          power_ground_recv_warh1,       INT32,            0x0008,    2,     REPORT,    ABS,      10,        900    )    \
+XTABLE_ITEM(MB_POWER_GROUND_RECV_WARH2,          power_ground_recv_warh2,       INT32,            0x000A,    2,     REPORT,    ABS,      10,        900    )    \
+XTABLE_ITEM(MB_POWER_GROUND_VAR,                 power_ground_var,              INT32,            0x000C,    2,     REPORT,    ABS,      10,        900    )    \
+XTABLE_ITEM(MB_WATT_GROUND_VAR,                  watt_ground_var,               INT32,            0x000E,    2,     REPORT,    PCT,      2,         300    )    \
+XTABLE_ITEM(MB_POWER_GROUND_TRAN_WARH1,          power_ground_tran_warh1,       INT32,            0x0010,    2,     REPORT,    ABS,      10,        900    )    \
+XTABLE_ITEM(MB_POWER_GROUND_TRAN_WARH2,          power_ground_tran_warh2,       INT32,            0x0012,    2,     REPORT,    ABS,      10,        900    )    \
+XTABLE_ITEM(MB_POWER_GROUND_TRAN_WARH3,          power_ground_tran_warh3,       INT32,            0x0014,    2,     REPORT,    ABS,      10,        900    )    \
+XTABLE_ITEM(MB_POWER_GROUND_TRAN_WARH4,          power_ground_tran_warh4,       INT32,            0x0016,    2,     REPORT,    ABS,      10,        900    )    \
+XTABLE_ITEM(MB_VOLTAGE_1,                        voltage_1,                     INT32,            0x0018,    2,     REPORT,    PCT,      1,         300    )    \
+XTABLE_ITEM(MB_VOLTAGE_2,                        voltage_2,                     INT32,            0x001A,    2,     REPORT,    PCT,      1,         300    )    \
+XTABLE_ITEM(MB_VOLTAGE_3,                        voltage_3,                     INT32,            0x001C,    2,     REPORT,    PCT,      1,         300    )    \
+XTABLE_ITEM(MB_CURRENT_1,                        current_1,                     INT32,            0x001E,    2,     REPORT,    PCT,      2,         300    )    \
+XTABLE_ITEM(MB_CURRENT_2,                        current_2,                     INT32,            0x0020,    2,     REPORT,    PCT,      2,         300    )    \
+XTABLE_ITEM(MB_CURRENT_3,                        current_3,                     INT32,            0x0022,    2,     REPORT,    PCT,      2,         300    )    \
+XTABLE_ITEM(MB_PHASE_1,                          phase_1,                       INT32,            0x0024,    2,     REPORT,    ABS,      5,         300    )    \
+XTABLE_ITEM(MB_PHASE_2,                          phase_2,                       INT32,            0x0026,    2,     REPORT,    ABS,      5,         300    )    \
+XTABLE_ITEM(MB_PHASE_3,                          phase_3,                       INT32,            0x0028,    2,     REPORT,    ABS,      5,         300    )    \
+XTABLE_ITEM(MB_FREQUENCY,                        frequency,                     INT32,            0x002A,    2,     REPORT,    ABS,      5,         300    )    \
+XTABLE_ITEM(MB_POWER_RELAY,                      power_relay,                   INT32,            0x002C,    2,     REPORT,    CHANGE,   0,         3600   )    \
+XTABLE_ITEM(MB_WATER_M3,                         water_m3,                      INT32,            0x002E,    2,     REPORT,    CHANGE,   0,         3600   )    \
+XTABLE_ITEM(MB_CHECK_FLOW,                       check_flow,                    INT32,            0x0030,    2,     REPORT,    CHANGE,   0,         3600   )    \
+XTABLE_ITEM(MB_WATER_HOT_M3,                     water_hot_m3,                  INT32,            0x0032,    2,     REPORT,    CHANGE,   0,         3600   )    \
+XTABLE_ITEM(MB_WATER_HOT_CHECK_FLOW,             water_hot_check_flow,          INT32,            0x0034,    2,     REPORT,    CHANGE,   0,         3600   )    \
+XTABLE_ITEM(MB_GAZ_M3,                           gaz_m3,                        INT32,            0x0036,    2,     REPORT,    CHANGE,   0,         3600   )    \
+XTABLE_ITEM(MB_GAZ_FLOW,                         gaz_flow,                      INT32,            0x0038,    2,     REPORT,    PCT,      5,         300    )    \
+XTABLE_ITEM(MB_HEATER_KW,                        heater_kw,                     INT32,            0x003A,    2,     REPORT,    CHANGE,   0,         3600   )    \
+XTABLE_ITEM(MB_HEATER_FLOW,                      heater_flow,                   INT32,            0x003C,    2,     REPORT,    PCT,      5,         300    )    \
+XTABLE_ITEM(MB_ID5_M3,                           id5_m3,                        INT32,            0x003E,    2,     REPORT,    CHANGE,   0,         3600   )    \
+XTABLE_ITEM(MB_HEATER_CHECK_FLOW,                heater_check_flow,             INT32,            0x0040,    2,     REPORT,    CHANGE,   0,         3600   )    \
+XTABLE_ITEM(MB_HEATER_TEMPERATURE,               heater_temperature,            INT32,            0x0042,    2,     REPORT,    ABS,      5,         600    )
 
 typedef uint16_t modbus_reg_id;
 enum {
-#define XTABLE_ITEM(id, name, type, address, size, flag) id,
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence) id,
     MODBUS_WATER_INPUT_REGS
 #undef XTABLE_ITEM
     MB_WATER_NUMBER_OF_REG,
     MB_WATER_INVALID_ID = 0xFFFF,
 };
 
+/* Registers laid out in table order, one slot each. Member offsets are the prefix sums of sizes,
+ * a duplicate name does not compile */
+typedef struct {
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence) uint16_t name[size];
+    MODBUS_WATER_INPUT_REGS
+#undef XTABLE_ITEM
+} modbus_water_map_t;
+
+#define MB_WATER_OFFSET(name)                         (offsetof(modbus_water_map_t, name) / sizeof(uint16_t))
+
+enum {
+    /* Size in byte of all registers */
+    MB_WATER_DATA_SIZE = sizeof(modbus_water_map_t),
+    /* Address of the first register */
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence) (id == 0) ? (address) :
+    MB_WATER_FIRST_ADDRESS = MODBUS_WATER_INPUT_REGS 0,
+#undef XTABLE_ITEM
+};
+
+/* Registers follow each other in address order, no overlap and no gap */
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence)                                           \
+_Static_assert(((size) > 0) && ((size) <= MB_WATER_REG_MAX_SIZE), #id ": size out of range");                                  \
+_Static_assert(((size) * 2) % MB_TYPE_SIZE_##type == 0, #id ": size is not a multiple of its wire type");                        \
+_Static_assert((address) == MB_WATER_FIRST_ADDRESS + MB_WATER_OFFSET(name), #id ": overlaps or leaves a gap after the previous register"); \
+_Static_assert(((threshold) >= 0) && ((silence) >= 0), #id ": negative threshold or silence");                                 \
+_Static_assert((MB_REPORT_##report != MB_REPORT_REFRESH) || ((silence) > 0), #id ": REFRESH needs a silence");
+MODBUS_WATER_INPUT_REGS
+#undef XTABLE_ITEM
+
+/* Poll groups, each (slave, group) is read on its own period */
+/*****************************************************************************************************************************
+                       id                      | first register               | last register                | period (ms)
+*****************************************************************************************************************************/
+#define MODBUS_WATER_POLL_GROUPS                                                                                                \
+XGROUP_ITEM(MB_WATER_GROUP_ENERGY,               MB_POWER_RECEIVE_WH,           MB_POWER_TRANSMISS_WH,         3600000 )    \
+XGROUP_ITEM(MB_WATER_GROUP_POWER,                MB_WATT_RECEIVE,               MB_WATT_TRANSMISS,             500     )    \
+XGROUP_ITEM(MB_WATER_GROUP_GROUND,               MB_POWER_GROUND_RECV_WARH1,    MB_POWER_GROUND_TRAN_WARH4,    3600000 )    \
+XGROUP_ITEM(MB_WATER_GROUP_INSTANT,              MB_VOLTAGE_1,                  MB_FREQUENCY,                  500     )    \
+XGROUP_ITEM(MB_WATER_GROUP_STATUS,               MB_POWER_RELAY,                MB_POWER_RELAY,                10000   )    \
+XGROUP_ITEM(MB_WATER_GROUP_COUNTER,              MB_WATER_M3,                   MB_HEATER_TEMPERATURE,         60000   )
+
+typedef uint8_t modbus_group_id;
+enum {
+#define XGROUP_ITEM(id, first, last, period) id,
+    MODBUS_WATER_POLL_GROUPS
+#undef XGROUP_ITEM
+    MB_WATER_NUMBER_OF_GROUP,
+};
+
+#define XGROUP_ITEM(id, first, last, period)                                                                                    \
+_Static_assert(((first) <= (last)) && ((last) < MB_WATER_NUMBER_OF_REG) && ((period) > 0), #id ": invalid group");
+MODBUS_WATER_POLL_GROUPS
+#undef XGROUP_ITEM
+
 /*******************************************************************************************************************************/
 
 /* NOTE: Size in byte of data response */
 
 /*****************************************************************************************************************************
-                       id                      | name                         | type            | address  | size | Flag
+                       id                      | name                         | wire type       | address  | size | Flag     | report  | threshold | silence (s)
 *****************************************************************************************************************************/
 #define MODBUS_ELECTRIC_CMD                                                                                                     \
-XTABLE_ITEM(MB_DATE_CMD,                         date,                          date_t,           0xF343,    4,     REPORT )    \
-XTABLE_ITEM(MB_TIME_CMD,                         time,                          time_t,           0xF344,    3,     REPORT )    \
-XTABLE_ITEM(MB_ENERGY_CMD,                       energy,                        uint8_t*,         0xC352,    20,    REPORT )    \
-XTABLE_ITEM(MB_SHOW_MODE_CMD,                    show_mode,                     mode_t,           0x1477,    3,     REPORT )    \
-XTABLE_ITEM(MB_VERSION_CMD,                      version,                       uint8_t,          0x2350,    3,     REPORT )    \
-XTABLE_ITEM(MB_CONSTANT_CMD,                     constant,                      uint8_t,          0xF363,    3,     REPORT )    \
-XTABLE_ITEM(MB_DAY_TABLE_CMD,                    constant,                      uint8_t,          0xF363,    3,     REPORT )
+XTABLE_ITEM(MB_DATE_CMD,                         date,                          DATE,             0xF343,    4,     REPORT,    CHANGE,   0,         86400  )    \
+XTABLE_ITEM(MB_TIME_CMD,                         time,                          TIME,             0xF344,    3,     REPORT,    REFRESH,  0,         3600   )    \
+XTABLE_ITEM(MB_ENERGY_CMD,                       energy,                        BCD4,             0xC352,    20,    REPORT,    ABS,      1,         900    )    \
+XTABLE_ITEM(MB_SHOW_MODE_CMD,                    show_mode,                     RAW,              0x1477,    3,     REPORT,    CHANGE,   0,         86400  )    \
+XTABLE_ITEM(MB_VERSION_CMD,                      version,                       RAW,              0x2350,    3,     REPORT,    CHANGE,   0,         86400  )    \
+XTABLE_ITEM(MB_CONSTANT_CMD,                     constant,                      BCD3,             0xF363,    3,     REPORT,    CHANGE,   0,         86400  )    \
+XTABLE_ITEM(MB_DAY_TABLE_CMD,                    day_table,                     BCD3,             0xF672,    24,    REPORT,    CHANGE,   0,         86400  )    \
+XTABLE_ITEM(MB_ADDRESS_CMD,                      address,                       RAW,              0xF367,    6,     FLAG_NONE, CHANGE,   0,         0      )
 
 typedef uint16_t modbus_elec_cmd_id;
 enum {
-#define XTABLE_ITEM(id, name, type, address, size, flag) id,
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence) id,
     MODBUS_ELECTRIC_CMD
 #undef XTABLE_ITEM
     MB_ELEC_NUMBER_OF_CMD,
     MB_ELEC_INVALID_CMD = 0xFFFF,
 };
 
+/* Commands laid out in table order, one slot each. Member offsets are the prefix sums of sizes,
+ * a duplicate name does not compile */
+typedef struct {
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence) uint8_t name[size];
+    MODBUS_ELECTRIC_CMD
+#undef XTABLE_ITEM
+} modbus_elec_map_t;
+
+#define MB_ELEC_OFFSET(name)                          offsetof(modbus_elec_map_t, name)
+
+/* Size in byte of all commands */
+enum {
+    MB_ELEC_DATA_SIZE = sizeof(modbus_elec_map_t),
+};
+
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence)                                           \
+_Static_assert(((size) > 0) && ((size) <= MB_ELEC_CMD_MAX_SIZE), #id ": size out of range");                                   \
+_Static_assert((size) % MB_TYPE_SIZE_##type == 0, #id ": size is not a multiple of its wire type");                          \
+_Static_assert(((threshold) >= 0) && ((silence) >= 0), #id ": negative threshold or silence");                                 \
+_Static_assert((MB_REPORT_##report != MB_REPORT_REFRESH) || ((silence) > 0), #id ": REFRESH needs a silence");
+MODBUS_ELECTRIC_CMD
+#undef XTABLE_ITEM
+
+/*****************************************************************************************************************************
+                       id                      | first command                | last command                 | period (ms)
+*****************************************************************************************************************************/
+#define MODBUS_ELECTRIC_POLL_GROUPS                                                                                             \
+XGROUP_ITEM(MB_ELEC_GROUP_ENERGY,                MB_ENERGY_CMD,                 MB_ENERGY_CMD,                 60000   )    \
+XGROUP_ITEM(MB_ELEC_GROUP_CLOCK,                 MB_DATE_CMD,                   MB_TIME_CMD,                   3600000 )    \
+XGROUP_ITEM(MB_ELEC_GROUP_SETTING,               MB_SHOW_MODE_CMD,              MB_DAY_TABLE_CMD,              3600000 )
+
+enum {
+#define XGROUP_ITEM(id, first, last, period) id,
+    MODBUS_ELECTRIC_POLL_GROUPS
+#undef XGROUP_ITEM
+    MB_ELEC_NUMBER_OF_GROUP,
+};
+
+#define XGROUP_ITEM(id, first, last, period)                                                                                    \
+_Static_assert(((first) <= (last)) && ((last) < MB_ELEC_NUMBER_OF_CMD) && ((period) > 0), #id ": invalid group");
+MODBUS_ELECTRIC_POLL_GROUPS
+#undef XGROUP_ITEM
+
 /******************************************************************************/
 /*                              PRIVATE DATA                                  */
 /******************************************************************************/
@@ -107,11 +247,28 @@ enum {
 
 
 
+/* Offset of each register or command from the first one, the last entry is the total:
+ * registers for water meter, bytes for electric meter */
+extern const uint16_t modbus_water_offset[MB_WATER_NUMBER_OF_REG + 1];
+extern const uint16_t modbus_elec_offset[MB_ELEC_NUMBER_OF_CMD + 1];
+
 /******************************************************************************/
 /*                                FUNCTIONS                                   */
 /******************************************************************************/
 
+/*!
+ * @brief  Find water meter register by address. A duplicate address in the table does not compile
+ * @param  Register address
+ * @retval Register id, MB_WATER_INVALID_ID if not found
+ */
+modbus_reg_id modbus_table_water_find(uint16_t reg_address);
 
+/*!
+ * @brief  Find electric meter command by its data identifier. A duplicate identifier in the table does not compile
+ * @param  Data identifier
+ * @retval Command id, MB_ELEC_INVALID_CMD if not found
+ */
+modbus_elec_cmd_id modbus_table_elec_find(uint16_t command);
 
 /******************************************************************************/
 
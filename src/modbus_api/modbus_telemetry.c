@@ -0,0 +1,308 @@
+/*
+ *  modbus_telemetry.c
+ *
+ *  Created on: Feb 23, 2022
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "config.h"
+#include "utility/utility.h"
+#include "utility/json_writer.h"
+#include "utility/bin_writer.h"
+#include "modbus_table.h"
+#include "modbus_decode.h"
+#include "modbus_telemetry.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+/*!
+ * @brief  Register of a reading as the backend sees it
+ */
+typedef struct {
+    const char *name;
+    uint16_t address;
+    modbus_wire_type_t type;
+    uint8_t count;                                    /* Number of elements */
+    uint8_t flag;
+} modbus_telemetry_reg_t;
+
+/*!
+ * @brief  Value type of the schema
+ */
+typedef uint8_t modbus_telemetry_type_t;
+enum {
+    TELEMETRY_TYPE_INT = 0,
+    TELEMETRY_TYPE_UINT,
+    TELEMETRY_TYPE_FLOAT,
+};
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static const char *modbus_telemetry_meter[METER_COUNT] = {"electric", "water"};
+static const char *modbus_telemetry_type[] = {"int", "uint", "float"};
+
+#ifdef ELECTRIC_METER_USED
+static const modbus_telemetry_reg_t modbus_telemetry_reg[MB_ELEC_NUMBER_OF_CMD] = {
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence) { #name, address, MB_TYPE_##type, (size) / MB_TYPE_SIZE_##type, flag },
+    MODBUS_ELECTRIC_CMD
+#undef XTABLE_ITEM
+};
+#else
+static const modbus_telemetry_reg_t modbus_telemetry_reg[MB_WATER_NUMBER_OF_REG] = {
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence) { #name, address, MB_TYPE_##type, (size) * 2 / MB_TYPE_SIZE_##type, flag },
+    MODBUS_WATER_INPUT_REGS
+#undef XTABLE_ITEM
+};
+#endif
+
+#define TELEMETRY_REG_COUNT                           (sizeof(modbus_telemetry_reg) / sizeof(modbus_telemetry_reg[0]))
+
+/* Only the reader task converts readings */
+static modbus_value_t modbus_telemetry_value[MODBUS_DATA_SIZE];
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static uint16_t modbus_telemetry_decode(const modbus_data_t *data);
+static modbus_telemetry_type_t modbus_telemetry_get_type(modbus_wire_type_t type);
+static void modbus_telemetry_value_to_json(json_writer_t *writer, const char *key, const modbus_value_t *value);
+
+/******************************************************************************/
+
+/*!
+ * @brief  Decode the registers of a reading to report into modbus_telemetry_value
+ * @retval Number of values
+ */
+static uint16_t modbus_telemetry_decode(const modbus_data_t *data)
+{
+    uint16_t count = MODBUS_DECODE(data->start, data->stop, data->data, REPORT, modbus_telemetry_value, MODBUS_DATA_SIZE);
+    uint16_t kept = 0;
+
+    for(uint16_t i = 0; i < count; i++)
+    {
+        if(data->report & MODBUS_REPORT_BIT(modbus_telemetry_value[i].reg))
+        {
+            modbus_telemetry_value[kept++] = modbus_telemetry_value[i];
+        }
+    }
+    return kept;
+}
+
+/*!
+ * @brief  Value type of a wire type, BCD, date and time are decoded to unsigned numbers
+ */
+static modbus_telemetry_type_t modbus_telemetry_get_type(modbus_wire_type_t type)
+{
+    switch(type)
+    {
+    case MB_TYPE_INT32:
+    case MB_TYPE_INT32_WS:
+        return TELEMETRY_TYPE_INT;
+    case MB_TYPE_FLOAT32:
+        return TELEMETRY_TYPE_FLOAT;
+    default:
+        return TELEMETRY_TYPE_UINT;
+    }
+}
+
+/*!
+ * @brief  Write a decoded element as json number
+ */
+static void modbus_telemetry_value_to_json(json_writer_t *writer, const char *key, const modbus_value_t *value)
+{
+    switch(modbus_telemetry_get_type(value->type))
+    {
+    case TELEMETRY_TYPE_INT:
+        json_writer_int(writer, key, value->i32);
+        break;
+    case TELEMETRY_TYPE_FLOAT:
+        json_writer_float(writer, key, value->f32);
+        break;
+    default:
+        json_writer_uint(writer, key, value->u32);
+        break;
+    }
+}
+
+/******************************************************************************/
+
+/*!
+ * @brief  Convert a reading to compact json, registers to report only.
+ *         Value of a register with several elements is an array
+ */
+uint32_t modbus_telemetry_to_json(const modbus_data_t *data, const uint8_t *slave, char *buffer, uint32_t size)
+{
+    modbus_value_t *value = modbus_telemetry_value;
+    json_writer_t writer;
+    bool array = false;
+    uint16_t count;
+
+    json_writer_init(&writer, buffer, size);
+    json_writer_object_begin(&writer, NULL);
+    json_writer_string(&writer, JSON_METER_TYPE_KEY, modbus_telemetry_meter[data->meter]);
+    json_writer_uint(&writer, JSON_BUS_KEY, data->bus);
+    json_writer_uint(&writer, JSON_TIME_KEY, data->time);
+#ifdef ELECTRIC_METER_USED
+    char slave_addr[32];
+    sprintf(slave_addr, "%02X %02X %02X %02X %02X %02X", slave[0], slave[1], slave[2], slave[3], slave[4], slave[5]);
+    json_writer_string(&writer, JSON_SLAVE_ID_KEY, slave_addr);
+#else
+    json_writer_uint(&writer, JSON_SLAVE_ID_KEY, slave[0]);
+#endif
+
+    json_writer_array_begin(&writer, JSON_REG_KEY);
+    count = modbus_telemetry_decode(data);
+    for(uint16_t i = 0; i < count; i++)
+    {
+        if(value[i].index == 0)
+        {
+            json_writer_object_begin(&writer, NULL);
+            json_writer_string(&writer, JSON_NAME_KEY, modbus_telemetry_reg[value[i].reg].name);
+#ifndef ELECTRIC_METER_USED
+            char addr_str[8];
+            sprintf(addr_str, "0x%04X", modbus_telemetry_reg[value[i].reg].address);
+            json_writer_string(&writer, JSON_ADDRESS_KEY, addr_str);
+#endif
+            array = ((i + 1) < count) && (value[i + 1].reg == value[i].reg);
+            if(array)
+            {
+                json_writer_array_begin(&writer, JSON_VALUE_KEY);
+            }
+        }
+        modbus_telemetry_value_to_json(&writer, array ? NULL : JSON_VALUE_KEY, &value[i]);
+
+        /* Last element of the register */
+        if(((i + 1) >= count) || (value[i + 1].reg != value[i].reg))
+        {
+            if(array)
+            {
+                json_writer_array_end(&writer);
+            }
+            json_writer_object_end(&writer);
+        }
+    }
+    json_writer_array_end(&writer);
+    json_writer_object_end(&writer);
+
+    return json_writer_finish(&writer);
+}
+
+/*!
+ * @brief  Convert a reading to binary, registers to report only.
+ *         Registers are keyed by id, value types and counts are in the schema
+ */
+uint32_t modbus_telemetry_to_binary(const modbus_data_t *data, const uint8_t *slave, uint8_t *buffer, uint32_t size)
+{
+    modbus_value_t *value = modbus_telemetry_value;
+    bin_writer_t writer;
+    uint16_t count;
+
+    bin_writer_init(&writer, buffer, size);
+    bin_writer_u8(&writer, TELEMETRY_BINARY_VERSION);
+    bin_writer_u16(&writer, modbus_telemetry_schema_id());
+    bin_writer_u8(&writer, data->meter);
+    bin_writer_u8(&writer, data->bus);
+    bin_writer_bytes(&writer, slave, MODBUS_SLAVE_ADDRESS_SIZE);
+    bin_writer_u32(&writer, data->time);
+
+    count = modbus_telemetry_decode(data);
+    for(uint16_t i = 0; i < count; i++)
+    {
+        if(value[i].index == 0)
+        {
+            bin_writer_varint(&writer, value[i].reg);
+        }
+        switch(modbus_telemetry_get_type(value[i].type))
+        {
+        case TELEMETRY_TYPE_INT:
+            bin_writer_svarint(&writer, value[i].i32);
+            break;
+        case TELEMETRY_TYPE_FLOAT:
+            bin_writer_float(&writer, value[i].f32);
+            break;
+        default:
+            bin_writer_varint(&writer, value[i].u32);
+            break;
+        }
+    }
+
+    return bin_writer_finish(&writer);
+}
+
+/*!
+ * @brief  Write the schema of binary readings as json
+ */
+uint32_t modbus_telemetry_schema(char *buffer, uint32_t size)
+{
+    const modbus_telemetry_reg_t *reg;
+    json_writer_t writer;
+    char addr_str[8];
+
+    json_writer_init(&writer, buffer, size);
+    json_writer_object_begin(&writer, NULL);
+    json_writer_uint(&writer, "id", modbus_telemetry_schema_id());
+    json_writer_uint(&writer, "version", TELEMETRY_BINARY_VERSION);
+    json_writer_string(&writer, JSON_METER_TYPE_KEY, modbus_telemetry_meter[MODBUS_METER_TYPE]);
+    json_writer_uint(&writer, "slave_size", MODBUS_SLAVE_ADDRESS_SIZE);
+    json_writer_array_begin(&writer, JSON_REG_KEY);
+    for(uint16_t i = 0; i < TELEMETRY_REG_COUNT; i++)
+    {
+        reg = &modbus_telemetry_reg[i];
+        if(!(reg->flag & REPORT))
+        {
+            continue;
+        }
+        json_writer_object_begin(&writer, NULL);
+        json_writer_uint(&writer, "id", i);
+        json_writer_string(&writer, JSON_NAME_KEY, reg->name);
+        sprintf(addr_str, "0x%04X", reg->address);
+        json_writer_string(&writer, JSON_ADDRESS_KEY, addr_str);
+        json_writer_string(&writer, "type", modbus_telemetry_type[modbus_telemetry_get_type(reg->type)]);
+        json_writer_uint(&writer, "count", reg->count);
+        json_writer_object_end(&writer);
+    }
+    json_writer_array_end(&writer);
+    json_writer_object_end(&writer);
+
+    return json_writer_finish(&writer);
+}
+
+/*!
+ * @brief  Get schema id, crc16 over version, meter and id, type and count of each REPORT register
+ */
+uint16_t modbus_telemetry_schema_id(void)
+{
+    uint8_t item[4] = { TELEMETRY_BINARY_VERSION, MODBUS_METER_TYPE, MODBUS_SLAVE_ADDRESS_SIZE };
+    uint16_t crc = crc16_modbus_update(CRC16_MODBUS_INIT, item, 3);
+
+    for(uint16_t i = 0; i < TELEMETRY_REG_COUNT; i++)
+    {
+        if(modbus_telemetry_reg[i].flag & REPORT)
+        {
+            item[0] = i & 0xFF;
+            item[1] = i >> 8;
+            item[2] = modbus_telemetry_get_type(modbus_telemetry_reg[i].type);
+            item[3] = modbus_telemetry_reg[i].count;
+            crc = crc16_modbus_update(crc, item, sizeof(item));
+        }
+    }
+    return crc16_modbus_final(crc);
+}
@@ -0,0 +1,94 @@
+/*
+ *  modbus_telemetry.h
+ *
+ *  Created on: Feb 23, 2022
+ */
+
+#ifndef _MODBUS_TELEMETRY_H_
+#define _MODBUS_TELEMETRY_H_
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdint.h>
+#include "modbus_data.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+/* JSON */
+#define JSON_METER_TYPE_KEY                           "meter"
+#define JSON_BUS_KEY                                  "bus"
+#define JSON_TIME_KEY                                 "time"
+#define JSON_SLAVE_ID_KEY                             "slave"
+#define JSON_REG_KEY                                  "regs"
+#define JSON_ADDRESS_KEY                              "address"
+#define JSON_NAME_KEY                                 "key"
+#define JSON_VALUE_KEY                                "value"
+
+/* Binary reading, little endian, see tools/telemetry_bench/telemetry_decode.py:
+ *   u8  TELEMETRY_BINARY_VERSION
+ *   u16 schema id, "id" of the schema the backend decodes it with
+ *   u8  meter, u8 bus, MODBUS_SLAVE_ADDRESS_SIZE bytes of slave address, u32 time (Unix time, 0 before
+ *   the clock is set, as "time" of JSON readings)
+ *   then for each register to report (REPORT flag and "report" mask of the reading): varint register id,
+ *   "count" values of its "type" in the schema:
+ *   "int" signed varint (zigzag), "uint" varint, "float" 4 bytes IEEE 754.
+ * Readings published together are framed by src/batch/batch.h */
+#define TELEMETRY_BINARY_VERSION                      1
+#define TELEMETRY_BINARY_HEADER_SIZE                  (9 + MODBUS_SLAVE_ADDRESS_SIZE)
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+/*!
+ * @brief  Convert a reading to compact json, no heap is used
+ * @param  Reading, slave address (MODBUS_SLAVE_ADDRESS_SIZE bytes)
+ *         [out] Buffer and its size
+ * @retval Length of the zero terminated string, 0 if the buffer is too small
+ */
+uint32_t modbus_telemetry_to_json(const modbus_data_t *data, const uint8_t *slave, char *buffer, uint32_t size);
+
+/*!
+ * @brief  Convert a reading to binary, no heap is used
+ * @param  Reading, slave address (MODBUS_SLAVE_ADDRESS_SIZE bytes)
+ *         [out] Buffer and its size
+ * @retval Length, 0 if the buffer is too small
+ */
+uint32_t modbus_telemetry_to_binary(const modbus_data_t *data, const uint8_t *slave, uint8_t *buffer, uint32_t size);
+
+/*!
+ * @brief  Write the schema of binary readings as json: id, version, meter, slave address size,
+ *         then id, key, address, type and count of each REPORT register
+ * @param  [out] Buffer and its size
+ * @retval Length of the zero terminated string, 0 if the buffer is too small
+ */
+uint32_t modbus_telemetry_schema(char *buffer, uint32_t size);
+
+/*!
+ * @brief  Get schema id, crc16 of the register descriptions. It changes with the register table
+ * @param  None
+ * @retval Schema id
+ */
+uint16_t modbus_telemetry_schema_id(void);
+
+/******************************************************************************/
+
+#endif /* _MODBUS_TELEMETRY_H_ */
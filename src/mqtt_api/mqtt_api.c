@@ -11,29 +11,33 @@
 /******************************************************************************/
 
 #include <mqtt_client.h>
+#include <freertos/semphr.h>
 #include "config.h"
 #include "wifi_lib/wifi_lib.h"
 #include "mqtt_api.h"
+#include "mqtt_window.h"
+#include "mqtt_inbound.h"
+#include "mqtt_topic.h"
 
 /******************************************************************************/
 /*                     EXPORTED TYPES and DEFINITIONS                         */
 /******************************************************************************/
 
 /*!
- * @brief  MQTT topic with callback function
+ * @brief  Buffers of received messages, pooled. Only pointers go through the queues
  */
 typedef struct {
-    char topic[MQTT_TOPIC_MAX_LENGTH];
-    mqtt_handle_t handler;
-} topic_map_t;
-
-/*!
- * @brief  MQTT message struct when using queue
- */
-typedef struct {
-    char message[MQTT_DATA_MAX_LENGTH];
-    char topic[MQTT_TOPIC_MAX_LENGTH];
-} mqtt_message_t;
+    mqtt_inbound_t message[MQTT_MESSAGE_QUEUE_SIZE];
+    char topic[MQTT_MESSAGE_QUEUE_SIZE][MQTT_TOPIC_MAX_LENGTH];
+    char data[MQTT_MESSAGE_QUEUE_SIZE][MQTT_MESSAGE_MAX_LENGTH + 1];
+} mqtt_message_pool_t;
+
+/* Retransmit check runs between received messages */
+#if (MQTT_DATA_QOS == 1)
+#define MQTT_MESSAGE_WAIT                             pdMS_TO_TICKS(MQTT_QOS1_CHECK_MS)
+#else
+#define MQTT_MESSAGE_WAIT                             portMAX_DELAY
+#endif
 
 /******************************************************************************/
 /*                              PRIVATE DATA                                  */
@@ -44,9 +48,28 @@ static const char* TAG = "MQTT";
 static esp_mqtt_client_handle_t mqtt_client;
 static bool mqtt_broker_connected = false;
 static char gateway_id[MQTT_CLIENT_ID_LENGTH] = "ESP-12345678";
-static topic_map_t topic_list[MQTT_MAX_SUBCRIBE_TOPIC];
-static uint8_t numb_topic = 0;
-static QueueHandle_t mqtt_message_queue;
+/* Subscriptions, by topic level. Lock is never held while the client or a handler is called */
+static mqtt_topic_trie_t topic_trie;
+static mqtt_topic_node_t topic_node[MQTT_TOPIC_TRIE_NODES];
+static mqtt_topic_sub_t topic_sub[MQTT_MAX_SUBCRIBE_TOPIC];
+static uint16_t topic_hash[MQTT_TOPIC_TRIE_HASH_SIZE];
+static SemaphoreHandle_t topic_lock;
+static QueueHandle_t mqtt_message_queue;            /* Complete messages, to the message task */
+static QueueHandle_t mqtt_message_free;             /* Free buffers, back from the message task */
+static mqtt_message_pool_t mqtt_message_pool;
+static mqtt_inbound_t *mqtt_message_partial = NULL; /* Message being reassembled by the event handler */
+static mqtt_inbound_stats_t mqtt_inbound_stats;
+
+#if (MQTT_DATA_QOS == 1)
+/* QoS 1 publishes in flight. Lock is never held while the client is called, its task holds its own lock
+ * while it runs the event handler */
+static mqtt_window_t window;
+static mqtt_window_slot_t window_slot[MQTT_QOS1_WINDOW];
+static uint8_t window_storage[MQTT_QOS1_WINDOW][MQTT_TOPIC_MAX_LENGTH + MQTT_DATA_MAX_LENGTH];
+static uint8_t window_resend[MQTT_TOPIC_MAX_LENGTH + MQTT_DATA_MAX_LENGTH];
+static SemaphoreHandle_t window_lock;
+static SemaphoreHandle_t window_free;                 /* Free slots */
+#endif
 
 /******************************************************************************/
 /*                              EXPORTED DATA                                 */
@@ -59,11 +82,260 @@ extern const uint8_t ca_cert_pem_end[] asm("_binary_ca_cert_crt_end");
 /*                                FUNCTIONS                                   */
 /******************************************************************************/
 
+static uint32_t mqtt_time_ms(void);
+static void mqtt_message_receive(esp_mqtt_event_handle_t event);
+static void mqtt_message_dispatch(const mqtt_inbound_t *message);
+static void mqtt_topic_resubscribe(void);
 static esp_err_t mqtt_client_event_handler(esp_mqtt_event_handle_t event);
 static void mqtt_handle_message_task(void* arg);
+#if (MQTT_DATA_QOS == 1)
+static void mqtt_window_acked(int32_t msg_id);
+static void mqtt_window_check(void);
+static bool mqtt_window_publish(const char* topic, const char* data, uint32_t len);
+#endif
 
 /******************************************************************************/
 
+/*!
+ * @brief  Time in ms
+ */
+static uint32_t mqtt_time_ms(void)
+{
+    return xTaskGetTickCount() * portTICK_RATE_MS;
+}
+
+#if (MQTT_DATA_QOS == 1)
+/*!
+ * @brief  Release the slot of an acked publish
+ */
+static void mqtt_window_acked(int32_t msg_id)
+{
+    bool released;
+
+    xSemaphoreTake(window_lock, portMAX_DELAY);
+    released = mqtt_window_ack(&window, msg_id, mqtt_time_ms());
+    xSemaphoreGive(window_lock);
+    if(released)
+    {
+        xSemaphoreGive(window_free);
+    }
+}
+
+/*!
+ * @brief  Send again the publishes not acked in time, or not sent since the link came back.
+ *         Payload is copied out first, the slot may be acked and reused while it is sent
+ */
+static void mqtt_window_check(void)
+{
+    mqtt_window_slot_t *slot;
+    const uint8_t *data;
+    const char *topic;
+    uint16_t length, topic_length;
+    uint32_t seq;
+    int32_t msg_id;
+    bool released;
+
+    while(mqtt_broker_connected)
+    {
+        xSemaphoreTake(window_lock, portMAX_DELAY);
+        slot = mqtt_window_next_due(&window, mqtt_time_ms());
+        if(slot == NULL)
+        {
+            xSemaphoreGive(window_lock);
+            return;
+        }
+        seq = slot->seq;
+        topic = mqtt_window_get(&window, slot, &data, &length);
+        topic_length = slot->topic_length + 1;
+        memcpy(window_resend, topic, topic_length);
+        memcpy(&window_resend[topic_length], data, length);
+        xSemaphoreGive(window_lock);
+
+        msg_id = esp_mqtt_client_publish(mqtt_client, (const char*) window_resend, (const char*) &window_resend[topic_length],
+                                         length, 1, 0);
+        ESP_LOGI(TAG, "Sent again, msg_id = %d", msg_id);
+
+        xSemaphoreTake(window_lock, portMAX_DELAY);
+        released = mqtt_window_sent(&window, slot, seq, msg_id, mqtt_time_ms());
+        xSemaphoreGive(window_lock);
+        if(released)
+        {
+            xSemaphoreGive(window_free);
+        }
+        if(msg_id < 0)
+        {
+            return;
+        }
+    }
+}
+
+/*!
+ * @brief  Publish QoS 1 through the window. Waits for a free slot, the publish is kept until acked
+ *         and sent again if needed, also after a reconnect
+ */
+static bool mqtt_window_publish(const char* topic, const char* data, uint32_t len)
+{
+    mqtt_window_slot_t *slot;
+    uint32_t seq;
+    int32_t msg_id;
+    bool released;
+
+    if(len == MQTT_AUTO_LENGTH)
+    {
+        len = strlen(data);
+    }
+    if(xSemaphoreTake(window_free, pdMS_TO_TICKS(MQTT_QOS1_WINDOW_WAIT_MS)) != pdTRUE)
+    {
+        xSemaphoreTake(window_lock, portMAX_DELAY);
+        window.stats.full++;
+        xSemaphoreGive(window_lock);
+        ESP_LOGW(TAG, "Publish window full, %u in flight", MQTT_QOS1_WINDOW);
+        return false;
+    }
+
+    xSemaphoreTake(window_lock, portMAX_DELAY);
+    slot = (len <= UINT16_MAX) ? mqtt_window_put(&window, topic, (const uint8_t*) data, len) : NULL;
+    seq = (slot != NULL) ? slot->seq : 0;
+    xSemaphoreGive(window_lock);
+
+    /* Larger than a slot: QoS 1 in the client outbox only */
+    if(slot == NULL)
+    {
+        xSemaphoreGive(window_free);
+        msg_id = esp_mqtt_client_publish(mqtt_client, topic, data, len, 1, 0);
+        ESP_LOGW(TAG, "Sent publish of %u bytes outside the window, msg_id = %d", len, msg_id);
+        return (msg_id >= 0);
+    }
+
+    msg_id = esp_mqtt_client_publish(mqtt_client, topic, data, len, 1, 0);
+    ESP_LOGI(TAG, "Sent publish, msg_id = %d", msg_id);
+    xSemaphoreTake(window_lock, portMAX_DELAY);
+    released = mqtt_window_sent(&window, slot, seq, msg_id, mqtt_time_ms());
+    xSemaphoreGive(window_lock);
+
+    /* The client task outranks the publisher, the ack may have come before the send was recorded */
+    if(released)
+    {
+        xSemaphoreGive(window_free);
+    }
+
+    /* In the window, a failed send is retried by mqtt_window_check() */
+    return true;
+}
+#endif
+
+/*!
+ * @brief  Reassemble a message from the chunks of MQTT_EVENT_DATA into a pooled buffer, by offset.
+ *         Chunks come in order from the client task, one message at a time
+ */
+static void mqtt_message_receive(esp_mqtt_event_handle_t event)
+{
+    mqtt_inbound_result_t result;
+    UBaseType_t queued;
+
+    if(event->current_data_offset == 0)
+    {
+        /* Last message never completed */
+        if(mqtt_message_partial != NULL)
+        {
+            mqtt_inbound_stats.broken++;
+            xQueueSend(mqtt_message_free, &mqtt_message_partial, 0);
+            mqtt_message_partial = NULL;
+        }
+        if(xQueueReceive(mqtt_message_free, &mqtt_message_partial, 0) != pdTRUE)
+        {
+            mqtt_inbound_stats.overflow++;
+            ESP_LOGW(TAG, "No buffer for message of %.*s, dropped", event->topic_len, event->topic);
+            return;
+        }
+        if(event->data_len < event->total_data_len)
+        {
+            mqtt_inbound_stats.fragmented++;
+        }
+    }
+    /* Rest of a dropped message */
+    if(mqtt_message_partial == NULL)
+    {
+        return;
+    }
+
+    result = mqtt_inbound_chunk(mqtt_message_partial, event->topic, event->topic_len, event->data, event->data_len,
+                                event->current_data_offset, event->total_data_len);
+    if(result == MQTT_INBOUND_PART)
+    {
+        return;
+    }
+    if(result == MQTT_INBOUND_DONE)
+    {
+        /* Never full, there are as many buffers as queue items */
+        xQueueSend(mqtt_message_queue, &mqtt_message_partial, 0);
+        mqtt_inbound_stats.received++;
+        queued = uxQueueMessagesWaiting(mqtt_message_queue);
+        if(queued > mqtt_inbound_stats.max_queued)
+        {
+            mqtt_inbound_stats.max_queued = queued;
+        }
+    }
+    else
+    {
+        if(result == MQTT_INBOUND_TOO_LARGE)
+        {
+            mqtt_inbound_stats.too_large++;
+            ESP_LOGW(TAG, "Message of %u bytes on %.*s too large, dropped", event->total_data_len, event->topic_len, event->topic);
+        }
+        else
+        {
+            mqtt_inbound_stats.broken++;
+        }
+        xQueueSend(mqtt_message_free, &mqtt_message_partial, 0);
+    }
+    mqtt_message_partial = NULL;
+}
+
+/*!
+ * @brief  Call the handlers of a message, payload is read in place
+ */
+static void mqtt_message_dispatch(const mqtt_inbound_t *message)
+{
+    mqtt_topic_route_t route[MQTT_TOPIC_MATCH_MAX];
+    uint32_t count;
+
+    ESP_LOGD(TAG, "-------- DATA %s: %s", message->topic, message->data);
+    xSemaphoreTake(topic_lock, portMAX_DELAY);
+    count = mqtt_topic_match(&topic_trie, message->topic, route, MQTT_TOPIC_MATCH_MAX);
+    xSemaphoreGive(topic_lock);
+
+    for(uint32_t i = 0; i < count; i++)
+    {
+        route[i].handler(message->topic, message->data, message->length, route[i].context);
+    }
+    if(count == 0)
+    {
+        ESP_LOGW(TAG, "message not handle!!!");
+    }
+}
+
+/*!
+ * @brief  Subscribe every filter of the trie to the broker, after connect
+ */
+static void mqtt_topic_resubscribe(void)
+{
+    char filter[MQTT_TOPIC_MAX_LENGTH];
+    bool found;
+
+    for(uint16_t i = 0; i < MQTT_TOPIC_TRIE_NODES; i++)
+    {
+        xSemaphoreTake(topic_lock, portMAX_DELAY);
+        found = mqtt_topic_filter(&topic_trie, i, filter, sizeof(filter));
+        xSemaphoreGive(topic_lock);
+        if(found)
+        {
+            esp_mqtt_client_subscribe(mqtt_client, filter, 0);
+            ESP_LOGI(TAG, "MQTT subcribe topic %s", filter);
+        }
+    }
+}
+
 /*!
  * @brief  MQTT event handler
  * @param  None
@@ -78,11 +350,13 @@ static esp_err_t mqtt_client_event_handler(esp_mqtt_event_handle_t event)
     case MQTT_EVENT_CONNECTED:
         mqtt_broker_connected = true;
         ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
-        for(uint8_t i = 0; i < numb_topic; i++)
-        {
-            esp_mqtt_client_subscribe(mqtt_client, topic_list[i].topic, 0);
-            ESP_LOGI(TAG, "MQTT subcribe topic %s", topic_list[i].topic);
-        }
+#if (MQTT_DATA_QOS == 1)
+        /* Publishes in flight when the link dropped are sent again by the message task */
+        xSemaphoreTake(window_lock, portMAX_DELAY);
+        mqtt_window_resend_all(&window);
+        xSemaphoreGive(window_lock);
+#endif
+        mqtt_topic_resubscribe();
         break;
 
     case MQTT_EVENT_DISCONNECTED:
@@ -100,21 +374,15 @@ static esp_err_t mqtt_client_event_handler(esp_mqtt_event_handle_t event)
 
     case MQTT_EVENT_PUBLISHED:
         ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+#if (MQTT_DATA_QOS == 1)
+        mqtt_window_acked(event->msg_id);
+#endif
         break;
 
     case MQTT_EVENT_DATA:
-        ESP_LOGI(TAG, "MQTT_EVENT_DATA");
-        if((event->data_len > 0) && (event->topic_len > 0))
-        {
-            ESP_LOGI(TAG, "-------- TOPIC = %.*s", event->topic_len, event->topic);
-            mqtt_message_t message;
-            sprintf(message.message, "%.*s", event->data_len, event->data);
-            sprintf(message.topic, "%.*s", event->topic_len, event->topic);
-            if (xQueueSend(mqtt_message_queue, &message, MQTT_QUEUE_MAX_DELAY_MS) != pdTRUE)
-            {
-                ESP_LOGW(TAG, "Send to mqtt message queue fail");
-            }
-        }
+        ESP_LOGD(TAG, "MQTT_EVENT_DATA, %d bytes at %d of %d", event->data_len, event->current_data_offset,
+                 event->total_data_len);
+        mqtt_message_receive(event);
         break;
 
     case MQTT_EVENT_ERROR:
@@ -135,9 +403,7 @@ static esp_err_t mqtt_client_event_handler(esp_mqtt_event_handle_t event)
  */
 static void mqtt_handle_message_task(void* arg)
 {
-    mqtt_message_t message;
-    uint32_t message_count = 0;
-    bool is_exec;
+    mqtt_inbound_t *message;
 
     /* Task will suppend at here util network up */
     wifi_lib_wait_network_up();
@@ -148,27 +414,17 @@ static void mqtt_handle_message_task(void* arg)
 
     while(1)
     {
-        /* Wait message receive */
-        if(xQueueReceive(mqtt_message_queue, &message, portMAX_DELAY) == pdTRUE)
+#if (MQTT_DATA_QOS == 1)
+        mqtt_window_check();
+#endif
+        /* Wait message receive, then take all that came meanwhile */
+        if(xQueueReceive(mqtt_message_queue, &message, MQTT_MESSAGE_WAIT) == pdTRUE)
         {
-            is_exec = false;
-            message_count++;
-            ESP_LOGI(TAG, "-------- %u_DATA %s", message_count, message.message);
-            for(uint8_t i = 0; i < numb_topic; i++) {
-                if(strncmp(message.topic, topic_list[i].topic, strlen(topic_list[i].topic)) == 0) 
-                {
-                    if(topic_list[i].handler != NULL) 
-                    {
-                        topic_list[i].handler(message.message, strlen(message.message));
-                        is_exec = true;
-                    }
-                }
-            }
-            if(!is_exec) 
+            do
             {
-                ESP_LOGW(TAG, "message not handle!!!");
-            }
-            vTaskDelay(100 / portTICK_RATE_MS);
+                mqtt_message_dispatch(message);
+                xQueueSend(mqtt_message_free, &message, 0);
+            } while(xQueueReceive(mqtt_message_queue, &message, 0) == pdTRUE);
         }
     }
     vTaskDelete(NULL);
@@ -180,35 +436,133 @@ static void mqtt_handle_message_task(void* arg)
  * @brief  Client to send a publish message to the broker
  */
 bool mqtt_api_publish(const char* topic, const char* data, uint32_t len)
+{
+#if (MQTT_DATA_QOS == 1)
+    if(mqtt_broker_connected)
+    {
+        return mqtt_window_publish(topic, data, len);
+    }
+    return false;
+#else
+    return mqtt_api_publish_unacked(topic, data, len);
+#endif
+}
+
+/*!
+ * @brief  Client to send a QoS 0 publish message to the broker
+ */
+bool mqtt_api_publish_unacked(const char* topic, const char* data, uint32_t len)
 {
     if(mqtt_broker_connected)
     {
         int32_t msg_id = esp_mqtt_client_publish(mqtt_client, topic, data, len, 0, 0);
-        ESP_LOGI(TAG, "Sent publish successful, msg_id = %d", msg_id);
-        return true;
+        ESP_LOGI(TAG, "Sent publish, msg_id = %d", msg_id);
+        return (msg_id >= 0);
+    }
+
+    return false;
+}
+
+/*!
+ * @brief  Client to send a retained publish message to the broker
+ */
+bool mqtt_api_publish_retained(const char* topic, const char* data, uint32_t len)
+{
+    if(mqtt_broker_connected)
+    {
+        int32_t msg_id = esp_mqtt_client_publish(mqtt_client, topic, data, len, 1, 1);
+        ESP_LOGI(TAG, "Sent retained publish, msg_id = %d", msg_id);
+        return (msg_id >= 0);
     }
 
     return false;
 }
 
 /*!
- * @brief  Register callback handle data reveived from topic
+ * @brief  Get statistics of the QoS 1 window
  */
-bool mqtt_register_callback(char* topic, mqtt_handle_t func) {
-    if (numb_topic >= MQTT_MAX_SUBCRIBE_TOPIC) {
+void mqtt_api_get_window_stats(mqtt_window_stats_t *stats)
+{
+#if (MQTT_DATA_QOS == 1)
+    xSemaphoreTake(window_lock, portMAX_DELAY);
+    mqtt_window_get_stats(&window, stats);
+    xSemaphoreGive(window_lock);
+#else
+    memset(stats, 0, sizeof(mqtt_window_stats_t));
+#endif
+}
+
+/*!
+ * @brief  Get statistics of received messages
+ */
+void mqtt_api_get_inbound_stats(mqtt_inbound_stats_t *stats)
+{
+    memcpy(stats, &mqtt_inbound_stats, sizeof(mqtt_inbound_stats_t));
+}
+
+/*!
+ * @brief  Check if connected to the broker
+ */
+bool mqtt_api_is_connected(void)
+{
+    return mqtt_broker_connected;
+}
+
+/*!
+ * @brief  Add a handler to a topic filter
+ */
+bool mqtt_api_subscribe(const char* filter, mqtt_topic_handler_t handler, void* context)
+{
+    bool added, first;
+
+    if((filter == NULL) || (handler == NULL) || (strlen(filter) >= MQTT_TOPIC_MAX_LENGTH))
+    {
         return false;
     }
 
-    if (topic == NULL || func == NULL) {
+    xSemaphoreTake(topic_lock, portMAX_DELAY);
+    added = mqtt_topic_subscribe(&topic_trie, filter, handler, context, &first);
+    xSemaphoreGive(topic_lock);
+    if(!added)
+    {
+        ESP_LOGE(TAG, "Add topic [%s] fail, invalid or no room", filter);
         return false;
     }
 
-    /* Register callback */
-    topic_list[numb_topic].handler = func;
-    snprintf(topic_list[numb_topic].topic, MQTT_TOPIC_MAX_LENGTH, "%s", topic);
-    numb_topic++;
+    /* Broker is subscribed once per filter, on connect otherwise */
+    if(first && mqtt_broker_connected)
+    {
+        esp_mqtt_client_subscribe(mqtt_client, filter, 0);
+    }
+    ESP_LOGI(TAG, "Add topic [%s] to subcribe list", filter);
+    return true;
+}
 
-    ESP_LOGI(TAG, "Add topic [%s] to subcribe list", topic);
+/*!
+ * @brief  Remove a handler from a topic filter
+ */
+bool mqtt_api_unsubscribe(const char* filter, mqtt_topic_handler_t handler, void* context)
+{
+    bool removed, last;
+
+    if(filter == NULL)
+    {
+        return false;
+    }
+
+    xSemaphoreTake(topic_lock, portMAX_DELAY);
+    removed = mqtt_topic_unsubscribe(&topic_trie, filter, handler, context, &last);
+    xSemaphoreGive(topic_lock);
+    if(!removed)
+    {
+        return false;
+    }
+
+    if(last && mqtt_broker_connected)
+    {
+        esp_mqtt_client_unsubscribe(mqtt_client, filter);
+    }
+    ESP_LOGI(TAG, "Remove topic [%s] from subcribe list", filter);
     return true;
 }
 
@@ -216,13 +570,43 @@ bool mqtt_register_callback(char* topic, mqtt_handle_t func) {
  * @brief  MQTT client (transport over TCP) initialization and start
  */
 void mqtt_api_init(void) {    
+    /* Subscriptions */
+    mqtt_topic_init(&topic_trie, topic_node, MQTT_TOPIC_TRIE_NODES, topic_sub, MQTT_MAX_SUBCRIBE_TOPIC, topic_hash,
+                    MQTT_TOPIC_TRIE_HASH_SIZE);
+    topic_lock = xSemaphoreCreateMutex();
+    if(topic_lock == NULL)
+    {
+        ESP_LOGE(TAG, "Create topic lock fail");
+        return;
+    }
+
     /* Creat message queue */
-    mqtt_message_queue = xQueueCreate(MQTT_MESSAGE_QUEUE_SIZE, sizeof(mqtt_message_t));
-    if(mqtt_message_queue == NULL)
+    mqtt_message_queue = xQueueCreate(MQTT_MESSAGE_QUEUE_SIZE, sizeof(mqtt_inbound_t*));
+    mqtt_message_free = xQueueCreate(MQTT_MESSAGE_QUEUE_SIZE, sizeof(mqtt_inbound_t*));
+    if((mqtt_message_queue == NULL) || (mqtt_message_free == NULL))
     {
         ESP_LOGE(TAG, "Create message queue fail");
         return;
     }
+    for(uint32_t i = 0; i < MQTT_MESSAGE_QUEUE_SIZE; i++)
+    {
+        mqtt_inbound_t *message = &mqtt_message_pool.message[i];
+        mqtt_inbound_init(message, mqtt_message_pool.topic[i], MQTT_TOPIC_MAX_LENGTH, mqtt_message_pool.data[i],
+                          MQTT_MESSAGE_MAX_LENGTH + 1);
+        xQueueSend(mqtt_message_free, &message, 0);
+    }
+
+#if (MQTT_DATA_QOS == 1)
+    mqtt_window_init(&window, window_slot, MQTT_QOS1_WINDOW, &window_storage[0][0], sizeof(window_storage[0]),
+                     MQTT_QOS1_RETRANSMIT_MS);
+    window_lock = xSemaphoreCreateMutex();
+    window_free = xSemaphoreCreateCounting(MQTT_QOS1_WINDOW, MQTT_QOS1_WINDOW);
+    if((window_lock == NULL) || (window_free == NULL))
+    {
+        ESP_LOGE(TAG, "Create publish window fail");
+        return;
+    }
+#endif
 
     esp_mqtt_client_config_t mqtt_cfg = {
         .uri = MQTT_BROKER_URI,
@@ -14,6 +14,9 @@
 /******************************************************************************/
 
 #include <stdint.h>
+#include "mqtt_window.h"
+#include "mqtt_inbound.h"
+#include "mqtt_topic.h"
 
 /******************************************************************************/
 /*                     EXPORTED TYPES and DEFINITIONS                         */
@@ -21,8 +24,6 @@
 
 #define MQTT_AUTO_LENGTH                              0
 
-typedef void (*mqtt_handle_t)(char*, uint32_t);
-
 /******************************************************************************/
 /*                              PRIVATE DATA                                  */
 /******************************************************************************/
@@ -45,21 +46,67 @@ typedef void (*mqtt_handle_t)(char*, uint32_t);
 void mqtt_api_init(void);
 
 /*!
- * @brief  publish message to the broker
+ * @brief  publish message to the broker, with MQTT_DATA_QOS. At QoS 1 the message waits up to
+ *         MQTT_QOS1_WINDOW_WAIT_MS for a slot in the window, then is kept until acked
  * @param  data: payload string (set to NULL, sending empty payload message)
  * @param  len:  data length, if set to 0, length is calculated from payload string
- * @retval true if success
+ * @retval true if success, at QoS 1 the message is delivered at least once
  */
 bool mqtt_api_publish(const char* topic, const char* data, uint32_t len);
 
+/*!
+ * @brief  publish message with QoS 0 whatever MQTT_DATA_QOS, for messages worth nothing once late, e.g. heartbeat
+ * @param  data: payload string
+ * @param  len:  data length, if set to 0, length is calculated from payload string
+ * @retval true if success
+ */
+bool mqtt_api_publish_unacked(const char* topic, const char* data, uint32_t len);
+
+/*!
+ * @brief  publish retained message, the broker gives it to every new subscriber of the topic
+ * @param  data: payload
+ * @param  len:  data length, if set to 0, length is calculated from payload string
+ * @retval true if success
+ */
+bool mqtt_api_publish_retained(const char* topic, const char* data, uint32_t len);
+
+/*!
+ * @brief  get statistics of the QoS 1 window: depth in flight, ack latency, retransmits
+ * @param  stats: [out] statistics, all 0 when MQTT_DATA_QOS is 0
+ * @retval None
+ */
+void mqtt_api_get_window_stats(mqtt_window_stats_t *stats);
+
+/*!
+ * @brief  get statistics of received messages: fragmented, dropped for lack of buffer, too large
+ * @param  stats: [out] statistics
+ * @retval None
+ */
+void mqtt_api_get_inbound_stats(mqtt_inbound_stats_t *stats);
+
+/*!
+ * @brief  check if the client is connected to the broker
+ * @retval true if connected
+ */
+bool mqtt_api_is_connected(void);
+
+/*!
+ * @brief  add a handler to a topic filter, at any time after mqtt_api_init. "+" matches one level,
+ *         "#" as last level matches the rest, e.g. "meters/+/cmd". The broker is subscribed once per filter
+ * @param  filter  : topic filter
+ * @param  handler : called from the MQTT task for each message matching the filter
+ * @param  context : given back to the handler
+ * @retval true when added or already there, false if the filter is invalid or MQTT_MAX_SUBCRIBE_TOPIC is reached
+ */
+bool mqtt_api_subscribe(const char* filter, mqtt_topic_handler_t handler, void* context);
 
 /*!
- * @brief  register calback function for topic
- * @param  topic : topic name
- * @param  func  : callback function
- * @retval true when resgister success, otherwise return false
+ * @brief  remove a handler from a topic filter, the broker is unsubscribed with the last one.
+ *         A message dispatched meanwhile may still reach the handler once
+ * @param  filter, handler, context : as given to mqtt_api_subscribe
+ * @retval true when removed
  */
-bool mqtt_register_callback(char* topic, mqtt_handle_t func);
+bool mqtt_api_unsubscribe(const char* filter, mqtt_topic_handler_t handler, void* context);
 
 /******************************************************************************/
 
@@ -0,0 +1,81 @@
+/*
+ *  mqtt_inbound.c
+ *
+ *  Created on: Mar 07, 2022
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <string.h>
+#include "mqtt_inbound.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+/*!
+ * @brief  Initialize a message buffer
+ */
+void mqtt_inbound_init(mqtt_inbound_t *message, char *topic, uint32_t topic_size, char *data, uint32_t size)
+{
+    memset(message, 0, sizeof(mqtt_inbound_t));
+    message->topic = topic;
+    message->topic_size = topic_size;
+    message->data = data;
+    message->size = size;
+}
+
+/*!
+ * @brief  Copy a chunk of a message at its offset
+ */
+mqtt_inbound_result_t mqtt_inbound_chunk(mqtt_inbound_t *message, const char *topic, uint32_t topic_length,
+                                         const char *data, uint32_t length, uint32_t offset, uint32_t total)
+{
+    if(offset == 0)
+    {
+        if((topic_length >= message->topic_size) || (total >= message->size))
+        {
+            return MQTT_INBOUND_TOO_LARGE;
+        }
+        memcpy(message->topic, topic, topic_length);
+        message->topic[topic_length] = '\0';
+        message->topic_length = topic_length;
+        message->length = total;
+        message->received = 0;
+    }
+    if((offset != message->received) || (total != message->length) || ((offset + length) > total))
+    {
+        return MQTT_INBOUND_BROKEN;
+    }
+
+    memcpy(&message->data[offset], data, length);
+    message->received += length;
+    if(message->received < total)
+    {
+        return MQTT_INBOUND_PART;
+    }
+    message->data[total] = '\0';
+    return MQTT_INBOUND_DONE;
+}
@@ -0,0 +1,95 @@
+/*
+ *  mqtt_inbound.h
+ *
+ *  Created on: Mar 07, 2022
+ */
+
+#ifndef _MQTT_INBOUND_H_
+#define _MQTT_INBOUND_H_
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+/* Result of a chunk */
+typedef uint8_t mqtt_inbound_result_t;
+enum {
+    MQTT_INBOUND_PART = 0,                            /* More chunks to come */
+    MQTT_INBOUND_DONE,                                /* Message complete */
+    MQTT_INBOUND_TOO_LARGE,                           /* Topic or payload larger than the buffer, message dropped */
+    MQTT_INBOUND_BROKEN,                              /* Chunk not at the next offset, message dropped */
+};
+
+/*!
+ * @brief  Inbound statistics
+ */
+typedef struct {
+    uint32_t received;                                /* Messages handed to the message task */
+    uint32_t fragmented;                              /* Of them, received in more than one chunk */
+    uint32_t overflow;                                /* Dropped, no free buffer */
+    uint32_t too_large;
+    uint32_t broken;
+    uint32_t max_queued;                              /* Most messages waiting for the message task */
+} mqtt_inbound_stats_t;
+
+/*!
+ * @brief  Message reassembled from the chunks of MQTT_EVENT_DATA. Topic and payload are zero terminated
+ */
+typedef struct {
+    char *topic;
+    uint32_t topic_size;
+    uint32_t topic_length;
+    char *data;
+    uint32_t size;
+    uint32_t length;                                  /* Total payload length */
+    uint32_t received;
+} mqtt_inbound_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+/*!
+ * @brief  Initialize a message buffer
+ * @param  Message
+ *         Topic buffer and its size
+ *         Payload buffer and its size, one byte is kept for the terminating zero
+ * @retval None
+ */
+void mqtt_inbound_init(mqtt_inbound_t *message, char *topic, uint32_t topic_size, char *data, uint32_t size);
+
+/*!
+ * @brief  Copy a chunk of a message at its offset. The chunk at offset 0 starts the message and carries the topic
+ * @param  Message
+ *         Topic and its length, used at offset 0 only
+ *         Chunk data, its length and offset in the payload
+ *         Total payload length
+ * @retval Result, the message is complete on MQTT_INBOUND_DONE
+ */
+mqtt_inbound_result_t mqtt_inbound_chunk(mqtt_inbound_t *message, const char *topic, uint32_t topic_length,
+                                         const char *data, uint32_t length, uint32_t offset, uint32_t total);
+
+/******************************************************************************/
+
+#endif /* _MQTT_INBOUND_H_ */
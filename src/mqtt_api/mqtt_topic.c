@@ -0,0 +1,465 @@
+/*
+ *  mqtt_topic.c
+ *
+ *  Created on: Mar 09, 2022
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <string.h>
+#include "mqtt_topic.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define MQTT_TOPIC_ROOT                               0
+#define MQTT_TOPIC_DELETED                            0xFFFE    /* Hash slot of a removed node */
+#define MQTT_TOPIC_MAX_LEVELS                         32
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static uint32_t mqtt_topic_hash(uint16_t parent, const char *segment, uint32_t length);
+static uint16_t mqtt_topic_find(const mqtt_topic_trie_t *trie, uint16_t parent, const char *segment, uint32_t length);
+static uint16_t mqtt_topic_add(mqtt_topic_trie_t *trie, uint16_t parent, const char *segment, uint32_t length);
+static void mqtt_topic_prune(mqtt_topic_trie_t *trie, uint16_t index);
+static bool mqtt_topic_valid(const char *filter);
+static uint16_t mqtt_topic_walk(mqtt_topic_trie_t *trie, const char *filter, bool create);
+static void mqtt_topic_collect(const mqtt_topic_trie_t *trie, uint16_t index, mqtt_topic_route_t *route, uint32_t max,
+                               uint32_t *count);
+static void mqtt_topic_match_node(const mqtt_topic_trie_t *trie, uint16_t index, const char *topic,
+                                  mqtt_topic_route_t *route, uint32_t max, uint32_t *count);
+
+/******************************************************************************/
+
+/*!
+ * @brief  FNV-1a of the segment, seeded with the parent
+ */
+static uint32_t mqtt_topic_hash(uint16_t parent, const char *segment, uint32_t length)
+{
+    uint32_t hash = 2166136261UL ^ parent;
+
+    for(uint32_t i = 0; i < length; i++)
+    {
+        hash ^= (uint8_t) segment[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+/*!
+ * @brief  Child of a node by segment
+ * @retval Node index, MQTT_TOPIC_NONE if none
+ */
+static uint16_t mqtt_topic_find(const mqtt_topic_trie_t *trie, uint16_t parent, const char *segment, uint32_t length)
+{
+    uint32_t slot = mqtt_topic_hash(parent, segment, length) & trie->hash_mask;
+    const mqtt_topic_node_t *node;
+    uint16_t index;
+
+    for(uint32_t probe = 0; probe <= trie->hash_mask; probe++)
+    {
+        index = trie->hash[slot];
+        if(index == MQTT_TOPIC_NONE)
+        {
+            break;
+        }
+        if(index != MQTT_TOPIC_DELETED)
+        {
+            node = &trie->node[index];
+            if((node->parent == parent) && (node->length == length) && (memcmp(node->segment, segment, length) == 0))
+            {
+                return index;
+            }
+        }
+        slot = (slot + 1) & trie->hash_mask;
+    }
+    return MQTT_TOPIC_NONE;
+}
+
+/*!
+ * @brief  New child of a node
+ * @retval Node index, MQTT_TOPIC_NONE if the trie is full
+ */
+static uint16_t mqtt_topic_add(mqtt_topic_trie_t *trie, uint16_t parent, const char *segment, uint32_t length)
+{
+    uint32_t slot = mqtt_topic_hash(parent, segment, length) & trie->hash_mask;
+    mqtt_topic_node_t *node;
+    uint16_t index;
+
+    if(length > MQTT_TOPIC_SEGMENT_SIZE)
+    {
+        return MQTT_TOPIC_NONE;
+    }
+    for(index = 0; index < trie->node_count; index++)
+    {
+        if(!trie->node[index].used)
+        {
+            break;
+        }
+    }
+    if(index == trie->node_count)
+    {
+        return MQTT_TOPIC_NONE;
+    }
+    while((trie->hash[slot] != MQTT_TOPIC_NONE) && (trie->hash[slot] != MQTT_TOPIC_DELETED))
+    {
+        slot = (slot + 1) & trie->hash_mask;
+    }
+
+    node = &trie->node[index];
+    node->used = 1;
+    node->parent = parent;
+    node->sub = MQTT_TOPIC_NONE;
+    node->children = 0;
+    node->length = length;
+    memcpy(node->segment, segment, length);
+    trie->hash[slot] = index;
+    trie->node[parent].children++;
+    trie->nodes_used++;
+    return index;
+}
+
+/*!
+ * @brief  Remove a node with no subscription and no child, then its parents alike
+ */
+static void mqtt_topic_prune(mqtt_topic_trie_t *trie, uint16_t index)
+{
+    mqtt_topic_node_t *node;
+    uint32_t slot;
+
+    while(index != MQTT_TOPIC_ROOT)
+    {
+        node = &trie->node[index];
+        if((node->sub != MQTT_TOPIC_NONE) || (node->children > 0))
+        {
+            return;
+        }
+        slot = mqtt_topic_hash(node->parent, node->segment, node->length) & trie->hash_mask;
+        while(trie->hash[slot] != index)
+        {
+            slot = (slot + 1) & trie->hash_mask;
+        }
+        trie->hash[slot] = MQTT_TOPIC_DELETED;
+        node->used = 0;
+        trie->nodes_used--;
+        trie->node[node->parent].children--;
+        index = node->parent;
+    }
+}
+
+/*!
+ * @brief  Check a filter: wildcards take a whole level, "#" only the last one
+ */
+static bool mqtt_topic_valid(const char *filter)
+{
+    const char *level = filter;
+    const char *end;
+    uint32_t length;
+
+    if(*filter == '\0')
+    {
+        return false;
+    }
+    while(level != NULL)
+    {
+        end = strchr(level, '/');
+        length = (end != NULL) ? (uint32_t) (end - level) : strlen(level);
+        if(length > MQTT_TOPIC_SEGMENT_SIZE)
+        {
+            return false;
+        }
+        for(uint32_t i = 0; i < length; i++)
+        {
+            if(((level[i] == '+') || (level[i] == '#')) && (length != 1))
+            {
+                return false;
+            }
+        }
+        if((level[0] == '#') && (end != NULL))
+        {
+            return false;
+        }
+        level = (end != NULL) ? end + 1 : NULL;
+    }
+    return true;
+}
+
+/*!
+ * @brief  Node of a filter, its levels are created if asked
+ * @retval Node index, MQTT_TOPIC_NONE if not found or the trie is full
+ */
+static uint16_t mqtt_topic_walk(mqtt_topic_trie_t *trie, const char *filter, bool create)
+{
+    uint16_t index = MQTT_TOPIC_ROOT;
+    uint16_t child;
+    const char *level = filter;
+    const char *end;
+    uint32_t length;
+
+    while(level != NULL)
+    {
+        end = strchr(level, '/');
+        length = (end != NULL) ? (uint32_t) (end - level) : strlen(level);
+        child = mqtt_topic_find(trie, index, level, length);
+        if((child == MQTT_TOPIC_NONE) && create)
+        {
+            child = mqtt_topic_add(trie, index, level, length);
+            if(child == MQTT_TOPIC_NONE)
+            {
+                /* Levels added so far are of no use */
+                mqtt_topic_prune(trie, index);
+            }
+        }
+        if(child == MQTT_TOPIC_NONE)
+        {
+            return MQTT_TOPIC_NONE;
+        }
+        index = child;
+        level = (end != NULL) ? end + 1 : NULL;
+    }
+    return index;
+}
+
+/*!
+ * @brief  Add the subscriptions of a node to the handlers found
+ */
+static void mqtt_topic_collect(const mqtt_topic_trie_t *trie, uint16_t index, mqtt_topic_route_t *route, uint32_t max,
+                               uint32_t *count)
+{
+    const mqtt_topic_sub_t *sub;
+
+    for(uint16_t i = trie->node[index].sub; (i != MQTT_TOPIC_NONE) && (*count < max); i = sub->next)
+    {
+        sub = &trie->sub[i];
+        route[*count].handler = sub->handler;
+        route[*count].context = sub->context;
+        (*count)++;
+    }
+}
+
+/*!
+ * @brief  Match the rest of a topic from a node: exact level, "+" and "#" children.
+ *         Topics starting with '$' are not matched by a wildcard at the first level
+ */
+static void mqtt_topic_match_node(const mqtt_topic_trie_t *trie, uint16_t index, const char *topic,
+                                  mqtt_topic_route_t *route, uint32_t max, uint32_t *count)
+{
+    bool wildcard = !((index == MQTT_TOPIC_ROOT) && (topic != NULL) && (topic[0] == '$'));
+    const char *end;
+    const char *next;
+    uint32_t length;
+    uint16_t child;
+
+    /* "a/#" matches "a" too */
+    if(topic == NULL)
+    {
+        mqtt_topic_collect(trie, index, route, max, count);
+        child = mqtt_topic_find(trie, index, "#", 1);
+        if(child != MQTT_TOPIC_NONE)
+        {
+            mqtt_topic_collect(trie, child, route, max, count);
+        }
+        return;
+    }
+
+    end = strchr(topic, '/');
+    length = (end != NULL) ? (uint32_t) (end - topic) : strlen(topic);
+    next = (end != NULL) ? end + 1 : NULL;
+
+    child = mqtt_topic_find(trie, index, topic, length);
+    if(child != MQTT_TOPIC_NONE)
+    {
+        mqtt_topic_match_node(trie, child, next, route, max, count);
+    }
+    if(wildcard)
+    {
+        child = mqtt_topic_find(trie, index, "+", 1);
+        if(child != MQTT_TOPIC_NONE)
+        {
+            mqtt_topic_match_node(trie, child, next, route, max, count);
+        }
+        child = mqtt_topic_find(trie, index, "#", 1);
+        if(child != MQTT_TOPIC_NONE)
+        {
+            mqtt_topic_collect(trie, child, route, max, count);
+        }
+    }
+}
+
+/******************************************************************************/
+
+/*!
+ * @brief  Initialize an empty trie
+ */
+void mqtt_topic_init(mqtt_topic_trie_t *trie, mqtt_topic_node_t *node, uint16_t node_count, mqtt_topic_sub_t *sub,
+                     uint16_t sub_count, uint16_t *hash, uint16_t hash_size)
+{
+    memset(trie, 0, sizeof(mqtt_topic_trie_t));
+    memset(node, 0, node_count * sizeof(mqtt_topic_node_t));
+    trie->node = node;
+    trie->node_count = node_count;
+    trie->sub = sub;
+    trie->sub_count = sub_count;
+    trie->hash = hash;
+    trie->hash_mask = hash_size - 1;
+    for(uint32_t i = 0; i < hash_size; i++)
+    {
+        hash[i] = MQTT_TOPIC_NONE;
+    }
+    for(uint16_t i = 0; i < sub_count; i++)
+    {
+        sub[i].next = ((i + 1) < sub_count) ? (i + 1) : MQTT_TOPIC_NONE;
+    }
+    trie->free_sub = (sub_count > 0) ? 0 : MQTT_TOPIC_NONE;
+
+    node[MQTT_TOPIC_ROOT].used = 1;
+    node[MQTT_TOPIC_ROOT].parent = MQTT_TOPIC_NONE;
+    node[MQTT_TOPIC_ROOT].sub = MQTT_TOPIC_NONE;
+    trie->nodes_used = 1;
+}
+
+/*!
+ * @brief  Add a handler to a topic filter
+ */
+bool mqtt_topic_subscribe(mqtt_topic_trie_t *trie, const char *filter, mqtt_topic_handler_t handler, void *context,
+                          bool *first)
+{
+    mqtt_topic_node_t *node;
+    mqtt_topic_sub_t *sub;
+    uint16_t index, i;
+
+    *first = false;
+    if((handler == NULL) || !mqtt_topic_valid(filter) || (trie->free_sub == MQTT_TOPIC_NONE))
+    {
+        return false;
+    }
+    index = mqtt_topic_walk(trie, filter, true);
+    if(index == MQTT_TOPIC_NONE)
+    {
+        return false;
+    }
+    node = &trie->node[index];
+
+    /* Already subscribed */
+    for(i = node->sub; i != MQTT_TOPIC_NONE; i = trie->sub[i].next)
+    {
+        if((trie->sub[i].handler == handler) && (trie->sub[i].context == context))
+        {
+            return true;
+        }
+    }
+
+    i = trie->free_sub;
+    sub = &trie->sub[i];
+    trie->free_sub = sub->next;
+    sub->handler = handler;
+    sub->context = context;
+    sub->node = index;
+    sub->next = node->sub;
+    *first = (node->sub == MQTT_TOPIC_NONE);
+    node->sub = i;
+    trie->subs_used++;
+    return true;
+}
+
+/*!
+ * @brief  Remove a handler from a topic filter
+ */
+bool mqtt_topic_unsubscribe(mqtt_topic_trie_t *trie, const char *filter, mqtt_topic_handler_t handler, void *context,
+                            bool *last)
+{
+    uint16_t index = mqtt_topic_walk(trie, filter, false);
+    uint16_t *link;
+    mqtt_topic_sub_t *sub;
+
+    *last = false;
+    if(index == MQTT_TOPIC_NONE)
+    {
+        return false;
+    }
+    for(link = &trie->node[index].sub; *link != MQTT_TOPIC_NONE; link = &sub->next)
+    {
+        sub = &trie->sub[*link];
+        if((sub->handler == handler) && (sub->context == context))
+        {
+            uint16_t i = *link;
+            *link = sub->next;
+            sub->next = trie->free_sub;
+            trie->free_sub = i;
+            trie->subs_used--;
+            *last = (trie->node[index].sub == MQTT_TOPIC_NONE);
+            mqtt_topic_prune(trie, index);
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * @brief  Get the handlers of the filters matching a topic
+ */
+uint32_t mqtt_topic_match(const mqtt_topic_trie_t *trie, const char *topic, mqtt_topic_route_t *route, uint32_t max)
+{
+    uint32_t count = 0;
+
+    mqtt_topic_match_node(trie, MQTT_TOPIC_ROOT, topic, route, max, &count);
+    return count;
+}
+
+/*!
+ * @brief  Get the filter ending at a node
+ */
+bool mqtt_topic_filter(const mqtt_topic_trie_t *trie, uint16_t index, char *filter, uint32_t size)
+{
+    uint16_t path[MQTT_TOPIC_MAX_LEVELS];
+    uint32_t depth = 0, length = 0;
+    const mqtt_topic_node_t *node;
+
+    if((index >= trie->node_count) || !trie->node[index].used || (trie->node[index].sub == MQTT_TOPIC_NONE))
+    {
+        return false;
+    }
+    for(; index != MQTT_TOPIC_ROOT; index = trie->node[index].parent)
+    {
+        if(depth == MQTT_TOPIC_MAX_LEVELS)
+        {
+            return false;
+        }
+        path[depth++] = index;
+    }
+    while(depth > 0)
+    {
+        node = &trie->node[path[--depth]];
+        if((length + node->length + 2) > size)
+        {
+            return false;
+        }
+        memcpy(&filter[length], node->segment, node->length);
+        length += node->length;
+        if(depth > 0)
+        {
+            filter[length++] = '/';
+        }
+    }
+    filter[length] = '\0';
+    return true;
+}
@@ -0,0 +1,143 @@
+/*
+ *  mqtt_topic.h
+ *
+ *  Created on: Mar 09, 2022
+ */
+
+#ifndef _MQTT_TOPIC_H_
+#define _MQTT_TOPIC_H_
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define MQTT_TOPIC_SEGMENT_SIZE                       24    /* Longest topic level, with no terminating zero */
+#define MQTT_TOPIC_NONE                               0xFFFF
+
+/*!
+ * @brief  Handler of the messages of a topic filter
+ * @param  Topic of the message
+ *         Payload, zero terminated, and its length
+ *         Context given at subscribe
+ */
+typedef void (*mqtt_topic_handler_t)(const char *topic, char *data, uint32_t length, void *context);
+
+/*!
+ * @brief  Handler matching a topic
+ */
+typedef struct {
+    mqtt_topic_handler_t handler;
+    void *context;
+} mqtt_topic_route_t;
+
+/*!
+ * @brief  Topic level. Children are found through the hash table of the trie, by parent and segment
+ */
+typedef struct {
+    uint16_t parent;
+    uint16_t sub;                                     /* First subscription of the filter ending here */
+    uint16_t children;
+    uint8_t used;
+    uint8_t length;
+    char segment[MQTT_TOPIC_SEGMENT_SIZE];
+} mqtt_topic_node_t;
+
+/*!
+ * @brief  Subscription, a handler and its context on a filter
+ */
+typedef struct {
+    mqtt_topic_handler_t handler;
+    void *context;
+    uint16_t next;                                    /* Next subscription of the same filter, or next free */
+    uint16_t node;
+} mqtt_topic_sub_t;
+
+/*!
+ * @brief  Topic trie, one node per filter level. Not thread safe, the caller locks
+ */
+typedef struct {
+    mqtt_topic_node_t *node;
+    uint16_t node_count;
+    uint16_t nodes_used;
+    mqtt_topic_sub_t *sub;
+    uint16_t sub_count;
+    uint16_t subs_used;
+    uint16_t free_sub;
+    uint16_t *hash;                                   /* Node index by (parent, segment), open addressing */
+    uint16_t hash_mask;
+} mqtt_topic_trie_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+/*!
+ * @brief  Initialize an empty trie
+ * @param  Trie
+ *         Nodes and their number, one is the root
+ *         Subscriptions and their number
+ *         Hash table and its size, power of 2 larger than the number of nodes
+ * @retval None
+ */
+void mqtt_topic_init(mqtt_topic_trie_t *trie, mqtt_topic_node_t *node, uint16_t node_count, mqtt_topic_sub_t *sub,
+                     uint16_t sub_count, uint16_t *hash, uint16_t hash_size);
+
+/*!
+ * @brief  Add a handler to a topic filter. "+" matches one level, "#" as last level matches the rest
+ * @param  Trie, filter, handler and its context
+ *         [out] True if the filter had no subscription, the broker must be subscribed
+ * @retval True if added, false if the filter is invalid or the trie is full
+ */
+bool mqtt_topic_subscribe(mqtt_topic_trie_t *trie, const char *filter, mqtt_topic_handler_t handler, void *context,
+                          bool *first);
+
+/*!
+ * @brief  Remove a handler from a topic filter
+ * @param  Trie, filter, handler and its context
+ *         [out] True if the filter has no subscription left, the broker can be unsubscribed
+ * @retval True if removed, false if not subscribed
+ */
+bool mqtt_topic_unsubscribe(mqtt_topic_trie_t *trie, const char *filter, mqtt_topic_handler_t handler, void *context,
+                            bool *last);
+
+/*!
+ * @brief  Get the handlers of the filters matching a topic. Cost grows with the levels of the topic,
+ *         not with the number of subscriptions
+ * @param  Trie, topic
+ *         [out] Handlers and the room for them
+ * @retval Number of handlers, at most "max"
+ */
+uint32_t mqtt_topic_match(const mqtt_topic_trie_t *trie, const char *topic, mqtt_topic_route_t *route, uint32_t max);
+
+/*!
+ * @brief  Get the filter ending at a node, e.g. to subscribe every filter again on reconnect
+ * @param  Trie, node index from 0 to node_count - 1
+ *         [out] Filter and its size
+ * @retval True if a filter with subscriptions ends at the node
+ */
+bool mqtt_topic_filter(const mqtt_topic_trie_t *trie, uint16_t index, char *filter, uint32_t size);
+
+/******************************************************************************/
+
+#endif /* _MQTT_TOPIC_H_ */
@@ -0,0 +1,280 @@
+/*
+ *  mqtt_window.c
+ *
+ *  Created on: Mar 04, 2022
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <string.h>
+#include "mqtt_window.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define MQTT_WINDOW_NO_ID                             (-1)
+
+/* Weight of the last ack in the moving average, 1/8 */
+#define MQTT_WINDOW_AVG_SHIFT                         3
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static void mqtt_window_release(mqtt_window_t *window, mqtt_window_slot_t *slot, uint32_t now_ms);
+static bool mqtt_window_early_take(mqtt_window_t *window, int32_t msg_id);
+
+/******************************************************************************/
+
+/*!
+ * @brief  Free an acked slot, update ack latency
+ */
+static void mqtt_window_release(mqtt_window_t *window, mqtt_window_slot_t *slot, uint32_t now_ms)
+{
+    mqtt_window_stats_t *stats = &window->stats;
+    uint32_t latency = now_ms - slot->first_ms;
+
+    slot->used = false;
+    slot->pending = false;
+    slot->msg_id = MQTT_WINDOW_NO_ID;
+    stats->in_flight--;
+    stats->acked++;
+    stats->ack_latency_last = latency;
+    if(latency > stats->ack_latency_max)
+    {
+        stats->ack_latency_max = latency;
+    }
+    if(stats->acked == 1)
+    {
+        stats->ack_latency_avg = latency;
+    }
+    else
+    {
+        stats->ack_latency_avg = stats->ack_latency_avg - (stats->ack_latency_avg >> MQTT_WINDOW_AVG_SHIFT) +
+                                 (latency >> MQTT_WINDOW_AVG_SHIFT);
+    }
+}
+
+/*!
+ * @brief  Take an ack that came before mqtt_window_sent() of its publish
+ */
+static bool mqtt_window_early_take(mqtt_window_t *window, int32_t msg_id)
+{
+    for(uint32_t i = 0; i < MQTT_WINDOW_EARLY_ACKS; i++)
+    {
+        if(window->early[i] == msg_id)
+        {
+            window->early[i] = MQTT_WINDOW_NO_ID;
+            return true;
+        }
+    }
+    return false;
+}
+
+/******************************************************************************/
+
+/*!
+ * @brief  Initialize an empty window
+ */
+void mqtt_window_init(mqtt_window_t *window, mqtt_window_slot_t *slot, uint32_t count, uint8_t *storage,
+                      uint32_t storage_size, uint32_t retransmit_ms)
+{
+    memset(window, 0, sizeof(mqtt_window_t));
+    memset(slot, 0, count * sizeof(mqtt_window_slot_t));
+    window->slot = slot;
+    window->count = count;
+    window->storage = storage;
+    window->storage_size = storage_size;
+    window->retransmit_ms = retransmit_ms;
+    for(uint32_t i = 0; i < count; i++)
+    {
+        slot[i].msg_id = MQTT_WINDOW_NO_ID;
+    }
+    for(uint32_t i = 0; i < MQTT_WINDOW_EARLY_ACKS; i++)
+    {
+        window->early[i] = MQTT_WINDOW_NO_ID;
+    }
+}
+
+/*!
+ * @brief  Copy a publish into a free slot
+ */
+mqtt_window_slot_t* mqtt_window_put(mqtt_window_t *window, const char *topic, const uint8_t *data, uint16_t length)
+{
+    uint32_t topic_length = strlen(topic);
+    mqtt_window_slot_t *slot;
+    uint8_t *storage;
+
+    if((topic_length + 1 + length) > window->storage_size)
+    {
+        window->stats.full++;
+        return NULL;
+    }
+    for(uint32_t i = 0; i < window->count; i++)
+    {
+        slot = &window->slot[i];
+        if(slot->used)
+        {
+            continue;
+        }
+        storage = &window->storage[i * window->storage_size];
+        memcpy(storage, topic, topic_length + 1);
+        memcpy(&storage[topic_length + 1], data, length);
+        slot->used = true;
+        slot->pending = true;
+        slot->msg_id = MQTT_WINDOW_NO_ID;
+        slot->seq = ++window->seq;
+        slot->topic_length = topic_length;
+        slot->length = length;
+        slot->attempts = 0;
+        window->stats.in_flight++;
+        if(window->stats.in_flight > window->stats.max_in_flight)
+        {
+            window->stats.max_in_flight = window->stats.in_flight;
+        }
+        return slot;
+    }
+    window->stats.full++;
+    return NULL;
+}
+
+/*!
+ * @brief  Record a send of a slot
+ */
+bool mqtt_window_sent(mqtt_window_t *window, mqtt_window_slot_t *slot, uint32_t seq, int32_t msg_id, uint32_t now_ms)
+{
+    /* Acked and reused while it was sent again */
+    if(!slot->used || (slot->seq != seq))
+    {
+        return false;
+    }
+    if(msg_id < 0)
+    {
+        slot->pending = true;
+        return false;
+    }
+
+    if(slot->attempts == 0)
+    {
+        slot->first_ms = now_ms;
+        window->stats.sent++;
+    }
+    else
+    {
+        window->stats.retransmits++;
+    }
+    slot->attempts++;
+    slot->msg_id = msg_id;
+    slot->sent_ms = now_ms;
+    slot->pending = false;
+
+    if(mqtt_window_early_take(window, msg_id))
+    {
+        window->stats.unknown_acks--;
+        mqtt_window_release(window, slot, now_ms);
+        return true;
+    }
+    return false;
+}
+
+/*!
+ * @brief  Release the slot of an acked publish
+ */
+bool mqtt_window_ack(mqtt_window_t *window, int32_t msg_id, uint32_t now_ms)
+{
+    mqtt_window_slot_t *slot;
+
+    for(uint32_t i = 0; i < window->count; i++)
+    {
+        slot = &window->slot[i];
+        if(slot->used && (slot->msg_id == msg_id))
+        {
+            mqtt_window_release(window, slot, now_ms);
+            return true;
+        }
+    }
+
+    /* The send may not be recorded yet, keep the id for mqtt_window_sent() */
+    window->early[window->early_next] = msg_id;
+    window->early_next = (window->early_next + 1) % MQTT_WINDOW_EARLY_ACKS;
+    window->stats.unknown_acks++;
+    return false;
+}
+
+/*!
+ * @brief  Get a slot to send, the oldest first
+ */
+mqtt_window_slot_t* mqtt_window_next_due(mqtt_window_t *window, uint32_t now_ms)
+{
+    mqtt_window_slot_t *slot;
+    mqtt_window_slot_t *best = NULL;
+
+    for(uint32_t i = 0; i < window->count; i++)
+    {
+        slot = &window->slot[i];
+        if(!slot->used)
+        {
+            continue;
+        }
+        if(!slot->pending && ((now_ms - slot->sent_ms) < window->retransmit_ms))
+        {
+            continue;
+        }
+        if((best == NULL) || ((int32_t)(slot->seq - best->seq) < 0))
+        {
+            best = slot;
+        }
+    }
+    return best;
+}
+
+/*!
+ * @brief  Mark every publish in flight to send again
+ */
+void mqtt_window_resend_all(mqtt_window_t *window)
+{
+    for(uint32_t i = 0; i < window->count; i++)
+    {
+        if(window->slot[i].used)
+        {
+            window->slot[i].pending = true;
+        }
+    }
+}
+
+/*!
+ * @brief  Get topic and payload of a slot
+ */
+const char* mqtt_window_get(const mqtt_window_t *window, const mqtt_window_slot_t *slot, const uint8_t **data, uint16_t *length)
+{
+    const uint8_t *storage = &window->storage[(slot - window->slot) * window->storage_size];
+
+    *data = &storage[slot->topic_length + 1];
+    *length = slot->length;
+    return (const char*) storage;
+}
+
+/*!
+ * @brief  Get window statistics
+ */
+void mqtt_window_get_stats(const mqtt_window_t *window, mqtt_window_stats_t *stats)
+{
+    memcpy(stats, &window->stats, sizeof(mqtt_window_stats_t));
+}
@@ -0,0 +1,153 @@
+/*
+ *  mqtt_window.h
+ *
+ *  Created on: Mar 04, 2022
+ */
+
+#ifndef _MQTT_WINDOW_H_
+#define _MQTT_WINDOW_H_
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define MQTT_WINDOW_EARLY_ACKS                        4     /* Acks seen before their publish was recorded as sent */
+
+/*!
+ * @brief  Window statistics, time in ms
+ */
+typedef struct {
+    uint32_t in_flight;                               /* Publishes not acked */
+    uint32_t max_in_flight;
+    uint32_t sent;                                    /* First sends */
+    uint32_t retransmits;
+    uint32_t acked;
+    uint32_t unknown_acks;                            /* Acks of no publish in flight, e.g. of a send retransmitted since */
+    uint32_t full;                                    /* Publishes refused, window full or payload too large */
+    uint32_t ack_latency_avg;                         /* From first send to ack, moving average */
+    uint32_t ack_latency_max;
+    uint32_t ack_latency_last;
+} mqtt_window_stats_t;
+
+/*!
+ * @brief  Publish in flight. Its topic and payload are kept in the storage of the slot until acked
+ */
+typedef struct {
+    bool used;
+    bool pending;                                     /* To send: not sent yet, send failed or link came back */
+    int32_t msg_id;                                   /* Of the last send */
+    uint32_t seq;                                     /* Changes on each put, a send of a former publish is ignored */
+    uint32_t first_ms;                                /* First send */
+    uint32_t sent_ms;                                 /* Last send */
+    uint16_t topic_length;
+    uint16_t length;
+    uint8_t attempts;
+} mqtt_window_slot_t;
+
+/*!
+ * @brief  Bounded window of QoS 1 publishes waiting for their ack. Not thread safe, the caller locks
+ */
+typedef struct {
+    mqtt_window_slot_t *slot;
+    uint32_t count;                                   /* Number of slots */
+    uint8_t *storage;                                 /* Topic, '\0' and payload of each slot */
+    uint32_t storage_size;                            /* Bytes per slot */
+    uint32_t retransmit_ms;                           /* Unacked publish sent again after */
+    uint32_t seq;
+    int32_t early[MQTT_WINDOW_EARLY_ACKS];
+    uint32_t early_next;
+    mqtt_window_stats_t stats;
+} mqtt_window_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+/*!
+ * @brief  Initialize an empty window
+ * @param  Window
+ *         Slots and their number
+ *         Storage of "count" x "storage_size" bytes, for topic and payload of each slot
+ *         Time in ms after which an unacked publish is sent again
+ * @retval None
+ */
+void mqtt_window_init(mqtt_window_t *window, mqtt_window_slot_t *slot, uint32_t count, uint8_t *storage,
+                      uint32_t storage_size, uint32_t retransmit_ms);
+
+/*!
+ * @brief  Copy a publish into a free slot, it is pending until mqtt_window_sent()
+ * @param  Window, topic, payload and its length
+ * @retval Slot, NULL if the window is full or the publish does not fit in a slot
+ */
+mqtt_window_slot_t* mqtt_window_put(mqtt_window_t *window, const char *topic, const uint8_t *data, uint16_t length);
+
+/*!
+ * @brief  Record a send of a slot
+ * @param  Window, slot, its seq when the send was started
+ *         Message id given by the client, negative if the send failed
+ *         Current time in ms
+ * @retval True if an ack that came before the send released the slot, its free slot is given back by the caller
+ */
+bool mqtt_window_sent(mqtt_window_t *window, mqtt_window_slot_t *slot, uint32_t seq, int32_t msg_id, uint32_t now_ms);
+
+/*!
+ * @brief  Release the slot of an acked publish
+ * @param  Window, message id of the ack, current time in ms
+ * @retval True if a publish in flight was acked
+ */
+bool mqtt_window_ack(mqtt_window_t *window, int32_t msg_id, uint32_t now_ms);
+
+/*!
+ * @brief  Get a slot to send: pending, or not acked within the retransmit time
+ * @param  Window, current time in ms
+ * @retval Slot, NULL if none
+ */
+mqtt_window_slot_t* mqtt_window_next_due(mqtt_window_t *window, uint32_t now_ms);
+
+/*!
+ * @brief  Mark every publish in flight to send again, e.g. on reconnect
+ * @param  Window
+ * @retval None
+ */
+void mqtt_window_resend_all(mqtt_window_t *window);
+
+/*!
+ * @brief  Get topic and payload of a slot
+ * @param  Window, slot
+ *         [out] Payload and its length
+ * @retval Topic
+ */
+const char* mqtt_window_get(const mqtt_window_t *window, const mqtt_window_slot_t *slot, const uint8_t **data, uint16_t *length);
+
+/*!
+ * @brief  Get window statistics
+ * @param  Window
+ *         [out] Statistics
+ * @retval None
+ */
+void mqtt_window_get_stats(const mqtt_window_t *window, mqtt_window_stats_t *stats);
+
+/******************************************************************************/
+
+#endif /* _MQTT_WINDOW_H_ */
@@ -0,0 +1,409 @@
+/*
+ *  publisher.c
+ *
+ *  Created on: Mar 02, 2022
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <sys/param.h>
+#include "config.h"
+#include "publisher.h"
+#include "modbus_api/modbus_api.h"
+#include "modbus_api/modbus_telemetry.h"
+#include "mqtt_api/mqtt_api.h"
+#include "journal/journal.h"
+#include "batch/batch.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#if (TELEMETRY_FORMAT == TELEMETRY_FORMAT_BINARY)
+#define PUBLISHER_DATA_TOPIC                          MQTT_DATA_BINARY_TOPIC
+#define PUBLISHER_BATCH_FORMAT                        BATCH_FORMAT_BINARY
+#else
+#define PUBLISHER_DATA_TOPIC                          MQTT_DATA_TOPIC
+#define PUBLISHER_BATCH_FORMAT                        BATCH_FORMAT_JSON
+#endif
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static const char* TAG = "PUBLISHER";
+static journal_t journal;
+static bool journal_ready = false;
+static uint8_t journal_record[JOURNAL_RECORD_MAX_SIZE];
+static modbus_data_t journal_data;
+static uint8_t reading_record[JOURNAL_RECORD_MAX_SIZE];
+static char message[JSON_READING_MAX_LENGTH];
+static bool schema_published = false;
+static batch_t batch;
+static uint8_t batch_payload[BATCH_MAX_LENGTH];
+static uint8_t batch_record[BATCH_RECORD_BUFFER_SIZE];
+static const char *batch_reason[BATCH_FLUSH_COUNT] = {"size", "latency", "offline"};
+static publisher_stats_t publisher_stats;
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static uint32_t publisher_time_ms(void);
+static uint32_t publisher_encode_reading(const modbus_data_t *modbus_data, uint8_t *buffer, uint32_t size);
+static bool publisher_publish_reading(const modbus_data_t *modbus_data);
+static void publisher_journal_store(const uint8_t *record, uint16_t length);
+static void publisher_batch_add(const modbus_data_t *modbus_data, const uint8_t *record, uint16_t record_length);
+static void publisher_batch_flush(batch_flush_t reason);
+static void publisher_publish_schema(void);
+static void publisher_journal_init(void);
+static void publisher_journal_replay(void);
+static uint32_t publisher_drain(void);
+static TickType_t publisher_wait(void);
+static void publisher_task(void *arg);
+
+/******************************************************************************/
+
+/*!
+ * @brief  Time in ms
+ */
+static uint32_t publisher_time_ms(void)
+{
+    return xTaskGetTickCount() * portTICK_RATE_MS;
+}
+
+/*!
+ * @brief  Encode a reading in TELEMETRY_FORMAT
+ * @retval Length, 0 if it does not fit
+ */
+static uint32_t publisher_encode_reading(const modbus_data_t *modbus_data, uint8_t *buffer, uint32_t size)
+{
+#if (TELEMETRY_FORMAT == TELEMETRY_FORMAT_BINARY)
+    return modbus_api_data_to_binary(modbus_data, buffer, size);
+#else
+    return modbus_api_data_to_json(modbus_data, (char*) buffer, size);
+#endif
+}
+
+/*!
+ * @brief  Publish a reading on its own, when it does not fit in a batch
+ * @retval True if handed to MQTT client, or dropped because it does not fit
+ */
+static bool publisher_publish_reading(const modbus_data_t *modbus_data)
+{
+    uint32_t length = publisher_encode_reading(modbus_data, (uint8_t*) message, sizeof(message));
+
+    /* Would never fit, do not keep it for retry */
+    if(length == 0)
+    {
+        ESP_LOGE(TAG, "Reading of bus %d slave %d does not fit in %u bytes", modbus_data->bus, modbus_data->slave_id,
+                 sizeof(message));
+        return true;
+    }
+    ESP_LOGI(TAG, "-------------- %u bytes to %s", length, PUBLISHER_DATA_TOPIC);
+    return mqtt_api_publish(PUBLISHER_DATA_TOPIC, message, length);
+}
+
+/*!
+ * @brief  Keep a reading in compact form until the uplink is back
+ */
+static void publisher_journal_store(const uint8_t *record, uint16_t length)
+{
+    if(journal_ready && (length > 0))
+    {
+        journal_append(&journal, record, length);
+    }
+}
+
+/*!
+ * @brief  Add a reading to the batch, publish the batch first when the reading does not fit.
+ *         Encoded in place, or once into message near the end of the batch. Offline, the reading goes to the journal
+ */
+static void publisher_batch_add(const modbus_data_t *modbus_data, const uint8_t *record, uint16_t record_length)
+{
+    uint8_t *buffer;
+    uint32_t room, length;
+
+    if(!mqtt_api_is_connected())
+    {
+        publisher_journal_store(record, record_length);
+        return;
+    }
+
+    buffer = batch_reserve(&batch, &room);
+    length = (room > 0) ? publisher_encode_reading(modbus_data, buffer, room) : 0;
+    if(length == 0)
+    {
+        buffer = (uint8_t*) message;
+        length = publisher_encode_reading(modbus_data, buffer, sizeof(message));
+    }
+
+    /* Would never fit, do not keep it for retry */
+    if(length == 0)
+    {
+        ESP_LOGE(TAG, "Reading of bus %d slave %d does not fit in %u bytes", modbus_data->bus, modbus_data->slave_id,
+                 sizeof(message));
+        return;
+    }
+
+    while(!batch_add(&batch, buffer, length, record, record_length, publisher_time_ms()))
+    {
+        if(batch.count == 0)
+        {
+            /* Larger than a batch */
+            ESP_LOGI(TAG, "-------------- %u bytes to %s", length, PUBLISHER_DATA_TOPIC);
+            if(!mqtt_api_publish(PUBLISHER_DATA_TOPIC, (const char*) buffer, length))
+            {
+                publisher_journal_store(record, record_length);
+            }
+            return;
+        }
+        /* Closing the payload writes over a reading encoded in place */
+        if(buffer != (uint8_t*) message)
+        {
+            memcpy(message, buffer, length);
+            buffer = (uint8_t*) message;
+        }
+        publisher_batch_flush(BATCH_FLUSH_SIZE);
+    }
+}
+
+/*!
+ * @brief  Publish the batch, its readings go to the journal if it cannot be published
+ */
+static void publisher_batch_flush(batch_flush_t reason)
+{
+    batch_stats_t *stats = &batch.stats;
+    uint32_t length = batch_finish(&batch, reason);
+    uint32_t count = batch.count;
+    uint32_t position = 0;
+    const uint8_t *record;
+    uint16_t record_length;
+    bool published;
+
+    if(length == 0)
+    {
+        return;
+    }
+    published = mqtt_api_publish(PUBLISHER_DATA_TOPIC, (const char*) batch_payload, length);
+    if(!published)
+    {
+        while((record = batch_record_next(&batch, &position, &record_length)) != NULL)
+        {
+            publisher_journal_store(record, record_length);
+        }
+    }
+    batch_reset(&batch, published);
+    ESP_LOGI(TAG, "Batch of %u readings, %u bytes, %s: %s. Flushes size %u latency %u offline %u, %u readings, max %u, failed %u",
+             count, length, batch_reason[reason], published ? "published" : "journaled",
+             stats->flushes[BATCH_FLUSH_SIZE], stats->flushes[BATCH_FLUSH_LATENCY], stats->flushes[BATCH_FLUSH_OFFLINE],
+             stats->readings, stats->max_readings, stats->failed);
+}
+
+/*!
+ * @brief  Publish the schema of binary readings once, retained so that the backend gets it when it subscribes
+ */
+static void publisher_publish_schema(void)
+{
+    uint32_t length = modbus_telemetry_schema(message, sizeof(message));
+
+    if(length == 0)
+    {
+        ESP_LOGE(TAG, "Schema does not fit in %u bytes", sizeof(message));
+        schema_published = true;
+        return;
+    }
+    schema_published = mqtt_api_publish_retained(MQTT_SCHEMA_TOPIC, message, length);
+    if(schema_published)
+    {
+        ESP_LOGI(TAG, "Schema %u published, %u bytes", modbus_telemetry_schema_id(), length);
+    }
+}
+
+/*!
+ * @brief  Open journal partition, readings not sent before reset are kept
+ */
+static void publisher_journal_init(void)
+{
+    journal_flash_t flash;
+
+    if(!journal_partition_open(&flash, JOURNAL_PARTITION_LABEL))
+    {
+        return;
+    }
+    journal_ready = journal_init(&journal, &flash);
+    if(!journal_ready)
+    {
+        ESP_LOGE(TAG, "Journal init fail");
+        return;
+    }
+    ESP_LOGI(TAG, "Journal: %u readings to replay", journal_pending(&journal));
+}
+
+/*!
+ * @brief  Publish journaled readings, oldest first. Live readings go on between replay batches
+ */
+static void publisher_journal_replay(void)
+{
+    journal_stats_t stats;
+    uint16_t length;
+    uint32_t count = 0;
+
+    while((count < JOURNAL_REPLAY_BATCH) && mqtt_api_is_connected())
+    {
+        length = journal_peek(&journal, journal_record, sizeof(journal_record));
+        if(length == 0)
+        {
+            break;
+        }
+        /* Batched like live readings, a batch not published journals them again */
+        if(modbus_api_reading_decode(&journal_data, journal_record, length))
+        {
+            publisher_batch_add(&journal_data, journal_record, length);
+        }
+        /* Sent or not a reading of this firmware */
+        journal_mark_sent(&journal);
+        count++;
+    }
+
+    if(count > 0)
+    {
+        journal_get_stats(&journal, &stats);
+        ESP_LOGI(TAG, "Journal: replayed %u, pending %u, appended %u, dropped %u, corrupted %u, erased %u", count,
+                 journal_pending(&journal), stats.appended, stats.dropped, stats.corrupted, stats.erased);
+    }
+}
+
+/*!
+ * @brief  Take all pending readings into the batch, read in place
+ * @retval Number of readings
+ */
+static uint32_t publisher_drain(void)
+{
+    modbus_data_t *modbus_data;
+    uint8_t *record;
+    uint32_t room;
+    uint16_t length;
+    uint32_t count = 0;
+
+    while((modbus_data = modbus_api_reading_acquire()) != NULL)
+    {
+        /* Compact form written straight into the batch, unless the batch is nearly full */
+        record = batch_record_slot(&batch, &room);
+        if(room < sizeof(reading_record))
+        {
+            record = reading_record;
+        }
+        length = modbus_api_reading_encode(modbus_data, record, sizeof(reading_record));
+        if(length > 0)
+        {
+            publisher_batch_add(modbus_data, record, length);
+        }
+        else if(!publisher_publish_reading(modbus_data))
+        {
+            ESP_LOGW(TAG, "Reading of bus %d slave %d lost, too large for the journal", modbus_data->bus, modbus_data->slave_id);
+        }
+        modbus_api_reading_release(modbus_data);
+        count++;
+    }
+    return count;
+}
+
+/*!
+ * @brief  Sleep until the batch is due, at most PUBLISHER_IDLE_MS
+ * @retval Ticks to wait for a reading
+ */
+static TickType_t publisher_wait(void)
+{
+    uint32_t wait = PUBLISHER_IDLE_MS;
+    uint32_t waited;
+
+    if(batch.count > 0)
+    {
+        waited = publisher_time_ms() - batch.first_ms;
+        wait = (waited >= batch.latency_ms) ? 0 : MIN(wait, batch.latency_ms - waited);
+    }
+    return pdMS_TO_TICKS(wait);
+}
+
+/*!
+ * @brief  Publisher task: woken up by the pollers, a slow uplink makes the rings fill up and the pollers wait
+ */
+static void publisher_task(void *arg)
+{
+    uint32_t count;
+
+    while(1)
+    {
+        modbus_api_reading_wait(publisher_wait());
+        publisher_stats.wakeups++;
+
+#if (TELEMETRY_FORMAT == TELEMETRY_FORMAT_BINARY)
+        /* Backend needs the schema before the first binary reading */
+        if(!schema_published && mqtt_api_is_connected())
+        {
+            publisher_publish_schema();
+        }
+#endif
+
+        count = publisher_drain();
+        publisher_stats.readings += count;
+        if(count > publisher_stats.max_drain)
+        {
+            publisher_stats.max_drain = count;
+        }
+
+        /* Uplink is back, send what was stored */
+        if(journal_ready && (journal_pending(&journal) > 0))
+        {
+            publisher_journal_replay();
+        }
+
+        /* Publish the batch when its oldest reading waited enough, journal it when the uplink is lost */
+        if((batch.count > 0) && !mqtt_api_is_connected())
+        {
+            publisher_batch_flush(BATCH_FLUSH_OFFLINE);
+        }
+        else if(batch_due(&batch, publisher_time_ms()))
+        {
+            publisher_batch_flush(BATCH_FLUSH_LATENCY);
+        }
+    }
+}
+
+/******************************************************************************/
+
+/*!
+ * @brief  Publisher initialization
+ */
+void publisher_init(void)
+{
+    /* Readings not sent while MQTT is down */
+    publisher_journal_init();
+    batch_init(&batch, PUBLISHER_BATCH_FORMAT, batch_payload, sizeof(batch_payload), batch_record, sizeof(batch_record),
+               BATCH_MAX_LATENCY_MS);
+
+    BaseType_t result = xTaskCreate(publisher_task, PUBLISHER_TASK_NAME, PUBLISHER_TASK_SIZE, NULL,
+                                    PUBLISHER_TASK_PRIORITY, NULL);
+    if (result != pdPASS) {
+        ESP_LOGE(TAG, "Create publisher task fail %d", result);
+    }
+}
+
+/*!
+ * @brief  Get publisher statistics
+ */
+void publisher_get_stats(publisher_stats_t *stats)
+{
+    memcpy(stats, &publisher_stats, sizeof(publisher_stats_t));
+}
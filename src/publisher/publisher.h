@@ -0,0 +1,64 @@
+/*
+ *  publisher.h
+ *
+ *  Created on: Mar 02, 2022
+ */
+
+#ifndef _PUBLISHER_H_
+#define _PUBLISHER_H_
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdint.h>
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+/*!
+ * @brief  Publisher statistics
+ */
+typedef struct {
+    uint32_t wakeups;                                 /* Times the task woke up, on readings or timeout */
+    uint32_t readings;                                /* Readings taken from the pollers */
+    uint32_t max_drain;                               /* Most readings taken in one wakeup */
+} publisher_stats_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+/*!
+ * @brief  Open the journal and start the publisher task. The task sleeps until a poller puts a reading,
+ *         then takes all pending readings into the batch, replays the journal and publishes the batch when due
+ * @param  None
+ * @retval None
+ */
+void publisher_init(void);
+
+/*!
+ * @brief  Get publisher statistics
+ * @param  [out] Statistics
+ * @retval None
+ */
+void publisher_get_stats(publisher_stats_t *stats);
+
+/******************************************************************************/
+
+#endif /* _PUBLISHER_H_ */
@@ -0,0 +1,124 @@
+/*
+ *  bin_writer.c
+ *
+ *  Created on: Feb 23, 2022
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <string.h>
+#include "bin_writer.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+/*!
+ * @brief  Start writing into a buffer
+ */
+void bin_writer_init(bin_writer_t *writer, uint8_t *buffer, uint32_t size)
+{
+    writer->buffer = buffer;
+    writer->size = size;
+    writer->length = 0;
+    writer->overflow = false;
+}
+
+/*!
+ * @brief  Append bytes
+ */
+void bin_writer_bytes(bin_writer_t *writer, const uint8_t *data, uint32_t length)
+{
+    if(writer->overflow || ((writer->length + length) > writer->size))
+    {
+        writer->overflow = true;
+        return;
+    }
+    memcpy(&writer->buffer[writer->length], data, length);
+    writer->length += length;
+}
+
+/*!
+ * @brief  Append fixed size values, little endian
+ */
+void bin_writer_u8(bin_writer_t *writer, uint8_t value)
+{
+    bin_writer_bytes(writer, &value, 1);
+}
+
+void bin_writer_u16(bin_writer_t *writer, uint16_t value)
+{
+    uint8_t b[2] = { value & 0xFF, value >> 8 };
+
+    bin_writer_bytes(writer, b, sizeof(b));
+}
+
+void bin_writer_u32(bin_writer_t *writer, uint32_t value)
+{
+    uint8_t b[4] = { value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF, value >> 24 };
+
+    bin_writer_bytes(writer, b, sizeof(b));
+}
+
+void bin_writer_float(bin_writer_t *writer, float value)
+{
+    uint32_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    bin_writer_u32(writer, bits);
+}
+
+/*!
+ * @brief  Append a varint, 1 byte below 128 up to 5 bytes
+ */
+void bin_writer_varint(bin_writer_t *writer, uint32_t value)
+{
+    uint8_t b[BIN_WRITER_VARINT_MAX_SIZE];
+    uint32_t length = 0;
+
+    while(value >= 0x80)
+    {
+        b[length++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    b[length++] = value;
+    bin_writer_bytes(writer, b, length);
+}
+
+/*!
+ * @brief  Append a signed varint, small negative values stay short: 0, -1, 1, -2 are 0, 1, 2, 3
+ */
+void bin_writer_svarint(bin_writer_t *writer, int32_t value)
+{
+    bin_writer_varint(writer, ((uint32_t) value << 1) ^ (uint32_t) (value >> 31));
+}
+
+/*!
+ * @brief  End writing
+ */
+uint32_t bin_writer_finish(bin_writer_t *writer)
+{
+    return writer->overflow ? 0 : writer->length;
+}
@@ -0,0 +1,82 @@
+/*
+ *  bin_writer.h
+ *
+ *  Created on: Feb 23, 2022
+ */
+
+#ifndef _BIN_WRITER_H_
+#define _BIN_WRITER_H_
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+/* Longest varint of a 32 bit value */
+#define BIN_WRITER_VARINT_MAX_SIZE                    5
+
+/*!
+ * @brief  Binary data written straight into a buffer, no heap. Fixed size fields are little endian,
+ *         varints are LEB128 (7 bits per byte, low bits first), signed varints are zigzag encoded first
+ */
+typedef struct {
+    uint8_t *buffer;
+    uint32_t size;
+    uint32_t length;
+    bool overflow;                                    /* Buffer too small, output is invalid */
+} bin_writer_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+/*!
+ * @brief  Start writing into a buffer
+ * @param  Writer, buffer and its size
+ * @retval None
+ */
+void bin_writer_init(bin_writer_t *writer, uint8_t *buffer, uint32_t size);
+
+/*!
+ * @brief  Write a field
+ * @param  Writer, value
+ * @retval None
+ */
+void bin_writer_bytes(bin_writer_t *writer, const uint8_t *data, uint32_t length);
+void bin_writer_u8(bin_writer_t *writer, uint8_t value);
+void bin_writer_u16(bin_writer_t *writer, uint16_t value);
+void bin_writer_u32(bin_writer_t *writer, uint32_t value);
+void bin_writer_float(bin_writer_t *writer, float value);
+void bin_writer_varint(bin_writer_t *writer, uint32_t value);
+void bin_writer_svarint(bin_writer_t *writer, int32_t value);
+
+/*!
+ * @brief  End writing
+ * @param  Writer
+ * @retval Length, 0 if the buffer is too small
+ */
+uint32_t bin_writer_finish(bin_writer_t *writer);
+
+/******************************************************************************/
+
+#endif /* _BIN_WRITER_H_ */
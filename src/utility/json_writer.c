@@ -0,0 +1,253 @@
+/*
+ *  json_writer.c
+ *
+ *  Created on: Feb 21, 2022
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "json_writer.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static const char json_writer_hex[] = "0123456789abcdef";
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static void json_writer_put(json_writer_t *writer, const char *data, uint32_t length);
+static void json_writer_put_string(json_writer_t *writer, const char *value);
+static void json_writer_put_uint(json_writer_t *writer, uint32_t value);
+static void json_writer_key(json_writer_t *writer, const char *key);
+static void json_writer_begin(json_writer_t *writer, const char *key, char open);
+static void json_writer_end(json_writer_t *writer, char close);
+
+/******************************************************************************/
+
+/*!
+ * @brief  Append bytes, keep room for the terminating zero
+ */
+static void json_writer_put(json_writer_t *writer, const char *data, uint32_t length)
+{
+    if(writer->overflow || ((writer->length + length) >= writer->size))
+    {
+        writer->overflow = true;
+        return;
+    }
+    memcpy(&writer->buffer[writer->length], data, length);
+    writer->length += length;
+}
+
+/*!
+ * @brief  Append a quoted string, escape quote, backslash and control characters
+ */
+static void json_writer_put_string(json_writer_t *writer, const char *value)
+{
+    const char *run = value;
+    char escape[6] = {'\\', 'u', '0', '0'};
+
+    json_writer_put(writer, "\"", 1);
+    for(; *value != '\0'; value++)
+    {
+        if(((uint8_t) *value >= 0x20) && (*value != '"') && (*value != '\\'))
+        {
+            continue;
+        }
+
+        /* Copy the plain run before the character to escape */
+        json_writer_put(writer, run, value - run);
+        run = value + 1;
+        if((*value == '"') || (*value == '\\'))
+        {
+            escape[1] = *value;
+            json_writer_put(writer, escape, 2);
+            escape[1] = 'u';
+        }
+        else
+        {
+            escape[4] = json_writer_hex[(uint8_t) *value >> 4];
+            escape[5] = json_writer_hex[*value & 0x0F];
+            json_writer_put(writer, escape, 6);
+        }
+    }
+    json_writer_put(writer, run, value - run);
+    json_writer_put(writer, "\"", 1);
+}
+
+/*!
+ * @brief  Append an unsigned number in decimal
+ */
+static void json_writer_put_uint(json_writer_t *writer, uint32_t value)
+{
+    char digits[10];
+    uint8_t i = sizeof(digits);
+
+    do
+    {
+        digits[--i] = '0' + (value % 10);
+        value /= 10;
+    } while(value > 0);
+    json_writer_put(writer, &digits[i], sizeof(digits) - i);
+}
+
+/*!
+ * @brief  Comma before a value when needed, then member name
+ */
+static void json_writer_key(json_writer_t *writer, const char *key)
+{
+    uint32_t bit = 1UL << writer->depth;
+
+    if(writer->comma & bit)
+    {
+        json_writer_put(writer, ",", 1);
+    }
+    writer->comma |= bit;
+
+    if(key != NULL)
+    {
+        json_writer_put_string(writer, key);
+        json_writer_put(writer, ":", 1);
+    }
+}
+
+static void json_writer_begin(json_writer_t *writer, const char *key, char open)
+{
+    json_writer_key(writer, key);
+    json_writer_put(writer, &open, 1);
+    if(++writer->depth >= JSON_WRITER_MAX_DEPTH)
+    {
+        writer->overflow = true;
+        writer->depth--;
+        return;
+    }
+    writer->comma &= ~(1UL << writer->depth);
+}
+
+static void json_writer_end(json_writer_t *writer, char close)
+{
+    if(writer->depth == 0)
+    {
+        writer->overflow = true;
+        return;
+    }
+    writer->depth--;
+    json_writer_put(writer, &close, 1);
+}
+
+/******************************************************************************/
+
+/*!
+ * @brief  Start writing into a buffer
+ */
+void json_writer_init(json_writer_t *writer, char *buffer, uint32_t size)
+{
+    writer->buffer = buffer;
+    writer->size = size;
+    writer->length = 0;
+    writer->comma = 0;
+    writer->depth = 0;
+    writer->overflow = (size == 0);
+}
+
+void json_writer_object_begin(json_writer_t *writer, const char *key)
+{
+    json_writer_begin(writer, key, '{');
+}
+
+void json_writer_object_end(json_writer_t *writer)
+{
+    json_writer_end(writer, '}');
+}
+
+void json_writer_array_begin(json_writer_t *writer, const char *key)
+{
+    json_writer_begin(writer, key, '[');
+}
+
+void json_writer_array_end(json_writer_t *writer)
+{
+    json_writer_end(writer, ']');
+}
+
+void json_writer_string(json_writer_t *writer, const char *key, const char *value)
+{
+    json_writer_key(writer, key);
+    json_writer_put_string(writer, value);
+}
+
+void json_writer_int(json_writer_t *writer, const char *key, int32_t value)
+{
+    json_writer_key(writer, key);
+    if(value < 0)
+    {
+        json_writer_put(writer, "-", 1);
+        json_writer_put_uint(writer, 0U - (uint32_t) value);
+    }
+    else
+    {
+        json_writer_put_uint(writer, value);
+    }
+}
+
+void json_writer_uint(json_writer_t *writer, const char *key, uint32_t value)
+{
+    json_writer_key(writer, key);
+    json_writer_put_uint(writer, value);
+}
+
+/*!
+ * @brief  Write a float, NaN and infinity are not JSON numbers and are written as null
+ */
+void json_writer_float(json_writer_t *writer, const char *key, float value)
+{
+    char number[16];
+    int length;
+
+    json_writer_key(writer, key);
+    if(!isfinite(value))
+    {
+        json_writer_put(writer, "null", 4);
+        return;
+    }
+    length = snprintf(number, sizeof(number), "%.7g", (double) value);
+    json_writer_put(writer, number, length);
+}
+
+/*!
+ * @brief  End writing
+ */
+uint32_t json_writer_finish(json_writer_t *writer)
+{
+    if(writer->overflow || (writer->depth != 0))
+    {
+        if(writer->size > 0)
+        {
+            writer->buffer[0] = '\0';
+        }
+        return 0;
+    }
+    writer->buffer[writer->length] = '\0';
+    return writer->length;
+}
@@ -0,0 +1,90 @@
+/*
+ *  json_writer.h
+ *
+ *  Created on: Feb 21, 2022
+ */
+
+#ifndef _JSON_WRITER_H_
+#define _JSON_WRITER_H_
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define JSON_WRITER_MAX_DEPTH                         32
+
+/*!
+ * @brief  Compact JSON written straight into a buffer, no heap.
+ *         "key" is the member name inside an object, NULL inside an array or at top level
+ */
+typedef struct {
+    char *buffer;
+    uint32_t size;
+    uint32_t length;                                  /* Without the terminating zero */
+    uint32_t comma;                                   /* Bit per depth: a value was written, next one needs a comma */
+    uint8_t depth;
+    bool overflow;                                    /* Buffer too small or too deep, output is invalid */
+} json_writer_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+/*!
+ * @brief  Start writing into a buffer
+ * @param  Writer, buffer and its size
+ * @retval None
+ */
+void json_writer_init(json_writer_t *writer, char *buffer, uint32_t size);
+
+/*!
+ * @brief  Begin / end an object or an array
+ * @param  Writer, member name or NULL
+ * @retval None
+ */
+void json_writer_object_begin(json_writer_t *writer, const char *key);
+void json_writer_object_end(json_writer_t *writer);
+void json_writer_array_begin(json_writer_t *writer, const char *key);
+void json_writer_array_end(json_writer_t *writer);
+
+/*!
+ * @brief  Write a value
+ * @param  Writer, member name or NULL, value
+ * @retval None
+ */
+void json_writer_string(json_writer_t *writer, const char *key, const char *value);
+void json_writer_int(json_writer_t *writer, const char *key, int32_t value);
+void json_writer_uint(json_writer_t *writer, const char *key, uint32_t value);
+void json_writer_float(json_writer_t *writer, const char *key, float value);
+
+/*!
+ * @brief  End writing, the buffer holds a zero terminated string
+ * @param  Writer
+ * @retval Length, 0 if the buffer is too small or objects and arrays are not closed
+ */
+uint32_t json_writer_finish(json_writer_t *writer);
+
+/******************************************************************************/
+
+#endif /* _JSON_WRITER_H_ */
@@ -25,6 +25,11 @@
 #define MERGE_UINT16(high,low)                        ((((high) << 8) & 0xFF00) | ((low) & 0xFF))
 #endif
 
+/* crc16 modbus: start with CRC16_MODBUS_INIT, add data with crc16_modbus_update().
+ * A frame with its CRC at the end (low byte first on the line) leaves CRC16_MODBUS_RESIDUE */
+#define CRC16_MODBUS_INIT                             0xFFFF
+#define CRC16_MODBUS_RESIDUE                          0x0000
+
 /******************************************************************************/
 /*                              PRIVATE DATA                                  */
 /******************************************************************************/
@@ -41,19 +46,42 @@
 /*                                FUNCTIONS                                   */
 /******************************************************************************/
 
+/**
+ * @brief  Add data to a running crc16 modbus
+ * @param  crc: running value, CRC16_MODBUS_INIT at start
+ * @param  data, length
+ * @retval running value
+ */
+uint16_t crc16_modbus_update(uint16_t crc, const uint8_t *data, uint16_t length);
+
+/**
+ * @brief  Running crc16 modbus to the value of crc16_modbus()
+ * @param  crc: running value
+ * @retval crc16 value, high byte is sent first
+ */
+uint16_t crc16_modbus_final(uint16_t crc);
+
 /**
  * @brief  Calculate crc16 modbus
  * @param  data, length
- * @retval crc16 value
+ * @retval crc16 value, high byte is sent first
+ */
+uint16_t crc16_modbus(const uint8_t *data, uint16_t length);
+
+/**
+ * @brief  Add data to a running check sum
+ * @param  sum: running value, 0 at start
+ * @param  data, length
+ * @retval running value
  */
-uint16_t crc16_modbus(uint8_t *data, uint16_t length);
+uint8_t check_sum_update(uint8_t sum, const uint8_t *data, uint16_t length);
 
 /**
  * @brief  Calculate check sum
  * @param  data, length
  * @retval check sum value
  */
-uint8_t check_sum(uint8_t *data, uint16_t length);
+uint8_t check_sum(const uint8_t *data, uint16_t length);
 
 /******************************************************************************/
 
@@ -0,0 +1,177 @@
+/*
+ *  wifi_fast.c
+ *
+ *  Created on: Mar 14, 2022
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <string.h>
+#include "wifi_fast.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define WIFI_FAST_FNV_OFFSET                          2166136261UL
+#define WIFI_FAST_FNV_PRIME                           16777619UL
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static wifi_fast_action_t wifi_fast_first(wifi_fast_t *fast);
+
+/******************************************************************************/
+
+/*!
+ * @brief  First attempt of a connect: direct when a link is cached
+ */
+static wifi_fast_action_t wifi_fast_first(wifi_fast_t *fast)
+{
+    fast->failures = 0;
+    fast->direct = (fast->cache.valid != 0) && (fast->attempts > 0);
+    return fast->direct ? WIFI_FAST_ACTION_DIRECT : WIFI_FAST_ACTION_SCAN;
+}
+
+/******************************************************************************/
+
+/*!
+ * @brief  FNV-1a of the SSID
+ */
+uint32_t wifi_fast_ssid_hash(const char *ssid)
+{
+    uint32_t hash = WIFI_FAST_FNV_OFFSET;
+
+    while(*ssid != '\0')
+    {
+        hash = (hash ^ (uint8_t) *ssid++) * WIFI_FAST_FNV_PRIME;
+    }
+    return hash;
+}
+
+/*!
+ * @brief  Initialize connect state, the cache of another SSID is dropped
+ */
+void wifi_fast_init(wifi_fast_t *fast, const wifi_fast_cache_t *cache, uint32_t ssid_hash, uint8_t attempts)
+{
+    memset(fast, 0, sizeof(wifi_fast_t));
+    if((cache != NULL) && (cache->valid != 0) && (cache->ssid_hash == ssid_hash))
+    {
+        memcpy(&fast->cache, cache, sizeof(wifi_fast_cache_t));
+    }
+    fast->ssid_hash = ssid_hash;
+    fast->attempts = attempts;
+}
+
+/*!
+ * @brief  Station started, time to IP counts from here
+ */
+wifi_fast_action_t wifi_fast_start(wifi_fast_t *fast, uint32_t now)
+{
+    fast->link_up = false;
+    fast->timing = true;
+    fast->start = now;
+    return wifi_fast_first(fast);
+}
+
+/*!
+ * @brief  Link lost: direct connect again. Connect failed: direct connect up to "attempts" times, then
+ *         a full scan. A failed scan waits, then starts over with a direct connect, the cached AP may be
+ *         back first after a power cut
+ */
+wifi_fast_action_t wifi_fast_disconnected(wifi_fast_t *fast, uint32_t now)
+{
+    bool lost = fast->link_up && !fast->timing;
+
+    fast->link_up = false;
+    if(lost)
+    {
+        fast->timing = true;
+        fast->start = now;
+        return wifi_fast_first(fast);
+    }
+
+    if(!fast->direct)
+    {
+        return wifi_fast_first(fast) | WIFI_FAST_ACTION_LATER;
+    }
+    fast->failures++;
+    if(fast->failures < fast->attempts)
+    {
+        return WIFI_FAST_ACTION_DIRECT;
+    }
+    fast->direct = false;
+    fast->stats.fallbacks++;
+    return WIFI_FAST_ACTION_SCAN;
+}
+
+/*!
+ * @brief  Station connected, IP not got yet
+ */
+bool wifi_fast_connected(wifi_fast_t *fast, const uint8_t *bssid, uint8_t channel)
+{
+    fast->link_up = true;
+    memcpy(fast->bssid, bssid, WIFI_FAST_BSSID_SIZE);
+    fast->channel = channel;
+    return (fast->cache.valid != 0) && (fast->cache.ip != 0) &&
+           (memcmp(fast->cache.bssid, bssid, WIFI_FAST_BSSID_SIZE) == 0);
+}
+
+/*!
+ * @brief  Station got its IP, count the path and time it took
+ */
+bool wifi_fast_got_ip(wifi_fast_t *fast, uint32_t ip, uint32_t netmask, uint32_t gw, uint32_t now)
+{
+    wifi_fast_cache_t cache;
+
+    if(fast->timing)
+    {
+        fast->timing = false;
+        fast->stats.time_to_ip = now - fast->start;
+        if(fast->stats.time_to_ip > fast->stats.time_to_ip_max)
+        {
+            fast->stats.time_to_ip_max = fast->stats.time_to_ip;
+        }
+        if(fast->direct)
+        {
+            fast->stats.direct++;
+        }
+        else
+        {
+            fast->stats.scan++;
+        }
+    }
+    fast->failures = 0;
+
+    memset(&cache, 0, sizeof(cache));
+    cache.ssid_hash = fast->ssid_hash;
+    cache.ip = ip;
+    cache.netmask = netmask;
+    cache.gw = gw;
+    memcpy(cache.bssid, fast->bssid, WIFI_FAST_BSSID_SIZE);
+    cache.channel = fast->channel;
+    cache.valid = 1;
+    if(memcmp(&cache, &fast->cache, sizeof(cache)) == 0)
+    {
+        return false;
+    }
+    memcpy(&fast->cache, &cache, sizeof(cache));
+    return true;
+}
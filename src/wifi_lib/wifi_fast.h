@@ -0,0 +1,137 @@
+/*
+ *  wifi_fast.h
+ *
+ *  Created on: Mar 14, 2022
+ */
+
+#ifndef _WIFI_FAST_H_
+#define _WIFI_FAST_H_
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define WIFI_FAST_BSSID_SIZE                          6
+
+/* Next connect attempt */
+typedef uint8_t wifi_fast_action_t;
+enum {
+    WIFI_FAST_ACTION_DIRECT = 0,                      /* Cached BSSID on the cached channel, no scan */
+    WIFI_FAST_ACTION_SCAN,                            /* Full scan of all channels */
+};
+#define WIFI_FAST_ACTION_LATER                        0x80  /* Flag of the action, after the retry delay */
+
+/*!
+ * @brief  Last good link, stored in NVS as is
+ */
+typedef struct {
+    uint32_t ssid_hash;                               /* SSID the link belongs to */
+    uint32_t ip;                                      /* Lease got on that link, network byte order */
+    uint32_t netmask;
+    uint32_t gw;
+    uint8_t bssid[WIFI_FAST_BSSID_SIZE];
+    uint8_t channel;
+    uint8_t valid;
+} wifi_fast_cache_t;
+
+/*!
+ * @brief  Connect statistics
+ */
+typedef struct {
+    uint32_t direct;                                  /* Links up from the cached BSSID */
+    uint32_t scan;                                    /* Links up after a full scan */
+    uint32_t fallbacks;                               /* Direct connects given up for a scan */
+    uint32_t time_to_ip;                              /* Last start or link loss to IP, ms */
+    uint32_t time_to_ip_max;
+} wifi_fast_stats_t;
+
+/*!
+ * @brief  Connect state of the station, driven by the Wi-Fi events
+ */
+typedef struct {
+    wifi_fast_cache_t cache;
+    uint32_t ssid_hash;
+    uint8_t attempts;                                 /* Direct connects before a scan, 0 never */
+    uint8_t failures;                                 /* Direct connects failed in a row */
+    bool direct;                                      /* Current attempt is direct */
+    bool link_up;
+    bool timing;                                      /* Waiting for IP since "start" */
+    uint32_t start;
+    uint8_t bssid[WIFI_FAST_BSSID_SIZE];              /* Link being set up */
+    uint8_t channel;
+    wifi_fast_stats_t stats;
+} wifi_fast_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+/*!
+ * @brief  Hash of an SSID, a cache of another network is not used
+ * @param  SSID, zero terminated
+ * @retval Hash
+ */
+uint32_t wifi_fast_ssid_hash(const char *ssid);
+
+/*!
+ * @brief  Initialize connect state
+ * @param  State
+ *         Cache loaded from NVS, NULL if none
+ *         Hash of the SSID configured
+ *         Direct connects before a scan, 0 to always scan
+ * @retval None
+ */
+void wifi_fast_init(wifi_fast_t *fast, const wifi_fast_cache_t *cache, uint32_t ssid_hash, uint8_t attempts);
+
+/*!
+ * @brief  Station started, first connect
+ * @param  State, time in ms
+ * @retval Action
+ */
+wifi_fast_action_t wifi_fast_start(wifi_fast_t *fast, uint32_t now);
+
+/*!
+ * @brief  Station disconnected: link lost, or connect failed
+ * @param  State, time in ms
+ * @retval Action, WIFI_FAST_ACTION_LATER set when the station should wait before it
+ */
+wifi_fast_action_t wifi_fast_disconnected(wifi_fast_t *fast, uint32_t now);
+
+/*!
+ * @brief  Station connected to an AP
+ * @param  State, BSSID and channel of the AP
+ * @retval True if the cached lease belongs to this AP
+ */
+bool wifi_fast_connected(wifi_fast_t *fast, const uint8_t *bssid, uint8_t channel);
+
+/*!
+ * @brief  Station got its IP, the link is the new cache
+ * @param  State, lease in network byte order, time in ms
+ * @retval True if the cache changed and must be stored
+ */
+bool wifi_fast_got_ip(wifi_fast_t *fast, uint32_t ip, uint32_t netmask, uint32_t gw, uint32_t now);
+
+/******************************************************************************/
+
+#endif /* _WIFI_FAST_H_ */
@@ -10,6 +10,9 @@
 /*                              INCLUDE FILES                                 */
 /******************************************************************************/
 
+#include <nvs.h>
+#include <esp_timer.h>
+#include <esp_sntp.h>
 #include "config.h"
 #include "wifi_lib.h"
 
@@ -18,6 +21,7 @@
 /******************************************************************************/
 
 #define NETWORK_GOT_IP_EVENT                              0x00000001
+#define WIFI_NVS_KEY                                      "fast"
 
 /******************************************************************************/
 /*                              PRIVATE DATA                                  */
@@ -27,6 +31,8 @@ static const char* TAG = "WIFI";
 static int32_t retry_num = 0;                        /* Retry to connect */
 esp_netif_t *wifi_sta_netif = NULL;                  /* Wifi station interface */
 static EventGroupHandle_t wifi_status_events;        /* Network up (wifi is connected) status */
+static wifi_fast_t wifi_fast;                        /* Direct connect or scan, last good link */
+static bool sntp_started = false;                    /* Once, lwIP keeps the clock in sync */
 
 /******************************************************************************/
 /*                              EXPORTED DATA                                 */
@@ -40,9 +46,124 @@ static EventGroupHandle_t wifi_status_events;        /* Network up (wifi is conn
 
 static void wifi_event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
 static void wifi_got_ip_event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
+static void wifi_lib_connect(wifi_fast_action_t action);
+static void wifi_lib_set_ip(uint32_t ip, uint32_t netmask, uint32_t gw);
+static bool wifi_lib_cache_load(wifi_fast_cache_t *cache);
+static void wifi_lib_cache_save(const wifi_fast_cache_t *cache);
+static void wifi_lib_sntp_synced(struct timeval *tv);
+static void wifi_lib_sntp_start(void);
 
 /******************************************************************************/
 
+/*!
+ * @brief  Time in ms since boot
+ */
+static uint32_t wifi_lib_time_ms(void)
+{
+    return (uint32_t) (esp_timer_get_time() / 1000);
+}
+
+/*!
+ * @brief  Connect to the cached AP on its channel, or scan all channels for the best AP of the SSID
+ * @param  Action from wifi_fast
+ * @retval None
+ */
+static void wifi_lib_connect(wifi_fast_action_t action)
+{
+    wifi_config_t wifi_config;
+
+    if(action & WIFI_FAST_ACTION_LATER)
+    {
+        vTaskDelay(WIFI_TIME_RETRY_CONNECT_MS / portTICK_PERIOD_MS);
+    }
+
+    esp_wifi_get_config(WIFI_IF_STA, &wifi_config);
+    if((action & ~WIFI_FAST_ACTION_LATER) == WIFI_FAST_ACTION_DIRECT)
+    {
+        wifi_config.sta.bssid_set = true;
+        memcpy(wifi_config.sta.bssid, wifi_fast.cache.bssid, sizeof(wifi_config.sta.bssid));
+        wifi_config.sta.channel = wifi_fast.cache.channel;
+        wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+        ESP_LOGI(TAG, "Wifi direct connect to " MACSTR " channel %d", MAC2STR(wifi_fast.cache.bssid),
+                 wifi_fast.cache.channel);
+    }
+    else
+    {
+        wifi_config.sta.bssid_set = false;
+        wifi_config.sta.channel = 0;
+        wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+        ESP_LOGI(TAG, "Wifi full scan");
+    }
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    esp_wifi_connect();
+}
+
+/*!
+ * @brief  Set the IP of the station without DHCP, IP_EVENT_STA_GOT_IP follows
+ * @param  Address, mask and gateway in network byte order
+ * @retval None
+ */
+static void wifi_lib_set_ip(uint32_t ip, uint32_t netmask, uint32_t gw)
+{
+    esp_netif_ip_info_t ip_info;
+    esp_err_t err;
+
+    /* Fails when DHCP is already stopped */
+    esp_netif_dhcpc_stop(wifi_sta_netif);
+
+    ip_info.ip.addr = ip;
+    ip_info.netmask.addr = netmask;
+    ip_info.gw.addr = gw;
+    err = esp_netif_set_ip_info(wifi_sta_netif, &ip_info);
+    if(err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Set IP fail %d", err);
+    }
+}
+
+/*!
+ * @brief  Load last good link from NVS
+ * @retval True when a link is stored
+ */
+static bool wifi_lib_cache_load(wifi_fast_cache_t *cache)
+{
+    nvs_handle_t handle;
+    size_t size = sizeof(wifi_fast_cache_t);
+    esp_err_t err;
+
+    if(nvs_open(WIFI_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+    {
+        return false;
+    }
+    err = nvs_get_blob(handle, WIFI_NVS_KEY, cache, &size);
+    nvs_close(handle);
+    return (err == ESP_OK) && (size == sizeof(wifi_fast_cache_t));
+}
+
+/*!
+ * @brief  Store last good link to NVS
+ */
+static void wifi_lib_cache_save(const wifi_fast_cache_t *cache)
+{
+    nvs_handle_t handle;
+    esp_err_t err;
+
+    err = nvs_open(WIFI_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if(err == ESP_OK)
+    {
+        err = nvs_set_blob(handle, WIFI_NVS_KEY, cache, sizeof(wifi_fast_cache_t));
+        if(err == ESP_OK)
+        {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if(err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Save wifi link fail %d", err);
+    }
+}
+
 /*!
  * @brief  Event handler for Wifi events
  * @param  Event data
@@ -50,30 +171,78 @@ static void wifi_got_ip_event_handler(void* arg, esp_event_base_t event_base, in
  */
 static void wifi_event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
 {
+    wifi_event_sta_connected_t *connected;
+    wifi_event_sta_disconnected_t *disconnected;
+    bool cached;
+
     switch(event_id)
     {
         case WIFI_EVENT_STA_START:
             ESP_LOGI(TAG, "Wifi Started");
-            esp_wifi_connect();
+            wifi_lib_connect(wifi_fast_start(&wifi_fast, wifi_lib_time_ms()));
             break;
         case WIFI_EVENT_STA_STOP:
             ESP_LOGI(TAG, "Wifi Stopped");
             break;
         case WIFI_EVENT_STA_CONNECTED:
-            ESP_LOGI(TAG, "Wifi is connected");
+            connected = (wifi_event_sta_connected_t*) event_data;
+            ESP_LOGI(TAG, "Wifi is connected to " MACSTR " channel %d", MAC2STR(connected->bssid), connected->channel);
             retry_num = 0;
+            cached = wifi_fast_connected(&wifi_fast, connected->bssid, connected->channel);
+#if (WIFI_IP_MODE == WIFI_IP_STATIC)
+            wifi_lib_set_ip(esp_ip4addr_aton(WIFI_STATIC_IP), esp_ip4addr_aton(WIFI_STATIC_NETMASK),
+                            esp_ip4addr_aton(WIFI_STATIC_GW));
+            (void) cached;
+#elif (WIFI_IP_MODE == WIFI_IP_CACHED)
+            /* Lease of the last good link on the same AP, DHCP on any other */
+            if(cached)
+            {
+                wifi_lib_set_ip(wifi_fast.cache.ip, wifi_fast.cache.netmask, wifi_fast.cache.gw);
+            }
+            else
+            {
+                esp_netif_dhcpc_start(wifi_sta_netif);
+            }
+#else
+            (void) cached;
+#endif
             break;
         case WIFI_EVENT_STA_DISCONNECTED:
+            disconnected = (wifi_event_sta_disconnected_t*) event_data;
             retry_num++;
-            ESP_LOGI(TAG, "Wifi is disconnected. Retry %d", retry_num);
-            vTaskDelay(WIFI_TIME_RETRY_CONNECT_MS / portTICK_PERIOD_MS);
-            esp_wifi_connect();
+            ESP_LOGI(TAG, "Wifi is disconnected, reason %d. Retry %d", disconnected->reason, retry_num);
+            wifi_lib_connect(wifi_fast_disconnected(&wifi_fast, wifi_lib_time_ms()));
             break;
         default:
             break;
     }
 }
 
+/*!
+ * @brief  Clock set by SNTP, readings get their Unix time from now on
+ */
+static void wifi_lib_sntp_synced(struct timeval *tv)
+{
+    ESP_LOGI(TAG, "Clock set by SNTP, %u", (uint32_t) tv->tv_sec);
+}
+
+/*!
+ * @brief  Start SNTP with the first IP
+ */
+static void wifi_lib_sntp_start(void)
+{
+    if(sntp_started)
+    {
+        return;
+    }
+    sntp_started = true;
+    sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    sntp_setservername(0, SNTP_SERVER);
+    sntp_set_time_sync_notification_cb(wifi_lib_sntp_synced);
+    sntp_init();
+    ESP_LOGI(TAG, "SNTP started, server %s", SNTP_SERVER);
+}
+
 /*!
  * @brief  Event handler for IP_EVENT_ETH_GOT_IP
  * @param  Event data
@@ -89,6 +258,15 @@ static void wifi_got_ip_event_handler(void* arg, esp_event_base_t event_base, in
     ESP_LOGI(TAG, "*********************** WIFIMASK:" IPSTR, IP2STR(&ip_info->netmask));
     ESP_LOGI(TAG, "*********************** WIFIGW:" IPSTR, IP2STR(&ip_info->gw));
 
+    if(wifi_fast_got_ip(&wifi_fast, ip_info->ip.addr, ip_info->netmask.addr, ip_info->gw.addr, wifi_lib_time_ms()))
+    {
+        wifi_lib_cache_save(&wifi_fast.cache);
+    }
+    ESP_LOGI(TAG, "Time to IP %u ms, max %u ms. Links up: %u direct, %u scan, %u fallbacks to scan",
+             wifi_fast.stats.time_to_ip, wifi_fast.stats.time_to_ip_max, wifi_fast.stats.direct, wifi_fast.stats.scan,
+             wifi_fast.stats.fallbacks);
+
+    wifi_lib_sntp_start();
     xEventGroupSetBits(wifi_status_events, NETWORK_GOT_IP_EVENT);
 }
 
@@ -102,11 +280,30 @@ void wifi_lib_wait_network_up(void)
     xEventGroupWaitBits(wifi_status_events, NETWORK_GOT_IP_EVENT, false, false, portMAX_DELAY);
 }
 
+/*!
+ * @brief  Get connect statistics
+ */
+void wifi_lib_get_stats(wifi_fast_stats_t *stats)
+{
+    memcpy(stats, &wifi_fast.stats, sizeof(wifi_fast_stats_t));
+}
+
 /*!
  * @brief  Wifi initialization in station mode
  */
 void wifi_lib_init_sta(void)
 {
+    wifi_fast_cache_t cache;
+    bool cached = wifi_lib_cache_load(&cache);
+
+    /* Last good link, its lease is reused in WIFI_IP_CACHED mode even without fast connect */
+    wifi_fast_init(&wifi_fast, cached ? &cache : NULL, wifi_fast_ssid_hash(WIFI_SSID),
+                   (WIFI_FAST_CONNECT) ? WIFI_FAST_ATTEMPTS : 0);
+    ESP_LOGI(TAG, "Wifi last link %s", (wifi_fast.cache.valid != 0) ? "loaded" : "not stored");
+
+    /* Network status event, before the handlers set it */
+    wifi_status_events = xEventGroupCreate();
+
     /* Initialize TCP/IP network interface (should be called only once in application) */
     ESP_ERROR_CHECK(esp_netif_init());
 
@@ -142,8 +339,5 @@ void wifi_lib_init_sta(void)
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
     ESP_ERROR_CHECK(esp_wifi_start());
-
-    /* Network status event */
-    wifi_status_events = xEventGroupCreate();
     ESP_LOGI(TAG, "Wifi is initialized");
 }
\ No newline at end of file
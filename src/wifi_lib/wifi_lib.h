@@ -13,7 +13,7 @@
 /*                              INCLUDE FILES                                 */
 /******************************************************************************/
 
-
+#include "wifi_fast.h"
 
 /******************************************************************************/
 /*                     EXPORTED TYPES and DEFINITIONS                         */
@@ -44,6 +44,13 @@
  */
 void wifi_lib_wait_network_up(void);
 
+/*!
+ * @brief  Get connect statistics: links up by direct connect or scan, time to IP
+ * @param  [out] Statistics
+ * @retval None
+ */
+void wifi_lib_get_stats(wifi_fast_stats_t *stats);
+
 /*!
  * @brief  Wifi initialization in station mode
  * @param  None
@@ -0,0 +1,371 @@
+/*
+ *  batch_bench.c
+ *
+ *  Created on: Feb 25, 2022
+ *
+ *  Host comparison of one publish per reading against batches of src/batch/batch.c.
+ *  An hour of 32 water meters polled by the groups of modbus_table.h is replayed, readings carry
+ *  a random part of their registers as report-by-exception leaves them. The main loop is followed:
+ *  readings of each second are taken, then the batch is published when its latency budget is due.
+ *  Publish is a mock that builds the MQTT packet into an outbox, the way the client copies it;
+ *  wire bytes add a TLS record (29 bytes, AES-GCM) and TCP/IP headers (40 bytes per segment).
+ *  CPU time is the best of BENCH_REPEAT runs.
+ *  "-o dir" writes a json and a binary batch of the same readings for telemetry_decode.py.
+ *
+ *  Build: gcc -O2 -Wall -I../telemetry_bench -I../../src -I../../src/modbus_api -o batch_bench batch_bench.c \
+ *             ../../src/batch/batch.c ../../src/modbus_api/modbus_telemetry.c ../../src/modbus_api/modbus_decode.c \
+ *             ../../src/modbus_api/modbus_table.c ../../src/utility/json_writer.c ../../src/utility/bin_writer.c \
+ *             ../../src/utility/utility.c -lm
+ *  Run:   ./batch_bench [-o dir]
+ *         python3 ../telemetry_bench/telemetry_decode.py dir/schema.json dir/batch.bin dir/batch.json
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "config.h"
+#include "batch/batch.h"
+#include "modbus_telemetry.h"
+
+#ifdef ELECTRIC_METER_USED
+#error "batch_bench replays water meter readings"
+#endif
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define BENCH_SLAVES                                  32
+#define BENCH_DURATION_S                              3600
+#define BENCH_LOOP_MS                                 1000  /* Main loop period */
+#define BENCH_BATCH_LENGTH                            1024  /* MQTT_DATA_MAX_LENGTH */
+#define BENCH_BATCH_LATENCY_MS                        5000
+#define BENCH_RECORD_SIZE                             4096
+#define BENCH_RECORD_LENGTH                           32    /* Compact reading */
+#define BENCH_MESSAGE_SIZE                            4096
+#define BENCH_TOPIC                                   "Data"
+#define BENCH_TLS_OVERHEAD                            29
+#define BENCH_TCP_SEGMENT                             1460
+#define BENCH_TCP_OVERHEAD                            40
+#define BENCH_REPEAT                                  5     /* Runs of each case, the fastest is kept */
+
+/*!
+ * @brief  Result of a run
+ */
+typedef struct {
+    uint64_t readings;
+    uint64_t publishes;
+    uint64_t payload_bytes;
+    uint64_t wire_bytes;
+    uint64_t encodes;                                 /* Readings encoded, again after a flush or into the message */
+    uint64_t copies;                                  /* Readings copied into the batch */
+    double cpu_s;
+    batch_stats_t batch;
+} bench_result_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static const struct {
+    modbus_reg_id first;
+    modbus_reg_id last;
+    uint32_t period;
+} bench_group[MB_WATER_NUMBER_OF_GROUP] = {
+#define XGROUP_ITEM(id, first, last, period) { first, last, period },
+    MODBUS_WATER_POLL_GROUPS
+#undef XGROUP_ITEM
+};
+
+static uint32_t bench_seed;
+static bench_result_t *bench_result;
+static uint8_t bench_outbox[BENCH_MESSAGE_SIZE + 64];
+static uint8_t bench_message[BENCH_MESSAGE_SIZE];
+static uint8_t bench_payload[BENCH_BATCH_LENGTH];
+static uint8_t bench_record[BENCH_RECORD_SIZE];
+static batch_t bench_batch;
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static uint32_t bench_random(void)
+{
+    bench_seed = bench_seed * 1103515245 + 12345;
+    return bench_seed >> 8;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Reading of a poll group, about a third of its registers to report */
+static void bench_reading(modbus_data_t *data, uint8_t slave, uint32_t group, uint32_t time)
+{
+    memset(data, 0, sizeof(modbus_data_t));
+    data->meter = WATER_METER;
+    data->slave_id = slave;
+    data->time = time;
+    data->start = bench_group[group].first;
+    data->stop = bench_group[group].last;
+    for(modbus_reg_id reg = data->start; reg <= data->stop; reg++)
+    {
+        uint8_t *slot = &data->data[(modbus_water_offset[reg] - modbus_water_offset[data->start]) * 2];
+        int32_t value = bench_random() % 1000000;
+        slot[0] = (uint32_t) value >> 24;
+        slot[1] = (uint32_t) value >> 16;
+        slot[2] = (uint32_t) value >> 8;
+        slot[3] = (uint32_t) value;
+        if((bench_random() % 3) == 0)
+        {
+            data->report |= MODBUS_REPORT_BIT(reg);
+        }
+    }
+    if(data->report == 0)
+    {
+        data->report = MODBUS_REPORT_BIT(data->start);
+    }
+}
+
+/* MQTT PUBLISH QoS 0 packet copied to the outbox */
+static void bench_publish(const uint8_t *payload, uint32_t length)
+{
+    uint32_t topic_length = strlen(BENCH_TOPIC);
+    uint32_t remaining = 2 + topic_length + length;
+    uint32_t header = 0;
+
+    bench_outbox[header++] = 0x30;
+    do
+    {
+        bench_outbox[header++] = (remaining & 0x7F) | ((remaining > 0x7F) ? 0x80 : 0);
+        remaining >>= 7;
+    } while(remaining > 0);
+    bench_outbox[header++] = topic_length >> 8;
+    bench_outbox[header++] = topic_length;
+    memcpy(&bench_outbox[header], BENCH_TOPIC, topic_length);
+    memcpy(&bench_outbox[header + topic_length], payload, length);
+
+    length += header + topic_length + BENCH_TLS_OVERHEAD;
+    bench_result->publishes++;
+    bench_result->payload_bytes += length - header - topic_length - BENCH_TLS_OVERHEAD;
+    bench_result->wire_bytes += length + ((length + BENCH_TCP_SEGMENT - 1) / BENCH_TCP_SEGMENT) * BENCH_TCP_OVERHEAD;
+}
+
+static uint32_t bench_encode(bool binary, const modbus_data_t *data, uint8_t *buffer, uint32_t size)
+{
+    uint8_t slave = data->slave_id;
+
+    bench_result->encodes++;
+    if(binary)
+    {
+        return modbus_telemetry_to_binary(data, &slave, buffer, size);
+    }
+    return modbus_telemetry_to_json(data, &slave, (char*) buffer, size);
+}
+
+static void bench_flush(batch_flush_t reason)
+{
+    uint32_t length = batch_finish(&bench_batch, reason);
+
+    if(length > 0)
+    {
+        bench_publish(bench_payload, length);
+    }
+    batch_reset(&bench_batch, true);
+}
+
+/* As publisher_batch_add(): encoded in place or once into the message, the compact record written in place */
+static void bench_batch_add(bool binary, const modbus_data_t *data, uint32_t now_ms)
+{
+    uint8_t spare[BENCH_RECORD_LENGTH];
+    uint8_t *record, *buffer;
+    uint32_t room, length;
+
+    record = batch_record_slot(&bench_batch, &room);
+    record = (room < BENCH_RECORD_LENGTH) ? spare : record;
+    memset(record, 0, BENCH_RECORD_LENGTH);
+
+    buffer = batch_reserve(&bench_batch, &room);
+    length = (room > 0) ? bench_encode(binary, data, buffer, room) : 0;
+    if(length == 0)
+    {
+        buffer = bench_message;
+        length = bench_encode(binary, data, buffer, sizeof(bench_message));
+    }
+    bench_result->copies += (buffer == bench_message) ? 1 : 0;
+    while(!batch_add(&bench_batch, buffer, length, record, BENCH_RECORD_LENGTH, now_ms))
+    {
+        if(bench_batch.count == 0)
+        {
+            bench_publish(buffer, length);
+            return;
+        }
+        if(buffer != bench_message)
+        {
+            memcpy(bench_message, buffer, length);
+            buffer = bench_message;
+        }
+        bench_flush(BATCH_FLUSH_SIZE);
+    }
+}
+
+static void bench_run(bool binary, bool batched, bench_result_t *result)
+{
+    static modbus_data_t data;
+    double start;
+
+    memset(result, 0, sizeof(bench_result_t));
+    bench_result = result;
+    bench_seed = 12345;
+    batch_init(&bench_batch, binary ? BATCH_FORMAT_BINARY : BATCH_FORMAT_JSON, bench_payload, sizeof(bench_payload),
+               bench_record, sizeof(bench_record), BENCH_BATCH_LATENCY_MS);
+
+    start = now_s();
+    for(uint32_t ms = 0; ms < BENCH_DURATION_S * 1000; ms += BENCH_LOOP_MS)
+    {
+        /* Readings polled during the last loop */
+        for(uint32_t t = ms; t < ms + BENCH_LOOP_MS; t += 500)
+        {
+            for(uint32_t s = 0; s < BENCH_SLAVES; s++)
+            {
+                for(uint32_t g = 0; g < MB_WATER_NUMBER_OF_GROUP; g++)
+                {
+                    if((t % bench_group[g].period) != 0)
+                    {
+                        continue;
+                    }
+                    bench_reading(&data, s + 1, g, 1645747200 + t / 1000);
+                    result->readings++;
+                    if(batched)
+                    {
+                        bench_batch_add(binary, &data, ms);
+                    }
+                    else
+                    {
+                        bench_publish(bench_message, bench_encode(binary, &data, bench_message, sizeof(bench_message)));
+                    }
+                }
+            }
+        }
+        if(batch_due(&bench_batch, ms + BENCH_LOOP_MS))
+        {
+            bench_flush(BATCH_FLUSH_LATENCY);
+        }
+    }
+    bench_flush(BATCH_FLUSH_LATENCY);
+    result->cpu_s = now_s() - start;
+    result->batch = bench_batch.stats;
+}
+
+static void bench_print(const char *name, const bench_result_t *result)
+{
+    printf("%-14s %9llu %10llu %12llu %12llu %9.2f %9.3f %8.1f%%", name, (unsigned long long) result->readings,
+           (unsigned long long) result->publishes, (unsigned long long) result->payload_bytes,
+           (unsigned long long) result->wire_bytes, result->cpu_s / result->readings * 1e9 / 1000.0,
+           (double) result->encodes / result->readings, 100.0 * result->copies / result->readings);
+    if(result->batch.readings > 0)
+    {
+        printf("   size %u latency %u, avg %.1f max %u", result->batch.flushes[BATCH_FLUSH_SIZE],
+               result->batch.flushes[BATCH_FLUSH_LATENCY],
+               (double) result->batch.readings / (result->batch.flushes[BATCH_FLUSH_SIZE] + result->batch.flushes[BATCH_FLUSH_LATENCY]),
+               result->batch.max_readings);
+    }
+    printf("\n");
+}
+
+/* The same readings as a json batch and a binary batch, with the schema */
+static bool bench_save(const char *dir)
+{
+    static modbus_data_t data[5];
+    static char schema[4096];
+    static uint8_t json[BENCH_BATCH_LENGTH], binary[BENCH_BATCH_LENGTH];
+    static uint8_t record[BENCH_RECORD_SIZE];
+    const char *name[3] = { "schema.json", "batch.json", "batch.bin" };
+    uint32_t length[3];
+    const void *content[3] = { schema, json, binary };
+    char path[512];
+    batch_t batch;
+    uint32_t length_one;
+
+    bench_seed = 777;
+    for(uint32_t i = 0; i < 5; i++)
+    {
+        bench_reading(&data[i], i + 1, i % MB_WATER_NUMBER_OF_GROUP, 1645747200 + i);
+    }
+    length[0] = modbus_telemetry_schema(schema, sizeof(schema));
+    for(uint32_t f = 0; f < 2; f++)
+    {
+        batch_init(&batch, f ? BATCH_FORMAT_BINARY : BATCH_FORMAT_JSON, f ? binary : json, BENCH_BATCH_LENGTH,
+                   record, sizeof(record), BENCH_BATCH_LATENCY_MS);
+        for(uint32_t i = 0; i < 5; i++)
+        {
+            length_one = bench_encode(f, &data[i], bench_message, sizeof(bench_message));
+            if(!batch_add(&batch, bench_message, length_one, &data[i].slave_id, 1, 0))
+            {
+                printf("Reading %u does not fit in the batch\n", i);
+                return false;
+            }
+        }
+        length[1 + f] = batch_finish(&batch, BATCH_FLUSH_SIZE);
+    }
+
+    for(uint32_t i = 0; i < 3; i++)
+    {
+        FILE *file;
+        snprintf(path, sizeof(path), "%s/%s", dir, name[i]);
+        file = fopen(path, "wb");
+        if(file == NULL)
+        {
+            printf("Cannot write %s\n", path);
+            return false;
+        }
+        fwrite(content[i], 1, length[i], file);
+        fclose(file);
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    bench_result_t result[4];
+    bench_result_t run;
+
+    for(uint32_t i = 0; i < 4; i++)
+    {
+        for(uint32_t r = 0; r < BENCH_REPEAT; r++)
+        {
+            bench_run(i >= 2, (i % 2) == 1, &run);
+            if((r == 0) || (run.cpu_s < result[i].cpu_s))
+            {
+                result[i] = run;
+            }
+        }
+    }
+
+    printf("%d meters, %d s, batch of %d bytes or %d ms\n", BENCH_SLAVES, BENCH_DURATION_S, BENCH_BATCH_LENGTH,
+           BENCH_BATCH_LATENCY_MS);
+    printf("%-14s %9s %10s %12s %12s %9s %9s %9s\n", "", "readings", "publishes", "payload", "wire bytes", "us/read",
+           "enc/read", "copied");
+    bench_print("json single", &result[0]);
+    bench_print("json batch", &result[1]);
+    bench_print("binary single", &result[2]);
+    bench_print("binary batch", &result[3]);
+
+    if((argc > 2) && (strcmp(argv[1], "-o") == 0))
+    {
+        return bench_save(argv[2]) ? 0 : 1;
+    }
+    return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ *  bus_bench.c
+ *
+ *  Created on: Mar 17, 2022
+ *
+ *  Scaling of polling with the number of buses: src/modbus_api/modbus_bus.c and modbus_command.c run on
+ *  the UART shim, one meter_sim per bus on its own pseudo-terminal, received at 9600 baud by the shim.
+ *  A poller thread per bus reads the water registers of its slaves in turn, as the poller task of a
+ *  bus does, through modbus_command_get_water_registers(). Transactions per second are measured with
+ *  1 to 4 buses polled at once and must grow with the number of buses.
+ *
+ *  Build: gcc -O2 -Wall -I../uart_shim -I../../src -I../../src/modbus_api -o bus_bench bus_bench.c ../uart_shim/uart_shim.c
+ *         ../../src/modbus_api/modbus_bus.c ../../src/modbus_api/modbus_command.c ../../src/modbus_api/modbus_frame.c
+ *         ../../src/utility/utility.c -lpthread
+ *         and meter_sim, see tools/meter_sim
+ *  Run:   ./bus_bench [-m ../meter_sim/meter_sim] [-t seconds]
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "uart_shim.h"
+#include "config.h"
+#include "modbus_command.h"
+#include "modbus_bus.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define BENCH_SLAVES                                  "8"   /* Slaves per bus */
+#define BENCH_SLAVE_COUNT                             8
+#define BENCH_SIM_DELAY                               "15"  /* + 5 ms end of request detection of meter_sim: MODBUS_TURNAROUND_MS */
+#define BENCH_REGS                                    20    /* Registers per read, 45 bytes reply */
+#define BENCH_SECONDS                                 4
+#define BENCH_SCALING_MIN                             0.9   /* Of linear scaling */
+
+/*!
+ * @brief  Poller of a bus
+ */
+typedef struct {
+    uint8_t bus;
+    volatile bool run;
+    uint32_t ok;
+    uint32_t failed;
+} bench_poller_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static bench_poller_t poller[MODBUS_BUS_COUNT];
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static void *bench_poller(void *arg)
+{
+    bench_poller_t *p = arg;
+    uint8_t rx_data[MODBUS_COMMAND_MAX_SIZE];
+    uint8_t slave_id = 1;
+
+    while(p->run)
+    {
+        if(modbus_command_get_water_registers(p->bus, slave_id, 0x0000, BENCH_REGS, rx_data))
+        {
+            p->ok++;
+        }
+        else
+        {
+            p->failed++;
+        }
+        slave_id = (slave_id % BENCH_SLAVE_COUNT) + 1;
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    char *sim_argv[] = {"../meter_sim/meter_sim", "-p", "rtu", "-n", BENCH_SLAVES, "-d", BENCH_SIM_DELAY, NULL};
+    pthread_t thread[MODBUS_BUS_COUNT];
+    pid_t sim[MODBUS_BUS_COUNT];
+    char path[64];
+    uint32_t seconds = BENCH_SECONDS;
+    uint32_t ok, failed;
+    double tps, tps_one = 0;
+    bool pass = true;
+    int opt;
+
+    while((opt = getopt(argc, argv, "m:t:")) != -1)
+    {
+        switch(opt)
+        {
+        case 'm': sim_argv[0] = optarg; break;
+        case 't': seconds = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "Usage: %s [-m meter_sim] [-t seconds]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    esp_log_level_set("*", ESP_LOG_NONE);
+    for(uint8_t i = 0; i < MODBUS_BUS_COUNT; i++)
+    {
+        sim[i] = uart_shim_spawn(sim_argv, path, sizeof(path));
+        if((sim[i] < 0) || (uart_shim_open(modbus_bus_get_config(i)->port, path) < 0))
+        {
+            fprintf(stderr, "Cannot start %s\n", sim_argv[0]);
+            return 2;
+        }
+    }
+    modbus_bus_init();
+
+    printf("%u baud, %s slaves per bus, %u registers per read, %u s per step\n", modbus_bus_get_config(0)->baudrate,
+           BENCH_SLAVES, BENCH_REGS, seconds);
+    printf("%5s %10s %10s %8s %8s\n", "buses", "reads/s", "per bus", "scaling", "failed");
+    for(uint8_t buses = 1; buses <= MODBUS_BUS_COUNT; buses++)
+    {
+        for(uint8_t i = 0; i < buses; i++)
+        {
+            memset(&poller[i], 0, sizeof(bench_poller_t));
+            poller[i].bus = i;
+            poller[i].run = true;
+            pthread_create(&thread[i], NULL, bench_poller, &poller[i]);
+        }
+        sleep(seconds);
+        ok = 0;
+        failed = 0;
+        for(uint8_t i = 0; i < buses; i++)
+        {
+            poller[i].run = false;
+        }
+        for(uint8_t i = 0; i < buses; i++)
+        {
+            pthread_join(thread[i], NULL);
+            ok += poller[i].ok;
+            failed += poller[i].failed;
+        }
+
+        tps = (double) ok / seconds;
+        if(buses == 1)
+        {
+            tps_one = tps;
+        }
+        printf("%5u %10.1f %10.1f %7.2fx %8u\n", buses, tps, tps / buses, tps / tps_one, failed);
+        pass = pass && (failed == 0) && (tps >= BENCH_SCALING_MIN * buses * tps_one);
+    }
+
+    for(uint8_t i = 0; i < MODBUS_BUS_COUNT; i++)
+    {
+        uart_shim_kill(sim[i]);
+    }
+    printf("bus scaling: %s\n", pass ? "pass" : "FAIL");
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,209 @@
+/*
+ *  command_bench.c
+ *
+ *  Created on: Mar 18, 2022
+ *
+ *  Poll throughput and latency of src/modbus_api/modbus_command.c against meter_sim: the water registers
+ *  of the slaves are read in turn through modbus_command_get_water_registers(), the call of the poller
+ *  task, with the real bus task and receive path on the UART shim at 9600 baud. Transactions per second
+ *  and the latency percentiles of the calls are reported. Replies from answering slaves must all be
+ *  read when no fault is injected, only the silent slave may fail.
+ *
+ *  The same bench builds with -DBENCH_BASELINE against modbus_command.c of the single bus firmware,
+ *  read with one uart_read_bytes() of the expected size, to compare on the same simulator.
+ *
+ *  Build: gcc -O2 -Wall -I../uart_shim -I../../src -I../../src/modbus_api -o command_bench command_bench.c
+ *         ../uart_shim/uart_shim.c ../../src/modbus_api/modbus_command.c ../../src/modbus_api/modbus_bus.c
+ *         ../../src/modbus_api/modbus_frame.c ../../src/utility/utility.c -lpthread
+ *         baseline: git show 73abb6b:src/modbus_api/modbus_command.c > base/modbus_command.c, the same
+ *         for modbus_command.h, then
+ *         gcc -O2 -Wall -DBENCH_BASELINE -I../uart_shim -Ibase -I../../src -o command_bench_base command_bench.c
+ *         ../uart_shim/uart_shim.c base/modbus_command.c ../../src/utility/utility.c -lpthread
+ *         and meter_sim, see tools/meter_sim
+ *  Run:   ./command_bench [-m ../meter_sim/meter_sim] [-t seconds] [-n slaves] [-r registers]
+ *                         [-d delay ms] [-j jitter ms] [-c corrupt %] [-l loss %] [-s silent id]
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include "uart_shim.h"
+#include "config.h"
+#include "modbus_command.h"
+#ifndef BENCH_BASELINE
+#include "modbus_bus.h"
+#endif
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define BENCH_SECONDS                                 5
+#define BENCH_SLAVES                                  "8"
+#define BENCH_SIM_DELAY                               "15"  /* + 5 ms end of request detection of meter_sim: MODBUS_TURNAROUND_MS */
+#define BENCH_REGS                                    20    /* Registers per read, 45 bytes reply */
+#define BENCH_MAX_SLAVES                              32
+#define BENCH_MAX_SAMPLES                             65536
+
+#ifdef BENCH_BASELINE
+#define BENCH_NAME                                    "single bus modbus_command.c"
+#define BENCH_PORT                                    MODBUS_PORT_NUM
+#define BENCH_BAUDRATE                                MODBUS_BAUDRATE
+#define bench_init()                                  modbus_command_init()
+#define bench_read(id, regs, rx)                      modbus_command_get_water_registers(id, 0x0000, regs, rx)
+#else
+#define BENCH_NAME                                    "modbus_command.c"
+#define BENCH_PORT                                    (modbus_bus_get_config(0)->port)
+#define BENCH_BAUDRATE                                (modbus_bus_get_config(0)->baudrate)
+#define bench_init()                                  modbus_bus_init()
+#define bench_read(id, regs, rx)                      modbus_command_get_water_registers(0, id, 0x0000, regs, rx)
+#endif
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static uint32_t latency_us[BENCH_MAX_SAMPLES];        /* Of every transaction */
+static uint32_t answered_us[BENCH_MAX_SAMPLES];       /* Of the transactions to the slaves that answer */
+static uint32_t slave_failed[BENCH_MAX_SLAVES + 1];
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static int bench_compare(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+
+    return (x > y) - (x < y);
+}
+
+static void bench_print_latency(const char *name, uint32_t *sample, uint32_t count)
+{
+    if(count == 0)
+    {
+        printf("%-10s %8s\n", name, "-");
+        return;
+    }
+    qsort(sample, count, sizeof(uint32_t), bench_compare);
+    printf("%-10s %8u %8.1f %8.1f %8.1f %8.1f\n", name, count, sample[count / 2] / 1000.0, sample[(count * 90) / 100] / 1000.0,
+           sample[(count * 99) / 100] / 1000.0, sample[count - 1] / 1000.0);
+}
+
+int main(int argc, char *argv[])
+{
+    char *sim_argv[24] = {"../meter_sim/meter_sim", "-p", "rtu", "-n", BENCH_SLAVES, "-d", BENCH_SIM_DELAY};
+    uint8_t rx_data[MODBUS_COMMAND_MAX_SIZE];
+    uint32_t seconds = BENCH_SECONDS;
+    uint32_t regs = BENCH_REGS;
+    uint32_t sim_argc = 7;
+    uint32_t slaves, silent = 0, faults = 0;
+    uint32_t count = 0, answered = 0, ok = 0, failed = 0, unexpected = 0;
+    uint64_t start, end, begin;
+    uint8_t slave_id = 1;
+    double elapsed;
+    char path[64];
+    bool pass;
+    pid_t sim;
+    int opt;
+
+    while((opt = getopt(argc, argv, "m:t:n:r:d:j:c:l:s:")) != -1)
+    {
+        switch(opt)
+        {
+        case 'm': sim_argv[0] = optarg; break;
+        case 't': seconds = strtoul(optarg, NULL, 0); break;
+        case 'n': sim_argv[4] = optarg; break;
+        case 'r': regs = strtoul(optarg, NULL, 0); break;
+        case 'd': sim_argv[6] = optarg; break;
+        case 'j':
+        case 'c':
+        case 'l':
+        case 's':
+            if(sim_argc + 2 >= sizeof(sim_argv) / sizeof(sim_argv[0]))
+            {
+                break;
+            }
+            /* Passed to meter_sim, "-s" and "-j" keep the check of failures */
+            faults += ((opt == 'c') || (opt == 'l')) ? strtoul(optarg, NULL, 0) : 0;
+            silent = (opt == 's') ? strtoul(optarg, NULL, 0) : silent;
+            sim_argv[sim_argc++] = (opt == 'j') ? "-j" : (opt == 'c') ? "-c" : (opt == 'l') ? "-l" : "-s";
+            sim_argv[sim_argc++] = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-m meter_sim] [-t seconds] [-n slaves] [-r registers] [-d delay ms]\n"
+                            "       [-j jitter ms] [-c corrupt %%] [-l loss %%] [-s silent id]\n", argv[0]);
+            return 2;
+        }
+    }
+    sim_argv[sim_argc] = NULL;
+    slaves = strtoul(sim_argv[4], NULL, 0);
+    if((slaves == 0) || (slaves > BENCH_MAX_SLAVES) || (regs == 0) || (regs > MODBUS_READ_MAX_REGS))
+    {
+        fprintf(stderr, "1 to %u slaves, 1 to %u registers\n", BENCH_MAX_SLAVES, MODBUS_READ_MAX_REGS);
+        return 2;
+    }
+
+    esp_log_level_set("*", ESP_LOG_NONE);
+    sim = uart_shim_spawn(sim_argv, path, sizeof(path));
+    if((sim < 0) || (uart_shim_open(BENCH_PORT, path) < 0))
+    {
+        fprintf(stderr, "Cannot start %s\n", sim_argv[0]);
+        return 2;
+    }
+    bench_init();
+
+    printf("%s, %u baud, %u slaves replying %u ms after the request, %u registers per read, %u s\n", BENCH_NAME,
+           BENCH_BAUDRATE, slaves, (uint32_t) strtoul(sim_argv[6], NULL, 0) + 5, regs, seconds);
+    fflush(stdout);
+
+    start = uart_shim_now_us();
+    end = start + seconds * 1000000ULL;
+    while((uart_shim_now_us() < end) && (count < BENCH_MAX_SAMPLES))
+    {
+        begin = uart_shim_now_us();
+        if(bench_read(slave_id, regs, rx_data))
+        {
+            ok++;
+        }
+        else
+        {
+            failed++;
+            slave_failed[slave_id]++;
+            unexpected += (slave_id == silent) ? 0 : 1;
+        }
+        latency_us[count] = uart_shim_now_us() - begin;
+        if(slave_id != silent)
+        {
+            answered_us[answered++] = latency_us[count];
+        }
+        count++;
+        slave_id = (slave_id % slaves) + 1;
+    }
+    elapsed = (uart_shim_now_us() - start) / 1e6;
+    uart_shim_kill(sim);
+
+    printf("%u transactions, %u ok, %u failed, %.1f tps, %.1f good reads/s\n", count, ok, failed, count / elapsed, ok / elapsed);
+    printf("%-10s %8s %8s %8s %8s %8s\n", "latency", "count", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    bench_print_latency("all", latency_us, count);
+
+    /* Without the timeouts of the silent slave */
+    if(silent != 0)
+    {
+        printf("silent slave %u: %u failed\n", silent, slave_failed[silent]);
+        bench_print_latency("answered", answered_us, answered);
+    }
+
+    pass = (ok > 0) && ((faults > 0) || (unexpected == 0));
+    printf("command throughput: %s\n", pass ? "pass" : "FAIL");
+    return pass ? 0 : 1;
+}
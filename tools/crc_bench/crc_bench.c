@@ -0,0 +1,185 @@
+/*
+ *  crc_bench.c
+ *
+ *  Created on: Feb 14, 2022
+ *
+ *  Host check and microbenchmark of crc16 modbus in src/utility. The firmware kernel (slice-by-4) is checked
+ *  against the previous two-table kernel and a bit by bit reference, on whole buffers and on buffers fed
+ *  in pieces, then timed against them and a one-table kernel on frame sizes seen on the bus.
+ *
+ *  Build: gcc -O2 -Wall -I../../src -o crc_bench crc_bench.c ../../src/utility/utility.c
+ *  Run:   ./crc_bench
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "utility/utility.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define BENCH_BUFFER_SIZE                             4096
+#define BENCH_BYTES                                   (64UL * 1024 * 1024)   /* Bytes hashed per size */
+
+typedef uint16_t (*crc_kernel_t)(const uint8_t *data, uint16_t length);
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static uint8_t table_hi[256], table_lo[256];      /* Previous kernel: high and low byte tables */
+static uint16_t table_one[256];
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+/* Definition, one bit at a time. Same byte order as crc16_modbus(): high byte is sent first */
+static uint16_t crc_bitwise(const uint8_t *data, uint16_t length)
+{
+    uint16_t crc = 0xFFFF;
+
+    while(length--)
+    {
+        crc ^= *data++;
+        for(int i = 0; i < 8; i++)
+        {
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+        }
+    }
+    return (uint16_t) ((crc << 8) | (crc >> 8));
+}
+
+/* Previous firmware kernel, two 8-bit tables */
+static uint16_t crc_two_table(const uint8_t *data, uint16_t length)
+{
+    uint8_t hi = 0xFF, lo = 0xFF, index;
+
+    while(length--)
+    {
+        index = hi ^ *data++;
+        hi = lo ^ table_hi[index];
+        lo = table_lo[index];
+    }
+    return (hi << 8 | lo);
+}
+
+/* One 16-bit table, 512 bytes */
+static uint16_t crc_one_table(const uint8_t *data, uint16_t length)
+{
+    uint16_t crc = 0xFFFF;
+
+    while(length--)
+    {
+        crc = (crc >> 8) ^ table_one[(crc ^ *data++) & 0xFF];
+    }
+    return (uint16_t) ((crc << 8) | (crc >> 8));
+}
+
+static void tables_init(void)
+{
+    for(int i = 0; i < 256; i++)
+    {
+        uint16_t crc = i;
+        for(int j = 0; j < 8; j++)
+        {
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+        }
+        table_one[i] = crc;
+        table_hi[i] = crc & 0xFF;
+        table_lo[i] = crc >> 8;
+    }
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double bench(crc_kernel_t kernel, const uint8_t *data, uint16_t length)
+{
+    volatile uint16_t sink = 0;
+    uint32_t rounds = BENCH_BYTES / length;
+    double start = now_ns();
+
+    for(uint32_t i = 0; i < rounds; i++)
+    {
+        sink ^= kernel(data + (i & 7), length);
+    }
+    (void) sink;
+    return (now_ns() - start) / ((double) rounds * length);
+}
+
+int main(void)
+{
+    static const uint8_t check[] = "123456789";
+    static const uint16_t sizes[] = {8, 64, 255, 4000};
+    static uint8_t data[BENCH_BUFFER_SIZE + 8];
+    uint32_t errors = 0;
+    uint16_t length, split, crc;
+
+    tables_init();
+    srand(1);
+    for(uint32_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = rand();
+    }
+
+    /* Catalogue check value 0x4B37, high byte first here */
+    if(crc16_modbus(check, 9) != 0x374B)
+    {
+        printf("Check value: FAIL %04X\n", crc16_modbus(check, 9));
+        errors++;
+    }
+
+    /* Whole buffer, any split, residue of a frame with its CRC, check sum */
+    for(uint32_t n = 0; n < 20000; n++)
+    {
+        length = rand() % 300;
+        split = (length > 0) ? rand() % (length + 1) : 0;
+        crc = crc16_modbus(data, length);
+        if((crc != crc_two_table(data, length)) || (crc != crc_bitwise(data, length)) || (crc != crc_one_table(data, length)) ||
+           (crc16_modbus_final(crc16_modbus_update(crc16_modbus_update(CRC16_MODBUS_INIT, data, split), data + split, length - split)) != crc) ||
+           (check_sum_update(check_sum(data, split), data + split, length - split) != check_sum(data, length)))
+        {
+            if(errors++ < 5)
+            {
+                printf("Mismatch: length %u split %u\n", length, split);
+            }
+        }
+
+        uint8_t frame[302];
+        memcpy(frame, data, length);
+        frame[length] = crc >> 8;
+        frame[length + 1] = crc & 0xFF;
+        if(crc16_modbus_update(CRC16_MODBUS_INIT, frame, length + 2) != CRC16_MODBUS_RESIDUE)
+        {
+            if(errors++ < 5)
+            {
+                printf("Residue: length %u\n", length);
+            }
+        }
+    }
+    printf("Conformance: %s\n", (errors == 0) ? "OK" : "FAIL");
+
+    printf("%8s %12s %12s %12s %12s  (ns/byte)\n", "bytes", "firmware", "two table", "one table", "bitwise");
+    for(uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        printf("%8u %12.3f %12.3f %12.3f %12.3f\n", sizes[i], bench(crc16_modbus, data, sizes[i]), bench(crc_two_table, data, sizes[i]),
+               bench(crc_one_table, data, sizes[i]), bench(crc_bitwise, data, sizes[i]));
+    }
+    return (errors == 0) ? 0 : 1;
+}
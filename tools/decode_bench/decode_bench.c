@@ -0,0 +1,161 @@
+/*
+ *  decode_bench.c
+ *
+ *  Created on: Feb 18, 2022
+ *
+ *  Host check and throughput of the register decoder in src/modbus_api/modbus_decode.c.
+ *  Each wire type is checked on known values, then whole water and electric readings are decoded
+ *  against values encoded from the tables, and decoded in a loop to measure throughput.
+ *  The decoder source is included to reach the element decoder of the types no table uses yet.
+ *
+ *  Build: gcc -O2 -Wall -I../../src/modbus_api -o decode_bench decode_bench.c ../../src/modbus_api/modbus_table.c
+ *  Run:   ./decode_bench
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "modbus_decode.c"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define BENCH_ROUNDS                                  200000
+
+typedef struct {
+    modbus_wire_type_t type;
+    uint8_t bias;
+    uint8_t data[4];
+    uint32_t expect;
+} bench_vector_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static const bench_vector_t bench_vector[] = {
+    { MB_TYPE_INT32,    0,    {0x00, 0x01, 0xE2, 0x40}, 123456 },
+    { MB_TYPE_INT32,    0,    {0xFF, 0xFF, 0xFF, 0xFE}, (uint32_t) -2 },
+    { MB_TYPE_INT32_WS, 0,    {0xE2, 0x40, 0x00, 0x01}, 123456 },
+    { MB_TYPE_FLOAT32,  0,    {0x42, 0xF6, 0xE9, 0x79}, 0x42F6E979 },     /* 123.456f */
+    { MB_TYPE_UINT16,   0,    {0xC3, 0x50, 0x00, 0x00}, 50000 },
+    { MB_TYPE_BCD3,     0x33, {0x33, 0x65, 0x33, 0x00}, 3200 },
+    { MB_TYPE_BCD4,     0x33, {0xAB, 0x89, 0x67, 0x45}, 12345678 },
+    { MB_TYPE_DATE,     0x33, {0x36, 0x49, 0x35, 0x55}, 20220216 },
+    { MB_TYPE_TIME,     0x33, {0x78, 0x63, 0x45, 0x00}, 123045 },
+    { MB_TYPE_RAW,      0x33, {0x34, 0x00, 0x00, 0x00}, 1 },
+};
+
+static const uint16_t water_address[] = {
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence) address,
+    MODBUS_WATER_INPUT_REGS
+#undef XTABLE_ITEM
+};
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void)
+{
+    static modbus_value_t value[MB_WATER_DATA_SIZE];
+    static uint8_t water[MB_WATER_DATA_SIZE], elec[MB_ELEC_DATA_SIZE];
+    uint32_t errors = 0, decoded = 0;
+    uint16_t count;
+    double start;
+
+    /* Wire types */
+    for(uint32_t i = 0; i < sizeof(bench_vector) / sizeof(bench_vector[0]); i++)
+    {
+        const bench_vector_t *v = &bench_vector[i];
+        uint32_t result = modbus_decode_element(v->type, v->data, v->bias);
+        if(result != v->expect)
+        {
+            printf("Type %u: %08X != %08X\n", v->type, result, v->expect);
+            errors++;
+        }
+    }
+
+    /* Water reading: each register holds its own address, big endian */
+    for(uint32_t i = 0; i < MB_WATER_NUMBER_OF_REG; i++)
+    {
+        uint8_t *p = &water[modbus_water_offset[i] * 2];
+        p[0] = 0; p[1] = 0; p[2] = water_address[i] >> 8; p[3] = water_address[i] & 0xFF;
+    }
+    count = modbus_decode_water(0, MB_WATER_NUMBER_OF_REG - 1, water, REPORT, value, MB_WATER_DATA_SIZE);
+    for(uint32_t i = 0; i < count; i++)
+    {
+        if((value[i].i32 != water_address[value[i].reg]) || (value[i].index != 0))
+        {
+            printf("Water %u: %d\n", value[i].reg, value[i].i32);
+            errors++;
+        }
+    }
+    if(count != MB_WATER_NUMBER_OF_REG)
+    {
+        printf("Water: %u values\n", count);
+        errors++;
+    }
+
+    /* Electric reading, data starts at the first command read: energy block holds 5 BCD values,
+     * address command is not REPORT */
+    memset(elec, 0x33, sizeof(elec));
+    for(uint32_t k = 0; k < 5; k++)
+    {
+        elec[modbus_elec_offset[MB_ENERGY_CMD] + k * 4] = 0x33 + 0x10 + k;
+    }
+    count = modbus_decode_elec(MB_ENERGY_CMD, MB_ENERGY_CMD, &elec[modbus_elec_offset[MB_ENERGY_CMD]], REPORT, value, MB_WATER_DATA_SIZE);
+    for(uint32_t k = 0; k < count; k++)
+    {
+        if((value[k].u32 != 10 + k) || (value[k].index != k) || (value[k].reg != MB_ENERGY_CMD))
+        {
+            printf("Energy %u: %u\n", k, value[k].u32);
+            errors++;
+        }
+    }
+    if((count != 5) ||
+       (modbus_decode_elec(0, MB_ELEC_NUMBER_OF_CMD - 1, elec, REPORT, value, MB_WATER_DATA_SIZE) !=
+        modbus_decode_elec(0, MB_ELEC_NUMBER_OF_CMD - 1, elec, FLAG_NONE, value, MB_WATER_DATA_SIZE) - 6) ||
+       (modbus_decode_elec(0, MB_ELEC_NUMBER_OF_CMD - 1, elec, FLAG_NONE, value, 3) != 3))
+    {
+        printf("Electric: flag or limit\n");
+        errors++;
+    }
+    printf("Conformance: %s\n", (errors == 0) ? "OK" : "FAIL");
+
+    /* Throughput */
+    start = now_s();
+    for(uint32_t r = 0; r < BENCH_ROUNDS; r++)
+    {
+        water[3] = r;
+        decoded += modbus_decode_water(0, MB_WATER_NUMBER_OF_REG - 1, water, REPORT, value, MB_WATER_DATA_SIZE);
+    }
+    printf("Water:    %.1f M values/s\n", decoded / (now_s() - start) / 1e6);
+
+    decoded = 0;
+    start = now_s();
+    for(uint32_t r = 0; r < BENCH_ROUNDS; r++)
+    {
+        elec[0] = r;
+        decoded += modbus_decode_elec(0, MB_ELEC_NUMBER_OF_CMD - 1, elec, FLAG_NONE, value, MB_WATER_DATA_SIZE);
+    }
+    printf("Electric: %.1f M values/s\n", decoded / (now_s() - start) / 1e6);
+    return (errors == 0) ? 0 : 1;
+}
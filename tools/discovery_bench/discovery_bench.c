@@ -0,0 +1,153 @@
+/*
+ *  discovery_bench.c
+ *
+ *  Created on: Mar 17, 2022
+ *
+ *  Timing of the slave discovery in src/modbus_api/modbus_discovery.c against meter_sim: the scan runs
+ *  through the real bus task and receive path on the UART shim, with the 10 ms tick of the firmware.
+ *  Simulated slaves reply MODBUS_TURNAROUND_MS after the end of the request (5 ms end of request
+ *  detection of meter_sim plus its delay), the slowest the probe timeout allows for. All of them must be
+ *  found, and the scan must take no longer than its probes cost: request on the wire, probe timeout
+ *  rounded up to whole ticks plus the tick the wait starts in, then MODBUS_FRAME_DELAY_MS before the next
+ *  request. Probes are counted from the bytes sent. The poller of the bus polls nothing meanwhile.
+ *
+ *  Build: gcc -O2 -Wall -I../uart_shim -I../../src -I../../src/modbus_api -o discovery_bench discovery_bench.c
+ *         ../uart_shim/uart_shim.c ../../src/modbus_api/modbus_discovery.c ../../src/modbus_api/modbus_bus.c
+ *         ../../src/modbus_api/modbus_command.c ../../src/modbus_api/modbus_frame.c ../../src/utility/utility.c -lpthread
+ *         add -DELECTRIC_METER_USED for the wildcard search of 0x68 meters at 1200 8E1
+ *         and meter_sim, see tools/meter_sim
+ *  Run:   ./discovery_bench [-m ../meter_sim/meter_sim] [-n slaves] [-d delay ms]
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include "uart_shim.h"
+#include "config.h"
+#include "modbus_command.h"
+#include "modbus_bus.h"
+#include "modbus_discovery.h"
+#include "modbus_frame.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define BENCH_SIM_GAP_MS                              5     /* End of request detection of meter_sim */
+#define BENCH_MAX_FOUND                               32
+#define BENCH_TICK_MS                                 portTICK_PERIOD_MS
+
+#ifdef ELECTRIC_METER_USED
+#define BENCH_PROTOCOL                                "elec"
+#define BENCH_SLAVES                                  "2"
+#define BENCH_REQUEST_SIZE                            14    /* Read of the 0x68 address command */
+#define BENCH_REPLY_SIZE                              (MODBUS_FRAME_OVERHEAD + 2 + 6 + 4)     /* As modbus_discovery.c */
+#else
+#define BENCH_PROTOCOL                                "rtu"
+#define BENCH_SLAVES                                  "8"
+#define BENCH_REQUEST_SIZE                            8     /* Function 04 of one register */
+#define BENCH_REPLY_SIZE                              (RAW_LEN(1) + 5)
+#endif
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+int main(int argc, char *argv[])
+{
+    char delay[8];
+    char *sim_argv[] = {"../meter_sim/meter_sim", "-p", BENCH_PROTOCOL, "-n", BENCH_SLAVES, "-d", delay, NULL};
+    uint8_t found[BENCH_MAX_FOUND * MODBUS_SLAVE_ADDRESS_SIZE];
+    uint8_t expect[MODBUS_SLAVE_ADDRESS_SIZE];
+    const modbus_bus_config_t *config;
+    uart_shim_stats_t stats;
+    uint32_t slaves, count, missing = 0;
+    uint32_t probes, timeout_ms, request_us;
+    uint64_t start;
+    double seconds, probe_ms, limit_ms;
+    char path[64];
+    bool pass;
+    pid_t sim;
+    int opt;
+
+    snprintf(delay, sizeof(delay), "%u", MODBUS_TURNAROUND_MS - BENCH_SIM_GAP_MS);
+    while((opt = getopt(argc, argv, "m:n:d:")) != -1)
+    {
+        switch(opt)
+        {
+        case 'm': sim_argv[0] = optarg; break;
+        case 'n': sim_argv[4] = optarg; break;
+        case 'd': snprintf(delay, sizeof(delay), "%s", optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-m meter_sim] [-n slaves] [-d delay ms]\n", argv[0]);
+            return 2;
+        }
+    }
+    slaves = strtoul(sim_argv[4], NULL, 0);
+
+    esp_log_level_set("*", ESP_LOG_NONE);
+    sim = uart_shim_spawn(sim_argv, path, sizeof(path));
+    if((sim < 0) || (uart_shim_open(modbus_bus_get_config(0)->port, path) < 0))
+    {
+        fprintf(stderr, "Cannot start %s\n", sim_argv[0]);
+        return 2;
+    }
+    modbus_bus_init();
+    config = modbus_bus_get_config(0);
+
+    printf("%s, %u baud, %u slaves replying %u ms after the request\n", BENCH_PROTOCOL, modbus_bus_get_config(0)->baudrate,
+           slaves, (uint32_t) strtoul(delay, NULL, 0) + BENCH_SIM_GAP_MS);
+    fflush(stdout);
+    /* Slaves found and probe count logged by modbus_discovery_scan() */
+    esp_log_level_set("DISCOVERY", ESP_LOG_INFO);
+    start = uart_shim_now_us();
+    count = modbus_discovery_scan(0, found, BENCH_MAX_FOUND);
+    seconds = (uart_shim_now_us() - start) / 1e6;
+    uart_shim_get_stats(config->port, &stats);
+    uart_shim_kill(sim);
+
+    /* Cost of a probe without reply, 1 start, 8 data, parity and 1 stop bits */
+    probes = stats.tx_bytes / BENCH_REQUEST_SIZE;
+    request_us = BENCH_REQUEST_SIZE * (((config->parity != UART_PARITY_DISABLE) ? 11 : 10) * 1000000UL) / config->baudrate;
+    timeout_ms = modbus_command_response_time_ms(config, BENCH_REPLY_SIZE);
+    probe_ms = request_us / 1000.0 + ((timeout_ms + BENCH_TICK_MS - 1) / BENCH_TICK_MS + 1) * BENCH_TICK_MS + MODBUS_FRAME_DELAY_MS;
+    limit_ms = probes * probe_ms;
+
+    /* Slaves of meter_sim: Modbus id 1..n, or meter address 01 00 00 00 00 00.. */
+    for(uint32_t i = 1; i <= slaves; i++)
+    {
+        bool seen = false;
+
+        memset(expect, 0, sizeof(expect));
+#ifdef ELECTRIC_METER_USED
+        expect[0] = ((i / 10) << 4) | (i % 10);
+#else
+        expect[0] = i;
+#endif
+        for(uint32_t j = 0; j < count; j++)
+        {
+            seen = seen || (memcmp(&found[j * MODBUS_SLAVE_ADDRESS_SIZE], expect, MODBUS_SLAVE_ADDRESS_SIZE) == 0);
+        }
+        missing += seen ? 0 : 1;
+    }
+
+    pass = (missing == 0) && (count == slaves) && (probes > 0) && (seconds * 1000.0 <= limit_ms);
+    printf("found %u of %u, scan %.1f s, %u probes, %.1f ms per probe (limit %.1f ms, %.1f s)\n", count, slaves, seconds,
+           probes, (probes > 0) ? seconds * 1000.0 / probes : 0.0, probe_ms, limit_ms / 1000.0);
+    printf("discovery: %s\n", pass ? "pass" : "FAIL");
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,356 @@
+/*
+ *  frame_bench.c
+ *
+ *  Created on: Mar 17, 2022
+ *
+ *  Host check and throughput of the 0x68 frame parser in src/modbus_api/modbus_frame.c. Each stream is
+ *  fed whole, byte by byte and split in two chunks at every offset, the result and the frame must not
+ *  depend on how the bytes come. Streams cover FE preamble, noise before the frame, false headers, a
+ *  frame buffered in a frame that does not fit and found again on resync, bad check sum, error flag
+ *  replies and lengths over the buffer. Throughput is measured over a recorded stream of replies fed
+ *  in chunks of the size the receive path reads.
+ *
+ *  Build: gcc -O2 -Wall -I../uart_shim -I../../src/modbus_api -o frame_bench frame_bench.c ../../src/modbus_api/modbus_frame.c
+ *  Run:   ./frame_bench
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "modbus_command.h"
+#include "modbus_frame.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define BENCH_MAX_SIZE                                256   /* MODBUS_COMMAND_MAX_SIZE */
+#define BENCH_STREAM_SIZE                             512
+#define BENCH_CHUNK_SIZE                              32    /* MODBUS_RX_CHUNK_SIZE of modbus_command.c */
+#define BENCH_RECORD_FRAMES                           20000
+#define BENCH_RECORD_SIZE                             (BENCH_RECORD_FRAMES * 64)
+#define BENCH_MIN_TIME                                0.5   /* Second */
+
+/*!
+ * @brief  Byte stream and the frame expected from it
+ */
+typedef struct {
+    const char *name;
+    uint8_t stream[BENCH_STREAM_SIZE];
+    uint16_t length;
+    uint16_t max_size;
+    modbus_frame_result_t expect;
+    uint8_t frame[BENCH_MAX_SIZE];                    /* Without preamble */
+    uint16_t frame_size;
+} bench_stream_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static const uint8_t bench_address[6] = {0x01, 0x00, 0x00, 0x00, 0x00, 0x00};
+static const char *result_name[] = {"INCOMPLETE", "COMPLETE", "ERROR_CODE", "CHECKSUM_ERROR", "RESYNC"};
+static uint32_t failures;
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static uint16_t bench_frame(uint8_t *out, uint8_t control, uint8_t length, uint8_t seed, bool bad_sum)
+{
+    uint16_t size = 0;
+    uint8_t sum = 0;
+
+    out[size++] = MODBUS_START_BYTE;
+    memcpy(&out[size], bench_address, 6);
+    size += 6;
+    out[size++] = MODBUS_START_BYTE;
+    out[size++] = control;
+    out[size++] = length;
+    for(uint8_t i = 0; i < length; i++)
+    {
+        out[size++] = (uint8_t) (seed + i * 7) + MODBUS_DATA_ADD_BYTE;
+    }
+    for(uint16_t i = 0; i < size; i++)
+    {
+        sum += out[i];
+    }
+    out[size++] = sum ^ (bad_sum ? 0x01 : 0);
+    out[size++] = MODBUS_END_BYTE;
+    return size;
+}
+
+static void bench_append(bench_stream_t *s, const uint8_t *data, uint16_t length)
+{
+    memcpy(&s->stream[s->length], data, length);
+    s->length += length;
+}
+
+static void bench_expect(bench_stream_t *s, modbus_frame_result_t expect, const uint8_t *frame, uint16_t size)
+{
+    s->expect = expect;
+    memcpy(s->frame, frame, size);
+    s->frame_size = size;
+}
+
+/* Feed in chunks split at "splits", stop at the first frame end */
+static modbus_frame_result_t bench_feed(const bench_stream_t *s, const uint16_t *splits, uint16_t count, uint8_t *frame, uint16_t *size)
+{
+    modbus_frame_parser_t parser;
+    modbus_frame_result_t result = MODBUS_FRAME_INCOMPLETE;
+    uint16_t start = 0;
+    uint16_t used;
+
+    modbus_frame_init(&parser, frame, s->max_size);
+    for(uint16_t i = 0; (i <= count) && (result == MODBUS_FRAME_INCOMPLETE); i++)
+    {
+        uint16_t end = (i < count) ? splits[i] : s->length;
+
+        result = modbus_frame_feed_buffer(&parser, &s->stream[start], end - start, &used);
+        start = end;
+    }
+    *size = parser.size;
+    return result;
+}
+
+static bool bench_match(const bench_stream_t *s, modbus_frame_result_t result, const uint8_t *frame, uint16_t size)
+{
+    if(result != s->expect)
+    {
+        return false;
+    }
+    return (result == MODBUS_FRAME_INCOMPLETE) || ((size == s->frame_size) && (memcmp(frame, s->frame, size) == 0));
+}
+
+static void bench_check(const bench_stream_t *s)
+{
+    uint8_t frame[BENCH_MAX_SIZE];
+    uint16_t splits[BENCH_STREAM_SIZE] = {0};
+    modbus_frame_result_t result, whole;
+    uint16_t size;
+    bool ok;
+
+    /* Whole */
+    whole = bench_feed(s, NULL, 0, frame, &size);
+    ok = bench_match(s, whole, frame, size);
+
+    /* Byte by byte */
+    for(uint16_t i = 0; i < s->length; i++)
+    {
+        splits[i] = i + 1;
+    }
+    result = bench_feed(s, splits, s->length, frame, &size);
+    ok = ok && bench_match(s, result, frame, size);
+
+    /* Two chunks, every offset */
+    for(uint16_t i = 0; ok && (i <= s->length); i++)
+    {
+        splits[0] = i;
+        result = bench_feed(s, splits, 1, frame, &size);
+        ok = bench_match(s, result, frame, size);
+    }
+
+    printf("%-28s %5u %16s %16s  %s\n", s->name, s->length, result_name[s->expect], result_name[whole], ok ? "pass" : "FAIL");
+    failures += ok ? 0 : 1;
+}
+
+static void bench_units(void)
+{
+    static const uint8_t preamble[4] = {0xFE, 0xFE, 0xFE, 0xFE};
+    static const uint8_t noise[5] = {0x00, 0x11, 0xFE, 0x93, 0x16};
+    static const uint8_t false_header[3] = {MODBUS_START_BYTE, 0x01, 0x02};
+    bench_stream_t s;
+    uint8_t frame[BENCH_MAX_SIZE];
+    uint8_t other[BENCH_MAX_SIZE];
+    uint8_t header[10];
+    uint16_t size, other_size;
+
+    printf("%-28s %5s %16s %16s\n", "", "bytes", "expected", "result");
+    size = bench_frame(frame, MODBUS_READ_RESPONSE_BYTE, 22, 0x10, false);
+
+    memset(&s, 0, sizeof(s));
+    s.name = "frame";
+    s.max_size = BENCH_MAX_SIZE;
+    bench_append(&s, frame, size);
+    bench_expect(&s, MODBUS_FRAME_COMPLETE, frame, size);
+    bench_check(&s);
+
+    memset(&s, 0, sizeof(s));
+    s.name = "FE preamble";
+    s.max_size = BENCH_MAX_SIZE;
+    bench_append(&s, preamble, sizeof(preamble));
+    bench_append(&s, frame, size);
+    bench_expect(&s, MODBUS_FRAME_COMPLETE, frame, size);
+    bench_check(&s);
+
+    memset(&s, 0, sizeof(s));
+    s.name = "noise then frame";
+    s.max_size = BENCH_MAX_SIZE;
+    bench_append(&s, noise, sizeof(noise));
+    bench_append(&s, preamble, 2);
+    bench_append(&s, frame, size);
+    bench_expect(&s, MODBUS_FRAME_COMPLETE, frame, size);
+    bench_check(&s);
+
+    memset(&s, 0, sizeof(s));
+    s.name = "false 0x68 header";
+    s.max_size = BENCH_MAX_SIZE;
+    bench_append(&s, false_header, sizeof(false_header));
+    bench_append(&s, frame, size);
+    bench_expect(&s, MODBUS_FRAME_COMPLETE, frame, size);
+    bench_check(&s);
+
+    /* Header whose length covers the next frame but its check sum: the end byte does not fit and the
+     * frame inside is found when the buffered bytes are parsed again */
+    memset(&s, 0, sizeof(s));
+    s.name = "frame inside a bad frame";
+    s.max_size = BENCH_MAX_SIZE;
+    memcpy(header, (const uint8_t[]){MODBUS_START_BYTE, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, MODBUS_START_BYTE, 0x81, 0}, 10);
+    header[MODBUS_FRAME_LENGTH_INDEX] = size - 1;
+    bench_append(&s, header, sizeof(header));
+    bench_append(&s, frame, size);
+    bench_append(&s, (const uint8_t[]){0x00, 0x55}, 2);
+    bench_expect(&s, MODBUS_FRAME_COMPLETE, frame, size);
+    bench_check(&s);
+
+    memset(&s, 0, sizeof(s));
+    s.name = "  with a bad check sum";
+    s.max_size = BENCH_MAX_SIZE;
+    other_size = bench_frame(other, MODBUS_READ_RESPONSE_BYTE, 22, 0x10, true);
+    bench_append(&s, header, sizeof(header));
+    bench_append(&s, other, other_size);
+    bench_append(&s, (const uint8_t[]){0x00, 0x55}, 2);
+    bench_expect(&s, MODBUS_FRAME_CHECKSUM_ERROR, other, other_size);
+    bench_check(&s);
+
+    memset(&s, 0, sizeof(s));
+    s.name = "bad check sum";
+    s.max_size = BENCH_MAX_SIZE;
+    bench_append(&s, preamble, sizeof(preamble));
+    bench_append(&s, other, other_size);
+    bench_expect(&s, MODBUS_FRAME_CHECKSUM_ERROR, other, other_size);
+    bench_check(&s);
+
+    memset(&s, 0, sizeof(s));
+    s.name = "error flag reply";
+    s.max_size = BENCH_MAX_SIZE;
+    other_size = bench_frame(other, MODBUS_READ_RESPONSE_BYTE | MODBUS_ERROR_FLAG, 1, 0x02, false);
+    bench_append(&s, preamble, sizeof(preamble));
+    bench_append(&s, other, other_size);
+    bench_expect(&s, MODBUS_FRAME_ERROR_CODE, other, other_size);
+    bench_check(&s);
+
+    memset(&s, 0, sizeof(s));
+    s.name = "no data, write reply";
+    s.max_size = BENCH_MAX_SIZE;
+    other_size = bench_frame(other, MODBUS_WRITE_RESPONSE_BYTE, 0, 0, false);
+    bench_append(&s, other, other_size);
+    bench_expect(&s, MODBUS_FRAME_COMPLETE, other, other_size);
+    bench_check(&s);
+
+    memset(&s, 0, sizeof(s));
+    s.name = "length over the buffer";
+    s.max_size = 64;
+    other_size = bench_frame(other, MODBUS_READ_RESPONSE_BYTE, 60, 0x20, false);
+    bench_append(&s, other, other_size);
+    bench_append(&s, frame, size);
+    bench_expect(&s, MODBUS_FRAME_COMPLETE, frame, size);
+    bench_check(&s);
+
+    memset(&s, 0, sizeof(s));
+    s.name = "wrong end byte, then frame";
+    s.max_size = BENCH_MAX_SIZE;
+    bench_append(&s, frame, size - 1);
+    bench_append(&s, (const uint8_t[]){0x00}, 1);
+    bench_append(&s, frame, size);
+    bench_expect(&s, MODBUS_FRAME_COMPLETE, frame, size);
+    bench_check(&s);
+
+    memset(&s, 0, sizeof(s));
+    s.name = "truncated";
+    s.max_size = BENCH_MAX_SIZE;
+    bench_append(&s, preamble, sizeof(preamble));
+    bench_append(&s, frame, size - 3);
+    bench_expect(&s, MODBUS_FRAME_INCOMPLETE, frame, 0);
+    bench_check(&s);
+}
+
+/* Replies as recorded on a bus: preamble of 0 to 4 FE, one in 16 after noise, data of 2 to 41 bytes */
+static uint32_t bench_record(uint8_t *record, uint32_t *frames)
+{
+    uint32_t length = 0;
+
+    srand(7);
+    *frames = 0;
+    while(length + 64 <= BENCH_RECORD_SIZE)
+    {
+        if((rand() % 16) == 0)
+        {
+            record[length++] = 0x00;
+            record[length++] = MODBUS_START_BYTE;
+            record[length++] = 0x22;
+        }
+        for(int i = rand() % 5; i > 0; i--)
+        {
+            record[length++] = MODBUS_FRAME_PREAMBLE_BYTE;
+        }
+        length += bench_frame(&record[length], MODBUS_READ_RESPONSE_BYTE, 2 + rand() % 40, rand(), false);
+        (*frames)++;
+    }
+    return length;
+}
+
+static void bench_throughput(void)
+{
+    static uint8_t record[BENCH_RECORD_SIZE];
+    uint8_t frame[BENCH_MAX_SIZE];
+    modbus_frame_parser_t parser;
+    uint32_t length, frames, found = 0, rounds = 0;
+    uint16_t used, chunk;
+    struct timespec t0, t1;
+    double seconds;
+
+    length = bench_record(record, &frames);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    do
+    {
+        found = 0;
+        modbus_frame_init(&parser, frame, BENCH_MAX_SIZE);
+        for(uint32_t i = 0; i < length; i += chunk)
+        {
+            chunk = (length - i < BENCH_CHUNK_SIZE) ? length - i : BENCH_CHUNK_SIZE;
+            for(uint16_t j = 0; j < chunk; j += used)
+            {
+                if(modbus_frame_feed_buffer(&parser, &record[i + j], chunk - j, &used) == MODBUS_FRAME_COMPLETE)
+                {
+                    found++;
+                }
+            }
+        }
+        rounds++;
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    } while(seconds < BENCH_MIN_TIME);
+
+    printf("recorded stream: %u bytes, %u frames, %u found, %.1f MB/s, %.2f M frames/s, %.1f ns/byte  %s\n",
+           length, frames, found, (double) length * rounds / seconds / 1e6, (double) frames * rounds / seconds / 1e6,
+           seconds * 1e9 / ((double) length * rounds), (found == frames) ? "pass" : "FAIL");
+    failures += (found == frames) ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+    bench_units();
+    bench_throughput();
+    printf("frame parser: %s\n", (failures == 0) ? "pass" : "FAIL");
+    return (failures == 0) ? 0 : 1;
+}
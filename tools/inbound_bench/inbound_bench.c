@@ -0,0 +1,357 @@
+/*
+ *  inbound_bench.c
+ *
+ *  Created on: Mar 07, 2022
+ *
+ *  Bulk configuration push through the inbound MQTT path. A client thread hands out each message in
+ *  chunks of the client buffer, as MQTT_EVENT_DATA does, a message thread runs the handler.
+ *  Former path: each chunk is copied into a queue item and handled as a message of its own, the
+ *  message task sleeps 100 ms after each one. Pooled path: chunks are reassembled by offset with
+ *  src/mqtt_api/mqtt_inbound.c into pooled buffers, only pointers are queued, the message task
+ *  drains the queue. The handler checks each payload against the one sent.
+ *
+ *  Build: gcc -O2 -Wall -pthread -I../../src/mqtt_api -o inbound_bench inbound_bench.c ../../src/mqtt_api/mqtt_inbound.c
+ *  Run:   ./inbound_bench [messages]
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "mqtt_inbound.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+/* As src/config.h and the ESP-IDF client */
+#define MQTT_TOPIC_MAX_LENGTH                         128
+#define MQTT_DATA_MAX_LENGTH                          1024
+#define MQTT_MESSAGE_QUEUE_SIZE                       4
+#define MQTT_MESSAGE_MAX_LENGTH                       4096
+#define MQTT_QUEUE_MAX_DELAY_MS                       200
+#define MQTT_CLIENT_BUFFER_SIZE                       1024  /* Chunk of MQTT_EVENT_DATA */
+#define FORMER_SLEEP_MS                               100
+
+#define BENCH_MESSAGES                                40
+#define BENCH_TOPIC                                   "Config"
+
+/*!
+ * @brief  Queue of fixed size items, as a FreeRTOS queue
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint8_t *item;
+    uint32_t item_size;
+    uint32_t size;
+    uint32_t head;
+    uint32_t count;
+} bench_queue_t;
+
+/*!
+ * @brief  Former queue item
+ */
+typedef struct {
+    char message[MQTT_DATA_MAX_LENGTH];
+    char topic[MQTT_TOPIC_MAX_LENGTH];
+} former_message_t;
+
+/*!
+ * @brief  Result of a run
+ */
+typedef struct {
+    uint32_t handled;                                 /* Handler calls */
+    uint32_t intact;                                  /* Of them, with a whole and exact payload */
+    uint32_t dropped;
+    uint32_t elapsed_ms;
+} bench_result_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static uint32_t bench_count = BENCH_MESSAGES;
+static char **bench_payload;
+static uint32_t *bench_length;
+static bench_result_t bench_result;
+static volatile bool bench_done;
+
+static bench_queue_t message_queue;
+static bench_queue_t free_queue;
+static uint8_t message_queue_item[MQTT_MESSAGE_QUEUE_SIZE * sizeof(former_message_t)];
+static uint8_t free_queue_item[MQTT_MESSAGE_QUEUE_SIZE * sizeof(mqtt_inbound_t*)];
+
+static mqtt_inbound_t pool[MQTT_MESSAGE_QUEUE_SIZE];
+static char pool_topic[MQTT_MESSAGE_QUEUE_SIZE][MQTT_TOPIC_MAX_LENGTH];
+static char pool_data[MQTT_MESSAGE_QUEUE_SIZE][MQTT_MESSAGE_MAX_LENGTH + 1];
+static mqtt_inbound_t *partial;
+static mqtt_inbound_stats_t inbound_stats;
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static uint32_t bench_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) (ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static void bench_queue_init(bench_queue_t *queue, uint8_t *item, uint32_t item_size, uint32_t size)
+{
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->cond, NULL);
+    queue->item = item;
+    queue->item_size = item_size;
+    queue->size = size;
+    queue->head = 0;
+    queue->count = 0;
+}
+
+/* xQueueSend() and xQueueReceive(), wait in ms */
+static bool bench_queue_op(bench_queue_t *queue, void *item, bool send, uint32_t wait_ms)
+{
+    struct timespec ts;
+    bool done = false;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += wait_ms / 1000;
+    ts.tv_nsec += (wait_ms % 1000) * 1000000L;
+    if(ts.tv_nsec >= 1000000000L)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock(&queue->lock);
+    while((send ? (queue->count == queue->size) : (queue->count == 0)) &&
+          (pthread_cond_timedwait(&queue->cond, &queue->lock, &ts) == 0))
+    {
+    }
+    if(send && (queue->count < queue->size))
+    {
+        memcpy(&queue->item[((queue->head + queue->count) % queue->size) * queue->item_size], item, queue->item_size);
+        queue->count++;
+        done = true;
+    }
+    else if(!send && (queue->count > 0))
+    {
+        memcpy(item, &queue->item[queue->head * queue->item_size], queue->item_size);
+        queue->head = (queue->head + 1) % queue->size;
+        queue->count--;
+        done = true;
+    }
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+    return done;
+}
+
+/* Config handler: the payload must be the one sent */
+static void bench_handler(const char *data, uint32_t length)
+{
+    bench_result.handled++;
+    for(uint32_t i = 0; i < bench_count; i++)
+    {
+        if((length == bench_length[i]) && (memcmp(data, bench_payload[i], length) == 0))
+        {
+            bench_result.intact++;
+            return;
+        }
+    }
+}
+
+/******************************************************************************/
+
+/* Former MQTT_EVENT_DATA: each chunk is a message */
+static void former_event(const char *topic, uint32_t topic_length, const char *data, uint32_t length)
+{
+    former_message_t message;
+
+    if((length > 0) && (topic_length > 0))
+    {
+        sprintf(message.message, "%.*s", (int) length, data);
+        sprintf(message.topic, "%.*s", (int) topic_length, topic);
+        if(!bench_queue_op(&message_queue, &message, true, MQTT_QUEUE_MAX_DELAY_MS))
+        {
+            bench_result.dropped++;
+        }
+    }
+}
+
+static void* former_task(void *arg)
+{
+    former_message_t message;
+
+    while(!bench_done || (message_queue.count > 0))
+    {
+        if(bench_queue_op(&message_queue, &message, false, 10))
+        {
+            if(strncmp(message.topic, BENCH_TOPIC, strlen(BENCH_TOPIC)) == 0)
+            {
+                bench_handler(message.message, strlen(message.message));
+            }
+            struct timespec ts = { 0, FORMER_SLEEP_MS * 1000000L };
+            nanosleep(&ts, NULL);
+        }
+    }
+    return NULL;
+}
+
+/* As mqtt_message_receive() */
+static void pooled_event(const char *topic, uint32_t topic_length, const char *data, uint32_t length, uint32_t offset,
+                         uint32_t total)
+{
+    mqtt_inbound_result_t result;
+
+    if(offset == 0)
+    {
+        if(!bench_queue_op(&free_queue, &partial, false, 0))
+        {
+            partial = NULL;
+            inbound_stats.overflow++;
+            bench_result.dropped++;
+            return;
+        }
+        if(length < total)
+        {
+            inbound_stats.fragmented++;
+        }
+    }
+    if(partial == NULL)
+    {
+        return;
+    }
+    result = mqtt_inbound_chunk(partial, topic, topic_length, data, length, offset, total);
+    if(result == MQTT_INBOUND_PART)
+    {
+        return;
+    }
+    if(result == MQTT_INBOUND_DONE)
+    {
+        bench_queue_op(&message_queue, &partial, true, 0);
+        inbound_stats.received++;
+    }
+    else
+    {
+        bench_result.dropped++;
+        bench_queue_op(&free_queue, &partial, true, 0);
+    }
+    partial = NULL;
+}
+
+/* As mqtt_handle_message_task() */
+static void* pooled_task(void *arg)
+{
+    mqtt_inbound_t *message;
+
+    while(!bench_done || (message_queue.count > 0))
+    {
+        if(bench_queue_op(&message_queue, &message, false, 10))
+        {
+            do
+            {
+                if(strcmp(message->topic, BENCH_TOPIC) == 0)
+                {
+                    bench_handler(message->data, message->length);
+                }
+                bench_queue_op(&free_queue, &message, true, 0);
+            } while(bench_queue_op(&message_queue, &message, false, 0));
+        }
+    }
+    return NULL;
+}
+
+static void bench_run(bool pooled)
+{
+    pthread_t task;
+    uint32_t start;
+
+    memset(&bench_result, 0, sizeof(bench_result));
+    memset(&inbound_stats, 0, sizeof(inbound_stats));
+    bench_done = false;
+    if(pooled)
+    {
+        bench_queue_init(&message_queue, message_queue_item, sizeof(mqtt_inbound_t*), MQTT_MESSAGE_QUEUE_SIZE);
+        bench_queue_init(&free_queue, free_queue_item, sizeof(mqtt_inbound_t*), MQTT_MESSAGE_QUEUE_SIZE);
+        for(uint32_t i = 0; i < MQTT_MESSAGE_QUEUE_SIZE; i++)
+        {
+            mqtt_inbound_t *message = &pool[i];
+            mqtt_inbound_init(message, pool_topic[i], MQTT_TOPIC_MAX_LENGTH, pool_data[i], MQTT_MESSAGE_MAX_LENGTH + 1);
+            bench_queue_op(&free_queue, &message, true, 0);
+        }
+    }
+    else
+    {
+        bench_queue_init(&message_queue, message_queue_item, sizeof(former_message_t), MQTT_MESSAGE_QUEUE_SIZE);
+    }
+
+    start = bench_time_ms();
+    pthread_create(&task, NULL, pooled ? pooled_task : former_task, NULL);
+    for(uint32_t i = 0; i < bench_count; i++)
+    {
+        /* The client gives the topic with the first chunk only */
+        for(uint32_t offset = 0; offset < bench_length[i]; offset += MQTT_CLIENT_BUFFER_SIZE)
+        {
+            uint32_t length = bench_length[i] - offset;
+            uint32_t topic_length = (offset == 0) ? strlen(BENCH_TOPIC) : 0;
+            if(length > MQTT_CLIENT_BUFFER_SIZE)
+            {
+                length = MQTT_CLIENT_BUFFER_SIZE;
+            }
+            if(pooled)
+            {
+                pooled_event(BENCH_TOPIC, topic_length, &bench_payload[i][offset], length, offset, bench_length[i]);
+            }
+            else
+            {
+                former_event(BENCH_TOPIC, topic_length, &bench_payload[i][offset], length);
+            }
+        }
+    }
+    bench_done = true;
+    pthread_join(task, NULL);
+    bench_result.elapsed_ms = bench_time_ms() - start;
+
+    printf("%-8s %9u %9u %9u %9u %10u\n", pooled ? "pooled" : "former", bench_count, bench_result.handled,
+           bench_result.intact, bench_result.dropped, bench_result.elapsed_ms);
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc > 1)
+    {
+        bench_count = atoi(argv[1]);
+    }
+    bench_payload = calloc(bench_count, sizeof(char*));
+    bench_length = calloc(bench_count, sizeof(uint32_t));
+    srand(1);
+    for(uint32_t i = 0; i < bench_count; i++)
+    {
+        /* Small commands and slave lists up to 3 chunks */
+        bench_length[i] = (i % 4 == 0) ? 2500 + rand() % 500 : 40 + rand() % 200;
+        bench_payload[i] = malloc(bench_length[i] + 1);
+        uint32_t n = snprintf(bench_payload[i], bench_length[i] + 1, "{\"cmd\":%u,\"slaves\":[", i);
+        for(; n < bench_length[i]; n++)
+        {
+            bench_payload[i][n] = '0' + (n + i) % 10;
+        }
+        bench_payload[i][n] = '\0';
+    }
+
+    printf("%u config messages, client chunk %d bytes\n", bench_count, MQTT_CLIENT_BUFFER_SIZE);
+    printf("%-8s %9s %9s %9s %9s %10s\n", "", "sent", "handled", "intact", "dropped", "time ms");
+    bench_run(false);
+    bench_run(true);
+    printf("pooled: %u fragmented, %u overflow\n", inbound_stats.fragmented, inbound_stats.overflow);
+    return 0;
+}
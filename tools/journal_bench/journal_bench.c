@@ -0,0 +1,204 @@
+/*
+ *  journal_bench.c
+ *
+ *  Created on: Feb 08, 2022
+ *
+ *  Host check of the reading journal on an emulated NOR flash (write clears bits, erase sets 0xFF).
+ *  Appends records of a long outage, reopens the journal as after a reset, replays and checks
+ *  order and contents, then reports throughput and flash statistics.
+ *
+ *  Build: gcc -O2 -Wall -I../../src -o journal_bench journal_bench.c ../../src/journal/journal.c ../../src/utility/utility.c
+ *  Run:   ./journal_bench -s 512 -n 20000 -r 120
+ *
+ *  Options:
+ *    -s kbyte       Journal size (default 512, the journal partition)
+ *    -n count       Records appended (default 20000)
+ *    -r bytes       Record length (default 120, a reading in compact form)
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "journal/journal.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define BENCH_SECTOR_SIZE                             4096
+#define BENCH_RECORD_MAX_SIZE                         1024
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static uint8_t *flash_memory;
+static uint32_t flash_size;
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static bool flash_read(void *ctx, uint32_t offset, void *data, uint32_t size)
+{
+    if(offset + size > flash_size)
+    {
+        return false;
+    }
+    memcpy(data, &flash_memory[offset], size);
+    return true;
+}
+
+static bool flash_write(void *ctx, uint32_t offset, const void *data, uint32_t size)
+{
+    const uint8_t *src = (const uint8_t*) data;
+
+    if(offset + size > flash_size)
+    {
+        return false;
+    }
+    for(uint32_t i = 0; i < size; i++)
+    {
+        flash_memory[offset + i] &= src[i];
+    }
+    return true;
+}
+
+static bool flash_erase(void *ctx, uint32_t offset, uint32_t size)
+{
+    if((offset % BENCH_SECTOR_SIZE) || (size % BENCH_SECTOR_SIZE) || (offset + size > flash_size))
+    {
+        return false;
+    }
+    memset(&flash_memory[offset], 0xFF, size);
+    return true;
+}
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Record "seq" is filled from its sequence number */
+static void record_fill(uint8_t *data, uint16_t length, uint32_t seq)
+{
+    for(uint16_t i = 0; i < length; i++)
+    {
+        data[i] = (uint8_t) (seq * 31 + i);
+    }
+    memcpy(data, &seq, sizeof(seq));
+}
+
+int main(int argc, char **argv)
+{
+    journal_flash_t flash = {
+        .read = flash_read,
+        .write = flash_write,
+        .erase = flash_erase,
+        .sector_size = BENCH_SECTOR_SIZE,
+    };
+    journal_t journal;
+    journal_stats_t stats;
+    uint8_t data[BENCH_RECORD_MAX_SIZE], expect[BENCH_RECORD_MAX_SIZE];
+    uint32_t count = 20000, length = 120, seq, first, replayed = 0, errors = 0;
+    double start, append_us, replay_us;
+    int opt;
+
+    flash_size = 512 * 1024;
+    while((opt = getopt(argc, argv, "s:n:r:")) != -1)
+    {
+        switch(opt)
+        {
+        case 's': flash_size = atoi(optarg) * 1024; break;
+        case 'n': count = atoi(optarg); break;
+        case 'r': length = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-s kbyte] [-n count] [-r bytes]\n", argv[0]);
+            return 1;
+        }
+    }
+    if((length < sizeof(seq)) || (length > BENCH_RECORD_MAX_SIZE))
+    {
+        fprintf(stderr, "Record length must be %u to %u\n", (unsigned) sizeof(seq), BENCH_RECORD_MAX_SIZE);
+        return 1;
+    }
+
+    flash_memory = malloc(flash_size);
+    memset(flash_memory, 0xFF, flash_size);
+    flash.size = flash_size;
+    if(!journal_init(&journal, &flash))
+    {
+        fprintf(stderr, "Journal init fail\n");
+        return 1;
+    }
+
+    /* Outage: append everything */
+    start = now_us();
+    for(seq = 0; seq < count; seq++)
+    {
+        record_fill(data, length, seq);
+        if(!journal_append(&journal, data, length))
+        {
+            fprintf(stderr, "Append %u fail\n", seq);
+            return 1;
+        }
+    }
+    append_us = now_us() - start;
+    journal_get_stats(&journal, &stats);
+    printf("Append:  %u records of %u bytes, %.0f records/s, %u pending, %u dropped, %u erases\n",
+           count, length, count / (append_us / 1e6), journal_pending(&journal), stats.dropped, stats.erased);
+
+    /* Reset: reopen, the same records must be pending */
+    seq = journal_pending(&journal);
+    if(!journal_init(&journal, &flash) || (journal_pending(&journal) != seq))
+    {
+        printf("Reopen:  FAIL, %u pending before, %u after\n", seq, journal_pending(&journal));
+        errors++;
+    }
+
+    /* Uplink back: replay half, reopen, replay the rest */
+    first = count - journal_pending(&journal);
+    start = now_us();
+    for(uint32_t pass = 0; pass < 2; pass++)
+    {
+        uint32_t limit = (pass == 0) ? journal_pending(&journal) / 2 : journal_pending(&journal);
+        for(uint32_t i = 0; i < limit; i++)
+        {
+            uint16_t size = journal_peek(&journal, data, sizeof(data));
+            record_fill(expect, length, first + replayed);
+            if((size != length) || (memcmp(data, expect, length) != 0))
+            {
+                if(errors++ < 5)
+                {
+                    printf("Replay:  record %u mismatch\n", first + replayed);
+                }
+            }
+            journal_mark_sent(&journal);
+            replayed++;
+        }
+        if(pass == 0)
+        {
+            journal_init(&journal, &flash);
+        }
+    }
+    replay_us = now_us() - start;
+    journal_get_stats(&journal, &stats);
+    printf("Replay:  %u records, %.0f records/s, %u pending, %u corrupted\n",
+           replayed, replayed / (replay_us / 1e6), journal_pending(&journal), stats.corrupted);
+    printf("Result:  %s\n", (errors == 0) && (journal_pending(&journal) == 0) ? "OK" : "FAIL");
+
+    free(flash_memory);
+    return (errors == 0) ? 0 : 1;
+}
@@ -0,0 +1,218 @@
+/*
+ *  json_bench.c
+ *
+ *  Created on: Feb 21, 2022
+ *
+ *  Host check and benchmark of the streaming json writer in src/utility/json_writer.c.
+ *  A water meter reading with every register is written in the firmware schema, checked against
+ *  the expected text, then written in a loop to measure bytes/s and heap allocations.
+ *  With JSON_BENCH_CJSON the same reading is also built with cJSON (DOM, then cJSON_Print as the
+ *  firmware did before) for comparison.
+ *
+ *  Build: gcc -O2 -Wall -I../../src -I../../src/modbus_api -o json_bench json_bench.c ../../src/utility/json_writer.c -lm
+ *  With cJSON from ESP-IDF:
+ *         gcc -O2 -Wall -DJSON_BENCH_CJSON -I../../src -I../../src/modbus_api -I$IDF_PATH/components/json/cJSON \
+ *             -o json_bench json_bench.c ../../src/utility/json_writer.c $IDF_PATH/components/json/cJSON/cJSON.c -lm
+ *  Run:   ./json_bench
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "utility/json_writer.h"
+#include "modbus_table.h"
+#ifdef JSON_BENCH_CJSON
+#include <cJSON.h>
+#endif
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define BENCH_ROUNDS                                  100000
+#define BENCH_BUFFER_SIZE                             4096
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static const struct {
+    const char *name;
+    uint16_t address;
+} bench_reg[] = {
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence) { #name, address },
+    MODBUS_WATER_INPUT_REGS
+#undef XTABLE_ITEM
+};
+
+static uint64_t bench_allocs;
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+/* Count heap allocations of the process */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+
+void *malloc(size_t size)
+{
+    bench_allocs++;
+    return __libc_malloc(size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    bench_allocs++;
+    return __libc_realloc(ptr, size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    bench_allocs++;
+    return __libc_calloc(count, size);
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Reading in the firmware schema, register i has value i * 1000 - 5000 */
+static uint32_t bench_writer(char *buffer, uint32_t size, uint32_t time)
+{
+    json_writer_t writer;
+    char addr_str[8];
+
+    json_writer_init(&writer, buffer, size);
+    json_writer_object_begin(&writer, NULL);
+    json_writer_string(&writer, "meter", "water");
+    json_writer_uint(&writer, "bus", 0);
+    json_writer_uint(&writer, "time", time);
+    json_writer_uint(&writer, "slave", 1);
+    json_writer_array_begin(&writer, "regs");
+    for(uint32_t i = 0; i < MB_WATER_NUMBER_OF_REG; i++)
+    {
+        json_writer_object_begin(&writer, NULL);
+        json_writer_string(&writer, "key", bench_reg[i].name);
+        sprintf(addr_str, "0x%04X", bench_reg[i].address);
+        json_writer_string(&writer, "address", addr_str);
+        json_writer_int(&writer, "value", (int32_t) i * 1000 - 5000);
+        json_writer_object_end(&writer);
+    }
+    json_writer_array_end(&writer);
+    json_writer_object_end(&writer);
+    return json_writer_finish(&writer);
+}
+
+#ifdef JSON_BENCH_CJSON
+static uint32_t bench_cjson(uint32_t time)
+{
+    char addr_str[8];
+    cJSON *root = cJSON_CreateObject();
+
+    cJSON_AddStringToObject(root, "meter", "water");
+    cJSON_AddNumberToObject(root, "bus", 0);
+    cJSON_AddNumberToObject(root, "time", time);
+    cJSON_AddNumberToObject(root, "slave", 1);
+    cJSON *regs = cJSON_AddArrayToObject(root, "regs");
+    for(uint32_t i = 0; i < MB_WATER_NUMBER_OF_REG; i++)
+    {
+        cJSON *object = cJSON_CreateObject();
+        cJSON_AddStringToObject(object, "key", bench_reg[i].name);
+        sprintf(addr_str, "0x%04X", bench_reg[i].address);
+        cJSON_AddStringToObject(object, "address", addr_str);
+        cJSON_AddNumberToObject(object, "value", (int32_t) i * 1000 - 5000);
+        cJSON_AddItemToArray(regs, object);
+    }
+    char *text = cJSON_Print(root);
+    uint32_t length = strlen(text);
+    cJSON_Delete(root);
+    free(text);
+    return length;
+}
+#endif
+
+static void bench_report(const char *name, uint64_t bytes, double seconds, uint64_t allocs)
+{
+    printf("%-8s %8.1f MB/s %10.0f readings/s %8.1f allocations/reading %8.0f bytes/reading\n", name,
+           bytes / seconds / 1e6, BENCH_ROUNDS / seconds, (double) allocs / BENCH_ROUNDS, (double) bytes / BENCH_ROUNDS);
+}
+
+int main(void)
+{
+    static char buffer[BENCH_BUFFER_SIZE];
+    json_writer_t writer;
+    uint32_t errors = 0, length;
+    uint64_t bytes = 0, allocs;
+    double start;
+
+    /* Escapes, numbers, nesting, float and overflow */
+    json_writer_init(&writer, buffer, sizeof(buffer));
+    json_writer_object_begin(&writer, NULL);
+    json_writer_string(&writer, "s", "a\"b\\c\n\x01");
+    json_writer_int(&writer, "min", INT32_MIN);
+    json_writer_uint(&writer, "max", UINT32_MAX);
+    json_writer_array_begin(&writer, "f");
+    json_writer_float(&writer, NULL, 1.5f);
+    json_writer_float(&writer, NULL, 0.0f / 0.0f);
+    json_writer_array_begin(&writer, NULL);
+    json_writer_array_end(&writer);
+    json_writer_array_end(&writer);
+    json_writer_object_end(&writer);
+    json_writer_finish(&writer);
+    if(strcmp(buffer, "{\"s\":\"a\\\"b\\\\c\\u000a\\u0001\",\"min\":-2147483648,\"max\":4294967295,\"f\":[1.5,null,[]]}") != 0)
+    {
+        printf("Writer: %s\n", buffer);
+        errors++;
+    }
+    length = bench_writer(buffer, sizeof(buffer), 1645401600);
+    for(uint32_t size = 0; size <= length; size++)
+    {
+        if(bench_writer(buffer, size, 1645401600) != 0)
+        {
+            printf("Overflow: not reported with %u bytes\n", size);
+            errors++;
+            break;
+        }
+    }
+    if((bench_writer(buffer, length + 1, 1645401600) != length) ||
+       (strncmp(buffer, "{\"meter\":\"water\",\"bus\":0,\"time\":1645401600,\"slave\":1,\"regs\":[{\"key\":\"power_receive_wh\",\"address\":\"0x0000\",\"value\":-5000},", 117) != 0))
+    {
+        printf("Reading: %.120s\n", buffer);
+        errors++;
+    }
+    printf("Conformance: %s, reading is %u bytes\n", (errors == 0) ? "OK" : "FAIL", length);
+
+    allocs = bench_allocs;
+    start = now_s();
+    for(uint32_t r = 0; r < BENCH_ROUNDS; r++)
+    {
+        bytes += bench_writer(buffer, sizeof(buffer), r);
+    }
+    bench_report("writer", bytes, now_s() - start, bench_allocs - allocs);
+
+#ifdef JSON_BENCH_CJSON
+    bytes = 0;
+    allocs = bench_allocs;
+    start = now_s();
+    for(uint32_t r = 0; r < BENCH_ROUNDS; r++)
+    {
+        bytes += bench_cjson(r);
+    }
+    bench_report("cJSON", bytes, now_s() - start, bench_allocs - allocs);
+#endif
+    return (errors == 0) ? 0 : 1;
+}
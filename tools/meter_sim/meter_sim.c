@@ -0,0 +1,715 @@
+/*
+ *  meter_sim.c
+ *
+ *  Created on: Jan 22, 2022
+ *
+ *  Meter simulator on a Linux pseudo-terminal, to load the firmware (or any master) without meters.
+ *  Modbus RTU slaves answer function 04 from MODBUS_WATER_INPUT_REGS and accept writes (06, 16),
+ *  0x68 meters answer the MODBUS_ELECTRIC_CMD commands with data bytes added MODBUS_DATA_ADD_BYTE
+ *  and accept write commands with the meter password.
+ *
+ *  Build: gcc -O2 -Wall -I../../src/modbus_api -o meter_sim meter_sim.c ../../src/modbus_api/modbus_table.c
+ *  Run:   ./meter_sim -p rtu -n 32 -d 5 -j 3 -c 1 -l 1 -s 7
+ *         then connect the master to the printed /dev/pts/N, Ctrl-C prints statistics
+ *
+ *  Options:
+ *    -p rtu|elec    Protocol (default rtu)
+ *    -n count       Number of slaves, Modbus id 1..count or meter address 01 00 00 00 00 00.. (default 2)
+ *    -a address     Add a meter address, 12 hex digits in wire order, e.g. 010203040506
+ *    -d ms          Response delay (default 0)
+ *    -j ms          Random jitter added to the delay (default 0)
+ *    -c percent     Responses sent with a corrupted CRC or check sum (default 0)
+ *    -l percent     Requests ignored at random (default 0)
+ *    -s id          Slave never answers, Modbus id or index of meter from 1 (repeatable)
+ *    -b baud        Emulate time on the wire of this baud rate (default 0, no wire time)
+ *    -f count       FE preamble bytes before 0x68 frames (default 0)
+ *    -w password    Password of 0x68 writes, 8 hex digits LSB first before adding 0x33 (default 00111111,
+ *                   33 44 44 44 on the wire). A write without it is answered with a password error
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include "modbus_table.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define SIM_MAX_SLAVE                                 247
+#define SIM_FRAME_MAX_SIZE                            512
+#define SIM_FRAME_GAP_MS                              5     /* Silence ending a request on the pty */
+
+#define SIM_READ_INPUT_FUNCTION                       0x04
+#define SIM_WRITE_REGISTER_FUNCTION                   0x06
+#define SIM_WRITE_MULTIPLE_FUNCTION                   0x10
+#define SIM_EXCEPTION_FLAG                            0x80
+#define SIM_EXCEPTION_ILLEGAL_FUNCTION                0x01
+#define SIM_EXCEPTION_ILLEGAL_ADDRESS                 0x02
+
+#define SIM_START_BYTE                                0x68
+#define SIM_END_BYTE                                  0x16
+#define SIM_DATA_ADD_BYTE                             0x33
+#define SIM_PREAMBLE_BYTE                             0xFE
+#define SIM_WILDCARD_BYTE                             0xAA
+#define SIM_BROADCAST_BYTE                            0x99
+#define SIM_READ_REQUEST_BYTE                         0x01
+#define SIM_READ_RESPONSE_BYTE                        0x81
+#define SIM_WRITE_REQUEST_BYTE                        0x04
+#define SIM_WRITE_RESPONSE_BYTE                       0x84
+#define SIM_ERROR_FLAG                                0x40
+#define SIM_ERROR_NO_DATA                             0x02
+#define SIM_ERROR_PASSWORD                            0x04
+#define SIM_PASSWORD_SIZE                             4
+
+typedef enum {
+    SIM_PROTOCOL_RTU = 0,
+    SIM_PROTOCOL_ELEC,
+} sim_protocol_t;
+
+typedef struct {
+    uint16_t address;
+    uint16_t size;
+} sim_item_t;
+
+typedef struct {
+    uint8_t address[6];                               /* Meter address, or Modbus id in address[0] */
+    bool silent;
+    uint32_t reads;                                   /* Changes register values between reads */
+} sim_slave_t;
+
+typedef struct {
+    sim_protocol_t protocol;
+    uint32_t delay_ms;
+    uint32_t jitter_ms;
+    uint32_t corrupt_percent;
+    uint32_t loss_percent;
+    uint32_t baudrate;
+    uint32_t preamble;
+    uint32_t num_slave;
+    sim_slave_t slave[SIM_MAX_SLAVE];
+    uint8_t password[SIM_PASSWORD_SIZE];              /* Of writes, before adding 0x33 */
+} sim_config_t;
+
+typedef struct {
+    uint64_t requests;
+    uint64_t responses;
+    uint64_t corrupted;
+    uint64_t lost;
+    uint64_t silent;
+    uint64_t collisions;
+    uint64_t writes;
+    uint64_t denied;                                  /* Writes without the password */
+    uint64_t invalid;
+} sim_stats_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static const sim_item_t sim_water_regs[] = {
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence) { address, size },
+    MODBUS_WATER_INPUT_REGS
+#undef XTABLE_ITEM
+};
+
+static const sim_item_t sim_elec_cmds[] = {
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence) { address, size },
+    MODBUS_ELECTRIC_CMD
+#undef XTABLE_ITEM
+};
+
+static sim_config_t sim_config = {
+    .password = {0x00, 0x11, 0x11, 0x11},              /* Factory default */
+};
+static sim_stats_t sim_stats;
+static volatile sig_atomic_t sim_running = 1;
+static struct timespec sim_start;
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static uint16_t sim_crc16(const uint8_t *data, uint32_t length)
+{
+    uint16_t crc = 0xFFFF;
+
+    while(length--)
+    {
+        crc ^= *data++;
+        for(uint8_t i = 0; i < 8; i++)
+        {
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+        }
+    }
+    return crc;
+}
+
+static uint8_t sim_check_sum(const uint8_t *data, uint32_t length)
+{
+    uint8_t sum = 0;
+
+    while(length--)
+    {
+        sum += *data++;
+    }
+    return sum;
+}
+
+static uint32_t sim_random_percent(void)
+{
+    return (uint32_t)(rand() % 100);
+}
+
+static double sim_elapsed_s(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - sim_start.tv_sec) + (now.tv_nsec - sim_start.tv_nsec) / 1e9;
+}
+
+static void sim_sleep_ms(uint32_t ms)
+{
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000L };
+
+    nanosleep(&ts, NULL);
+}
+
+static void sim_signal(int sig)
+{
+    (void) sig;
+    sim_running = 0;
+}
+
+/******************************************************************************/
+
+/*!
+ * @brief  Delay, jitter and time on the wire, then write the response
+ */
+static void sim_send(int fd, uint8_t *data, uint32_t length, bool checked_by_crc)
+{
+    uint32_t delay = sim_config.delay_ms;
+
+    if(sim_config.jitter_ms > 0)
+    {
+        delay += (uint32_t)(rand() % (sim_config.jitter_ms + 1));
+    }
+    if(sim_config.baudrate > 0)
+    {
+        /* 11 bits per character, 8E1 */
+        delay += (length * 11000 + sim_config.baudrate - 1) / sim_config.baudrate;
+    }
+    if(sim_random_percent() < sim_config.corrupt_percent)
+    {
+        /* Flip a bit of the CRC or of the check sum */
+        data[length - (checked_by_crc ? 1 : 2)] ^= 0x01;
+        sim_stats.corrupted++;
+    }
+    sim_sleep_ms(delay);
+    if(write(fd, data, length) != (ssize_t) length)
+    {
+        perror("write");
+    }
+    sim_stats.responses++;
+}
+
+/*!
+ * @brief  Register value: 32 bit per table item, high word first. Changes on each read
+ */
+static uint16_t sim_water_register(sim_slave_t *slave, uint16_t address, bool *valid)
+{
+    for(uint32_t i = 0; i < sizeof(sim_water_regs) / sizeof(sim_water_regs[0]); i++)
+    {
+        if((address >= sim_water_regs[i].address) && (address < sim_water_regs[i].address + sim_water_regs[i].size))
+        {
+            uint32_t value = slave->address[0] * 100000UL + i * 100 + slave->reads % 100;
+            uint16_t word = address - sim_water_regs[i].address;
+            *valid = true;
+            return (word == 0) ? (uint16_t)(value >> 16) : (uint16_t)value;
+        }
+    }
+    *valid = false;
+    return 0;
+}
+
+/*!
+ * @brief  Modbus RTU request, function 04 only
+ */
+static void sim_handle_rtu(int fd, const uint8_t *request, uint32_t length)
+{
+    uint8_t response[SIM_FRAME_MAX_SIZE];
+    uint16_t crc, address, num_reg, value;
+    uint32_t size = 0;
+    bool valid = false;
+    sim_slave_t *slave = NULL;
+
+    if((length < 8) || (sim_crc16(request, length - 2) != (request[length - 2] | (request[length - 1] << 8))))
+    {
+        sim_stats.invalid++;
+        return;
+    }
+    for(uint32_t i = 0; i < sim_config.num_slave; i++)
+    {
+        if(sim_config.slave[i].address[0] == request[0])
+        {
+            slave = &sim_config.slave[i];
+            break;
+        }
+    }
+    if(slave == NULL)
+    {
+        return;
+    }
+    if(slave->silent)
+    {
+        sim_stats.silent++;
+        return;
+    }
+    if(sim_random_percent() < sim_config.loss_percent)
+    {
+        sim_stats.lost++;
+        return;
+    }
+
+    response[size++] = request[0];
+    address = (request[2] << 8) | request[3];
+    num_reg = (request[4] << 8) | request[5];
+    if((request[1] == SIM_WRITE_REGISTER_FUNCTION) ||
+       ((request[1] == SIM_WRITE_MULTIPLE_FUNCTION) && (length == 9u + request[6])))
+    {
+        /* Echo of function 06, register and quantity for function 16 */
+        memcpy(&response[size], &request[1], 5);
+        size += 5;
+        sim_stats.writes++;
+    }
+    else if(request[1] != SIM_READ_INPUT_FUNCTION)
+    {
+        response[size++] = request[1] | SIM_EXCEPTION_FLAG;
+        response[size++] = SIM_EXCEPTION_ILLEGAL_FUNCTION;
+    }
+    else
+    {
+        /* Gaps between table items read as zero, a read without any table item is refused */
+        response[size++] = request[1];
+        response[size++] = num_reg << 1;
+        for(uint16_t i = 0; (i < num_reg) && (num_reg <= 125); i++)
+        {
+            bool found;
+            value = sim_water_register(slave, address + i, &found);
+            valid |= found;
+            response[size++] = value >> 8;
+            response[size++] = value & 0xFF;
+        }
+        if(!valid)
+        {
+            size = 1;
+            response[size++] = request[1] | SIM_EXCEPTION_FLAG;
+            response[size++] = SIM_EXCEPTION_ILLEGAL_ADDRESS;
+        }
+    }
+    slave->reads++;
+
+    crc = sim_crc16(response, size);
+    response[size++] = crc & 0xFF;
+    response[size++] = crc >> 8;
+    sim_send(fd, response, size, true);
+}
+
+/*!
+ * @brief  Address of a 0x68 request matches the meter, 0xAA matches any byte, 99..99 is broadcast
+ */
+static bool sim_elec_match(const uint8_t *request, const uint8_t *address)
+{
+    bool broadcast = true;
+    bool match = true;
+
+    for(uint8_t i = 0; i < 6; i++)
+    {
+        broadcast &= (request[i] == SIM_BROADCAST_BYTE);
+        match &= ((request[i] == SIM_WILDCARD_BYTE) || (request[i] == address[i]));
+    }
+    return broadcast || match;
+}
+
+/*!
+ * @brief  Build response of a meter to a read command
+ */
+static uint32_t sim_elec_response(sim_slave_t *slave, uint16_t di, uint8_t *response)
+{
+    uint32_t size = 0;
+    const sim_item_t *item = NULL;
+
+    for(uint32_t i = 0; i < sim_config.preamble; i++)
+    {
+        response[size++] = SIM_PREAMBLE_BYTE;
+    }
+    uint8_t *frame = &response[size];
+    size = 0;
+    frame[size++] = SIM_START_BYTE;
+    memcpy(&frame[size], slave->address, 6);
+    size += 6;
+    frame[size++] = SIM_START_BYTE;
+
+    modbus_elec_cmd_id id = modbus_table_elec_find(di);
+    if(id != MB_ELEC_INVALID_CMD)
+    {
+        item = &sim_elec_cmds[id];
+    }
+
+    if(item == NULL)
+    {
+        frame[size++] = SIM_READ_RESPONSE_BYTE | SIM_ERROR_FLAG;
+        frame[size++] = 1;
+        frame[size++] = SIM_ERROR_NO_DATA + SIM_DATA_ADD_BYTE;
+    }
+    else
+    {
+        frame[size++] = SIM_READ_RESPONSE_BYTE;
+        frame[size++] = 2 + item->size;
+        frame[size++] = di >> 8;
+        frame[size++] = di & 0xFF;
+        for(uint16_t i = 0; i < item->size; i++)
+        {
+            /* BCD digits, the meter address for the read address command */
+            uint8_t value = (item->size == 6) ? slave->address[i] : (uint8_t)(((i + slave->reads) % 10 << 4) | (i % 10));
+            frame[size++] = value + SIM_DATA_ADD_BYTE;
+        }
+    }
+    frame[size] = sim_check_sum(frame, size);
+    size++;
+    frame[size++] = SIM_END_BYTE;
+    slave->reads++;
+    return size + sim_config.preamble;
+}
+
+/*!
+ * @brief  Acknowledge of a write command, or password error
+ */
+static uint32_t sim_elec_write_response(sim_slave_t *slave, const uint8_t *request, uint8_t *response)
+{
+    uint32_t size = 0;
+    bool granted = (request[9] >= 2 + SIM_PASSWORD_SIZE);
+
+    for(uint32_t i = 0; i < sim_config.preamble; i++)
+    {
+        response[size++] = SIM_PREAMBLE_BYTE;
+    }
+    uint8_t *frame = &response[size];
+    size = 0;
+    frame[size++] = SIM_START_BYTE;
+    memcpy(&frame[size], slave->address, 6);
+    size += 6;
+    frame[size++] = SIM_START_BYTE;
+
+    /* Command, then password */
+    for(uint32_t i = 0; granted && (i < SIM_PASSWORD_SIZE); i++)
+    {
+        granted = ((uint8_t) (request[12 + i] - SIM_DATA_ADD_BYTE) == sim_config.password[i]);
+    }
+    if(!granted)
+    {
+        frame[size++] = SIM_WRITE_RESPONSE_BYTE | SIM_ERROR_FLAG;
+        frame[size++] = 1;
+        frame[size++] = SIM_ERROR_PASSWORD + SIM_DATA_ADD_BYTE;
+        sim_stats.denied++;
+    }
+    else
+    {
+        frame[size++] = SIM_WRITE_RESPONSE_BYTE;
+        frame[size++] = 2;
+        frame[size++] = request[10];
+        frame[size++] = request[11];
+        sim_stats.writes++;
+    }
+    frame[size] = sim_check_sum(frame, size);
+    size++;
+    frame[size++] = SIM_END_BYTE;
+    return size + sim_config.preamble;
+}
+
+/*!
+ * @brief  0x68 read or write request. Several meters matching a wildcard answer at the same time:
+ *         the bytes on the line are merged (AND) like on a real bus
+ */
+static void sim_handle_elec(int fd, const uint8_t *request, uint32_t length)
+{
+    uint8_t response[SIM_FRAME_MAX_SIZE];
+    uint8_t frame[SIM_FRAME_MAX_SIZE];
+    uint32_t size = 0, frame_size;
+    uint32_t answers = 0;
+
+    while((length > 0) && (*request == SIM_PREAMBLE_BYTE))
+    {
+        request++;
+        length--;
+    }
+    if((length < 12) || (request[0] != SIM_START_BYTE) || (request[7] != SIM_START_BYTE) ||
+       (length != 12u + request[9]) || (request[length - 1] != SIM_END_BYTE) ||
+       (sim_check_sum(request, length - 2) != request[length - 2]))
+    {
+        sim_stats.invalid++;
+        return;
+    }
+    if(((request[8] != SIM_READ_REQUEST_BYTE) && (request[8] != SIM_WRITE_REQUEST_BYTE)) || (request[9] < 2))
+    {
+        return;
+    }
+
+    for(uint32_t i = 0; i < sim_config.num_slave; i++)
+    {
+        sim_slave_t *slave = &sim_config.slave[i];
+        if(!sim_elec_match(&request[1], slave->address))
+        {
+            continue;
+        }
+        if(slave->silent)
+        {
+            sim_stats.silent++;
+            continue;
+        }
+
+        if(request[8] == SIM_WRITE_REQUEST_BYTE)
+        {
+            frame_size = sim_elec_write_response(slave, request, frame);
+        }
+        else
+        {
+            frame_size = sim_elec_response(slave, (request[10] << 8) | request[11], frame);
+        }
+        if(answers == 0)
+        {
+            memcpy(response, frame, frame_size);
+            size = frame_size;
+        }
+        else
+        {
+            for(uint32_t k = 0; k < frame_size; k++)
+            {
+                response[k] = (k < size) ? (response[k] & frame[k]) : frame[k];
+            }
+            size = (frame_size > size) ? frame_size : size;
+        }
+        answers++;
+    }
+
+    if(answers == 0)
+    {
+        return;
+    }
+    if(answers > 1)
+    {
+        sim_stats.collisions++;
+    }
+    if(sim_random_percent() < sim_config.loss_percent)
+    {
+        sim_stats.lost++;
+        return;
+    }
+    sim_send(fd, response, size, false);
+}
+
+/******************************************************************************/
+
+static void sim_print_stats(void)
+{
+    double elapsed = sim_elapsed_s();
+
+    fprintf(stderr, "%.1fs: %llu requests (%.1f/s), %llu responses, %llu corrupted, %llu lost, %llu silent, %llu collisions, %llu writes, "
+                    "%llu denied, %llu invalid\n",
+            elapsed, (unsigned long long) sim_stats.requests, (elapsed > 0) ? sim_stats.requests / elapsed : 0.0,
+            (unsigned long long) sim_stats.responses, (unsigned long long) sim_stats.corrupted,
+            (unsigned long long) sim_stats.lost, (unsigned long long) sim_stats.silent,
+            (unsigned long long) sim_stats.collisions, (unsigned long long) sim_stats.writes,
+            (unsigned long long) sim_stats.denied, (unsigned long long) sim_stats.invalid);
+}
+
+static int sim_parse_hex(const char *text, uint8_t *address, uint8_t size)
+{
+    unsigned int value;
+
+    if(strlen(text) != size * 2u)
+    {
+        return -1;
+    }
+    for(uint8_t i = 0; i < size; i++)
+    {
+        if(sscanf(&text[i * 2], "%2x", &value) != 1)
+        {
+            return -1;
+        }
+        address[i] = (uint8_t) value;
+    }
+    return 0;
+}
+
+static void sim_usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-p rtu|elec] [-n count] [-a address] [-d ms] [-j ms] [-c percent] [-l percent] [-s id] [-b baud] [-f count]\n"
+                    "       [-w password]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t request[SIM_FRAME_MAX_SIZE];
+    uint32_t length = 0;
+    uint32_t num_generated = 2;
+    uint32_t silent[SIM_MAX_SLAVE];
+    uint32_t num_silent = 0;
+    uint8_t extra[SIM_MAX_SLAVE][6];
+    uint32_t num_extra = 0;
+    struct termios tio;
+    int opt, master, slave_fd;
+
+    while((opt = getopt(argc, argv, "p:n:a:d:j:c:l:s:b:f:w:h")) != -1)
+    {
+        switch(opt)
+        {
+        case 'p': sim_config.protocol = (strcmp(optarg, "elec") == 0) ? SIM_PROTOCOL_ELEC : SIM_PROTOCOL_RTU; break;
+        case 'n': num_generated = strtoul(optarg, NULL, 0); break;
+        case 'd': sim_config.delay_ms = strtoul(optarg, NULL, 0); break;
+        case 'j': sim_config.jitter_ms = strtoul(optarg, NULL, 0); break;
+        case 'c': sim_config.corrupt_percent = strtoul(optarg, NULL, 0); break;
+        case 'l': sim_config.loss_percent = strtoul(optarg, NULL, 0); break;
+        case 'b': sim_config.baudrate = strtoul(optarg, NULL, 0); break;
+        case 'f': sim_config.preamble = strtoul(optarg, NULL, 0); break;
+        case 's':
+            if(num_silent < SIM_MAX_SLAVE)
+            {
+                silent[num_silent++] = strtoul(optarg, NULL, 0);
+            }
+            break;
+        case 'a':
+            if((num_extra >= SIM_MAX_SLAVE) || (sim_parse_hex(optarg, extra[num_extra], 6) != 0))
+            {
+                fprintf(stderr, "Invalid address %s\n", optarg);
+                return 1;
+            }
+            num_extra++;
+            break;
+        case 'w':
+            if(sim_parse_hex(optarg, sim_config.password, SIM_PASSWORD_SIZE) != 0)
+            {
+                fprintf(stderr, "Invalid password %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            sim_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    /* Slaves: Modbus id 1..n, or meter address in BCD */
+    for(uint32_t i = 0; (i < num_generated) && (sim_config.num_slave < SIM_MAX_SLAVE); i++)
+    {
+        sim_slave_t *slave = &sim_config.slave[sim_config.num_slave++];
+        uint32_t number = i + 1;
+        if(sim_config.protocol == SIM_PROTOCOL_RTU)
+        {
+            slave->address[0] = (uint8_t) number;
+        }
+        else
+        {
+            slave->address[0] = ((number % 100 / 10) << 4) | (number % 10);
+            slave->address[1] = ((number / 1000 % 10) << 4) | (number / 100 % 10);
+        }
+    }
+    for(uint32_t i = 0; (i < num_extra) && (sim_config.num_slave < SIM_MAX_SLAVE); i++)
+    {
+        memcpy(sim_config.slave[sim_config.num_slave++].address, extra[i], 6);
+    }
+    for(uint32_t i = 0; i < num_silent; i++)
+    {
+        for(uint32_t k = 0; k < sim_config.num_slave; k++)
+        {
+            uint32_t id = (sim_config.protocol == SIM_PROTOCOL_RTU) ? sim_config.slave[k].address[0] : k + 1;
+            if(id == silent[i])
+            {
+                sim_config.slave[k].silent = true;
+            }
+        }
+    }
+
+    /* Pseudo-terminal in raw mode, the slave side is kept open so settings stay */
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if((master < 0) || (grantpt(master) != 0) || (unlockpt(master) != 0))
+    {
+        perror("posix_openpt");
+        return 1;
+    }
+    slave_fd = open(ptsname(master), O_RDWR | O_NOCTTY);
+    if((slave_fd < 0) || (tcgetattr(slave_fd, &tio) != 0))
+    {
+        perror("open pts");
+        return 1;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(slave_fd, TCSANOW, &tio);
+    printf("%s: %u %s slaves on %s\n", argv[0], sim_config.num_slave,
+           (sim_config.protocol == SIM_PROTOCOL_RTU) ? "Modbus RTU" : "0x68", ptsname(master));
+    fflush(stdout);
+
+    signal(SIGINT, sim_signal);
+    signal(SIGTERM, sim_signal);
+    srand((unsigned int) time(NULL));
+    clock_gettime(CLOCK_MONOTONIC, &sim_start);
+
+    /* A request ends after SIM_FRAME_GAP_MS of silence */
+    while(sim_running)
+    {
+        struct pollfd pfd = { master, POLLIN, 0 };
+        int rc = poll(&pfd, 1, (length > 0) ? SIM_FRAME_GAP_MS : 1000);
+        if(rc < 0)
+        {
+            continue;
+        }
+        if(rc > 0)
+        {
+            ssize_t n = read(master, &request[length], sizeof(request) - length);
+            if(n > 0)
+            {
+                length += n;
+                if(length < sizeof(request))
+                {
+                    continue;
+                }
+            }
+        }
+        if(length == 0)
+        {
+            continue;
+        }
+
+        sim_stats.requests++;
+        if(sim_config.protocol == SIM_PROTOCOL_RTU)
+        {
+            sim_handle_rtu(master, request, length);
+        }
+        else
+        {
+            sim_handle_elec(master, request, length);
+        }
+        length = 0;
+    }
+
+    sim_print_stats();
+    close(slave_fd);
+    close(master);
+    return 0;
+}
@@ -0,0 +1,22 @@
+/*
+ *  config.h
+ *
+ *  Created on: Mar 11, 2022
+ *
+ *  Host stand-in of src/config.h for the poll plan, found first with -I. in the build of plan_bench.
+ *  The meter is water, or electric with -DELECTRIC_METER_USED as in src/config.h.
+ */
+
+#ifndef _CONFIG_H_
+#define _CONFIG_H_
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+/* As src/config.h */
+#define MAX_SLAVE_ID                                  32
+#define MODBUS_READ_PLAN_SIZE                         8
+#define MODBUS_READ_MAX_REGS                          125
+
+#endif /* _CONFIG_H_ */
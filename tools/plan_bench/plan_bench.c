@@ -0,0 +1,293 @@
+/*
+ *  plan_bench.c
+ *
+ *  Created on: Mar 11, 2022
+ *
+ *  Live change of the poll plan while a poller reads it. A builder thread publishes new plans as fast
+ *  as it can, a poller thread runs cycles: at each cycle boundary it looks for a new plan, then reads
+ *  every field of its plan several times as the schedule and the jobs do. Each field of a plan is
+ *  derived from its version, a field that does not match is a torn plan.
+ *  Former path: the builder writes the one plan in place, as modbus_api_set_slave() did.
+ *  Locked path: the builder writes the plan under a mutex, the poller holds it for the cycle.
+ *  Store path: src/modbus_api/modbus_plan.c, the builder fills its own slot and the poller swaps
+ *  pointers with an atomic exchange. Checks the plan command parser first.
+ *
+ *  Build: gcc -O2 -Wall -pthread -I. -I../../src/modbus_api -o plan_bench plan_bench.c \
+ *             ../../src/modbus_api/modbus_plan.c
+ *  Run:   ./plan_bench [duration ms]      add -DELECTRIC_METER_USED for electric meter commands
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "config.h"
+#include "modbus_plan.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define BENCH_DURATION_MS                             2000
+#define BENCH_CYCLE_READS                             8     /* Reads of the plan in one poll cycle */
+
+typedef uint8_t bench_path_t;
+enum {
+    BENCH_FORMER = 0,
+    BENCH_LOCKED,
+    BENCH_STORE,
+};
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static const char *bench_name[] = {"former", "locked", "store"};
+static bench_path_t bench_path;
+static atomic_bool bench_stop;
+
+static modbus_plan_t former_plan;
+static pthread_mutex_t locked_mutex = PTHREAD_MUTEX_INITIALIZER;
+static modbus_plan_store_t store;
+
+static uint64_t built;
+static uint64_t cycles;
+static uint64_t swaps;
+static uint64_t torn;
+static uint64_t stale;
+static uint32_t failures;
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static double bench_time_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000.0) + (ts.tv_nsec / 1000000.0);
+}
+
+/* Every field from the version */
+static void bench_fill(modbus_plan_t *plan, uint32_t version)
+{
+    plan->version = version;
+    plan->protocol = (uint8_t) version;
+    plan->slave_count = 1 + (version % MAX_SLAVE_ID);
+    for(uint32_t i = 0; i < MAX_SLAVE_ID; i++)
+    {
+        plan->slave[i] = (uint8_t) (version + i);
+    }
+    plan->gap = (uint16_t) version;
+    for(uint32_t i = 0; i < MODBUS_GROUP_COUNT; i++)
+    {
+        plan->group[i].first = (modbus_reg_id) version;
+        plan->group[i].last = (modbus_reg_id) (version + i);
+        plan->group[i].period = version * 3 + i;
+    }
+}
+
+static bool bench_intact(const volatile modbus_plan_t *plan, uint32_t version)
+{
+    bool intact = (plan->protocol == (uint8_t) version) && (plan->slave_count == 1 + (version % MAX_SLAVE_ID)) &&
+                  (plan->gap == (uint16_t) version);
+
+    for(uint32_t i = 0; i < MAX_SLAVE_ID; i++)
+    {
+        intact &= (plan->slave[i] == (uint8_t) (version + i));
+    }
+    for(uint32_t i = 0; i < MODBUS_GROUP_COUNT; i++)
+    {
+        intact &= (plan->group[i].first == (modbus_reg_id) version) &&
+                  (plan->group[i].last == (modbus_reg_id) (version + i)) && (plan->group[i].period == version * 3 + i);
+    }
+    return intact;
+}
+
+static void* bench_builder(void *arg)
+{
+    modbus_plan_t *plan;
+    uint32_t version = 1;
+
+    while(!atomic_load(&bench_stop))
+    {
+        version++;
+        switch(bench_path)
+        {
+        case BENCH_FORMER:
+            bench_fill(&former_plan, version);
+            break;
+        case BENCH_LOCKED:
+            pthread_mutex_lock(&locked_mutex);
+            bench_fill(&former_plan, version);
+            pthread_mutex_unlock(&locked_mutex);
+            break;
+        default:
+            plan = modbus_plan_edit(&store);
+            bench_fill(plan, plan->version);
+            modbus_plan_publish(&store);
+            break;
+        }
+        built++;
+    }
+    return NULL;
+}
+
+static void* bench_poller(void *arg)
+{
+    const modbus_plan_t *plan = NULL;
+    uint32_t last = 0;
+
+    while(!atomic_load(&bench_stop))
+    {
+        /* Cycle boundary */
+        if(bench_path == BENCH_LOCKED)
+        {
+            pthread_mutex_lock(&locked_mutex);
+            plan = &former_plan;
+        }
+        else if(bench_path == BENCH_STORE)
+        {
+            if(modbus_plan_take(&store) != NULL)
+            {
+                swaps++;
+            }
+            plan = modbus_plan_active(&store);
+        }
+        else
+        {
+            plan = &former_plan;
+        }
+
+        uint32_t version = ((const volatile modbus_plan_t*) plan)->version;
+        if(version < last)
+        {
+            stale++;
+        }
+        last = version;
+        for(uint32_t i = 0; i < BENCH_CYCLE_READS; i++)
+        {
+            if(!bench_intact(plan, version))
+            {
+                torn++;
+                break;
+            }
+        }
+
+        if(bench_path == BENCH_LOCKED)
+        {
+            pthread_mutex_unlock(&locked_mutex);
+        }
+        cycles++;
+    }
+    return NULL;
+}
+
+static void bench_run(bench_path_t path, uint32_t duration)
+{
+    pthread_t builder, poller;
+    double start;
+    modbus_plan_t first;
+
+    bench_path = path;
+    built = cycles = swaps = torn = stale = 0;
+    memset(&first, 0, sizeof(first));
+    bench_fill(&first, 1);
+    memcpy(&former_plan, &first, sizeof(first));
+    modbus_plan_store_init(&store, &first);
+    atomic_store(&bench_stop, false);
+
+    start = bench_time_ms();
+    pthread_create(&poller, NULL, bench_poller, NULL);
+    pthread_create(&builder, NULL, bench_builder, NULL);
+    while((bench_time_ms() - start) < duration)
+    {
+        struct timespec ts = {0, 10000000};
+        nanosleep(&ts, NULL);
+    }
+    atomic_store(&bench_stop, true);
+    pthread_join(builder, NULL);
+    pthread_join(poller, NULL);
+
+    printf("%-8s %12lu %12lu %12lu %10lu %8lu %10.1f\n", bench_name[path], (unsigned long) built,
+           (unsigned long) cycles, (unsigned long) swaps, (unsigned long) torn, (unsigned long) stale,
+           (bench_time_ms() - start) * 1000000.0 / (double) cycles);
+    if((path == BENCH_STORE) && ((torn > 0) || (stale > 0)))
+    {
+        failures++;
+    }
+}
+
+static void bench_expect(const char *command, bool valid)
+{
+    modbus_plan_change_t change;
+
+    if(modbus_plan_parse(command, &change) != valid)
+    {
+        printf("FAIL \"%s\" should be %s\n", command, valid ? "valid" : "invalid");
+        failures++;
+    }
+}
+
+static void bench_check(void)
+{
+    modbus_plan_change_t change;
+
+    bench_expect("bus=0", true);
+    bench_expect("bus=0 g1=1000 g2=0 gap=4", true);
+    bench_expect("  bus=1\tg0=500:0-1\n", true);
+    bench_expect("", false);
+    bench_expect("g1=1000", false);
+    bench_expect("bus=0 g1=", false);
+    bench_expect("bus=0 g1=1000:3-1", false);
+    bench_expect("bus=0 g99=1000", false);
+    bench_expect("bus=0 speed=9600", false);
+    bench_expect("bus=0 gap=4x", false);
+#ifdef ELECTRIC_METER_USED
+    bench_expect("bus=0 slaves=010203040506,0A0B0C0D0E0F", true);
+    bench_expect("bus=0 slaves=01020304050", false);
+    bench_expect("bus=0 slaves=0102030405067", false);
+    modbus_plan_parse("bus=0 slaves=010203040506,0a0B0c0D0e0F", &change);
+    if((change.slave_count != 2) || (change.slave[1][0] != 0x0A) || (change.slave[1][5] != 0x0F))
+#else
+    bench_expect("bus=0 slaves=1,2,247", true);
+    bench_expect("bus=0 slaves=0", false);
+    bench_expect("bus=0 slaves=248", false);
+    bench_expect("bus=0 slaves=1,", false);
+    modbus_plan_parse("bus=2 slaves=7,9 g1=250:2-5 gap=3", &change);
+    if((change.bus != 2) || (change.slave_count != 2) || (change.slave[1][0] != 9) || (change.gap != 3) ||
+       (change.period_set != 0x02) || (change.range_set != 0x02) || (change.group[1].period != 250) ||
+       (change.group[1].first != 2) || (change.group[1].last != 5) ||
+       (change.fields != (MODBUS_PLAN_SLAVES | MODBUS_PLAN_GAP)))
+#endif
+    {
+        printf("FAIL parsed change\n");
+        failures++;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t duration = (argc > 1) ? strtoul(argv[1], NULL, 10) : BENCH_DURATION_MS;
+
+    bench_check();
+    printf("plan commands: %s\n", (failures == 0) ? "pass" : "FAIL");
+
+    printf("%u ms per path, %d reads of the plan per cycle\n", duration, BENCH_CYCLE_READS);
+    printf("%-8s %12s %12s %12s %10s %8s %10s\n", "", "built", "cycles", "swaps", "torn", "stale", "ns/cycle");
+    bench_run(BENCH_FORMER, duration);
+    bench_run(BENCH_LOCKED, duration);
+    bench_run(BENCH_STORE, duration);
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,363 @@
+/*
+ *  publisher_bench.c
+ *
+ *  Created on: Mar 02, 2022
+ *
+ *  Host throughput of the reading path: a poller thread puts water meter readings into the ring of
+ *  src/modbus_api/modbus_ring.c, a publisher thread takes them into batches of src/batch/batch.c.
+ *  The publisher either sleeps a fixed period and drains (the former 1 Hz main loop), or is woken up
+ *  by each reading as by modbus_api_reading_wait(). The poller waits while the ring holds
+ *  MODBUS_RING_BACKPRESSURE unread readings, or overwrites the oldest when backpressure is off.
+ *  Publish copies the payload out and sleeps the time the uplink takes to send it, 0 for no limit.
+ *
+ *  Build: gcc -O2 -Wall -pthread -I../telemetry_bench -I../../src -I../../src/modbus_api -o publisher_bench \
+ *             publisher_bench.c ../../src/modbus_api/modbus_ring.c ../../src/batch/batch.c \
+ *             ../../src/modbus_api/modbus_telemetry.c ../../src/modbus_api/modbus_decode.c \
+ *             ../../src/modbus_api/modbus_table.c ../../src/utility/json_writer.c \
+ *             ../../src/utility/bin_writer.c ../../src/utility/utility.c -lm
+ *  Run:   ./publisher_bench [-b]      -b: binary readings
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "config.h"
+#include "modbus_ring.h"
+#include "batch/batch.h"
+#include "modbus_telemetry.h"
+
+#ifdef ELECTRIC_METER_USED
+#error "publisher_bench uses water meter readings"
+#endif
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+/* As src/config.h */
+#define MODBUS_RING_SIZE                              32
+#define MODBUS_RING_BACKPRESSURE                      24
+#define MODBUS_BACKPRESSURE_WAIT_MS                   20
+#define BATCH_MAX_LENGTH                              1024
+#define BATCH_MAX_LATENCY_MS                          5000
+#define BATCH_RECORD_BUFFER_SIZE                      4096
+#define PUBLISHER_IDLE_MS                             1000
+
+#define BENCH_DURATION_MS                             3000
+#define BENCH_LOOP_MS                                 1000  /* Period of the former main loop */
+#define BENCH_SLAVES                                  32
+#define BENCH_MESSAGE_SIZE                            4096  /* JSON_READING_MAX_LENGTH */
+
+/*!
+ * @brief  A run
+ */
+typedef struct {
+    const char *name;
+    bool event;                                       /* Woken up by readings, or periodic drain */
+    bool backpressure;
+    uint32_t uplink;                                  /* Uplink in byte/s, 0 for no limit */
+    uint32_t poll_rate;                               /* Readings/s put by the poller, 0 for as fast as possible */
+} bench_case_t;
+
+/*!
+ * @brief  Result of a run
+ */
+typedef struct {
+    uint64_t put;
+    uint64_t taken;
+    uint64_t wakeups;
+    uint64_t max_drain;
+    uint64_t publishes;
+    uint64_t bytes;
+    uint64_t throttled_ms;
+    modbus_ring_stats_t ring;
+} bench_result_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static const bench_case_t bench_case[] = {
+    { "1 Hz loop",           false, true,  0,     0   },
+    { "event",               true,  true,  0,     0   },
+    { "event, no backpress", true,  false, 0,     0   },
+    { "event, 50/s",         true,  true,  0,     50  },
+    { "slow uplink",         true,  true,  16000, 0   },
+    { "slow, no backpress",  true,  false, 16000, 0   },
+};
+
+static modbus_data_t bench_slot[MODBUS_RING_SIZE];
+static modbus_ring_t bench_ring;
+static batch_t bench_batch;
+static uint8_t bench_payload[BATCH_MAX_LENGTH];
+static uint8_t bench_record[BATCH_RECORD_BUFFER_SIZE];
+static uint8_t bench_outbox[BATCH_MAX_LENGTH];
+static uint8_t bench_message[BENCH_MESSAGE_SIZE];
+static bool bench_binary = false;
+static const bench_case_t *bench_run_case;
+static bench_result_t bench_result;
+static atomic_bool bench_stop;
+
+/* Task notification of the publisher */
+static pthread_mutex_t notify_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t notify_cond = PTHREAD_COND_INITIALIZER;
+static uint32_t notify_count;
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static uint64_t bench_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void bench_sleep_us(uint64_t us)
+{
+    struct timespec ts = { us / 1000000, (us % 1000000) * 1000 };
+    nanosleep(&ts, NULL);
+}
+
+/* xTaskNotifyGive() */
+static void bench_notify(void)
+{
+    pthread_mutex_lock(&notify_lock);
+    notify_count++;
+    pthread_cond_signal(&notify_cond);
+    pthread_mutex_unlock(&notify_lock);
+}
+
+/* ulTaskNotifyTake(pdTRUE, wait) */
+static bool bench_notify_take(uint32_t wait_ms)
+{
+    struct timespec ts;
+    bool taken;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += wait_ms / 1000;
+    ts.tv_nsec += (wait_ms % 1000) * 1000000L;
+    if(ts.tv_nsec >= 1000000000L)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock(&notify_lock);
+    while((notify_count == 0) && (pthread_cond_timedwait(&notify_cond, &notify_lock, &ts) == 0))
+    {
+    }
+    taken = (notify_count > 0);
+    notify_count = 0;
+    pthread_mutex_unlock(&notify_lock);
+    return taken;
+}
+
+/* Poller: a reading of the slaves in turn, all registers of the group of 4 reported */
+static void* bench_poller(void *arg)
+{
+    uint32_t seq = 0;
+    uint64_t start = bench_time_ms();
+    modbus_data_t *slot;
+
+    while(!atomic_load(&bench_stop))
+    {
+        if(bench_run_case->backpressure && (modbus_ring_count(&bench_ring) >= MODBUS_RING_BACKPRESSURE))
+        {
+            bench_result.throttled_ms += MODBUS_BACKPRESSURE_WAIT_MS;
+            bench_sleep_us(MODBUS_BACKPRESSURE_WAIT_MS * 1000);
+            continue;
+        }
+        if(bench_run_case->poll_rate > 0)
+        {
+            uint64_t due = start + (uint64_t) seq * 1000 / bench_run_case->poll_rate;
+            uint64_t now = bench_time_ms();
+            if(due > now)
+            {
+                bench_sleep_us((due - now) * 1000);
+            }
+        }
+
+        slot = (modbus_data_t*) modbus_ring_produce(&bench_ring);
+        if(slot != NULL)
+        {
+            memset(slot, 0, sizeof(modbus_data_t));
+            slot->meter = WATER_METER;
+            slot->slave_id = 1 + seq % BENCH_SLAVES;
+            slot->time = 1646179200 + seq / 100;
+            slot->start = MB_WATER_M3;
+            slot->stop = MB_ID5_M3;
+            for(uint32_t i = 0; i < 4 * (MB_ID5_M3 - MB_WATER_M3 + 1); i += 4)
+            {
+                slot->data[i + 3] = (uint8_t) (seq + i);
+                slot->data[i + 2] = (uint8_t) (seq >> 8);
+            }
+            slot->report = MODBUS_REPORT_ALL;
+            modbus_ring_commit(&bench_ring);
+            bench_notify();
+        }
+        seq++;
+    }
+    return NULL;
+}
+
+static void bench_publish(uint32_t length)
+{
+    memcpy(bench_outbox, bench_payload, length);
+    bench_result.publishes++;
+    bench_result.bytes += length;
+    if(bench_run_case->uplink > 0)
+    {
+        bench_sleep_us((uint64_t) length * 1000000 / bench_run_case->uplink);
+    }
+}
+
+static void bench_flush(batch_flush_t reason)
+{
+    uint32_t length = batch_finish(&bench_batch, reason);
+
+    if(length > 0)
+    {
+        bench_publish(length);
+    }
+    batch_reset(&bench_batch, true);
+}
+
+/* As publisher_batch_add(), the compact record is not needed here */
+static void bench_batch_add(const modbus_data_t *data)
+{
+    uint8_t slave = data->slave_id;
+    uint8_t *buffer;
+    uint32_t room, length;
+
+    buffer = batch_reserve(&bench_batch, &room);
+    if(room == 0)
+    {
+        buffer = bench_message;
+        room = sizeof(bench_message);
+    }
+    length = bench_binary ? modbus_telemetry_to_binary(data, &slave, buffer, room) :
+                            modbus_telemetry_to_json(data, &slave, (char*) buffer, room);
+    if((length == 0) && (buffer != bench_message))
+    {
+        buffer = bench_message;
+        length = bench_binary ? modbus_telemetry_to_binary(data, &slave, buffer, sizeof(bench_message)) :
+                                modbus_telemetry_to_json(data, &slave, (char*) buffer, sizeof(bench_message));
+    }
+    if(length == 0)
+    {
+        return;
+    }
+    while(!batch_add(&bench_batch, buffer, length, &slave, 1, (uint32_t) bench_time_ms()))
+    {
+        if(bench_batch.count == 0)
+        {
+            return;
+        }
+        if(buffer != bench_message)
+        {
+            memcpy(bench_message, buffer, length);
+            buffer = bench_message;
+        }
+        bench_flush(BATCH_FLUSH_SIZE);
+    }
+}
+
+/* As publisher_task() */
+static void* bench_publisher(void *arg)
+{
+    modbus_data_t *data;
+    uint32_t wait, waited, count;
+
+    while(!atomic_load(&bench_stop))
+    {
+        if(bench_run_case->event)
+        {
+            wait = PUBLISHER_IDLE_MS;
+            if(bench_batch.count > 0)
+            {
+                waited = (uint32_t) bench_time_ms() - bench_batch.first_ms;
+                wait = (waited >= bench_batch.latency_ms) ? 0 : bench_batch.latency_ms - waited;
+            }
+            bench_notify_take(wait);
+        }
+        else
+        {
+            bench_sleep_us(BENCH_LOOP_MS * 1000);
+        }
+        bench_result.wakeups++;
+
+        count = 0;
+        while((data = (modbus_data_t*) modbus_ring_acquire(&bench_ring)) != NULL)
+        {
+            bench_batch_add(data);
+            modbus_ring_release(&bench_ring);
+            count++;
+        }
+        bench_result.taken += count;
+        if(count > bench_result.max_drain)
+        {
+            bench_result.max_drain = count;
+        }
+        if(batch_due(&bench_batch, (uint32_t) bench_time_ms()))
+        {
+            bench_flush(BATCH_FLUSH_LATENCY);
+        }
+    }
+    return NULL;
+}
+
+static void bench_run(const bench_case_t *run)
+{
+    pthread_t poller, publisher;
+
+    memset(&bench_result, 0, sizeof(bench_result));
+    bench_run_case = run;
+    notify_count = 0;
+    atomic_store(&bench_stop, false);
+    modbus_ring_init(&bench_ring, bench_slot, sizeof(modbus_data_t), MODBUS_RING_SIZE);
+    batch_init(&bench_batch, bench_binary ? BATCH_FORMAT_BINARY : BATCH_FORMAT_JSON, bench_payload,
+               sizeof(bench_payload), bench_record, sizeof(bench_record), BATCH_MAX_LATENCY_MS);
+
+    pthread_create(&publisher, NULL, bench_publisher, NULL);
+    pthread_create(&poller, NULL, bench_poller, NULL);
+    bench_sleep_us(BENCH_DURATION_MS * 1000);
+    atomic_store(&bench_stop, true);
+    bench_notify();
+    pthread_join(poller, NULL);
+    pthread_join(publisher, NULL);
+
+    modbus_ring_get_stats(&bench_ring, &bench_result.ring);
+    bench_result.put = bench_result.ring.written;
+    printf("%-20s %10.0f %9llu %9llu %11llu %10.1f %9u %9llu %12llu\n", run->name,
+           bench_result.taken * 1000.0 / BENCH_DURATION_MS, (unsigned long long) bench_result.put,
+           (unsigned long long) bench_result.taken, (unsigned long long) bench_result.ring.overwritten,
+           bench_result.wakeups ? (double) bench_result.taken / bench_result.wakeups : 0.0, bench_result.ring.high_water,
+           (unsigned long long) bench_result.throttled_ms, (unsigned long long) bench_result.publishes);
+}
+
+int main(int argc, char *argv[])
+{
+    bench_binary = (argc > 1) && (strcmp(argv[1], "-b") == 0);
+
+    printf("%s readings, ring of %d, backpressure at %d, %d ms per run\n", bench_binary ? "binary" : "json",
+           MODBUS_RING_SIZE, MODBUS_RING_BACKPRESSURE, BENCH_DURATION_MS);
+    printf("%-20s %10s %9s %9s %11s %10s %9s %9s %12s\n", "", "taken/s", "put", "taken", "overwritten", "per wakeup",
+           "high", "wait ms", "publishes");
+    for(uint32_t i = 0; i < sizeof(bench_case) / sizeof(bench_case[0]); i++)
+    {
+        bench_run(&bench_case[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,514 @@
+/*
+ *  qos_bench.c
+ *
+ *  Created on: Mar 04, 2022
+ *
+ *  QoS 1 publishing through the in-flight window of src/mqtt_api/mqtt_window.c, against a broker.
+ *  A minimal MQTT 3.1.1 client publishes batches of readings for a few seconds per window size and
+ *  reports acked publishes per second, ack latency and retransmits. Like the ESP-IDF client, each
+ *  send gets a new packet id. "-l pct" ignores that share of PUBACKs to exercise retransmits, the
+ *  run ends with a check that every publish was acked.
+ *
+ *  Before the runs, acks are delivered before mqtt_window_sent() of their publish, as when the client task
+ *  outranks the publisher. Free slots are counted as window_free of mqtt_api.c: taken on each publish,
+ *  given back on each release. They must equal the publishes the window can still take afterwards.
+ *
+ *  Against a local Mosquitto:  mosquitto -p 1883 &  then  ./qos_bench -h 127.0.0.1 -p 1883
+ *  Without a broker, "-s" starts one in the bench that acks after "-r ms" round trip time.
+ *
+ *  Build: gcc -O2 -Wall -pthread -I../../src/mqtt_api -o qos_bench qos_bench.c ../../src/mqtt_api/mqtt_window.c
+ *  Run:   ./qos_bench [-h host] [-p port] [-s] [-r rtt_ms] [-l loss_pct] [-t retransmit_ms]
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "mqtt_window.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define BENCH_TOPIC                                   "DataBench"
+#define BENCH_PAYLOAD_SIZE                            512
+#define BENCH_TOPIC_MAX_LENGTH                        128   /* MQTT_TOPIC_MAX_LENGTH */
+#define BENCH_DATA_MAX_LENGTH                         1024  /* MQTT_DATA_MAX_LENGTH */
+#define BENCH_WINDOW_MAX                              16
+#define BENCH_RUN_MS                                  3000
+#define BENCH_DRAIN_MS                                30000 /* Longest wait for the last acks */
+#define BENCH_PACKET_SIZE                             2048
+#define BENCH_EARLY_ROUNDS                            4     /* Early acks per slot of the window */
+
+#define MQTT_CONNECT                                  0x10
+#define MQTT_CONNACK                                  0x20
+#define MQTT_PUBLISH                                  0x30
+#define MQTT_PUBACK                                   0x40
+#define MQTT_DISCONNECT                               0xE0
+#define MQTT_QOS1                                     0x02
+
+/*!
+ * @brief  Broker of the bench: acks each QoS 1 publish after the round trip time
+ */
+typedef struct {
+    int listen_fd;
+    uint16_t port;
+    uint32_t rtt_ms;
+} bench_broker_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static const uint32_t bench_window[] = { 1, 2, 4, 8, 16 };
+
+static uint32_t bench_loss = 0;
+static uint32_t bench_retransmit_ms = 1000;
+static uint32_t bench_seed = 1;
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static uint32_t bench_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) (ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static uint32_t bench_random(void)
+{
+    bench_seed = bench_seed * 1103515245 + 12345;
+    return bench_seed >> 8;
+}
+
+static bool bench_write(int fd, const uint8_t *data, uint32_t length)
+{
+    while(length > 0)
+    {
+        ssize_t n = write(fd, data, length);
+        if(n <= 0)
+        {
+            return false;
+        }
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+/* Fixed header: type and remaining length */
+static uint32_t bench_header(uint8_t *packet, uint8_t type, uint32_t remaining)
+{
+    uint32_t length = 0;
+
+    packet[length++] = type;
+    do
+    {
+        packet[length++] = (remaining & 0x7F) | ((remaining > 0x7F) ? 0x80 : 0);
+        remaining >>= 7;
+    } while(remaining > 0);
+    return length;
+}
+
+/*!
+ * @brief  Read one packet, waiting at most "wait_ms"
+ * @retval Length of the variable header and payload, -1 on timeout, -2 on error
+ */
+static int32_t bench_read(int fd, uint8_t *type, uint8_t *body, uint32_t size, uint32_t wait_ms)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    uint32_t remaining = 0, shift = 0, got = 0;
+    uint8_t byte;
+
+    if(poll(&pfd, 1, wait_ms) <= 0)
+    {
+        return -1;
+    }
+    if(read(fd, type, 1) != 1)
+    {
+        return -2;
+    }
+    do
+    {
+        if(read(fd, &byte, 1) != 1)
+        {
+            return -2;
+        }
+        remaining |= (byte & 0x7F) << shift;
+        shift += 7;
+    } while(byte & 0x80);
+    if(remaining > size)
+    {
+        return -2;
+    }
+    while(got < remaining)
+    {
+        ssize_t n = read(fd, &body[got], remaining - got);
+        if(n <= 0)
+        {
+            return -2;
+        }
+        got += n;
+    }
+    return remaining;
+}
+
+/* Broker: one client, CONNACK then PUBACK of each QoS 1 publish once its round trip time is over */
+static void* bench_broker_task(void *arg)
+{
+    bench_broker_t *broker = (bench_broker_t*) arg;
+    static uint8_t body[BENCH_PACKET_SIZE];
+    uint16_t ack_id[4096];
+    uint32_t ack_ms[4096];
+    uint32_t ack_head = 0, ack_tail = 0;
+    uint8_t packet[8], type;
+    int32_t length;
+    int fd;
+
+    while((fd = accept(broker->listen_fd, NULL, NULL)) >= 0)
+    {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        ack_head = ack_tail = 0;
+        while(1)
+        {
+            uint32_t now = bench_time_ms();
+            uint32_t wait = 50;
+            while((ack_tail != ack_head) && ((int32_t) (now - ack_ms[ack_tail % 4096]) >= 0))
+            {
+                uint32_t n = bench_header(packet, MQTT_PUBACK, 2);
+                packet[n++] = ack_id[ack_tail % 4096] >> 8;
+                packet[n++] = ack_id[ack_tail % 4096];
+                bench_write(fd, packet, n);
+                ack_tail++;
+            }
+            if(ack_tail != ack_head)
+            {
+                wait = ack_ms[ack_tail % 4096] - now;
+            }
+
+            length = bench_read(fd, &type, body, sizeof(body), wait);
+            if(length == -1)
+            {
+                continue;
+            }
+            if((length < 0) || ((type & 0xF0) == MQTT_DISCONNECT))
+            {
+                break;
+            }
+            if((type & 0xF0) == MQTT_CONNECT)
+            {
+                uint32_t n = bench_header(packet, MQTT_CONNACK, 2);
+                packet[n++] = 0;
+                packet[n++] = 0;
+                bench_write(fd, packet, n);
+            }
+            else if(((type & 0xF0) == MQTT_PUBLISH) && (type & MQTT_QOS1))
+            {
+                uint32_t topic_length = (body[0] << 8) | body[1];
+                ack_id[ack_head % 4096] = (body[2 + topic_length] << 8) | body[3 + topic_length];
+                ack_ms[ack_head % 4096] = now + broker->rtt_ms;
+                ack_head++;
+            }
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+static bool bench_broker_start(bench_broker_t *broker)
+{
+    struct sockaddr_in addr = { 0 };
+    socklen_t addr_length = sizeof(addr);
+    pthread_t thread;
+
+    broker->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if((bind(broker->listen_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) ||
+       (listen(broker->listen_fd, 1) != 0) ||
+       (getsockname(broker->listen_fd, (struct sockaddr*) &addr, &addr_length) != 0))
+    {
+        return false;
+    }
+    broker->port = ntohs(addr.sin_port);
+    return pthread_create(&thread, NULL, bench_broker_task, broker) == 0;
+}
+
+static int bench_connect(const char *host, uint16_t port)
+{
+    static const uint8_t connect_body[] = {
+        0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x02, 0x00, 0x3C,      /* 3.1.1, clean session, keep alive 60 s */
+        0x00, 0x09, 'q', 'o', 's', '_', 'b', 'e', 'n', 'c', 'h',
+    };
+    struct sockaddr_in addr = { 0 };
+    uint8_t packet[64], type, body[8];
+    uint32_t length;
+    int one = 1;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, host, &addr.sin_addr);
+    if(connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0)
+    {
+        printf("Cannot connect to %s:%u\n", host, port);
+        close(fd);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    length = bench_header(packet, MQTT_CONNECT, sizeof(connect_body));
+    memcpy(&packet[length], connect_body, sizeof(connect_body));
+    bench_write(fd, packet, length + sizeof(connect_body));
+    if((bench_read(fd, &type, body, sizeof(body), 5000) != 2) || (type != MQTT_CONNACK) || (body[1] != 0))
+    {
+        printf("No CONNACK from %s:%u\n", host, port);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* QoS 1 publish with a new packet id, as esp_mqtt_client_publish() */
+static int32_t bench_publish(int fd, const char *topic, const uint8_t *data, uint16_t length)
+{
+    static uint16_t packet_id = 0;
+    static uint8_t packet[BENCH_PACKET_SIZE];
+    uint32_t topic_length = strlen(topic);
+    uint32_t n = bench_header(packet, MQTT_PUBLISH | MQTT_QOS1, 2 + topic_length + 2 + length);
+
+    packet_id = (packet_id % 0xFFFF) + 1;
+    packet[n++] = topic_length >> 8;
+    packet[n++] = topic_length;
+    memcpy(&packet[n], topic, topic_length);
+    n += topic_length;
+    packet[n++] = packet_id >> 8;
+    packet[n++] = packet_id;
+    memcpy(&packet[n], data, length);
+    return bench_write(fd, packet, n + length) ? packet_id : -1;
+}
+
+/* Send what the window has due, new publishes first go through mqtt_window_put() */
+static void bench_send_due(int fd, mqtt_window_t *window)
+{
+    mqtt_window_slot_t *slot;
+    const uint8_t *data;
+    const char *topic;
+    uint16_t length;
+
+    while((slot = mqtt_window_next_due(window, bench_time_ms())) != NULL)
+    {
+        uint32_t seq = slot->seq;
+        topic = mqtt_window_get(window, slot, &data, &length);
+        mqtt_window_sent(window, slot, seq, bench_publish(fd, topic, data, length), bench_time_ms());
+    }
+}
+
+/* Take acks for at most "wait_ms" */
+static bool bench_take_acks(int fd, mqtt_window_t *window, uint32_t wait_ms)
+{
+    uint8_t type, body[BENCH_PACKET_SIZE];
+    int32_t length = bench_read(fd, &type, body, sizeof(body), wait_ms);
+
+    while(length >= 0)
+    {
+        if((type == MQTT_PUBACK) && (length == 2) && ((bench_random() % 100) >= bench_loss))
+        {
+            mqtt_window_ack(window, (body[0] << 8) | body[1], bench_time_ms());
+        }
+        length = bench_read(fd, &type, body, sizeof(body), 0);
+    }
+    return length != -2;
+}
+
+/* Acks before the send is recorded: each release must give its free slot back */
+static bool bench_early_acks(uint32_t size)
+{
+    static mqtt_window_slot_t slot[BENCH_WINDOW_MAX];
+    static uint8_t storage[BENCH_WINDOW_MAX][BENCH_TOPIC_MAX_LENGTH + BENCH_DATA_MAX_LENGTH];
+    uint8_t payload[BENCH_PAYLOAD_SIZE] = "{\"seq\":0}";
+    mqtt_window_slot_t *put;
+    mqtt_window_t window;
+    uint32_t free_slots = size, refused = 0, available = 0;
+    int32_t msg_id = 0;
+    bool pass;
+
+    mqtt_window_init(&window, slot, size, &storage[0][0], sizeof(storage[0]), bench_retransmit_ms);
+    for(uint32_t i = 0; i < size * BENCH_EARLY_ROUNDS; i++)
+    {
+        /* xSemaphoreTake(window_free) of mqtt_window_publish() */
+        if(free_slots == 0)
+        {
+            refused++;
+            continue;
+        }
+        free_slots--;
+        put = mqtt_window_put(&window, BENCH_TOPIC, payload, sizeof(payload));
+        if(put == NULL)
+        {
+            refused++;
+            continue;
+        }
+        /* Every other publish is acked early, the others after the send */
+        msg_id++;
+        if((i % 2) == 0)
+        {
+            mqtt_window_ack(&window, msg_id, bench_time_ms());
+        }
+        if(mqtt_window_sent(&window, put, put->seq, msg_id, bench_time_ms()))
+        {
+            free_slots++;
+        }
+        if(((i % 2) != 0) && mqtt_window_ack(&window, msg_id, bench_time_ms()))
+        {
+            free_slots++;
+        }
+    }
+    while(mqtt_window_put(&window, BENCH_TOPIC, payload, sizeof(payload)) != NULL)
+    {
+        available++;
+    }
+
+    pass = (refused == 0) && (window.stats.unknown_acks == 0) && (free_slots == available) && (available == size);
+    printf("early acks, window %2u: %u publishes, %u refused, %u free slots, %u publishes available: %s\n", size,
+           size * BENCH_EARLY_ROUNDS, refused, free_slots, available, pass ? "pass" : "FAIL");
+    return pass;
+}
+
+static bool bench_run(const char *host, uint16_t port, uint32_t size)
+{
+    static mqtt_window_slot_t slot[BENCH_WINDOW_MAX];
+    static uint8_t storage[BENCH_WINDOW_MAX][BENCH_TOPIC_MAX_LENGTH + BENCH_DATA_MAX_LENGTH];
+    uint8_t payload[BENCH_PAYLOAD_SIZE];
+    mqtt_window_stats_t stats;
+    mqtt_window_t window;
+    uint32_t start, end, put = 0, acked;
+    uint8_t disconnect[2] = { MQTT_DISCONNECT, 0 };
+    int fd = bench_connect(host, port);
+
+    if(fd < 0)
+    {
+        return false;
+    }
+    mqtt_window_init(&window, slot, size, &storage[0][0], sizeof(storage[0]), bench_retransmit_ms);
+
+    start = bench_time_ms();
+    while((bench_time_ms() - start) < BENCH_RUN_MS)
+    {
+        /* Fill the window, as publisher task with mqtt_api_publish() */
+        while(window.stats.in_flight < size)
+        {
+            snprintf((char*) payload, sizeof(payload), "{\"seq\":%u}", put++);
+            mqtt_window_put(&window, BENCH_TOPIC, payload, sizeof(payload));
+        }
+        bench_send_due(fd, &window);
+        if(!bench_take_acks(fd, &window, 10))
+        {
+            printf("Connection lost\n");
+            close(fd);
+            return false;
+        }
+    }
+    acked = window.stats.acked;
+    end = bench_time_ms();
+
+    /* Every publish must be acked, sent again if needed */
+    while((window.stats.in_flight > 0) && ((bench_time_ms() - end) < BENCH_DRAIN_MS))
+    {
+        bench_send_due(fd, &window);
+        bench_take_acks(fd, &window, 10);
+    }
+    bench_write(fd, disconnect, sizeof(disconnect));
+    close(fd);
+
+    mqtt_window_get_stats(&window, &stats);
+    printf("%6u %10.0f %9u %9u %11u %9u %9u %12u %s\n", size, acked * 1000.0 / (end - start), put, stats.acked,
+           stats.retransmits, stats.ack_latency_avg, stats.ack_latency_max, stats.max_in_flight,
+           (stats.in_flight == 0) ? "all acked" : "NOT ACKED");
+    return stats.in_flight == 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *host = "127.0.0.1";
+    uint16_t port = 1883;
+    bool self = false;
+    bench_broker_t broker = { .rtt_ms = 50 };
+    bool ok = true;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if((strcmp(argv[i], "-h") == 0) && (i + 1 < argc))
+        {
+            host = argv[++i];
+        }
+        else if((strcmp(argv[i], "-p") == 0) && (i + 1 < argc))
+        {
+            port = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "-s") == 0)
+        {
+            self = true;
+        }
+        else if((strcmp(argv[i], "-r") == 0) && (i + 1 < argc))
+        {
+            broker.rtt_ms = atoi(argv[++i]);
+        }
+        else if((strcmp(argv[i], "-l") == 0) && (i + 1 < argc))
+        {
+            bench_loss = atoi(argv[++i]);
+        }
+        else if((strcmp(argv[i], "-t") == 0) && (i + 1 < argc))
+        {
+            bench_retransmit_ms = atoi(argv[++i]);
+        }
+        else
+        {
+            printf("usage: qos_bench [-h host] [-p port] [-s] [-r rtt_ms] [-l loss_pct] [-t retransmit_ms]\n");
+            return 2;
+        }
+    }
+    for(uint32_t i = 0; i < sizeof(bench_window) / sizeof(bench_window[0]); i++)
+    {
+        ok = bench_early_acks(bench_window[i]) && ok;
+    }
+
+    if(self)
+    {
+        if(!bench_broker_start(&broker))
+        {
+            printf("Cannot start the bench broker\n");
+            return 1;
+        }
+        host = "127.0.0.1";
+        port = broker.port;
+        printf("Bench broker, round trip %u ms\n", broker.rtt_ms);
+    }
+
+    printf("%s:%u, %d byte publishes, %d ms per run, %u%% acks lost, retransmit after %u ms\n", host, port,
+           BENCH_PAYLOAD_SIZE, BENCH_RUN_MS, bench_loss, bench_retransmit_ms);
+    printf("%6s %10s %9s %9s %11s %9s %9s %12s\n", "window", "acked/s", "put", "acked", "retransmits", "ack avg",
+           "ack max", "max flight");
+    for(uint32_t i = 0; i < sizeof(bench_window) / sizeof(bench_window[0]); i++)
+    {
+        ok = bench_run(host, port, bench_window[i]) && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,385 @@
+/*
+ *  report_bench.c
+ *
+ *  Created on: Feb 24, 2022
+ *
+ *  Replay of water meter readings through the report-by-exception filter of src/modbus_api/modbus_report.c.
+ *  Each reading is encoded as json and binary with src/modbus_api/modbus_telemetry.c, once with every
+ *  register and once with the registers the filter lets through, to show the traffic saved.
+ *
+ *  The trace is a csv file of "time,slave,register,value" lines, time in second, register by key as in
+ *  the json. Lines of the same time and slave make one reading, their registers must follow each other
+ *  like a poll group. Without a file, a day of two meters polled by the groups of modbus_table.h is
+ *  simulated; "-w file" writes it in the same format.
+ *
+ *  Build: gcc -O2 -Wall -I../telemetry_bench -I../../src -I../../src/modbus_api -o report_bench report_bench.c \
+ *             ../../src/modbus_api/modbus_report.c ../../src/modbus_api/modbus_telemetry.c \
+ *             ../../src/modbus_api/modbus_decode.c ../../src/modbus_api/modbus_table.c \
+ *             ../../src/utility/json_writer.c ../../src/utility/bin_writer.c ../../src/utility/utility.c -lm
+ *  Run:   ./report_bench [trace.csv] [-w trace.csv]
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include "config.h"
+#include "modbus_report.h"
+#include "modbus_telemetry.h"
+
+#ifdef ELECTRIC_METER_USED
+#error "report_bench replays water meter readings"
+#endif
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define BENCH_SLAVES                                  2
+#define BENCH_DURATION_S                              86400
+#define BENCH_TICK_MS                                 500
+#define BENCH_BUFFER_SIZE                             4096
+
+/*!
+ * @brief  Traffic of one way of reporting
+ */
+typedef struct {
+    uint64_t readings;
+    uint64_t regs;
+    uint64_t json_bytes;
+    uint64_t binary_bytes;
+} bench_traffic_t;
+
+/*!
+ * @brief  Simulated meter, values in register units
+ */
+typedef struct {
+    double power;                                     /* W */
+    double energy_in;                                 /* Wh */
+    double energy_out;
+    double ground[6];
+    double voltage[3];
+    double water_l;
+    double gaz_l;
+    double heater_wh;
+    double temperature;                               /* 0.1 degree */
+    uint32_t tap_until;                               /* Water flows until this time */
+    uint32_t load_until;                              /* Appliance on until this time */
+} bench_meter_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static const char *bench_reg_name[MB_WATER_NUMBER_OF_REG] = {
+#define XTABLE_ITEM(id, name, type, address, size, flag, report, threshold, silence) #name,
+    MODBUS_WATER_INPUT_REGS
+#undef XTABLE_ITEM
+};
+
+static const struct {
+    modbus_reg_id first;
+    modbus_reg_id last;
+    uint32_t period;
+} bench_group[MB_WATER_NUMBER_OF_GROUP] = {
+#define XGROUP_ITEM(id, first, last, period) { first, last, period },
+    MODBUS_WATER_POLL_GROUPS
+#undef XGROUP_ITEM
+};
+
+static uint32_t bench_seed = 12345;
+static modbus_report_t bench_report;
+static modbus_report_last_t bench_last[BENCH_SLAVES];
+static bench_traffic_t bench_all, bench_exception;
+static FILE *bench_out;
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+/* Uniform in [0, 1) */
+static double bench_random(void)
+{
+    bench_seed = bench_seed * 1103515245 + 12345;
+    return (bench_seed >> 8) / 16777216.0;
+}
+
+/* Gaussian noise of a standard deviation */
+static double bench_noise(double sigma)
+{
+    return sigma * (bench_random() + bench_random() + bench_random() - 1.5) * 2.0;
+}
+
+static void bench_set(modbus_data_t *data, modbus_reg_id reg, int32_t value)
+{
+    uint8_t *slot = &data->data[(modbus_water_offset[reg] - modbus_water_offset[data->start]) * 2];
+
+    slot[0] = (uint32_t) value >> 24;
+    slot[1] = (uint32_t) value >> 16;
+    slot[2] = (uint32_t) value >> 8;
+    slot[3] = (uint32_t) value;
+}
+
+static void bench_count(bench_traffic_t *traffic, modbus_data_t *data, uint8_t slave)
+{
+    static char json[BENCH_BUFFER_SIZE];
+    static uint8_t binary[BENCH_BUFFER_SIZE];
+
+    traffic->readings++;
+    for(modbus_reg_id reg = data->start; reg <= data->stop; reg++)
+    {
+        traffic->regs += (data->report & MODBUS_REPORT_BIT(reg)) ? 1 : 0;
+    }
+    traffic->json_bytes += modbus_telemetry_to_json(data, &slave, json, sizeof(json));
+    traffic->binary_bytes += modbus_telemetry_to_binary(data, &slave, binary, sizeof(binary));
+}
+
+/* One reading through both ways of reporting, as modbus_api_reading_put() does */
+static void bench_replay(modbus_data_t *data, uint8_t slave)
+{
+    modbus_report_last_t *last = &bench_last[slave % BENCH_SLAVES];
+
+    data->meter = WATER_METER;
+    data->slave_id = slave;
+    data->report = MODBUS_REPORT_ALL;
+    bench_count(&bench_all, data, slave);
+
+    data->report = modbus_report_check(&bench_report, last, &slave, data);
+    if(data->report != 0)
+    {
+        bench_count(&bench_exception, data, slave);
+        modbus_report_commit(last, &slave, data);
+    }
+
+    if(bench_out != NULL)
+    {
+        for(modbus_reg_id reg = data->start; reg <= data->stop; reg++)
+        {
+            const uint8_t *b = &data->data[(modbus_water_offset[reg] - modbus_water_offset[data->start]) * 2];
+            fprintf(bench_out, "%u,%u,%s,%d\n", data->time, slave, bench_reg_name[reg],
+                    (int32_t) (((uint32_t) b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3]));
+        }
+    }
+}
+
+/* Household: base load with appliances, mains voltage, taps and a heater */
+static void bench_meter_step(bench_meter_t *meter, uint32_t now, double dt)
+{
+    if((meter->load_until < now) && (bench_random() < dt / 1800.0))
+    {
+        meter->load_until = now + 60 + (uint32_t) (bench_random() * 1800);
+    }
+    meter->power = ((meter->load_until > now) ? 2000.0 : 300.0) * (1.0 + bench_noise(0.005));
+    meter->energy_in += meter->power * dt / 3600.0;
+    meter->energy_out += 5.0 * dt / 3600.0;
+    for(uint32_t i = 0; i < 6; i++)
+    {
+        meter->ground[i] += (10.0 + i) * dt / 3600.0;
+    }
+    for(uint32_t i = 0; i < 3; i++)
+    {
+        meter->voltage[i] = 230000.0 * (1.0 + bench_noise(0.002));
+    }
+    if((meter->tap_until < now) && (bench_random() < dt / 7200.0))
+    {
+        meter->tap_until = now + 30 + (uint32_t) (bench_random() * 300);
+    }
+    if(meter->tap_until > now)
+    {
+        meter->water_l += 0.15 * dt;
+        meter->gaz_l += 0.02 * dt;
+        meter->heater_wh += 8.0 * dt;
+    }
+    meter->temperature += bench_noise(0.5) * dt / 60.0 + (450.0 - meter->temperature) * dt / 3600.0;
+}
+
+static int32_t bench_meter_value(const bench_meter_t *meter, modbus_reg_id reg, uint32_t now)
+{
+    bool tap = (meter->tap_until > now);
+
+    switch(reg)
+    {
+    case MB_POWER_RECEIVE_WH: return (int32_t) meter->energy_in;
+    case MB_POWER_TRANSMISS_WH: return (int32_t) meter->energy_out;
+    case MB_WATT_RECEIVE: return (int32_t) meter->power;
+    case MB_WATT_TRANSMISS: return 5;
+    case MB_POWER_GROUND_VAR: return (int32_t) meter->ground[2];
+    case MB_WATT_GROUND_VAR: return (int32_t) (meter->power * 0.1);
+    case MB_VOLTAGE_1: case MB_VOLTAGE_2: case MB_VOLTAGE_3: return (int32_t) meter->voltage[reg - MB_VOLTAGE_1];
+    case MB_CURRENT_1: case MB_CURRENT_2: case MB_CURRENT_3: return (int32_t) (meter->power / 0.23 / 3.0);
+    case MB_PHASE_1: case MB_PHASE_2: case MB_PHASE_3: return 980 + (int32_t) bench_noise(2.0);
+    case MB_FREQUENCY: return 5000 + (int32_t) bench_noise(2.0);
+    case MB_POWER_RELAY: return 1;
+    case MB_WATER_M3: return (int32_t) meter->water_l;
+    case MB_CHECK_FLOW: case MB_WATER_HOT_CHECK_FLOW: case MB_HEATER_CHECK_FLOW: return tap ? 1 : 0;
+    case MB_WATER_HOT_M3: return (int32_t) (meter->water_l * 0.4);
+    case MB_GAZ_M3: return (int32_t) meter->gaz_l;
+    case MB_GAZ_FLOW: return tap ? 20 + (int32_t) bench_noise(1.0) : 0;
+    case MB_HEATER_KW: return (int32_t) (meter->heater_wh / 1000.0);
+    case MB_HEATER_FLOW: return tap ? 150 + (int32_t) bench_noise(5.0) : 0;
+    case MB_ID5_M3: return 0;
+    case MB_HEATER_TEMPERATURE: return (int32_t) meter->temperature;
+    default: return (int32_t) meter->ground[reg - MB_POWER_GROUND_RECV_WARH1 - ((reg > MB_POWER_GROUND_VAR) ? 2 : 0)];
+    }
+}
+
+/* A day of BENCH_SLAVES meters, each poll group read on its period */
+static void bench_simulate(void)
+{
+    static bench_meter_t meter[BENCH_SLAVES];
+    static modbus_data_t data;
+    uint32_t base = 1645574400;
+
+    for(uint32_t s = 0; s < BENCH_SLAVES; s++)
+    {
+        meter[s].energy_in = 1234567 + s * 1000;
+        meter[s].temperature = 450;
+    }
+    for(uint32_t ms = 0; ms < BENCH_DURATION_S * 1000; ms += BENCH_TICK_MS)
+    {
+        uint32_t now = base + ms / 1000;
+        for(uint32_t s = 0; s < BENCH_SLAVES; s++)
+        {
+            bench_meter_step(&meter[s], now, BENCH_TICK_MS / 1000.0);
+            for(uint32_t g = 0; g < MB_WATER_NUMBER_OF_GROUP; g++)
+            {
+                if((ms % bench_group[g].period) != 0)
+                {
+                    continue;
+                }
+                memset(&data, 0, sizeof(data));
+                data.start = bench_group[g].first;
+                data.stop = bench_group[g].last;
+                data.time = now;
+                for(modbus_reg_id reg = data.start; reg <= data.stop; reg++)
+                {
+                    bench_set(&data, reg, bench_meter_value(&meter[s], reg, now));
+                }
+                bench_replay(&data, s + 1);
+            }
+        }
+    }
+}
+
+static modbus_reg_id bench_find(const char *name)
+{
+    for(modbus_reg_id reg = 0; reg < MB_WATER_NUMBER_OF_REG; reg++)
+    {
+        if(strcmp(bench_reg_name[reg], name) == 0)
+        {
+            return reg;
+        }
+    }
+    return MB_WATER_INVALID_ID;
+}
+
+/* Replay a csv trace, lines of the same time and slave are one reading */
+static bool bench_load(const char *path)
+{
+    static modbus_data_t data;
+    char line[256], name[64];
+    unsigned time, slave, last_time = 0, last_slave = 0;
+    int value;
+    bool open = false;
+    modbus_reg_id reg;
+    FILE *file = fopen(path, "r");
+
+    if(file == NULL)
+    {
+        printf("Cannot open %s\n", path);
+        return false;
+    }
+    while(fgets(line, sizeof(line), file) != NULL)
+    {
+        if(sscanf(line, "%u,%u,%63[^,],%d", &time, &slave, name, &value) != 4)
+        {
+            continue;
+        }
+        reg = bench_find(name);
+        if(reg == MB_WATER_INVALID_ID)
+        {
+            printf("Unknown register %s\n", name);
+            continue;
+        }
+        if(open && ((time != last_time) || (slave != last_slave) || (reg != data.stop + 1)))
+        {
+            bench_replay(&data, last_slave);
+            open = false;
+        }
+        if(!open)
+        {
+            memset(&data, 0, sizeof(data));
+            data.start = reg;
+            data.time = time;
+            open = true;
+        }
+        data.stop = reg;
+        bench_set(&data, reg, value);
+        last_time = time;
+        last_slave = slave;
+    }
+    if(open)
+    {
+        bench_replay(&data, last_slave);
+    }
+    fclose(file);
+    return true;
+}
+
+static void bench_print(const char *name, const bench_traffic_t *traffic)
+{
+    printf("%-20s %10llu %12llu %14llu %14llu\n", name, (unsigned long long) traffic->readings,
+           (unsigned long long) traffic->regs, (unsigned long long) traffic->json_bytes,
+           (unsigned long long) traffic->binary_bytes);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *trace = NULL;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if((strcmp(argv[i], "-w") == 0) && (i + 1 < argc))
+        {
+            bench_out = fopen(argv[++i], "w");
+        }
+        else
+        {
+            trace = argv[i];
+        }
+    }
+
+    if(trace != NULL)
+    {
+        if(!bench_load(trace))
+        {
+            return 1;
+        }
+    }
+    else
+    {
+        bench_simulate();
+    }
+    if(bench_out != NULL)
+    {
+        fclose(bench_out);
+    }
+
+    printf("%-20s %10s %12s %14s %14s\n", "", "readings", "registers", "json bytes", "binary bytes");
+    bench_print("every reading", &bench_all);
+    bench_print("report by exception", &bench_exception);
+    printf("Saved: %.1f%% of readings, %.1f%% of json bytes, %.1f%% of binary bytes, %u registers refreshed\n",
+           100.0 * (1.0 - (double) bench_exception.readings / bench_all.readings),
+           100.0 * (1.0 - (double) bench_exception.json_bytes / bench_all.json_bytes),
+           100.0 * (1.0 - (double) bench_exception.binary_bytes / bench_all.binary_bytes),
+           bench_report.stats.regs_refreshed);
+    return 0;
+}
@@ -0,0 +1,340 @@
+/*
+ *  ring_bench.c
+ *
+ *  Created on: Mar 18, 2022
+ *
+ *  Reading ring of src/modbus_api/modbus_ring.c against the FreeRTOS queue it replaced, on host threads.
+ *  The queue is the one of the UART shim (mutex and condition variables, items copied by value on send
+ *  and receive), used as modbus_api_queue_put() and modbus_api_queue_get() of the single bus firmware
+ *  did: a reading built on the stack is sent, and when the queue is full the oldest is received and
+ *  the send tried again. The ring is filled and read in place. Both carry modbus_data_t.
+ *
+ *  Reported: RAM of each, time of a put and a get on one thread, readings per second from a producer to
+ *  a consumer thread with the backpressure of the poller. Then a producer runs against a slow consumer
+ *  that holds each slot a long time: no reading may be torn or out of order, the ring counters
+ *  must add up, written = read + overwritten and written + dropped = offered, with overwrites and drops
+ *  both seen. The queue makes the producer wait instead, its rate is shown.
+ *
+ *  Build: gcc -O2 -Wall -I../uart_shim -I../../src -I../../src/modbus_api -o ring_bench ring_bench.c
+ *         ../uart_shim/uart_shim.c ../../src/modbus_api/modbus_ring.c -lpthread
+ *  Run:   ./ring_bench [-n readings]
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "uart_shim.h"
+#include "config.h"
+#include "modbus_api.h"
+#include "modbus_ring.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define BENCH_READINGS                                2000000
+#define BENCH_SLOW_READINGS                           1000000
+#define BENCH_SLOW_QUEUE_READINGS                     10000 /* The queue makes the producer wait for the consumer */
+#define BENCH_HOLD_LOOPS                              100000 /* Work of the slow consumer on a slot */
+#define BENCH_PACE_LOOPS                              100   /* Work of the producer on a reading */
+#define BENCH_QUEUE_CONTROL                           84    /* sizeof(StaticQueue_t) of ESP-IDF FreeRTOS */
+
+/* Queue of the single bus firmware: 128 readings with a 128 byte payload */
+#define BENCH_OLD_QUEUE_SIZE                          128
+#define BENCH_OLD_PAYLOAD                             128
+
+typedef struct
+{
+    meter_type_t meter;
+    uint8_t slave_id;
+    modbus_reg_id start;
+    modbus_reg_id stop;
+    uint8_t data[BENCH_OLD_PAYLOAD];
+} bench_old_data_t;
+
+/*!
+ * @brief  One run of a producer and a consumer thread
+ */
+typedef struct {
+    bool ring;                                        /* modbus_ring.c, or the queue */
+    uint32_t count;                                   /* Readings offered by the producer */
+    uint32_t hold;                                    /* Loops of the consumer on each reading */
+    uint32_t pace;                                    /* Loops of the producer before each reading */
+    bool backpressure;                                /* Ring: producer waits above MODBUS_RING_BACKPRESSURE */
+    volatile bool done;                               /* Producer finished */
+    uint32_t put;                                     /* Queue: readings sent */
+    uint32_t replaced;                                /* Queue: oldest received to make room */
+    uint32_t failed;                                  /* Queue: send failed again */
+    uint32_t read;
+    uint32_t torn;                                    /* Reading with mixed contents */
+    uint32_t disorder;                                /* Reading not newer than the previous one */
+    uint64_t producer_us;
+    uint64_t total_us;                                /* Until the consumer has read the last reading */
+} bench_run_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static modbus_ring_t ring;
+static modbus_data_t reading[MODBUS_RING_SIZE];
+static QueueHandle_t queue;
+static volatile uint32_t sink;
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static void bench_fill(modbus_data_t *data, uint32_t seq)
+{
+    data->meter = WATER_METER;
+    data->bus = 0;
+    data->slave_id = seq % MAX_SLAVE_ID;
+    data->time = seq;
+    data->report = MODBUS_REPORT_ALL;
+    memset(data->data, (uint8_t) seq, sizeof(data->data));
+}
+
+/* Reading is whole and newer than the last one */
+static void bench_check(bench_run_t *run, const modbus_data_t *data, int64_t *last)
+{
+    bool whole = (data->slave_id == data->time % MAX_SLAVE_ID);
+
+    for(uint32_t i = 0; i < sizeof(data->data); i++)
+    {
+        whole = whole && (data->data[i] == (uint8_t) data->time);
+    }
+    for(uint32_t i = 0; i < run->hold; i++)
+    {
+        sink += data->data[i % sizeof(data->data)];
+    }
+    run->torn += whole ? 0 : 1;
+    run->disorder += ((int64_t) data->time > *last) ? 0 : 1;
+    *last = data->time;
+    run->read++;
+}
+
+/* modbus_api_queue_put() of the single bus firmware */
+static void bench_queue_put(bench_run_t *run, modbus_data_t *data)
+{
+    modbus_data_t tmp;
+
+    if(xQueueSend(queue, data, pdMS_TO_TICKS(MODBUS_QUEUE_TIMEOUT_MS)) == pdPASS)
+    {
+        run->put++;
+        return;
+    }
+    xQueueReceive(queue, &tmp, pdMS_TO_TICKS(MODBUS_QUEUE_TIMEOUT_MS));
+    run->replaced++;
+    if(xQueueSend(queue, data, pdMS_TO_TICKS(MODBUS_QUEUE_TIMEOUT_MS)) == pdPASS)
+    {
+        run->put++;
+        return;
+    }
+    run->failed++;
+}
+
+static void *bench_producer(void *arg)
+{
+    bench_run_t *run = arg;
+    uint64_t start = uart_shim_now_us();
+    modbus_data_t data;
+    modbus_data_t *slot;
+
+    for(uint32_t seq = 0; seq < run->count; seq++)
+    {
+        for(uint32_t i = 0; i < run->pace; i++)
+        {
+            sink += i;
+        }
+        if(run->ring)
+        {
+            /* As the poller, which waits for the reader task instead of overwriting */
+            while(run->backpressure && (modbus_ring_count(&ring) >= MODBUS_RING_BACKPRESSURE))
+            {
+                sched_yield();
+            }
+            slot = (modbus_data_t*) modbus_ring_produce(&ring);
+            if(slot != NULL)
+            {
+                bench_fill(slot, seq);
+                modbus_ring_commit(&ring);
+            }
+        }
+        else
+        {
+            bench_fill(&data, seq);
+            bench_queue_put(run, &data);
+        }
+    }
+    run->producer_us = uart_shim_now_us() - start;
+    run->done = true;
+    return NULL;
+}
+
+static void *bench_consumer(void *arg)
+{
+    bench_run_t *run = arg;
+    modbus_data_t data;
+    modbus_data_t *slot;
+    int64_t last = -1;
+    bool done;
+
+    do
+    {
+        /* Read "done" first, what was produced before it is drained after */
+        done = run->done;
+        if(run->ring)
+        {
+            while((slot = (modbus_data_t*) modbus_ring_acquire(&ring)) != NULL)
+            {
+                bench_check(run, slot, &last);
+                modbus_ring_release(&ring);
+            }
+            sched_yield();
+        }
+        else
+        {
+            while(xQueueReceive(queue, &data, done ? 0 : pdMS_TO_TICKS(MODBUS_QUEUE_TIMEOUT_MS)) == pdPASS)
+            {
+                bench_check(run, &data, &last);
+            }
+        }
+    } while(!done);
+    return NULL;
+}
+
+static void bench_run(bench_run_t *run)
+{
+    pthread_t producer, consumer;
+    uint64_t start = uart_shim_now_us();
+
+    modbus_ring_init(&ring, reading, sizeof(modbus_data_t), MODBUS_RING_SIZE);
+    xQueueReset(queue);
+    pthread_create(&consumer, NULL, bench_consumer, run);
+    pthread_create(&producer, NULL, bench_producer, run);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+    run->total_us = uart_shim_now_us() - start;
+}
+
+/* Put and get of one reading in turn on one thread, in ns */
+static double bench_single(bool use_ring, uint32_t count)
+{
+    bench_run_t run = {.ring = use_ring};
+    uint64_t start = uart_shim_now_us();
+    modbus_data_t data;
+    modbus_data_t *slot;
+    int64_t last = -1;
+
+    modbus_ring_init(&ring, reading, sizeof(modbus_data_t), MODBUS_RING_SIZE);
+    xQueueReset(queue);
+    for(uint32_t seq = 0; seq < count; seq++)
+    {
+        if(use_ring)
+        {
+            slot = (modbus_data_t*) modbus_ring_produce(&ring);
+            bench_fill(slot, seq);
+            modbus_ring_commit(&ring);
+            slot = (modbus_data_t*) modbus_ring_acquire(&ring);
+            bench_check(&run, slot, &last);
+            modbus_ring_release(&ring);
+        }
+        else
+        {
+            bench_fill(&data, seq);
+            bench_queue_put(&run, &data);
+            xQueueReceive(queue, &data, 0);
+            bench_check(&run, &data, &last);
+        }
+    }
+    return (uart_shim_now_us() - start) * 1000.0 / count;
+}
+
+int main(int argc, char *argv[])
+{
+    modbus_ring_stats_t stats;
+    bench_run_t run;
+    uint32_t count = BENCH_READINGS;
+    uint32_t ring_ram, queue_ram, old_ram;
+    bool pass = true, ok;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:")) != -1)
+    {
+        switch(opt)
+        {
+        case 'n': count = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "Usage: %s [-n readings]\n", argv[0]);
+            return 2;
+        }
+    }
+    queue = xQueueCreate(MODBUS_RING_SIZE, sizeof(modbus_data_t));
+
+    ring_ram = sizeof(modbus_ring_t) + sizeof(reading);
+    queue_ram = BENCH_QUEUE_CONTROL + MODBUS_RING_SIZE * sizeof(modbus_data_t);
+    old_ram = BENCH_QUEUE_CONTROL + BENCH_OLD_QUEUE_SIZE * sizeof(bench_old_data_t);
+    printf("modbus_data_t %u bytes, %u readings per bus\n", (uint32_t) sizeof(modbus_data_t), MODBUS_RING_SIZE);
+    printf("RAM per bus: ring %u bytes, queue of the same depth %u bytes, queue of the single bus firmware "
+           "%u bytes (%u x %u)\n", ring_ram, queue_ram, old_ram, BENCH_OLD_QUEUE_SIZE, (uint32_t) sizeof(bench_old_data_t));
+    printf("reading copies per put and get: ring 0 (filled and read in place), queue 2 plus the stack reading\n\n");
+
+    printf("one thread, then a producer and a consumer thread, the ring with the backpressure of the poller\n");
+    printf("%-8s %14s %14s %10s %10s\n", "", "put+get ns", "readings/s", "lost", "torn");
+    for(int i = 0; i < 2; i++)
+    {
+        double ns = bench_single(i == 0, count);
+
+        memset(&run, 0, sizeof(run));
+        run.ring = (i == 0);
+        run.count = count;
+        run.backpressure = true;
+        bench_run(&run);
+        ok = (run.read == count) && (run.torn == 0) && (run.disorder == 0);
+        printf("%-8s %14.1f %14.0f %10u %10u  %s\n", run.ring ? "ring" : "queue", ns, run.read * 1e6 / run.total_us,
+               count - run.read, run.torn, ok ? "pass" : "FAIL");
+        pass = pass && ok;
+    }
+
+    /* Slow consumer: the ring laps it, the queue throttles the producer */
+    printf("\nslow consumer, %u loops on each reading, %u loops of the producer\n", BENCH_HOLD_LOOPS, BENCH_PACE_LOOPS);
+    printf("%-8s %10s %10s %12s %10s %10s %10s %10s %10s\n", "", "written", "read", "overwritten", "dropped", "high",
+           "torn", "disorder", "produced/s");
+    memset(&run, 0, sizeof(run));
+    run.ring = true;
+    run.count = BENCH_SLOW_READINGS;
+    run.hold = BENCH_HOLD_LOOPS;
+    run.pace = BENCH_PACE_LOOPS;
+    bench_run(&run);
+    modbus_ring_get_stats(&ring, &stats);
+    ok = (run.torn == 0) && (run.disorder == 0) && (stats.written == run.read + stats.overwritten) &&
+         (stats.written + stats.dropped == run.count) && (stats.overwritten > 0) && (stats.dropped > 0) &&
+         (stats.high_water <= MODBUS_RING_SIZE - 1);
+    printf("%-8s %10u %10u %12u %10u %10u %10u %10u %10.0f  %s\n", "ring", stats.written, run.read, stats.overwritten,
+           stats.dropped, stats.high_water, run.torn, run.disorder, run.count * 1e6 / run.producer_us, ok ? "pass" : "FAIL");
+    pass = pass && ok;
+
+    memset(&run, 0, sizeof(run));
+    run.count = BENCH_SLOW_QUEUE_READINGS;
+    run.hold = BENCH_HOLD_LOOPS;
+    run.pace = BENCH_PACE_LOOPS;
+    bench_run(&run);
+    ok = (run.torn == 0) && (run.disorder == 0) && (run.put == run.read + run.replaced);
+    printf("%-8s %10u %10u %12u %10u %10s %10u %10u %10.0f  %s\n", "queue", run.put, run.read, run.replaced, run.failed,
+           "-", run.torn, run.disorder, run.count * 1e6 / run.producer_us, ok ? "pass" : "FAIL");
+    pass = pass && ok;
+
+    printf("reading ring: %s\n", pass ? "pass" : "FAIL");
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,281 @@
+/*
+ *  rx_bench.c
+ *
+ *  Created on: Mar 16, 2022
+ *
+ *  Receive path of src/modbus_api/modbus_command.c on the UART shim: modbus_command_execute() runs as
+ *  on the bus task, the shim receives the reply at the baud rate of the bus and posts the data events
+ *  of the IDF driver, at 120 bytes in the FIFO or after t3.5 of silence. A slave thread on the other
+ *  end of a socketpair sends replies of every length, with gaps inside the frame shorter and longer
+ *  than t3.5: a frame longer than the FIFO must be read whole, a gap under t3.5 must not split it,
+ *  a gap over t3.5 must.
+ *
+ *  Build: gcc -O2 -Wall -I../uart_shim -I../../src -I../../src/modbus_api -o rx_bench rx_bench.c ../uart_shim/uart_shim.c
+ *         ../../src/modbus_api/modbus_command.c ../../src/modbus_api/modbus_frame.c ../../src/modbus_api/modbus_bus.c
+ *         ../../src/utility/utility.c -lpthread
+ *  Run:   ./rx_bench [-v]
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "uart_shim.h"
+#include "config.h"
+#include "utility/utility.h"
+#include "modbus_command.h"
+#include "modbus_frame.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define BENCH_WATER_PORT                              0     /* 9600 8N1 */
+#define BENCH_ELEC_PORT                               1     /* 1200 8E1 */
+#define BENCH_SLAVE_ID                                7
+#define BENCH_TURNAROUND_US                           5000
+#define BENCH_PREAMBLE                                4     /* FE bytes before 0x68 frames */
+
+/* Reply of the slave */
+typedef uint8_t bench_reply_t;
+enum {
+    BENCH_REPLY_DATA = 0,
+    BENCH_REPLY_EXCEPTION,
+    BENCH_REPLY_BAD_CRC,
+    BENCH_REPLY_NONE,
+};
+
+/*!
+ * @brief  One transaction: reply of "size" registers (RTU) or data bytes (0x68 frame), with a gap of
+ *         "gap" tenths of a character time after "gap_at" bytes
+ */
+typedef struct {
+    const char *name;
+    modbus_protocol_t protocol;
+    uint16_t size;
+    bench_reply_t reply;
+    uint16_t gap_at;
+    uint32_t gap;
+    modbus_status_t expect;
+} bench_case_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static const modbus_bus_config_t bench_config[] = {
+    {BENCH_WATER_PORT, -1, -1, 9600, UART_PARITY_DISABLE, 0},
+    {BENCH_ELEC_PORT, -1, -1, 1200, UART_PARITY_EVEN, 0},
+};
+
+static const uint8_t bench_meter[6] = {0x01, 0x00, 0x00, 0x00, 0x00, 0x00};
+
+static const bench_case_t bench_case[] = {
+    {"read 1 register",           MODBUS_PROTOCOL_RTU,  1,   BENCH_REPLY_DATA,      0,   0,  MODBUS_STATUS_OK},
+    {"read 59, 123 bytes",        MODBUS_PROTOCOL_RTU,  59,  BENCH_REPLY_DATA,      0,   0,  MODBUS_STATUS_OK},
+    {"read 68, 141 bytes",        MODBUS_PROTOCOL_RTU,  68,  BENCH_REPLY_DATA,      0,   0,  MODBUS_STATUS_OK},
+    {"read 125, 255 bytes",       MODBUS_PROTOCOL_RTU,  125, BENCH_REPLY_DATA,      0,   0,  MODBUS_STATUS_OK},
+    {"141 bytes, 1.5 char gap",   MODBUS_PROTOCOL_RTU,  68,  BENCH_REPLY_DATA,      60,  15, MODBUS_STATUS_OK},
+    {"  gap after the FIFO",      MODBUS_PROTOCOL_RTU,  68,  BENCH_REPLY_DATA,      130, 15, MODBUS_STATUS_OK},
+    {"141 bytes, 8 char gap",     MODBUS_PROTOCOL_RTU,  68,  BENCH_REPLY_DATA,      60,  80, MODBUS_STATUS_FRAME_ERROR},
+    {"  gap after the FIFO",      MODBUS_PROTOCOL_RTU,  68,  BENCH_REPLY_DATA,      130, 80, MODBUS_STATUS_FRAME_ERROR},
+    {"exception",                 MODBUS_PROTOCOL_RTU,  68,  BENCH_REPLY_EXCEPTION, 0,   0,  MODBUS_STATUS_EXCEPTION},
+    {"bad CRC, 255 bytes",        MODBUS_PROTOCOL_RTU,  125, BENCH_REPLY_BAD_CRC,   0,   0,  MODBUS_STATUS_CRC_ERROR},
+    {"no reply",                  MODBUS_PROTOCOL_RTU,  68,  BENCH_REPLY_NONE,      0,   0,  MODBUS_STATUS_TIMEOUT},
+    {"0x68 energy, preamble",     MODBUS_PROTOCOL_ELEC, 20,  BENCH_REPLY_DATA,      0,   0,  MODBUS_STATUS_OK},
+    {"  3 char gap after FE",     MODBUS_PROTOCOL_ELEC, 20,  BENCH_REPLY_DATA,      BENCH_PREAMBLE, 30, MODBUS_STATUS_OK},
+    {"  1.5 char gap in data",    MODBUS_PROTOCOL_ELEC, 20,  BENCH_REPLY_DATA,      20,  15, MODBUS_STATUS_OK},
+    {"  bad check sum",           MODBUS_PROTOCOL_ELEC, 20,  BENCH_REPLY_BAD_CRC,   0,   0,  MODBUS_STATUS_CRC_ERROR},
+    {"  error reply",             MODBUS_PROTOCOL_ELEC, 20,  BENCH_REPLY_EXCEPTION, 0,   0,  MODBUS_STATUS_EXCEPTION},
+};
+
+static int slave_fd[2];                               /* Slave end of the line, per port */
+static const bench_case_t *volatile slave_case;
+static const char *status_name[] = {"OK", "TIMEOUT", "CRC_ERROR", "FRAME_ERROR", "EXCEPTION"};
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static uint16_t bench_reply(const bench_case_t *c, uint8_t *reply)
+{
+    uint16_t size = 0;
+    uint16_t crc16;
+    uint8_t *frame;
+
+    if(c->protocol == MODBUS_PROTOCOL_RTU)
+    {
+        reply[size++] = BENCH_SLAVE_ID;
+        if(c->reply == BENCH_REPLY_EXCEPTION)
+        {
+            reply[size++] = MODBUS_READ_INPUT_FUNCTION | MODBUS_EXCEPTION_FLAG;
+            reply[size++] = 0x02;
+        }
+        else
+        {
+            reply[size++] = MODBUS_READ_INPUT_FUNCTION;
+            reply[size++] = RAW_LEN(c->size);
+            for(uint16_t i = 0; i < RAW_LEN(c->size); i++)
+            {
+                reply[size++] = i;
+            }
+        }
+        crc16 = crc16_modbus(reply, size);
+        reply[size++] = HI_UINT16(crc16) ^ ((c->reply == BENCH_REPLY_BAD_CRC) ? 0x5A : 0);
+        reply[size++] = LO_UINT16(crc16);
+        return size;
+    }
+
+    for(uint16_t i = 0; i < BENCH_PREAMBLE; i++)
+    {
+        reply[size++] = MODBUS_FRAME_PREAMBLE_BYTE;
+    }
+    frame = &reply[size];
+    reply[size++] = MODBUS_START_BYTE;
+    memcpy(&reply[size], bench_meter, 6);
+    size += 6;
+    reply[size++] = MODBUS_START_BYTE;
+    if(c->reply == BENCH_REPLY_EXCEPTION)
+    {
+        reply[size++] = MODBUS_READ_RESPONSE_BYTE | MODBUS_ERROR_FLAG;
+        reply[size++] = 1;
+        reply[size++] = 0x02 + MODBUS_DATA_ADD_BYTE;
+    }
+    else
+    {
+        reply[size++] = MODBUS_READ_RESPONSE_BYTE;
+        reply[size++] = 2 + c->size;
+        reply[size++] = 0x52 + MODBUS_DATA_ADD_BYTE;
+        reply[size++] = 0xC3 + MODBUS_DATA_ADD_BYTE;
+        for(uint16_t i = 0; i < c->size; i++)
+        {
+            reply[size++] = i + MODBUS_DATA_ADD_BYTE;
+        }
+    }
+    reply[size] = check_sum(frame, &reply[size] - frame) ^ ((c->reply == BENCH_REPLY_BAD_CRC) ? 0x5A : 0);
+    size++;
+    reply[size++] = MODBUS_END_BYTE;
+    return size;
+}
+
+/* Slave: the request comes whole, the shim hands it over when its last byte is sent */
+static void *bench_slave(void *arg)
+{
+    int index = (int) (intptr_t) arg;
+    const modbus_bus_config_t *config = &bench_config[index];
+    uint32_t char_us = ((config->parity == UART_PARITY_DISABLE) ? 10000000UL : 11000000UL) / config->baudrate;
+    uint8_t request[MODBUS_COMMAND_MAX_SIZE];
+    uint8_t reply[MODBUS_COMMAND_MAX_SIZE + BENCH_PREAMBLE];
+    const bench_case_t *c;
+    uint16_t size;
+    uint16_t gap_at;
+
+    while(read(slave_fd[index], request, sizeof(request)) > 0)
+    {
+        c = slave_case;
+        if((c == NULL) || (c->reply == BENCH_REPLY_NONE))
+        {
+            continue;
+        }
+        size = bench_reply(c, reply);
+        gap_at = ((c->gap > 0) && (c->gap_at < size)) ? c->gap_at : size;
+        usleep(BENCH_TURNAROUND_US);
+
+        /* Second part written once the first is on the wire and the gap passed */
+        if(write(slave_fd[index], reply, gap_at) != gap_at)
+        {
+            break;
+        }
+        if(gap_at < size)
+        {
+            usleep(gap_at * char_us + (c->gap * char_us) / 10);
+            if(write(slave_fd[index], &reply[gap_at], size - gap_at) != size - gap_at)
+            {
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    modbus_port_t port[2];
+    modbus_transaction_t transaction;
+    uint8_t rx_data[MODBUS_COMMAND_MAX_SIZE];
+    uart_shim_stats_t before, after;
+    pthread_t thread;
+    uint32_t failures = 0;
+    uint64_t start;
+    int fd[2];
+    bool ok;
+
+    esp_log_level_set("*", ((argc > 1) && (strcmp(argv[1], "-v") == 0)) ? ESP_LOG_INFO : ESP_LOG_NONE);
+    for(int i = 0; i < 2; i++)
+    {
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, fd) != 0)
+        {
+            perror("socketpair");
+            return 1;
+        }
+        uart_shim_attach(bench_config[i].port, fd[0]);
+        slave_fd[i] = fd[1];
+        modbus_command_init(&port[i], &bench_config[i]);
+        pthread_create(&thread, NULL, bench_slave, (void*) (intptr_t) i);
+    }
+
+    printf("9600 8N1 and 1200 8E1, t3.5 %u us and %u us, driver event at 120 bytes or RX timeout\n",
+           port[0].t35_us, port[1].t35_us);
+    printf("%-26s %6s %8s %7s %12s %12s\n", "", "bytes", "events", "ms", "status", "expected");
+    for(uint32_t i = 0; i < sizeof(bench_case) / sizeof(bench_case[0]); i++)
+    {
+        const bench_case_t *c = &bench_case[i];
+        int index = (c->protocol == MODBUS_PROTOCOL_RTU) ? 0 : 1;
+
+        memset(&transaction, 0, sizeof(transaction));
+        transaction.protocol = c->protocol;
+        transaction.size = c->size;
+        transaction.rx_data = rx_data;
+        if(c->protocol == MODBUS_PROTOCOL_RTU)
+        {
+            transaction.slave[0] = BENCH_SLAVE_ID;
+            transaction.address = 0x0000;
+        }
+        else
+        {
+            memcpy(transaction.slave, bench_meter, 6);
+            transaction.address = 0xC352;
+            transaction.timeout_ms = 2000;
+        }
+
+        slave_case = c;
+        uart_shim_get_stats(bench_config[index].port, &before);
+        start = uart_shim_now_us();
+        modbus_command_execute(&port[index], &transaction);
+        uart_shim_get_stats(bench_config[index].port, &after);
+
+        ok = (transaction.status == c->expect);
+        if(ok && (c->expect == MODBUS_STATUS_OK) && (c->protocol == MODBUS_PROTOCOL_RTU))
+        {
+            ok = (transaction.rx_size == RAW_LEN(c->size) + 5) && (rx_data[2 + RAW_LEN(c->size)] == (uint8_t) (RAW_LEN(c->size) - 1));
+        }
+        printf("%-26s %6u %8u %7.1f %12s %12s  %s\n", c->name, transaction.rx_size, after.data_events - before.data_events,
+               (uart_shim_now_us() - start) / 1000.0, status_name[transaction.status], status_name[c->expect], ok ? "pass" : "FAIL");
+        failures += ok ? 0 : 1;
+
+        /* Tail of a split frame and the line settle before the next case */
+        usleep(300000);
+    }
+
+    printf("receive path: %s\n", (failures == 0) ? "pass" : "FAIL");
+    return (failures == 0) ? 0 : 1;
+}
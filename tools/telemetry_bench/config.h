@@ -0,0 +1,17 @@
+/*
+ *  config.h
+ *
+ *  Created on: Feb 23, 2022
+ *
+ *  Host stand-in of src/config.h for the telemetry encoder, found first with -I. in the build of
+ *  telemetry_bench. The meter is water, or electric with -DELECTRIC_METER_USED as in src/config.h.
+ */
+
+#ifndef _CONFIG_H_
+#define _CONFIG_H_
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#endif /* _CONFIG_H_ */
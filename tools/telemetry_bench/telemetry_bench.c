@@ -0,0 +1,193 @@
+/*
+ *  telemetry_bench.c
+ *
+ *  Created on: Feb 23, 2022
+ *
+ *  Host size and speed comparison of the reading encoders in src/modbus_api/modbus_telemetry.c:
+ *  compact json (modbus_api_data_to_json) against binary (modbus_api_data_to_binary).
+ *  A reading of every register is filled with meter-like values, both encodings are timed, and the
+ *  schema, binary and json of the reading are written to a directory for telemetry_decode.py.
+ *
+ *  Build: gcc -O2 -Wall -I. -I../../src -I../../src/modbus_api -o telemetry_bench telemetry_bench.c \
+ *             ../../src/modbus_api/modbus_telemetry.c ../../src/modbus_api/modbus_decode.c \
+ *             ../../src/modbus_api/modbus_table.c ../../src/utility/json_writer.c \
+ *             ../../src/utility/bin_writer.c ../../src/utility/utility.c -lm
+ *         Add -DELECTRIC_METER_USED for the electric meter
+ *  Run:   ./telemetry_bench [output directory]
+ *         python3 telemetry_decode.py <dir>/schema.json <dir>/reading.bin <dir>/reading.json
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "config.h"
+#include "modbus_telemetry.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define BENCH_ROUNDS                                  100000
+#define BENCH_BUFFER_SIZE                             4096
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static uint32_t bench_seed = 12345;
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static uint32_t bench_random(void)
+{
+    bench_seed = bench_seed * 1103515245 + 12345;
+    return bench_seed >> 8;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Reading of every register: water values of 1 to 7 digits, some negative; electric BCD digits */
+static void bench_fill(modbus_data_t *data)
+{
+    memset(data, 0, sizeof(modbus_data_t));
+    data->meter = MODBUS_METER_TYPE;
+    data->bus = 1;
+    data->time = 1645574400;
+    data->report = MODBUS_REPORT_ALL;
+    data->start = 0;
+#ifdef ELECTRIC_METER_USED
+    data->stop = MB_ELEC_NUMBER_OF_CMD - 1;
+    for(uint32_t i = 0; i < MODBUS_DATA_SIZE; i++)
+    {
+        uint8_t digits = bench_random() % 100;
+        data->data[i] = (((digits / 10) << 4) | (digits % 10)) + 0x33;
+    }
+#else
+    static const uint32_t scale[] = { 10, 100, 1000, 10000, 100000, 1000000, 10000000 };
+    data->stop = MB_WATER_NUMBER_OF_REG - 1;
+    for(uint32_t i = 0; i < MODBUS_DATA_SIZE / 4; i++)
+    {
+        int32_t value = bench_random() % scale[i % 7];
+        if((i % 5) == 4)
+        {
+            value = -value;
+        }
+        data->data[i * 4] = (uint32_t) value >> 24;
+        data->data[i * 4 + 1] = (uint32_t) value >> 16;
+        data->data[i * 4 + 2] = (uint32_t) value >> 8;
+        data->data[i * 4 + 3] = (uint32_t) value;
+    }
+#endif
+}
+
+static bool bench_save(const char *dir, const char *name, const void *data, uint32_t length)
+{
+    char path[512];
+    FILE *file;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    file = fopen(path, "wb");
+    if(file == NULL)
+    {
+        printf("Cannot write %s\n", path);
+        return false;
+    }
+    fwrite(data, 1, length, file);
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    static modbus_data_t data;
+    static char json[BENCH_BUFFER_SIZE];
+    static uint8_t binary[BENCH_BUFFER_SIZE];
+    static char schema[BENCH_BUFFER_SIZE];
+#ifdef ELECTRIC_METER_USED
+    static const uint8_t slave[MODBUS_SLAVE_ADDRESS_SIZE] = { 0x12, 0x34, 0x56, 0x78, 0x90, 0x12 };
+#else
+    static const uint8_t slave[MODBUS_SLAVE_ADDRESS_SIZE] = { 7 };
+#endif
+    uint32_t json_length, binary_length, schema_length, errors = 0;
+    uint64_t bytes;
+    double start, json_time, binary_time;
+
+    bench_fill(&data);
+    json_length = modbus_telemetry_to_json(&data, slave, json, sizeof(json));
+    binary_length = modbus_telemetry_to_binary(&data, slave, binary, sizeof(binary));
+    schema_length = modbus_telemetry_schema(schema, sizeof(schema));
+    if((json_length == 0) || (binary_length == 0) || (schema_length == 0))
+    {
+        printf("Encoding failed: json %u, binary %u, schema %u\n", json_length, binary_length, schema_length);
+        return 1;
+    }
+
+    /* Binary must report overflow at every short size */
+    for(uint32_t size = 0; size < binary_length; size++)
+    {
+        if(modbus_telemetry_to_binary(&data, slave, binary, size) != 0)
+        {
+            printf("Overflow: not reported with %u bytes\n", size);
+            errors++;
+            break;
+        }
+    }
+    modbus_telemetry_to_binary(&data, slave, binary, sizeof(binary));
+
+    bytes = 0;
+    start = now_s();
+    for(uint32_t r = 0; r < BENCH_ROUNDS; r++)
+    {
+        data.time++;
+        bytes += modbus_telemetry_to_json(&data, slave, json, sizeof(json));
+    }
+    json_time = now_s() - start;
+
+    bytes = 0;
+    start = now_s();
+    for(uint32_t r = 0; r < BENCH_ROUNDS; r++)
+    {
+        data.time++;
+        bytes += modbus_telemetry_to_binary(&data, slave, binary, sizeof(binary));
+    }
+    binary_time = now_s() - start;
+    (void) bytes;
+
+    /* Files from the first reading for the decoder */
+    data.time -= 2 * BENCH_ROUNDS;
+    json_length = modbus_telemetry_to_json(&data, slave, json, sizeof(json));
+    binary_length = modbus_telemetry_to_binary(&data, slave, binary, sizeof(binary));
+
+    printf("Meter %s, schema id 0x%04X, schema %u bytes\n", MODBUS_METER_TYPE == ELECTRIC_METER ? "electric" : "water",
+           modbus_telemetry_schema_id(), schema_length);
+    printf("json    %5u bytes %8.2f us/reading\n", json_length, json_time / BENCH_ROUNDS * 1e6);
+    printf("binary  %5u bytes %8.2f us/reading\n", binary_length, binary_time / BENCH_ROUNDS * 1e6);
+    printf("Size ratio %.1fx\n", (double) json_length / binary_length);
+
+    if(argc > 1)
+    {
+        if(!bench_save(argv[1], "schema.json", schema, schema_length) ||
+           !bench_save(argv[1], "reading.bin", binary, binary_length) ||
+           !bench_save(argv[1], "reading.json", json, json_length))
+        {
+            errors++;
+        }
+    }
+    return (errors == 0) ? 0 : 1;
+}
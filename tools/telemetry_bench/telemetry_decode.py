@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+#
+#  telemetry_decode.py
+#
+#  Created on: Feb 23, 2022
+#
+#  Host decoder of binary readings (TELEMETRY_FORMAT_BINARY, see src/modbus_api/modbus_telemetry.h),
+#  one reading or a batch of them (src/batch/batch.h). The schema is the retained message of
+#  MQTT_SCHEMA_TOPIC. The payload is printed as the json the firmware publishes with TELEMETRY_FORMAT_JSON,
+#  and compared to it when a json file is given.
+#
+#  Run: python3 telemetry_decode.py schema.json payload.bin [payload.json]
+
+import json
+import struct
+import sys
+
+METERS = ("electric", "water")
+BATCH_BINARY_MARKER = 0x80
+
+
+def read_varint(data, pos):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if byte < 0x80:
+            return value, pos
+
+
+def read_value(data, pos, kind):
+    if kind == "float":
+        return struct.unpack_from("<f", data, pos)[0], pos + 4
+    value, pos = read_varint(data, pos)
+    if kind == "int":
+        value = (value >> 1) ^ -(value & 1)
+    return value, pos
+
+
+def decode(schema, data):
+    version, schema_id, meter, bus = struct.unpack_from("<BHBB", data, 0)
+    if version != schema["version"] or schema_id != schema["id"]:
+        raise ValueError("reading has version %d schema 0x%04X, schema is version %d id 0x%04X"
+                         % (version, schema_id, schema["version"], schema["id"]))
+    pos = 5
+    slave = data[pos:pos + schema["slave_size"]]
+    pos += schema["slave_size"]
+    (time,) = struct.unpack_from("<I", data, pos)
+    pos += 4
+
+    regs = {reg["id"]: reg for reg in schema["regs"]}
+    reading = {
+        "meter": METERS[meter],
+        "bus": bus,
+        "time": time,
+        "slave": " ".join("%02X" % b for b in slave) if len(slave) > 1 else slave[0],
+        "regs": [],
+    }
+    while pos < len(data):
+        reg_id, pos = read_varint(data, pos)
+        reg = regs[reg_id]
+        values = []
+        for _ in range(reg["count"]):
+            value, pos = read_value(data, pos, reg["type"])
+            values.append(value)
+        item = {"key": reg["key"]}
+        if reading["meter"] == "water":
+            item["address"] = reg["address"]
+        item["value"] = values if reg["count"] > 1 else values[0]
+        reading["regs"].append(item)
+    return reading
+
+
+def decode_payload(schema, data):
+    if data[0] != BATCH_BINARY_MARKER:
+        return decode(schema, data)
+    readings = []
+    pos = 1
+    while pos < len(data):
+        (length,) = struct.unpack_from("<H", data, pos)
+        pos += 2
+        readings.append(decode(schema, data[pos:pos + length]))
+        pos += length
+    return readings
+
+
+def same(a, b):
+    if isinstance(a, float) or isinstance(b, float):
+        return abs(a - b) <= 1e-6 * max(abs(a), abs(b), 1.0)
+    if isinstance(a, dict):
+        return a.keys() == b.keys() and all(same(a[k], b[k]) for k in a)
+    if isinstance(a, list):
+        return len(a) == len(b) and all(same(x, y) for x, y in zip(a, b))
+    return a == b
+
+
+def main():
+    if len(sys.argv) < 3:
+        print("usage: telemetry_decode.py schema.json payload.bin [payload.json]")
+        return 2
+    with open(sys.argv[1]) as f:
+        schema = json.load(f)
+    with open(sys.argv[2], "rb") as f:
+        reading = decode_payload(schema, f.read())
+    print(json.dumps(reading, separators=(",", ":")))
+    if len(sys.argv) > 3:
+        with open(sys.argv[3]) as f:
+            expected = json.load(f)
+        if not same(reading, expected):
+            print("MISMATCH with %s" % sys.argv[3])
+            return 1
+        print("Match with %s" % sys.argv[3])
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
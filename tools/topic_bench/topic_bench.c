@@ -0,0 +1,310 @@
+/*
+ *  topic_bench.c
+ *
+ *  Created on: Mar 09, 2022
+ *
+ *  Dispatch of inbound MQTT messages to their handlers. Former path: strncmp prefix scan over the
+ *  registered topics, as mqtt_message_dispatch did. Trie path: src/mqtt_api/mqtt_topic.c, one node
+ *  per topic level. Checks the matching rules first, then times dispatch with one "meters/<id>/cmd"
+ *  subscription per slave, for a growing number of slaves.
+ *
+ *  Build: gcc -O2 -Wall -I../../src/mqtt_api -o topic_bench topic_bench.c ../../src/mqtt_api/mqtt_topic.c
+ *  Run:   ./topic_bench [messages]
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "mqtt_topic.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+/* As src/config.h */
+#define MQTT_TOPIC_MAX_LENGTH                         128
+#define MQTT_MAX_SUBCRIBE_TOPIC                       256
+#define MQTT_TOPIC_TRIE_NODES                         640
+#define MQTT_TOPIC_TRIE_HASH_SIZE                     1024
+#define MQTT_TOPIC_MATCH_MAX                          8
+
+#define BENCH_MESSAGES                                1000000
+
+typedef struct {
+    char topic[MQTT_TOPIC_MAX_LENGTH];
+    mqtt_topic_handler_t handler;
+    void *context;
+} former_map_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static mqtt_topic_trie_t trie;
+static mqtt_topic_node_t node[MQTT_TOPIC_TRIE_NODES];
+static mqtt_topic_sub_t sub[MQTT_MAX_SUBCRIBE_TOPIC];
+static uint16_t hash[MQTT_TOPIC_TRIE_HASH_SIZE];
+
+static former_map_t former_list[MQTT_MAX_SUBCRIBE_TOPIC];
+static uint32_t former_count;
+
+static uint32_t handled[MQTT_MAX_SUBCRIBE_TOPIC];
+static uint32_t failures;
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static double bench_time_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000.0) + (ts.tv_nsec / 1000000.0);
+}
+
+static void bench_handler(const char *topic, char *data, uint32_t length, void *context)
+{
+    handled[(uintptr_t) context]++;
+}
+
+static void bench_reset(void)
+{
+    mqtt_topic_init(&trie, node, MQTT_TOPIC_TRIE_NODES, sub, MQTT_MAX_SUBCRIBE_TOPIC, hash, MQTT_TOPIC_TRIE_HASH_SIZE);
+    former_count = 0;
+}
+
+static void bench_subscribe(const char *filter, uintptr_t id)
+{
+    bool first;
+
+    if(!mqtt_topic_subscribe(&trie, filter, bench_handler, (void*) id, &first))
+    {
+        printf("FAIL subscribe %s\n", filter);
+        failures++;
+    }
+    if(former_count < MQTT_MAX_SUBCRIBE_TOPIC)
+    {
+        snprintf(former_list[former_count].topic, MQTT_TOPIC_MAX_LENGTH, "%s", filter);
+        former_list[former_count].handler = bench_handler;
+        former_list[former_count].context = (void*) id;
+        former_count++;
+    }
+}
+
+/* Dispatch of the former mqtt_api.c */
+static uint32_t former_dispatch(const char *topic, char *data, uint32_t length)
+{
+    uint32_t count = 0;
+
+    for(uint32_t i = 0; i < former_count; i++)
+    {
+        if(strncmp(topic, former_list[i].topic, strlen(former_list[i].topic)) == 0)
+        {
+            former_list[i].handler(topic, data, length, former_list[i].context);
+            count++;
+        }
+    }
+    return count;
+}
+
+static uint32_t trie_dispatch(const char *topic, char *data, uint32_t length)
+{
+    mqtt_topic_route_t route[MQTT_TOPIC_MATCH_MAX];
+    uint32_t count = mqtt_topic_match(&trie, topic, route, MQTT_TOPIC_MATCH_MAX);
+
+    for(uint32_t i = 0; i < count; i++)
+    {
+        route[i].handler(topic, data, length, route[i].context);
+    }
+    return count;
+}
+
+/* Handlers of the topic are those of the list, by id */
+static void bench_expect(const char *topic, const char *expected)
+{
+    char got[64] = "";
+    uint32_t length = 0;
+
+    memset(handled, 0, sizeof(handled));
+    trie_dispatch(topic, NULL, 0);
+    for(uint32_t i = 0; i < MQTT_MAX_SUBCRIBE_TOPIC; i++)
+    {
+        for(uint32_t n = 0; n < handled[i]; n++)
+        {
+            length += snprintf(&got[length], sizeof(got) - length, "%s%u", (length > 0) ? "," : "", i);
+        }
+    }
+    if(strcmp(got, expected) != 0)
+    {
+        printf("FAIL %-16s got [%s] expected [%s]\n", topic, got, expected);
+        failures++;
+    }
+}
+
+static void bench_check(void)
+{
+    char filter[MQTT_TOPIC_MAX_LENGTH];
+    bool first, last;
+
+    bench_reset();
+    bench_subscribe("Config", 1);
+    bench_subscribe("meters/+/cmd", 2);
+    bench_subscribe("meters/#", 3);
+    bench_subscribe("#", 4);
+    bench_subscribe("meters/7/cmd", 5);
+    bench_subscribe("a//b", 6);
+    bench_subscribe("$SYS/#", 7);
+
+    bench_expect("Config", "1,4");
+    bench_expect("Config2", "4");
+    bench_expect("Config/x", "4");
+    bench_expect("meters", "3,4");
+    bench_expect("meters/7/cmd", "2,3,4,5");
+    bench_expect("meters/8/cmd", "2,3,4");
+    bench_expect("meters/8/cmd/x", "3,4");
+    bench_expect("a//b", "4,6");
+    bench_expect("$SYS/load", "7");
+
+    /* Invalid filters are refused, nothing left behind */
+    if(mqtt_topic_subscribe(&trie, "a/b#", bench_handler, NULL, &first) ||
+       mqtt_topic_subscribe(&trie, "a/#/b", bench_handler, NULL, &first) ||
+       mqtt_topic_subscribe(&trie, "a+/b", bench_handler, NULL, &first) ||
+       mqtt_topic_subscribe(&trie, "", bench_handler, NULL, &first))
+    {
+        printf("FAIL invalid filter accepted\n");
+        failures++;
+    }
+
+    /* Same handler and context once, the broker is subscribed once per filter */
+    mqtt_topic_subscribe(&trie, "Config", bench_handler, (void*) 1, &first);
+    if(first || (trie.subs_used != 7))
+    {
+        printf("FAIL duplicate subscription\n");
+        failures++;
+    }
+    mqtt_topic_subscribe(&trie, "Config", bench_handler, (void*) 8, &first);
+    bench_expect("Config", "1,4,8");
+    mqtt_topic_unsubscribe(&trie, "Config", bench_handler, (void*) 8, &last);
+    if(first || last)
+    {
+        printf("FAIL first/last of a shared filter\n");
+        failures++;
+    }
+
+    /* Unsubscribe prunes the levels of the filter */
+    uint16_t used = trie.nodes_used;
+    mqtt_topic_unsubscribe(&trie, "a//b", bench_handler, (void*) 6, &last);
+    if(!last || (trie.nodes_used != used - 3) || mqtt_topic_unsubscribe(&trie, "a//b", bench_handler, (void*) 6, &last))
+    {
+        printf("FAIL unsubscribe\n");
+        failures++;
+    }
+    bench_expect("a//b", "4");
+
+    /* Filters of the trie, as subscribed again on connect */
+    uint32_t filters = 0;
+    for(uint16_t i = 0; i < MQTT_TOPIC_TRIE_NODES; i++)
+    {
+        filters += mqtt_topic_filter(&trie, i, filter, sizeof(filter)) ? 1 : 0;
+        if(mqtt_topic_filter(&trie, i, filter, sizeof(filter)) && (strcmp(filter, "meters/+/cmd") == 0))
+        {
+            filters += 100;
+        }
+    }
+    if(filters != 106)
+    {
+        printf("FAIL filters %u\n", filters);
+        failures++;
+    }
+
+    /* More than the former 8 subscriptions, then the trie is full */
+    bench_reset();
+    for(uint32_t i = 0; i < MQTT_MAX_SUBCRIBE_TOPIC; i++)
+    {
+        snprintf(filter, sizeof(filter), "meters/%u/cmd", i);
+        bench_subscribe(filter, i);
+    }
+    bench_expect("meters/200/cmd", "200");
+    if(mqtt_topic_subscribe(&trie, "meters/x/cmd", bench_handler, NULL, &first) ||
+       (trie.nodes_used != 2 + (2 * MQTT_MAX_SUBCRIBE_TOPIC)))
+    {
+        printf("FAIL full trie\n");
+        failures++;
+    }
+    for(uint32_t i = 0; i < MQTT_MAX_SUBCRIBE_TOPIC; i++)
+    {
+        snprintf(filter, sizeof(filter), "meters/%u/cmd", i);
+        mqtt_topic_unsubscribe(&trie, filter, bench_handler, (void*) (uintptr_t) i, &last);
+    }
+    if((trie.nodes_used != 1) || (trie.subs_used != 0))
+    {
+        printf("FAIL prune all, %u nodes left\n", trie.nodes_used);
+        failures++;
+    }
+}
+
+static void bench_run(uint32_t slaves, uint32_t messages)
+{
+    char filter[MQTT_TOPIC_MAX_LENGTH];
+    char (*topic)[32] = malloc(slaves * sizeof(*topic));
+    char data[] = "{\"period\":60}";
+    uint32_t former_hits = 0, trie_hits = 0;
+    double start, former_ms, trie_ms;
+
+    bench_reset();
+    bench_subscribe("Config", 0);
+    for(uint32_t i = 1; i < slaves; i++)
+    {
+        snprintf(filter, sizeof(filter), "meters/%u/cmd", i);
+        bench_subscribe(filter, i);
+        snprintf(topic[i], sizeof(topic[i]), "meters/%u/cmd", i);
+    }
+    snprintf(topic[0], sizeof(topic[0]), "Config");
+
+    start = bench_time_ms();
+    for(uint32_t i = 0; i < messages; i++)
+    {
+        former_hits += former_dispatch(topic[i % slaves], data, sizeof(data) - 1);
+    }
+    former_ms = bench_time_ms() - start;
+
+    start = bench_time_ms();
+    for(uint32_t i = 0; i < messages; i++)
+    {
+        trie_hits += trie_dispatch(topic[i % slaves], data, sizeof(data) - 1);
+    }
+    trie_ms = bench_time_ms() - start;
+
+    /* Both paths call one handler per message here, the topics are no prefix of one another */
+    printf("%6u %10.1f %10.1f %10.1f %10.1f %9u %9u\n", slaves, former_ms, trie_ms, former_ms * 1000000.0 / messages,
+           trie_ms * 1000000.0 / messages, former_hits, trie_hits);
+    free(topic);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t messages = (argc > 1) ? strtoul(argv[1], NULL, 10) : BENCH_MESSAGES;
+    uint32_t slaves[] = {8, 32, 128, 256};
+
+    bench_check();
+    printf("matching rules: %s\n", (failures == 0) ? "pass" : "FAIL");
+
+    printf("%u messages, one subscription per slave\n", messages);
+    printf("%6s %10s %10s %10s %10s %9s %9s\n", "slaves", "former ms", "trie ms", "former ns", "trie ns", "former",
+           "trie");
+    for(uint32_t i = 0; i < sizeof(slaves) / sizeof(slaves[0]); i++)
+    {
+        bench_run(slaves[i], messages);
+    }
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,89 @@
+/*
+ *  config.h
+ *
+ *  Created on: Mar 16, 2022
+ *
+ *  Host stand-in of src/config.h for the modbus sources run on uart_shim, found first with
+ *  -I../uart_shim. Modbus values as src/config.h, the meter is water, or electric with
+ *  -DELECTRIC_METER_USED. Four buses on host ports 0 to 3, a bench uses the first ones.
+ */
+
+#ifndef _CONFIG_H_
+#define _CONFIG_H_
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <esp_err.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+
+/* Modbus */
+#define MAX_SLAVE_ID                                  32
+#define MODBUS_RX_BUFFER_SIZE                         1024
+#define MODBUS_UART_EVENT_QUEUE_SIZE                  16
+#define MODBUS_COMMAND_MAX_SIZE                       256
+#define MODBUS_RING_SIZE                              32
+#define MODBUS_RING_BACKPRESSURE                      24
+#define MODBUS_BACKPRESSURE_WAIT_MS                   20
+#define MODBUS_QUEUE_TIMEOUT_MS                       50
+#define MODBUS_BUS_QUEUE_SIZE                         8
+#define MODBUS_WRITE_QUEUE_SIZE                       8
+#define MODBUS_WRITE_MAX_SIZE                         32
+#define MODBUS_WRITE_MAX_REGS                         123
+#define MODBUS_WRITE_BURST                            4
+#define MODBUS_TRANSACTION_DEPTH                      2
+#define MODBUS_READ_MAX_REGS                          125
+#define MODBUS_READ_GAP_MAX                           8
+#define MODBUS_READ_PLAN_SIZE                         8
+
+#define MODBUS_RETRY_MAX                              2
+#define MODBUS_QUARANTINE_TIMEOUTS                    3
+#define MODBUS_QUARANTINE_BACKOFF_MIN_MS              5000
+#define MODBUS_QUARANTINE_BACKOFF_MAX_MS              600000
+#define MODBUS_REPORT_BY_EXCEPTION                    1
+#define MODBUS_SCHEDULE_REPORT_MS                     60000
+#define MODBUS_RX_TIMEOUT_MS                          1000
+#define MODBUS_FRAME_DELAY_MS                         20
+#define MODBUS_TURNAROUND_MS                          20
+#define MODBUS_ELEC_PASSWORD                          {0x00, 0x11, 0x11, 0x11}
+
+#define MODBUS_DISCOVERY_AT_BOOT                      1
+#define MODBUS_DISCOVERY_ID_FIRST                     1
+#define MODBUS_DISCOVERY_ID_LAST                      247
+#define MODBUS_DISCOVERY_PROBE_REGISTER               0x0000
+
+#define MODBUS_BUS_COUNT                              4
+#ifdef ELECTRIC_METER_USED
+/*                                                     port txd  rxd  baudrate  parity           core */
+#define MODBUS_BUS_DEFAULT                            {{0,  -1,  -1,  1200,     UART_PARITY_EVEN, 0}, \
+                                                       {1,  -1,  -1,  1200,     UART_PARITY_EVEN, 0}, \
+                                                       {2,  -1,  -1,  1200,     UART_PARITY_EVEN, 0}, \
+                                                       {3,  -1,  -1,  1200,     UART_PARITY_EVEN, 0}, }
+#else
+/*                                                     port txd  rxd  baudrate  parity              core */
+#define MODBUS_BUS_DEFAULT                            {{0,  -1,  -1,  9600,     UART_PARITY_DISABLE, 0}, \
+                                                       {1,  -1,  -1,  9600,     UART_PARITY_DISABLE, 0}, \
+                                                       {2,  -1,  -1,  9600,     UART_PARITY_DISABLE, 0}, \
+                                                       {3,  -1,  -1,  9600,     UART_PARITY_DISABLE, 0}, }
+#endif
+
+/* Single bus of the firmware before MODBUS_BUS_DEFAULT, to build its modbus_command.c for comparison */
+#define MODBUS_PORT_NUM                               0
+#ifdef ELECTRIC_METER_USED
+#define MODBUS_BAUDRATE                               1200
+#define MODBUS_PARITY                                 UART_PARITY_EVEN
+#else
+#define MODBUS_BAUDRATE                               9600
+#define MODBUS_PARITY                                 UART_PARITY_DISABLE
+#endif
+#define MODBUS_UART_TXD                               -1
+#define MODBUS_UART_RXD                               -1
+
+#define MODBUS_BUS_TASK_NAME                          "modbus_bus"
+#define MODBUS_BUS_TASK_SIZE                          4096
+#define MODBUS_BUS_TASK_PRIORITY                      5
+
+#endif /* _CONFIG_H_ */
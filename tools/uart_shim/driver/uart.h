@@ -0,0 +1,95 @@
+/*
+ *  uart.h
+ *
+ *  Created on: Mar 16, 2022
+ *
+ *  Host stand-in of the IDF UART driver, the part the modbus sources use. Behavior is in uart_shim.c.
+ */
+
+#ifndef _DRIVER_UART_H_
+#define _DRIVER_UART_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+typedef int uart_port_t;
+
+#define UART_NUM_0                                    0
+#define UART_NUM_1                                    1
+#define UART_NUM_2                                    2
+#define UART_NUM_MAX                                  8     /* Host: more ports than the ESP32, for bus scaling */
+#define UART_PIN_NO_CHANGE                            -1
+
+typedef enum {
+    UART_DATA_5_BITS = 0,
+    UART_DATA_6_BITS,
+    UART_DATA_7_BITS,
+    UART_DATA_8_BITS,
+} uart_word_length_t;
+
+typedef enum {
+    UART_PARITY_DISABLE = 0,
+    UART_PARITY_EVEN = 2,
+    UART_PARITY_ODD = 3,
+} uart_parity_t;
+
+typedef enum {
+    UART_STOP_BITS_1 = 1,
+    UART_STOP_BITS_1_5,
+    UART_STOP_BITS_2,
+} uart_stop_bits_t;
+
+typedef enum {
+    UART_HW_FLOWCTRL_DISABLE = 0,
+} uart_hw_flowcontrol_t;
+
+typedef enum {
+    UART_SCLK_APB = 0,
+} uart_sclk_t;
+
+typedef struct {
+    int baud_rate;
+    uart_word_length_t data_bits;
+    uart_parity_t parity;
+    uart_stop_bits_t stop_bits;
+    uart_hw_flowcontrol_t flow_ctrl;
+    uint8_t rx_flow_ctrl_thresh;
+    uart_sclk_t source_clk;
+} uart_config_t;
+
+typedef enum {
+    UART_DATA,
+    UART_BREAK,
+    UART_BUFFER_FULL,
+    UART_FIFO_OVF,
+    UART_FRAME_ERR,
+    UART_PARITY_ERR,
+    UART_DATA_BREAK,
+    UART_PATTERN_DET,
+    UART_EVENT_MAX,
+} uart_event_type_t;
+
+typedef struct {
+    uart_event_type_t type;
+    size_t size;
+    bool timeout_flag;
+} uart_event_t;
+
+esp_err_t uart_driver_install(uart_port_t port, int rx_buffer_size, int tx_buffer_size, int queue_size,
+                              QueueHandle_t *queue, int intr_alloc_flags);
+esp_err_t uart_param_config(uart_port_t port, const uart_config_t *config);
+esp_err_t uart_set_pin(uart_port_t port, int txd, int rxd, int rts, int cts);
+esp_err_t uart_set_rx_timeout(uart_port_t port, const uint8_t tout_thresh);
+esp_err_t uart_set_rx_full_threshold(uart_port_t port, int threshold);
+int uart_read_bytes(uart_port_t port, void *buf, uint32_t length, TickType_t ticks);
+int uart_write_bytes(uart_port_t port, const void *src, size_t size);
+esp_err_t uart_wait_tx_done(uart_port_t port, TickType_t ticks);
+esp_err_t uart_flush_input(uart_port_t port);
+esp_err_t uart_flush(uart_port_t port);
+esp_err_t uart_get_buffered_data_len(uart_port_t port, size_t *size);
+
+#endif /* _DRIVER_UART_H_ */
@@ -0,0 +1,43 @@
+/*
+ *  esp_log.h
+ *
+ *  Created on: Mar 16, 2022
+ *
+ *  Host stand-in of the IDF log, to stderr with the time of uart_shim. Level set by the bench
+ *  with esp_log_level_set(), for all tags with "*", warnings by default.
+ */
+
+#ifndef _ESP_LOG_H_
+#define _ESP_LOG_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+typedef enum {
+    ESP_LOG_NONE = 0,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+uint32_t esp_log_timestamp(void);
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+esp_log_level_t esp_log_level_get(const char *tag);
+
+#define ESP_SHIM_LOG(level, letter, tag, format, ...)                                \
+    do {                                                                             \
+        if(esp_log_level_get(tag) >= (level)) {                                      \
+            fprintf(stderr, letter " (%u) %s: " format "\n", esp_log_timestamp(),    \
+                    tag, ##__VA_ARGS__);                                             \
+        }                                                                            \
+    } while(0)
+
+#define ESP_LOGE(tag, format, ...)                    ESP_SHIM_LOG(ESP_LOG_ERROR, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...)                    ESP_SHIM_LOG(ESP_LOG_WARN, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...)                    ESP_SHIM_LOG(ESP_LOG_INFO, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...)                    ESP_SHIM_LOG(ESP_LOG_DEBUG, "D", tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...)                    ESP_SHIM_LOG(ESP_LOG_VERBOSE, "V", tag, format, ##__VA_ARGS__)
+
+#endif /* _ESP_LOG_H_ */
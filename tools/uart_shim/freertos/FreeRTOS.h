@@ -0,0 +1,34 @@
+/*
+ *  FreeRTOS.h
+ *
+ *  Created on: Mar 16, 2022
+ *
+ *  Host stand-in of the FreeRTOS types and tick, 100 Hz as CONFIG_FREERTOS_HZ of the firmware.
+ */
+
+#ifndef _FREERTOS_H_
+#define _FREERTOS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef uint32_t TickType_t;
+typedef int32_t BaseType_t;
+typedef uint32_t UBaseType_t;
+
+#define configTICK_RATE_HZ                            100
+#define configMAX_TASK_NAME_LEN                       16
+#define portTICK_PERIOD_MS                            (1000 / configTICK_RATE_HZ)
+#define portTICK_RATE_MS                              portTICK_PERIOD_MS
+#define portMAX_DELAY                                 ((TickType_t) 0xFFFFFFFFUL)
+
+/* Truncates as the FreeRTOS macro */
+#define pdMS_TO_TICKS(ms)                             ((TickType_t) (((uint64_t) (ms) * configTICK_RATE_HZ) / 1000))
+
+#define pdFALSE                                       0
+#define pdTRUE                                        1
+#define pdFAIL                                        0
+#define pdPASS                                        1
+
+#endif /* _FREERTOS_H_ */
@@ -0,0 +1,24 @@
+/*
+ *  queue.h
+ *
+ *  Created on: Mar 16, 2022
+ *
+ *  Host stand-in of the FreeRTOS queues: items copied by value, waits in tick as FreeRTOS.
+ */
+
+#ifndef _QUEUE_H_
+#define _QUEUE_H_
+
+#include "FreeRTOS.h"
+
+typedef struct uart_shim_queue* QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+void vQueueDelete(QueueHandle_t queue);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks);
+#define xQueueSendToBack(queue, item, ticks)          xQueueSend(queue, item, ticks)
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks);
+BaseType_t xQueueReset(QueueHandle_t queue);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+
+#endif /* _QUEUE_H_ */
@@ -0,0 +1,29 @@
+/*
+ *  task.h
+ *
+ *  Created on: Mar 16, 2022
+ *
+ *  Host stand-in of the FreeRTOS tasks: a task is a thread, priority and core are ignored.
+ */
+
+#ifndef _TASK_H_
+#define _TASK_H_
+
+#include "FreeRTOS.h"
+
+typedef struct uart_shim_task* TaskHandle_t;
+typedef void (*TaskFunction_t)(void *arg);
+
+#define tskNO_AFFINITY                                0x7FFFFFFF
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core);
+#define xTaskCreate(function, name, stack, arg, priority, handle) \
+    xTaskCreatePinnedToCore(function, name, stack, arg, priority, handle, tskNO_AFFINITY)
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+TickType_t xTaskGetTickCount(void);
+void vTaskDelay(TickType_t ticks);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks);
+
+#endif /* _TASK_H_ */
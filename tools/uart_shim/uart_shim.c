@@ -0,0 +1,792 @@
+/*
+ *  uart_shim.c
+ *
+ *  Created on: Mar 16, 2022
+ *
+ *  IDF UART driver and FreeRTOS stand-ins on POSIX threads, for host benches of the modbus sources.
+ *
+ *  Driver model: a receive thread per port takes the bytes of the line from the attached file
+ *  descriptor and moves them into the hardware FIFO one character time apart. The FIFO goes to the
+ *  ring buffer with a UART_DATA event when it reaches rxfifo_full_thresh (120 bytes), or when the
+ *  line is idle for the RX timeout, then with timeout_flag set, as the IDF driver does. A write
+ *  blocks for the time on the wire of its bytes and hands them to the line at the end, so the far
+ *  end sees a request when its last byte is sent.
+ *
+ *  FreeRTOS model: tasks are threads, the tick is 10 ms of the monotonic clock and a wait of n ticks
+ *  ends at the n-th tick boundary, so it lasts between n-1 and n tick periods as on the target.
+ *
+ *  Build: add uart_shim.c to the sources of the bench, with -I../uart_shim before -I../../src and -lpthread
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/wait.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include "uart_shim.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define UART_SHIM_LINE_SIZE                           4096  /* Bytes read from the line, not received yet */
+#define UART_SHIM_IDLE_US                             50000 /* Poll of a port with nothing to do */
+#define UART_SHIM_NEVER                               UINT64_MAX
+#define UART_SHIM_LOG_TAGS                            8     /* Tags with a level of their own */
+
+/*!
+ * @brief  Task, a thread with its notification value
+ */
+struct uart_shim_task {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notify;
+    TaskFunction_t function;
+    void *arg;
+};
+
+/*!
+ * @brief  Queue of items copied by value
+ */
+struct uart_shim_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t readable;
+    pthread_cond_t writable;
+    uint8_t *items;
+    uint32_t item_size;
+    uint32_t length;
+    uint32_t head;
+    uint32_t count;
+};
+
+/*!
+ * @brief  UART port: line, hardware FIFO and ring buffer of the driver
+ */
+typedef struct {
+    bool installed;
+    int fd;
+    pthread_t rx_thread;
+    pthread_mutex_t lock;
+    pthread_cond_t readable;                          /* Ring buffer got bytes */
+    QueueHandle_t queue;
+    uint32_t char_us;
+    uint32_t tout;                                    /* RX timeout in symbols */
+    uint32_t full;                                    /* rxfifo_full_thresh */
+    uint8_t line[UART_SHIM_LINE_SIZE];                /* On the wire */
+    uint32_t line_head;
+    uint32_t line_count;
+    uint64_t line_at;                                 /* End of the last character on the wire */
+    uint32_t fifo;                                    /* Bytes in the hardware FIFO, at the tail of the line */
+    uint8_t fifo_data[UART_SHIM_LINE_SIZE];
+    uint8_t *ring;
+    uint32_t ring_size;
+    uint32_t ring_head;
+    uint32_t ring_count;
+    uint64_t tx_at;                                   /* End of the last character sent */
+    uart_shim_stats_t stats;
+} uart_shim_port_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static uart_shim_port_t uart_shim_port[UART_NUM_MAX];
+static uint64_t uart_shim_start_us;
+static pthread_condattr_t uart_shim_condattr;
+static __thread struct uart_shim_task *uart_shim_current;
+static esp_log_level_t uart_shim_log_level = ESP_LOG_WARN;
+static const char *uart_shim_log_tag[UART_SHIM_LOG_TAGS];
+static esp_log_level_t uart_shim_log_tag_level[UART_SHIM_LOG_TAGS];
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static uint64_t uart_shim_clock_us(void);
+static void uart_shim_sleep_until(uint64_t at);
+static uint64_t uart_shim_tick_deadline(TickType_t ticks);
+static bool uart_shim_wait(pthread_cond_t *cond, pthread_mutex_t *lock, uint64_t deadline);
+static void uart_shim_cond_init(pthread_cond_t *cond);
+static void uart_shim_deliver(uart_shim_port_t *port, bool timeout);
+static void *uart_shim_rx_thread(void *arg);
+static void *uart_shim_task_thread(void *arg);
+
+/******************************************************************************/
+
+__attribute__((constructor)) static void uart_shim_init(void)
+{
+    pthread_condattr_init(&uart_shim_condattr);
+    pthread_condattr_setclock(&uart_shim_condattr, CLOCK_MONOTONIC);
+    uart_shim_start_us = uart_shim_clock_us();
+    for(uint32_t i = 0; i < UART_NUM_MAX; i++)
+    {
+        uart_shim_port[i].fd = -1;
+        pthread_mutex_init(&uart_shim_port[i].lock, NULL);
+        uart_shim_cond_init(&uart_shim_port[i].readable);
+    }
+    signal(SIGPIPE, SIG_IGN);
+}
+
+static uint64_t uart_shim_clock_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void uart_shim_sleep_until(uint64_t at)
+{
+    struct timespec ts;
+
+    at += uart_shim_start_us;
+    ts.tv_sec = at / 1000000;
+    ts.tv_nsec = (at % 1000000) * 1000;
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    {
+    }
+}
+
+/* End of a wait of "ticks": the tick boundary "ticks" after the current tick */
+static uint64_t uart_shim_tick_deadline(TickType_t ticks)
+{
+    if(ticks == portMAX_DELAY)
+    {
+        return UART_SHIM_NEVER;
+    }
+    if(ticks == 0)
+    {
+        return 0;
+    }
+    return ((uint64_t) xTaskGetTickCount() + ticks) * UART_SHIM_TICK_US;
+}
+
+/* Wait on "cond" until "deadline", false when it passed */
+static bool uart_shim_wait(pthread_cond_t *cond, pthread_mutex_t *lock, uint64_t deadline)
+{
+    struct timespec ts;
+    uint64_t at;
+
+    if(deadline == UART_SHIM_NEVER)
+    {
+        pthread_cond_wait(cond, lock);
+        return true;
+    }
+    if(uart_shim_now_us() >= deadline)
+    {
+        return false;
+    }
+    at = deadline + uart_shim_start_us;
+    ts.tv_sec = at / 1000000;
+    ts.tv_nsec = (at % 1000000) * 1000;
+    return pthread_cond_timedwait(cond, lock, &ts) != ETIMEDOUT;
+}
+
+static void uart_shim_cond_init(pthread_cond_t *cond)
+{
+    pthread_cond_init(cond, &uart_shim_condattr);
+}
+
+/******************************************************************************/
+
+uint64_t uart_shim_now_us(void)
+{
+    return uart_shim_clock_us() - uart_shim_start_us;
+}
+
+uint32_t esp_log_timestamp(void)
+{
+    return uart_shim_now_us() / 1000;
+}
+
+/* "*" sets all tags, levels set before for a tag are dropped */
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    uint32_t i;
+
+    if(strcmp(tag, "*") == 0)
+    {
+        uart_shim_log_level = level;
+        memset(uart_shim_log_tag, 0, sizeof(uart_shim_log_tag));
+        return;
+    }
+    for(i = 0; (i < UART_SHIM_LOG_TAGS) && (uart_shim_log_tag[i] != NULL) && (strcmp(uart_shim_log_tag[i], tag) != 0); i++)
+    {
+    }
+    if(i < UART_SHIM_LOG_TAGS)
+    {
+        uart_shim_log_tag[i] = tag;
+        uart_shim_log_tag_level[i] = level;
+    }
+}
+
+esp_log_level_t esp_log_level_get(const char *tag)
+{
+    for(uint32_t i = 0; (i < UART_SHIM_LOG_TAGS) && (uart_shim_log_tag[i] != NULL); i++)
+    {
+        if(strcmp(uart_shim_log_tag[i], tag) == 0)
+        {
+            return uart_shim_log_tag_level[i];
+        }
+    }
+    return uart_shim_log_level;
+}
+
+/******************************************************************************/
+
+static void *uart_shim_task_thread(void *arg)
+{
+    struct uart_shim_task *task = arg;
+
+    uart_shim_current = task;
+    task->function(task->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core)
+{
+    struct uart_shim_task *task = calloc(1, sizeof(struct uart_shim_task));
+
+    if(task == NULL)
+    {
+        return pdFAIL;
+    }
+    pthread_mutex_init(&task->lock, NULL);
+    uart_shim_cond_init(&task->cond);
+    task->function = function;
+    task->arg = arg;
+    if(handle != NULL)
+    {
+        *handle = task;
+    }
+    if(pthread_create(&task->thread, NULL, uart_shim_task_thread, task) != 0)
+    {
+        return pdFAIL;
+    }
+    pthread_detach(task->thread);
+    return pdPASS;
+}
+
+/* Threads of the bench become tasks when they first need a handle */
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    if(uart_shim_current == NULL)
+    {
+        uart_shim_current = calloc(1, sizeof(struct uart_shim_task));
+        pthread_mutex_init(&uart_shim_current->lock, NULL);
+        uart_shim_cond_init(&uart_shim_current->cond);
+        uart_shim_current->thread = pthread_self();
+    }
+    return uart_shim_current;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return uart_shim_now_us() / UART_SHIM_TICK_US;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    uint64_t deadline = uart_shim_tick_deadline(ticks);
+
+    if((deadline != 0) && (deadline != UART_SHIM_NEVER))
+    {
+        uart_shim_sleep_until(deadline);
+    }
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notify++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+    struct uart_shim_task *task = xTaskGetCurrentTaskHandle();
+    uint64_t deadline = uart_shim_tick_deadline(ticks);
+    uint32_t value;
+
+    pthread_mutex_lock(&task->lock);
+    while((task->notify == 0) && uart_shim_wait(&task->cond, &task->lock, deadline))
+    {
+    }
+    value = task->notify;
+    if(value > 0)
+    {
+        task->notify = clear ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+    return value;
+}
+
+/******************************************************************************/
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct uart_shim_queue *queue = calloc(1, sizeof(struct uart_shim_queue));
+
+    if(queue == NULL)
+    {
+        return NULL;
+    }
+    queue->items = calloc(length, item_size);
+    if(queue->items == NULL)
+    {
+        free(queue);
+        return NULL;
+    }
+    pthread_mutex_init(&queue->lock, NULL);
+    uart_shim_cond_init(&queue->readable);
+    uart_shim_cond_init(&queue->writable);
+    queue->item_size = item_size;
+    queue->length = length;
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    free(queue->items);
+    free(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    uint64_t deadline = uart_shim_tick_deadline(ticks);
+
+    pthread_mutex_lock(&queue->lock);
+    while(queue->count == queue->length)
+    {
+        if(!uart_shim_wait(&queue->writable, &queue->lock, deadline) && (queue->count == queue->length))
+        {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFAIL;
+        }
+    }
+    memcpy(&queue->items[((queue->head + queue->count) % queue->length) * queue->item_size], item, queue->item_size);
+    queue->count++;
+    pthread_cond_signal(&queue->readable);
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    uint64_t deadline = uart_shim_tick_deadline(ticks);
+
+    pthread_mutex_lock(&queue->lock);
+    while(queue->count == 0)
+    {
+        if(!uart_shim_wait(&queue->readable, &queue->lock, deadline) && (queue->count == 0))
+        {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFALSE;
+        }
+    }
+    memcpy(item, &queue->items[queue->head * queue->item_size], queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    pthread_cond_signal(&queue->writable);
+    pthread_mutex_unlock(&queue->lock);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->head = 0;
+    queue->count = 0;
+    pthread_cond_broadcast(&queue->writable);
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    UBaseType_t count;
+
+    pthread_mutex_lock(&queue->lock);
+    count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
+
+/******************************************************************************/
+
+/* FIFO to ring buffer and UART_DATA event, as the RX interrupt of the driver. Port locked */
+static void uart_shim_deliver(uart_shim_port_t *port, bool timeout)
+{
+    uart_event_t event = {.type = UART_DATA, .size = 0, .timeout_flag = timeout};
+
+    for(uint32_t i = 0; i < port->fifo; i++)
+    {
+        if(port->ring_count == port->ring_size)
+        {
+            port->stats.dropped += port->fifo - i;
+            event.type = UART_BUFFER_FULL;
+            break;
+        }
+        port->ring[(port->ring_head + port->ring_count) % port->ring_size] = port->fifo_data[i];
+        port->ring_count++;
+        event.size++;
+    }
+    port->fifo = 0;
+    if(event.type == UART_DATA)
+    {
+        port->stats.data_events++;
+        port->stats.full_events += timeout ? 0 : 1;
+    }
+    pthread_cond_broadcast(&port->readable);
+    if(port->queue != NULL)
+    {
+        xQueueSend(port->queue, &event, 0);
+    }
+}
+
+/* Receiver of a port: line to FIFO one character time apart, FIFO to ring on full or RX timeout */
+static void *uart_shim_rx_thread(void *arg)
+{
+    uart_shim_port_t *port = arg;
+    uint8_t data[UART_SHIM_LINE_SIZE];
+    struct pollfd pfd;
+    struct timespec ts;
+    uint64_t deadline, now;
+    ssize_t rc;
+    uint32_t space;
+
+    for(;;)
+    {
+        /* Next thing to happen: a character in, or the RX timeout */
+        pthread_mutex_lock(&port->lock);
+        if(port->line_count > 0)
+        {
+            deadline = port->line_at + port->char_us;
+        }
+        else if(port->fifo > 0)
+        {
+            deadline = port->line_at + port->tout * port->char_us;
+        }
+        else
+        {
+            deadline = uart_shim_now_us() + UART_SHIM_IDLE_US;
+        }
+        pfd.fd = port->fd;
+        pfd.events = POLLIN;
+        space = UART_SHIM_LINE_SIZE - port->line_count;
+        pthread_mutex_unlock(&port->lock);
+
+        now = uart_shim_now_us();
+        ts.tv_sec = (deadline > now) ? (deadline - now) / 1000000 : 0;
+        ts.tv_nsec = (deadline > now) ? ((deadline - now) % 1000000) * 1000 : 0;
+        if((pfd.fd >= 0) && (space > 0))
+        {
+            rc = ppoll(&pfd, 1, &ts, NULL);
+            if((rc > 0) && (pfd.revents & (POLLHUP | POLLERR)) && !(pfd.revents & POLLIN))
+            {
+                /* Far end closed: the line is dead, no busy loop on it */
+                nanosleep(&ts, NULL);
+            }
+            else if((rc > 0) && (pfd.revents & POLLIN))
+            {
+                rc = read(pfd.fd, data, MIN(space, sizeof(data)));
+                now = uart_shim_now_us();
+                pthread_mutex_lock(&port->lock);
+                if(rc > 0)
+                {
+                    /* A character starts when it arrives, or after the one before it */
+                    if((port->line_count == 0) && (port->line_at < now))
+                    {
+                        port->line_at = now;
+                    }
+                    for(ssize_t i = 0; i < rc; i++)
+                    {
+                        port->line[(port->line_head + port->line_count) % UART_SHIM_LINE_SIZE] = data[i];
+                        port->line_count++;
+                    }
+                }
+                pthread_mutex_unlock(&port->lock);
+            }
+        }
+        else
+        {
+            nanosleep(&ts, NULL);
+        }
+
+        /* Characters whose time passed are in the FIFO */
+        now = uart_shim_now_us();
+        pthread_mutex_lock(&port->lock);
+        while((port->line_count > 0) && (port->line_at + port->char_us <= now))
+        {
+            port->line_at += port->char_us;
+            port->fifo_data[port->fifo++] = port->line[port->line_head];
+            port->line_head = (port->line_head + 1) % UART_SHIM_LINE_SIZE;
+            port->line_count--;
+            port->stats.rx_bytes++;
+            if(port->fifo >= port->full)
+            {
+                uart_shim_deliver(port, false);
+            }
+        }
+        if((port->fifo > 0) && (port->line_at + port->tout * port->char_us <= now))
+        {
+            uart_shim_deliver(port, true);
+        }
+        pthread_mutex_unlock(&port->lock);
+    }
+    return NULL;
+}
+
+/******************************************************************************/
+
+esp_err_t uart_driver_install(uart_port_t num, int rx_buffer_size, int tx_buffer_size, int queue_size,
+                              QueueHandle_t *queue, int intr_alloc_flags)
+{
+    uart_shim_port_t *port = &uart_shim_port[num];
+
+    if((num < 0) || (num >= UART_NUM_MAX) || port->installed)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    port->ring = calloc(1, rx_buffer_size);
+    port->ring_size = rx_buffer_size;
+    port->queue = (queue_size > 0) ? xQueueCreate(queue_size, sizeof(uart_event_t)) : NULL;
+    port->char_us = 1000000 / 9600 * 10;
+    port->tout = UART_SHIM_TOUT_DEFAULT;
+    port->full = UART_SHIM_FIFO_FULL;
+    if(queue != NULL)
+    {
+        *queue = port->queue;
+    }
+    port->installed = true;
+    pthread_create(&port->rx_thread, NULL, uart_shim_rx_thread, port);
+    return ESP_OK;
+}
+
+esp_err_t uart_param_config(uart_port_t num, const uart_config_t *config)
+{
+    uart_shim_port_t *port = &uart_shim_port[num];
+    uint32_t bits = 2 + (config->data_bits + 5) + ((config->parity == UART_PARITY_DISABLE) ? 0 : 1);
+
+    pthread_mutex_lock(&port->lock);
+    port->char_us = (bits * 1000000UL) / config->baud_rate;
+    pthread_mutex_unlock(&port->lock);
+    return ESP_OK;
+}
+
+esp_err_t uart_set_pin(uart_port_t num, int txd, int rxd, int rts, int cts)
+{
+    return ESP_OK;
+}
+
+esp_err_t uart_set_rx_timeout(uart_port_t num, const uint8_t tout_thresh)
+{
+    uart_shim_port[num].tout = tout_thresh;
+    return ESP_OK;
+}
+
+esp_err_t uart_set_rx_full_threshold(uart_port_t num, int threshold)
+{
+    uart_shim_port[num].full = threshold;
+    return ESP_OK;
+}
+
+int uart_read_bytes(uart_port_t num, void *buf, uint32_t length, TickType_t ticks)
+{
+    uart_shim_port_t *port = &uart_shim_port[num];
+    uint64_t deadline = uart_shim_tick_deadline(ticks);
+    uint8_t *data = buf;
+    uint32_t count;
+
+    pthread_mutex_lock(&port->lock);
+    while((port->ring_count < length) && uart_shim_wait(&port->readable, &port->lock, deadline))
+    {
+    }
+    count = MIN(length, port->ring_count);
+    for(uint32_t i = 0; i < count; i++)
+    {
+        data[i] = port->ring[port->ring_head];
+        port->ring_head = (port->ring_head + 1) % port->ring_size;
+    }
+    port->ring_count -= count;
+    pthread_mutex_unlock(&port->lock);
+    return count;
+}
+
+/* Blocks for the time on the wire, the far end gets the bytes when the last one is sent */
+int uart_write_bytes(uart_port_t num, const void *src, size_t size)
+{
+    uart_shim_port_t *port = &uart_shim_port[num];
+    const uint8_t *data = src;
+    uint64_t start = MAX(uart_shim_now_us(), port->tx_at);
+    ssize_t rc;
+
+    port->tx_at = start + size * port->char_us;
+    uart_shim_sleep_until(port->tx_at);
+    for(size_t sent = 0; (sent < size) && (port->fd >= 0); sent += rc)
+    {
+        rc = write(port->fd, &data[sent], size - sent);
+        if(rc <= 0)
+        {
+            return -1;
+        }
+    }
+    port->stats.tx_bytes += size;
+    return size;
+}
+
+esp_err_t uart_wait_tx_done(uart_port_t num, TickType_t ticks)
+{
+    return ESP_OK;
+}
+
+esp_err_t uart_flush_input(uart_port_t num)
+{
+    uart_shim_port_t *port = &uart_shim_port[num];
+
+    pthread_mutex_lock(&port->lock);
+    port->ring_count = 0;
+    port->fifo = 0;
+    pthread_mutex_unlock(&port->lock);
+    return ESP_OK;
+}
+
+esp_err_t uart_flush(uart_port_t num)
+{
+    return uart_flush_input(num);
+}
+
+esp_err_t uart_get_buffered_data_len(uart_port_t num, size_t *size)
+{
+    uart_shim_port_t *port = &uart_shim_port[num];
+
+    pthread_mutex_lock(&port->lock);
+    *size = port->ring_count;
+    pthread_mutex_unlock(&port->lock);
+    return ESP_OK;
+}
+
+/******************************************************************************/
+
+void uart_shim_attach(uart_port_t num, int fd)
+{
+    uart_shim_port_t *port = &uart_shim_port[num];
+
+    pthread_mutex_lock(&port->lock);
+    port->fd = fd;
+    port->line_count = 0;
+    pthread_mutex_unlock(&port->lock);
+}
+
+int uart_shim_open(uart_port_t num, const char *path)
+{
+    struct termios tio;
+    int fd = open(path, O_RDWR | O_NOCTTY);
+
+    if(fd < 0)
+    {
+        return -1;
+    }
+    if(tcgetattr(fd, &tio) == 0)
+    {
+        cfmakeraw(&tio);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    uart_shim_attach(num, fd);
+    return fd;
+}
+
+pid_t uart_shim_spawn(char *const argv[], char *path, size_t size)
+{
+    char line[256];
+    char *pts, *end;
+    int out[2];
+    pid_t pid;
+    ssize_t rc;
+    size_t len = 0;
+
+    if(pipe(out) != 0)
+    {
+        return -1;
+    }
+    pid = fork();
+    if(pid == 0)
+    {
+        dup2(out[1], STDOUT_FILENO);
+        close(out[0]);
+        close(out[1]);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    close(out[1]);
+
+    /* First line: "<program>: <n> <protocol> slaves on /dev/pts/N" */
+    while((len < sizeof(line) - 1) && ((rc = read(out[0], &line[len], 1)) == 1) && (line[len] != '\n'))
+    {
+        len++;
+    }
+    line[len] = '\0';
+    close(out[0]);
+    pts = strstr(line, "/dev/");
+    if((pid < 0) || (pts == NULL))
+    {
+        if(pid > 0)
+        {
+            uart_shim_kill(pid);
+        }
+        return -1;
+    }
+    end = strpbrk(pts, " \t\r");
+    if(end != NULL)
+    {
+        *end = '\0';
+    }
+    snprintf(path, size, "%s", pts);
+    return pid;
+}
+
+void uart_shim_kill(pid_t pid)
+{
+    kill(pid, SIGINT);
+    waitpid(pid, NULL, 0);
+}
+
+void uart_shim_get_stats(uart_port_t num, uart_shim_stats_t *stats)
+{
+    uart_shim_port_t *port = &uart_shim_port[num];
+
+    pthread_mutex_lock(&port->lock);
+    memcpy(stats, &port->stats, sizeof(uart_shim_stats_t));
+    pthread_mutex_unlock(&port->lock);
+}
@@ -0,0 +1,109 @@
+/*
+ *  uart_shim.h
+ *
+ *  Created on: Mar 16, 2022
+ *
+ *  Host run of the modbus sources: IDF UART driver and FreeRTOS stand-ins on POSIX threads.
+ *  A port is attached to a file descriptor, a pseudo-terminal of meter_sim or one end of a
+ *  socketpair driven by the bench.
+ */
+
+#ifndef _UART_SHIM_H_
+#define _UART_SHIM_H_
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <driver/uart.h>
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#define UART_SHIM_TICK_US                             (1000000UL / configTICK_RATE_HZ)
+#define UART_SHIM_FIFO_FULL                           120   /* rxfifo_full_thresh set by uart_driver_install */
+#define UART_SHIM_TOUT_DEFAULT                        10    /* RX timeout in symbols, driver default */
+
+/*!
+ * @brief  Counters of a port
+ */
+typedef struct {
+    uint32_t rx_bytes;
+    uint32_t tx_bytes;
+    uint32_t data_events;                             /* UART_DATA posted */
+    uint32_t full_events;                             /* ... of them at rxfifo_full_thresh */
+    uint32_t dropped;                                 /* Bytes lost, ring buffer full */
+} uart_shim_stats_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                              EXPORTED DATA                                 */
+/******************************************************************************/
+
+
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+/*!
+ * @brief  Monotonic time
+ * @param  None
+ * @retval Time in microsecond, from the start of the program
+ */
+uint64_t uart_shim_now_us(void);
+
+/*!
+ * @brief  Attach a port to the line: bytes read from "fd" are received at the baud rate of the port,
+ *         bytes written by the port are sent to "fd" once their time on the wire passed
+ * @param  Port, before or after uart_driver_install()
+ *         File descriptor, -1 to detach
+ * @retval None
+ */
+void uart_shim_attach(uart_port_t port, int fd);
+
+/*!
+ * @brief  Open a terminal in raw mode and attach it to a port
+ * @param  Port
+ *         Path of the terminal, e.g. /dev/pts/3
+ * @retval File descriptor, -1 on error
+ */
+int uart_shim_open(uart_port_t port, const char *path);
+
+/*!
+ * @brief  Start a simulator printing its terminal on the first line of stdout, as meter_sim
+ * @param  Arguments, argv[0] is the program
+ *         [out] Path of the terminal
+ *         Size of path
+ * @retval Process id, -1 on error
+ */
+pid_t uart_shim_spawn(char *const argv[], char *path, size_t size);
+
+/*!
+ * @brief  Stop a simulator started by uart_shim_spawn()
+ * @param  Process id
+ * @retval None
+ */
+void uart_shim_kill(pid_t pid);
+
+/*!
+ * @brief  Counters of a port
+ * @param  Port
+ *         [out] Counters
+ * @retval None
+ */
+void uart_shim_get_stats(uart_port_t port, uart_shim_stats_t *stats);
+
+/******************************************************************************/
+
+#endif /* _UART_SHIM_H_ */
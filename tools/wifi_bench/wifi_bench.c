@@ -0,0 +1,262 @@
+/*
+ *  wifi_bench.c
+ *
+ *  Created on: Mar 14, 2022
+ *
+ *  Connect paths of the station against a stubbed Wi-Fi driver: src/wifi_lib/wifi_fast.c decides,
+ *  the stub plays the driver events of wifi_lib.c on a simulated clock. A direct connect listens on
+ *  the cached channel for the cached BSSID, a full scan listens on every channel. The stored link
+ *  is kept across simulated reboots as NVS keeps it. Driver and DHCP times are model values, not
+ *  measured: the bench checks which path is taken and compares the time to IP of the paths.
+ *
+ *  Build: gcc -O2 -Wall -I../../src/wifi_lib -o wifi_bench wifi_bench.c ../../src/wifi_lib/wifi_fast.c
+ *  Run:   ./wifi_bench
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "wifi_fast.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+/* As src/config.h */
+#define WIFI_SSID                                     "A501"
+#define WIFI_TIME_RETRY_CONNECT_MS                    3000
+#define WIFI_FAST_ATTEMPTS                            2
+
+/* Driver model, ms */
+#define SIM_CHANNELS                                  13
+#define SIM_CHANNEL_DWELL_MS                          120   /* Active scan of one channel */
+#define SIM_ASSOC_MS                                  80    /* Auth, assoc and 4-way handshake */
+#define SIM_DHCP_MS                                   1200  /* Discover to ack, ARP check of the address */
+#define SIM_GIVE_UP_MS                                60000
+
+#define SIM_AP_COUNT                                  2
+
+typedef uint8_t sim_ip_mode_t;
+enum {
+    SIM_IP_DHCP = 0,
+    SIM_IP_CACHED,
+};
+
+/*!
+ * @brief  Access point of the SSID, up from "up_at"
+ */
+typedef struct {
+    uint8_t bssid[WIFI_FAST_BSSID_SIZE];
+    uint8_t channel;
+    bool present;
+    uint32_t up_at;
+    uint32_t lease;                                   /* Address its DHCP server gives */
+} sim_ap_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static sim_ap_t sim_ap[SIM_AP_COUNT];
+static uint32_t sim_clock;
+static wifi_fast_cache_t sim_nvs;                     /* Blob of wifi_lib.c */
+static bool sim_nvs_stored;
+static uint32_t sim_nvs_writes;
+static wifi_fast_t fast;
+
+static uint32_t connects;                             /* Connect attempts of the last outage */
+static uint32_t dhcp;                                 /* DHCP used on the last outage */
+static uint32_t failures;
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+/* Stub of esp_wifi_connect() with the config set by wifi_lib_connect() */
+static const sim_ap_t* sim_connect(wifi_fast_action_t action)
+{
+    if(action & WIFI_FAST_ACTION_LATER)
+    {
+        sim_clock += WIFI_TIME_RETRY_CONNECT_MS;
+    }
+    connects++;
+
+    if((action & ~WIFI_FAST_ACTION_LATER) == WIFI_FAST_ACTION_DIRECT)
+    {
+        sim_clock += SIM_CHANNEL_DWELL_MS;
+        for(uint32_t i = 0; i < SIM_AP_COUNT; i++)
+        {
+            if(sim_ap[i].present && (sim_clock >= sim_ap[i].up_at) && (sim_ap[i].channel == fast.cache.channel) &&
+               (memcmp(sim_ap[i].bssid, fast.cache.bssid, WIFI_FAST_BSSID_SIZE) == 0))
+            {
+                return &sim_ap[i];
+            }
+        }
+        return NULL;
+    }
+
+    sim_clock += SIM_CHANNELS * SIM_CHANNEL_DWELL_MS;
+    for(uint32_t i = 0; i < SIM_AP_COUNT; i++)
+    {
+        if(sim_ap[i].present && (sim_clock >= sim_ap[i].up_at))
+        {
+            return &sim_ap[i];
+        }
+    }
+    return NULL;
+}
+
+/* Driver events until IP, as the handlers of wifi_lib.c */
+static uint32_t sim_outage(wifi_fast_action_t action, sim_ip_mode_t mode)
+{
+    const sim_ap_t *ap;
+    uint32_t start = sim_clock;
+    uint32_t ip;
+
+    connects = 0;
+    dhcp = 0;
+    while((sim_clock - start) < SIM_GIVE_UP_MS)
+    {
+        ap = sim_connect(action);
+        if(ap == NULL)
+        {
+            action = wifi_fast_disconnected(&fast, sim_clock);
+            continue;
+        }
+
+        sim_clock += SIM_ASSOC_MS;
+        if(wifi_fast_connected(&fast, ap->bssid, ap->channel) && (mode == SIM_IP_CACHED))
+        {
+            ip = fast.cache.ip;
+        }
+        else
+        {
+            sim_clock += SIM_DHCP_MS;
+            ip = ap->lease;
+            dhcp++;
+        }
+        if(wifi_fast_got_ip(&fast, ip, 0x00FFFFFF, ap->lease & 0x00FFFFFF, sim_clock))
+        {
+            memcpy(&sim_nvs, &fast.cache, sizeof(sim_nvs));
+            sim_nvs_stored = true;
+            sim_nvs_writes++;
+        }
+        return sim_clock - start;
+    }
+    return UINT32_MAX;
+}
+
+/* Power up: NVS kept, clock from 0 */
+static uint32_t sim_boot(const char *ssid, uint8_t attempts, sim_ip_mode_t mode)
+{
+    sim_clock = 0;
+    wifi_fast_init(&fast, sim_nvs_stored ? &sim_nvs : NULL, wifi_fast_ssid_hash(ssid), attempts);
+    return sim_outage(wifi_fast_start(&fast, sim_clock), mode);
+}
+
+static void sim_ap_set(uint32_t index, uint8_t last, uint8_t channel, uint32_t up_at, uint32_t lease)
+{
+    sim_ap_t *ap = &sim_ap[index];
+    uint8_t bssid[WIFI_FAST_BSSID_SIZE] = {0x24, 0x0A, 0xC4, 0x10, 0x20, last};
+
+    memcpy(ap->bssid, bssid, WIFI_FAST_BSSID_SIZE);
+    ap->channel = channel;
+    ap->present = true;
+    ap->up_at = up_at;
+    ap->lease = lease;
+}
+
+static void bench_report(const char *name, uint32_t time, const char *path, bool ok)
+{
+    char ms[12] = "never";
+
+    if(time != UINT32_MAX)
+    {
+        snprintf(ms, sizeof(ms), "%u", time);
+    }
+    printf("%-28s %-7s %8s %8u %5u %7u  %s\n", name, path, ms, connects, dhcp, fast.stats.fallbacks,
+           ok ? "pass" : "FAIL");
+    if(!ok)
+    {
+        failures++;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    wifi_fast_stats_t before;
+    uint32_t time, writes;
+
+    printf("Simulated driver: %u ms per channel, %u channels, %u ms assoc, %u ms DHCP\n", SIM_CHANNEL_DWELL_MS,
+           SIM_CHANNELS, SIM_ASSOC_MS, SIM_DHCP_MS);
+    printf("%-28s %-7s %8s %8s %5s %7s\n", "", "path", "ms to IP", "connects", "dhcp", "fallbk");
+
+    /* Former behavior: scan then DHCP on every boot */
+    memset(sim_ap, 0, sizeof(sim_ap));
+    sim_ap_set(0, 0x01, 6, 0, 0x3201A8C0);
+    time = sim_boot(WIFI_SSID, 0, SIM_IP_DHCP);
+    bench_report("fast connect off", time, "scan", (fast.stats.scan == 1) && (connects == 1));
+
+    /* Nothing stored: scan, the link is stored */
+    sim_nvs_stored = false;
+    sim_nvs_writes = 0;
+    time = sim_boot(WIFI_SSID, WIFI_FAST_ATTEMPTS, SIM_IP_DHCP);
+    bench_report("first boot", time, "scan", (fast.stats.scan == 1) && (sim_nvs_writes == 1));
+
+    /* Reboot: direct, same lease so nothing written */
+    time = sim_boot(WIFI_SSID, WIFI_FAST_ATTEMPTS, SIM_IP_DHCP);
+    bench_report("reboot", time, "direct", (fast.stats.direct == 1) && (connects == 1) && (sim_nvs_writes == 1));
+
+    time = sim_boot(WIFI_SSID, WIFI_FAST_ATTEMPTS, SIM_IP_CACHED);
+    bench_report("reboot, cached lease", time, "direct",
+                 (fast.stats.direct == 1) && (dhcp == 0) && (sim_nvs_writes == 1));
+
+    /* Link lost while up: direct again */
+    memcpy(&before, &fast.stats, sizeof(before));
+    time = sim_outage(wifi_fast_disconnected(&fast, sim_clock), SIM_IP_CACHED);
+    bench_report("link lost", time, "direct", (fast.stats.direct == before.direct + 1) && (connects == 1));
+
+    /* AP moved to another channel: direct fails, scan, new channel stored then used */
+    sim_ap[0].channel = 11;
+    time = sim_boot(WIFI_SSID, WIFI_FAST_ATTEMPTS, SIM_IP_CACHED);
+    bench_report("AP on a new channel", time, "scan",
+                 (fast.stats.scan == 1) && (fast.stats.fallbacks == 1) && (connects == WIFI_FAST_ATTEMPTS + 1) &&
+                 (sim_nvs.channel == 11) && (dhcp == 0));
+    time = sim_boot(WIFI_SSID, WIFI_FAST_ATTEMPTS, SIM_IP_CACHED);
+    bench_report("  then reboot", time, "direct", (fast.stats.direct == 1) && (connects == 1));
+
+    /* AP replaced: scan, the cached lease is not used on another AP */
+    sim_ap_set(0, 0x02, 1, 0, 0x3301A8C0);
+    time = sim_boot(WIFI_SSID, WIFI_FAST_ATTEMPTS, SIM_IP_CACHED);
+    bench_report("AP replaced", time, "scan",
+                 (fast.stats.scan == 1) && (dhcp == 1) && (sim_nvs.bssid[5] == 0x02) && (sim_nvs.ip == 0x3301A8C0));
+
+    /* Another SSID configured: the stored link is ignored */
+    writes = sim_nvs_writes;
+    time = sim_boot("B702", WIFI_FAST_ATTEMPTS, SIM_IP_CACHED);
+    bench_report("other SSID", time, "scan", (fast.stats.scan == 1) && (dhcp == 1) && (sim_nvs_writes == writes + 1));
+    sim_boot(WIFI_SSID, WIFI_FAST_ATTEMPTS, SIM_IP_DHCP);
+
+    /* Power cut: the AP is up 9 s after the gateway, direct connects between failed scans. IP within a
+     * retry cycle of the AP */
+    sim_ap[0].up_at = 9000;
+    time = sim_boot(WIFI_SSID, WIFI_FAST_ATTEMPTS, SIM_IP_CACHED);
+    bench_report("AP up 9 s after boot", time, "direct",
+                 (fast.stats.direct == 1) &&
+                 (time < 9000 + WIFI_TIME_RETRY_CONNECT_MS + (SIM_CHANNELS + WIFI_FAST_ATTEMPTS) * SIM_CHANNEL_DWELL_MS));
+
+    /* No AP: scans keep going, each after the retry delay */
+    sim_ap[0].present = false;
+    time = sim_boot(WIFI_SSID, WIFI_FAST_ATTEMPTS, SIM_IP_CACHED);
+    bench_report("no AP", time, "none", (time == UINT32_MAX) && (fast.stats.direct == 0) && (fast.stats.scan == 0));
+
+    printf("connect paths: %s\n", (failures == 0) ? "pass" : "FAIL");
+    return (failures == 0) ? 0 : 1;
+}
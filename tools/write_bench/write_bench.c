@@ -0,0 +1,181 @@
+/*
+ *  write_bench.c
+ *
+ *  Created on: Mar 19, 2022
+ *
+ *  Writes to 0x68 meters through src/modbus_api/modbus_bus.c and modbus_command.c against meter_sim, on
+ *  the UART shim at 1200 8E1. The write frame carries the command, the meter password and the data, as
+ *  the date write of the meter protocol: LEN 0x0A for 4 bytes of data. meter_sim answers a write with a
+ *  wrong or missing password with an error, so each case checks the status of the write: the default
+ *  password and a password set per meter must be granted, a wrong one refused. Writes queued together
+ *  to one command are sent once and must keep the password.
+ *
+ *  Build: gcc -O2 -Wall -DELECTRIC_METER_USED -I../uart_shim -I../../src -I../../src/modbus_api -o write_bench
+ *         write_bench.c ../uart_shim/uart_shim.c ../../src/modbus_api/modbus_bus.c ../../src/modbus_api/modbus_command.c
+ *         ../../src/modbus_api/modbus_frame.c ../../src/utility/utility.c -lpthread
+ *         and meter_sim, see tools/meter_sim
+ *  Run:   ./write_bench [-m ../meter_sim/meter_sim]
+ */
+
+/******************************************************************************/
+
+/******************************************************************************/
+/*                              INCLUDE FILES                                 */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include "uart_shim.h"
+#include "config.h"
+#include "modbus_command.h"
+#include "modbus_bus.h"
+
+/******************************************************************************/
+/*                     EXPORTED TYPES and DEFINITIONS                         */
+/******************************************************************************/
+
+#ifndef ELECTRIC_METER_USED
+#error "Build with -DELECTRIC_METER_USED, the bus runs at 1200 8E1"
+#endif
+
+#define BENCH_DATE_CMD                                0xF343    /* MB_DATE_CMD */
+#define BENCH_DATE_SIZE                               4
+#define BENCH_WAIT_MS                                 5000
+#define BENCH_MERGED                                  3         /* Writes queued at once to one command */
+
+/*!
+ * @brief  One write: password, NULL for MODBUS_ELEC_PASSWORD, and expected status
+ */
+typedef struct {
+    const char *name;
+    const uint8_t *meter;
+    const uint8_t *password;
+    uint32_t count;                                   /* Writes queued at once */
+    modbus_status_t expect;
+} bench_case_t;
+
+/******************************************************************************/
+/*                              PRIVATE DATA                                  */
+/******************************************************************************/
+
+static const uint8_t bench_meter[6] = {0x01, 0x00, 0x00, 0x00, 0x00, 0x00};
+static const uint8_t bench_meter_own[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x00};     /* Password of its own */
+static const uint8_t bench_default[MODBUS_PASSWORD_SIZE] = MODBUS_ELEC_PASSWORD;
+static const uint8_t bench_own[MODBUS_PASSWORD_SIZE] = {0x78, 0x56, 0x34, 0x12};
+static const uint8_t bench_wrong[MODBUS_PASSWORD_SIZE] = {0x01, 0x11, 0x11, 0x11};
+static const uint8_t bench_date[BENCH_DATE_SIZE] = {0x01, 0x22, 0x11, 0x06};         /* 06-11-22 */
+
+static const bench_case_t bench_case[] = {
+    {"default password",         bench_meter,     bench_default, 1,             MODBUS_STATUS_OK},
+    {"wrong password",           bench_meter,     bench_wrong,   1,             MODBUS_STATUS_EXCEPTION},
+    {"merged writes",            bench_meter,     bench_default, BENCH_MERGED,  MODBUS_STATUS_OK},
+    {"own password",             bench_meter_own, bench_own,     1,             MODBUS_STATUS_OK},
+    {"default on own password",  bench_meter_own, bench_default, 1,             MODBUS_STATUS_EXCEPTION},
+};
+
+static const char *status_name[] = {"OK", "TIMEOUT", "CRC_ERROR", "FRAME_ERROR", "EXCEPTION"};
+static volatile uint32_t completed;
+static volatile modbus_status_t last_status;
+
+/******************************************************************************/
+/*                                FUNCTIONS                                   */
+/******************************************************************************/
+
+static void bench_complete(const modbus_write_t *write, modbus_status_t status)
+{
+    last_status = status;
+    completed++;
+}
+
+int main(int argc, char *argv[])
+{
+    /* Meter 1 on the default password, meter 2 on a password of its own: one meter_sim each on the bus */
+    char *sim_argv[] = {"../meter_sim/meter_sim", "-p", "elec", "-n", "1", "-d", "15", NULL};
+    char *own_argv[] = {"../meter_sim/meter_sim", "-p", "elec", "-n", "0", "-a", "020000000000", "-d", "15",
+                        "-w", "78563412", NULL};
+    modbus_transaction_t transaction;
+    uint8_t rx_data[MODBUS_COMMAND_MAX_SIZE];
+    uint32_t failures = 0;
+    modbus_write_t write;
+    char path[64], own_path[64];
+    pid_t sim, own_sim;
+    bool ok;
+    int opt;
+
+    while((opt = getopt(argc, argv, "m:")) != -1)
+    {
+        switch(opt)
+        {
+        case 'm': sim_argv[0] = optarg; own_argv[0] = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [-m meter_sim]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    esp_log_level_set("*", ESP_LOG_NONE);
+    sim = uart_shim_spawn(sim_argv, path, sizeof(path));
+    own_sim = uart_shim_spawn(own_argv, own_path, sizeof(own_path));
+    if((sim < 0) || (own_sim < 0) || (uart_shim_open(modbus_bus_get_config(0)->port, path) < 0) ||
+       (uart_shim_open(modbus_bus_get_config(1)->port, own_path) < 0))
+    {
+        fprintf(stderr, "Cannot start %s\n", sim_argv[0]);
+        return 2;
+    }
+    modbus_bus_init();
+    printf("0x68 writes of %u bytes to command %04X, %u baud\n", BENCH_DATE_SIZE, BENCH_DATE_CMD, modbus_bus_get_config(0)->baudrate);
+
+    for(uint32_t i = 0; i < sizeof(bench_case) / sizeof(bench_case[0]); i++)
+    {
+        const bench_case_t *c = &bench_case[i];
+        uint32_t queued = 0;
+
+        memset(&write, 0, sizeof(write));
+        write.bus = (c->meter == bench_meter) ? 0 : 1;
+        write.protocol = MODBUS_PROTOCOL_ELEC;
+        memcpy(write.slave, c->meter, sizeof(write.slave));
+        write.address = BENCH_DATE_CMD;
+        write.size = BENCH_DATE_SIZE;
+        memcpy(write.data, bench_date, BENCH_DATE_SIZE);
+        memcpy(write.password, c->password, MODBUS_PASSWORD_SIZE);
+        write.complete = bench_complete;
+
+        completed = 0;
+        for(uint32_t k = 0; k < c->count; k++)
+        {
+            queued += (modbus_bus_write(&write) == ESP_OK) ? 1 : 0;
+        }
+        for(uint32_t ms = 0; (completed < queued) && (ms < BENCH_WAIT_MS); ms += 10)
+        {
+            usleep(10000);
+        }
+
+        ok = (queued == c->count) && (completed == queued) && (last_status == c->expect);
+        failures += ok ? 0 : 1;
+        printf("%-24s %u write(s): %-9s expected %-9s %s\n", c->name, c->count, (completed == queued) ? status_name[last_status] : "-",
+               status_name[c->expect], ok ? "pass" : "FAIL");
+    }
+
+    /* Transaction without a password given: MODBUS_ELEC_PASSWORD */
+    memset(&transaction, 0, sizeof(transaction));
+    transaction.bus = 0;
+    transaction.protocol = MODBUS_PROTOCOL_ELEC;
+    memcpy(transaction.slave, bench_meter, sizeof(transaction.slave));
+    transaction.address = BENCH_DATE_CMD;
+    transaction.size = BENCH_DATE_SIZE;
+    transaction.tx_data = bench_date;
+    transaction.rx_data = rx_data;
+    modbus_bus_transfer(&transaction);
+    ok = (transaction.status == MODBUS_STATUS_OK);
+    failures += ok ? 0 : 1;
+    printf("%-24s %u write(s): %-9s expected %-9s %s\n", "config password", 1, status_name[transaction.status],
+           status_name[MODBUS_STATUS_OK], ok ? "pass" : "FAIL");
+
+    uart_shim_kill(sim);
+    uart_shim_kill(own_sim);
+    printf("meter password: %s\n", (failures == 0) ? "pass" : "FAIL");
+    return (failures == 0) ? 0 : 1;
+}